@@ -0,0 +1,777 @@
+#include "concurrent_map.h"
+#include "corpus_generator.h"
+#include "document_store.h"
+#include "durable_search_server.h"
+#include "process_queries.h"
+#include "scoring.h"
+#include "search_server.h"
+#include "stop_words.h"
+#include "string_processing.h"
+#include "vector_index.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Набор бенчмарков поискового сервера на воспроизводимом корпусе с распределением слов по Ципфу.
+ *
+ * Пример использования:
+ *
+ *  ./benchmarks --documents=20000 --json=new.json
+ *  ./benchmarks --documents=20000 --json=new.json --baseline=old.json --tolerance=0.15
+ *
+ * Результат пишется в JSON по одному бенчмарку на строку, чтобы версии удобно было сравнивать diff'ом.
+ * С --baseline каждый бенчмарк сравнивается с прошлым прогоном; если какой-то стал медленнее больше
+ * чем на tolerance, программа завершается с кодом 1.
+ */
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+struct BenchmarkResult {
+    string name;
+    uint64_t iterations = 0;
+    double ns_per_op = 0;
+    uint64_t bytes = 0;
+};
+
+class BenchmarkRunner {
+public:
+    explicit BenchmarkRunner(int repetitions)
+        : repetitions_(max(1, repetitions)) {
+    }
+
+    // function выполняет iterations операций и возвращает время измеряемой части;
+    // из повторов берется лучший, он меньше всего зашумлен
+    template <typename Function>
+    void Run(const string& name, uint64_t iterations, Function function) {
+        Clock::duration best = Clock::duration::max();
+        for (int i = 0; i < repetitions_; ++i) {
+            best = min(best, static_cast<Clock::duration>(function()));
+        }
+        const double ns = chrono::duration<double, nano>(best).count();
+        Add({name, iterations, iterations ? ns / iterations : ns, 0});
+    }
+
+    void Add(BenchmarkResult result) {
+        cerr << result.name << ": "s << result.ns_per_op << " ns/op"s;
+        if (result.bytes) {
+            cerr << ", "s << result.bytes << " bytes"s;
+        }
+        cerr << '\n';
+        results_.push_back(move(result));
+    }
+
+    const vector<BenchmarkResult>& Results() const {
+        return results_;
+    }
+
+private:
+    const int repetitions_;
+    vector<BenchmarkResult> results_;
+};
+
+template <typename Function>
+Clock::duration Measure(Function function) {
+    const auto start = Clock::now();
+    function();
+    return Clock::now() - start;
+}
+
+uint64_t ResidentBytes() {
+#ifdef __linux__
+    ifstream statm("/proc/self/statm"s);
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+map<string, string> ParseArguments(int argc, char* argv[]) {
+    map<string, string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+        if (argument.rfind("--"s, 0) != 0) {
+            throw invalid_argument("Неизвестный аргумент "s + argument);
+        }
+        const size_t equal = argument.find('=');
+        if (equal == string::npos) {
+            arguments[argument.substr(2)] = "1"s;
+        } else {
+            arguments[argument.substr(2, equal - 2)] = argument.substr(equal + 1);
+        }
+    }
+    return arguments;
+}
+
+size_t GetSize(const map<string, string>& arguments, const string& key, size_t default_value) {
+    const auto it = arguments.find(key);
+    return it == arguments.end() ? default_value : stoull(it->second);
+}
+
+unique_ptr<SearchServer> BuildServer(const vector<string>& corpus, size_t document_count, TextAnalyzer analyzer = TextAnalyzer(),
+                                     MemoryResources resources = MemoryResources()) {
+    auto search_server = make_unique<SearchServer>("a an the"s, analyzer, resources);
+    for (size_t i = 0; i < document_count; ++i) {
+        search_server->AddDocument(static_cast<int>(i), corpus[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 10)});
+    }
+    return search_server;
+}
+
+template <typename ExecutionPolicy>
+double FindAll(const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy, QueryMode mode) {
+    double total_relevance = 0;
+    for (const string& query : queries) {
+        for (const Document& document : search_server.FindTopDocuments(policy, query, mode)) {
+            total_relevance += document.relevance;
+        }
+    }
+    return total_relevance;
+}
+
+template <typename ExecutionPolicy>
+size_t MatchAll(const SearchServer& search_server, const vector<string>& queries, size_t document_count, ExecutionPolicy&& policy) {
+    size_t total_words = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto [words, status] = search_server.MatchDocument(policy, queries[i], static_cast<int>(i % document_count));
+        total_words += words.size();
+    }
+    return total_words;
+}
+
+void RunSearchBenchmarks(BenchmarkRunner& runner, const CorpusOptions& options) {
+    mt19937 generator(options.seed);
+    const auto vocabulary = GenerateVocabulary(generator, options.vocabulary_size, 12);
+    const auto corpus = GenerateCorpus(generator, vocabulary, options);
+    const auto queries = GenerateQueryLog(generator, vocabulary, options);
+
+    // память меряется первой, пока освобожденные другими бенчмарками страницы не исказили прирост
+    const uint64_t rss_before = ResidentBytes();
+    const auto search_server = BuildServer(corpus, corpus.size());
+    const uint64_t rss_after = ResidentBytes();
+    runner.Add({"memory/index_resident"s, corpus.size(), 0, rss_after > rss_before ? rss_after - rss_before : 0});
+    const MemoryUsage usage = search_server->GetMemoryUsage();
+    runner.Add({"memory/inverted_index"s, corpus.size(), 0, usage.inverted_index});
+    runner.Add({"memory/forward_index"s, corpus.size(), 0, usage.forward_index});
+    runner.Add({"memory/vocabulary"s, corpus.size(), 0, usage.vocabulary});
+    runner.Add({"memory/metadata"s, corpus.size(), 0, usage.metadata});
+    // опрос мониторингом: счетчики памяти и полная статистика с проходом по словарю
+    size_t stats_sink = 0;
+    runner.Run("stats/memory_usage"s, 1000, [&] {
+        return Measure([&] {
+            for (int i = 0; i < 1000; ++i) {
+                stats_sink += search_server->GetMemoryUsage().Total();
+            }
+        });
+    });
+    runner.Run("stats/get_stats"s, 1, [&] {
+        return Measure([&] { stats_sink += search_server->GetStats().vocabulary_size; });
+    });
+    cerr << "stats checksum: "s << stats_sink << '\n';
+
+    runner.Run("ingest/add_document"s, corpus.size(), [&] {
+        unique_ptr<SearchServer> fresh_server;
+        const auto elapsed = Measure([&] { fresh_server = BuildServer(corpus, corpus.size()); });
+        return elapsed;
+    });
+    // цена полной цепочки анализа: регистр, пунктуация и выделение основы на каждом слове
+    runner.Run("ingest/add_document_analyzed"s, corpus.size(), [&] {
+        unique_ptr<SearchServer> fresh_server;
+        const auto elapsed = Measure([&] { fresh_server = BuildServer(corpus, corpus.size(), TextAnalyzer::Full()); });
+        return elapsed;
+    });
+
+    // цена журнала: fsync на каждую запись против групповой синхронизации
+    const auto durable_ingest = [&corpus](const DurabilityOptions& durability, size_t document_count) {
+        const filesystem::path directory = filesystem::temp_directory_path() / ("search_server_bench_"s + to_string(random_device()()));
+        filesystem::remove_all(directory);
+        const auto elapsed = Measure([&] {
+            DurableSearchServer durable_server(directory.string(), "a an the"s, TextAnalyzer(), durability);
+            for (size_t i = 0; i < document_count; ++i) {
+                durable_server.AddDocument(static_cast<int>(i), corpus[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 10)});
+            }
+            durable_server.Sync();
+        });
+        filesystem::remove_all(directory);
+        return elapsed;
+    };
+    runner.Run("ingest/durable_group_commit"s, corpus.size(), [&] {
+        return durable_ingest(DurabilityOptions(), corpus.size());
+    });
+    const size_t synced_documents = min<size_t>(corpus.size(), 500);
+    runner.Run("ingest/durable_sync_every_write"s, synced_documents, [&] {
+        return durable_ingest(DurabilityOptions{true}, synced_documents);
+    });
+
+    // узлы постингов из пула вместо отдельного new на каждый; пул освобождается целиком вместе с сервером
+    runner.Run("ingest/add_document_pool"s, corpus.size(), [&] {
+        pmr::unsynchronized_pool_resource pool;
+        unique_ptr<SearchServer> fresh_server;
+        const auto elapsed = Measure([&] { fresh_server = BuildServer(corpus, corpus.size(), TextAnalyzer(), {&pool}); });
+        return elapsed;
+    });
+
+    // правка документа: дописывается одно слово. Удаление с добавлением разбирает текст заново и трогает
+    // постинги всех слов дважды, обновление - только постинг нового слова и частоты старых
+    const auto updated_server = BuildServer(corpus, corpus.size());
+    const size_t edited_documents = min<size_t>(corpus.size(), 1000);
+    runner.Run("update/remove_add"s, edited_documents, [&] {
+        return Measure([&] {
+            for (size_t i = 0; i < edited_documents; ++i) {
+                updated_server->RemoveDocument(execution::par, static_cast<int>(i));
+                updated_server->AddDocument(static_cast<int>(i), corpus[i] + " edited"s, DocumentStatus::ACTUAL, {1});
+            }
+        });
+    });
+    runner.Run("update/update_document"s, edited_documents, [&] {
+        return Measure([&] {
+            for (size_t i = 0; i < edited_documents; ++i) {
+                updated_server->UpdateDocument(static_cast<int>(i), corpus[i] + " revised"s, DocumentStatus::ACTUAL, {1});
+            }
+        });
+    });
+    runner.Run("update/set_status"s, corpus.size(), [&] {
+        return Measure([&] {
+            for (size_t i = 0; i < corpus.size(); ++i) {
+                updated_server->SetDocumentStatus(static_cast<int>(i), i % 2 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL);
+            }
+        });
+    });
+
+    double sink = 0;
+    runner.Run("find_top/seq"s, queries.size(), [&] {
+        return Measure([&] { sink += FindAll(*search_server, queries, execution::seq, QueryMode::ANY); });
+    });
+    runner.Run("find_top/par"s, queries.size(), [&] {
+        return Measure([&] { sink += FindAll(*search_server, queries, execution::par, QueryMode::ANY); });
+    });
+    runner.Run("find_top/all_mode"s, queries.size(), [&] {
+        return Measure([&] { sink += FindAll(*search_server, queries, execution::seq, QueryMode::ALL); });
+    });
+    // то же, но каждое плюс-слово нечеткое: показывает, во сколько раз раскрытие дороже точного поиска
+    vector<string> fuzzy_queries;
+    for (const string& query : queries) {
+        string fuzzy_query;
+        for (const string_view word : SplitIntoWordsView(query)) {
+            fuzzy_query += string(word) + (word[0] == '-' ? " "s : "~1 "s);
+        }
+        fuzzy_queries.push_back(fuzzy_query);
+    }
+    runner.Run("find_top/fuzzy"s, fuzzy_queries.size(), [&] {
+        return Measure([&] { sink += FindAll(*search_server, fuzzy_queries, execution::seq, QueryMode::ANY); });
+    });
+    // однословные запросы по самым частым словам: полный просмотр постинга против головы копии, упорядоченной по вкладу
+    vector<string> frequent_word_queries;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        frequent_word_queries.push_back(vocabulary[i % min<size_t>(vocabulary.size(), 50)]);
+    }
+    runner.Run("find_top/single_term_scan"s, frequent_word_queries.size(), [&] {
+        return Measure([&] { sink += FindAll(*search_server, frequent_word_queries, execution::seq, QueryMode::ANY); });
+    });
+    const auto impact_server = BuildServer(corpus, corpus.size());
+    impact_server->RebuildImpactPostings(64 << 20);
+    runner.Add({"memory/impact_postings"s, corpus.size(), 0, impact_server->GetImpactPostingsBytes()});
+    runner.Run("find_top/single_term_impact"s, frequent_word_queries.size(), [&] {
+        return Measure([&] { sink += FindAll(*impact_server, frequent_word_queries, execution::seq, QueryMode::ANY); });
+    });
+    // глубокое листание: первые 10 страниц по 10 документов каждого запроса, по курсору и из окна страниц
+    const size_t page_count = 10;
+    runner.Run("find_page/ten_pages"s, queries.size() * page_count, [&] {
+        return Measure([&] {
+            for (const string& query : queries) {
+                SearchCursor cursor;
+                for (size_t page = 0; page < page_count; ++page) {
+                    const SearchPage result = search_server->FindPage(query, cursor, 10);
+                    sink += result.documents.size();
+                    cursor = result.next;
+                }
+            }
+        });
+    });
+    runner.Run("match_document/seq"s, queries.size(), [&] {
+        return Measure([&] { sink += MatchAll(*search_server, queries, corpus.size(), execution::seq); });
+    });
+    runner.Run("match_document/par"s, queries.size(), [&] {
+        return Measure([&] { sink += MatchAll(*search_server, queries, corpus.size(), execution::par); });
+    });
+    vector<int> batch_ids(min<size_t>(64, corpus.size()));
+    iota(batch_ids.begin(), batch_ids.end(), 0);
+    runner.Run("match_documents/batch"s, queries.size() * batch_ids.size(), [&] {
+        return Measure([&] {
+            for (const string& query : queries) {
+                sink += search_server->MatchDocuments(query, batch_ids).size();
+            }
+        });
+    });
+    runner.Run("process_queries"s, queries.size(), [&] {
+        return Measure([&] { sink += ProcessQueries(*search_server, queries).size(); });
+    });
+    // каждый узел NUMA опрашивает свою реплику; по узлам отдельно - пропускная способность сокета
+    // на локальной памяти. На машине с одним узлом реплик нет, и это тот же пул потоков на исходном индексе
+    const NumaReplicas replicas(*search_server);
+    runner.Run("numa/process_queries"s, queries.size(), [&] {
+        return Measure([&] { sink += ProcessQueriesNuma(replicas, queries).size(); });
+    });
+    for (size_t node = 0; node < replicas.NodeCount(); ++node) {
+        runner.Run("numa/node"s + to_string(replicas.Node(node).id) + "/process_queries"s, queries.size(), [&] {
+            return Measure([&] { sink += ProcessQueriesNuma(replicas, queries, node).size(); });
+        });
+    }
+
+    const size_t remove_count = min<size_t>(1'000, corpus.size() / 4);
+    runner.Run("remove_document/seq"s, remove_count, [&] {
+        auto victim = BuildServer(corpus, remove_count * 4);
+        return Measure([&] {
+            for (size_t i = 0; i < remove_count; ++i) {
+                victim->RemoveDocument(execution::seq, static_cast<int>(i * 4));
+            }
+        });
+    });
+    runner.Run("remove_document/par"s, remove_count, [&] {
+        auto victim = BuildServer(corpus, remove_count * 4);
+        return Measure([&] {
+            for (size_t i = 0; i < remove_count; ++i) {
+                victim->RemoveDocument(execution::par, static_cast<int>(i * 4));
+            }
+        });
+    });
+
+    // слияние двух длинных постингов, размером с постинги самых частых слов
+    Posting first;
+    Posting second;
+    for (size_t i = 0; i < corpus.size(); ++i) {
+        if (i % 2 == 0) {
+            first[static_cast<int>(i)] = 0.1;
+        }
+        if (i % 3 == 0) {
+            second[static_cast<int>(i)] = 0.2;
+        }
+    }
+    runner.Run("scoring/accumulate_posting"s, first.size() + second.size(), [&] {
+        ScoreAccumulator acc;
+        MergeBuffers buffer;
+        return Measure([&] {
+            for (int i = 0; i < 100; ++i) {
+                acc.Clear();
+                AccumulatePosting(acc, first, 1.5, buffer);
+                AccumulatePosting(acc, second, 0.5, buffer);
+            }
+            sink += acc.Size();
+        }) / 100;
+    });
+
+    // векторные ядра над накопителем такого же размера, под каждый набор команд процессора
+    ScoreAccumulator merged;
+    {
+        MergeBuffers buffer;
+        AccumulatePosting(merged, first, 1.5, buffer);
+        AccumulatePosting(merged, second, 0.5, buffer);
+    }
+    vector<double> scores = merged.scores;
+    vector<double> maxima((scores.size() + SCORING_BLOCK_SIZE - 1) / SCORING_BLOCK_SIZE);
+    vector<uint32_t> indices(scores.size());
+    for (const ScoringIsa isa : {ScoringIsa::PORTABLE, ScoringIsa::AVX2, ScoringIsa::AVX512}) {
+        if (!IsScoringIsaSupported(isa)) {
+            continue;
+        }
+        const ScoringKernels& kernels = GetScoringKernels(isa);
+        const string suffix = "/"s + ScoringIsaName(isa);
+        runner.Run("scoring/scale_scores"s + suffix, scores.size(), [&] {
+            return Measure([&] {
+                for (int i = 0; i < 100; ++i) {
+                    kernels.scale(scores.data(), scores.size(), i % 2 == 0 ? 2.0 : 0.5);
+                }
+            }) / 100;
+        });
+        const vector<double> tfs = merged.scores;
+        runner.Run("scoring/add_scaled"s + suffix, scores.size(), [&] {
+            return Measure([&] {
+                for (int i = 0; i < 100; ++i) {
+                    kernels.add_scaled(scores.data(), tfs.data(), scores.size(), i % 2 == 0 ? 0.5 : -0.5);
+                }
+            }) / 100;
+        });
+        runner.Run("scoring/block_max"s + suffix, scores.size(), [&] {
+            return Measure([&] {
+                for (int i = 0; i < 100; ++i) {
+                    kernels.block_max(scores.data(), scores.size(), maxima.data());
+                }
+                sink += static_cast<size_t>(maxima.front());
+            }) / 100;
+        });
+        // порог пропускает документы с обоими словами, четверть накопителя
+        runner.Run("scoring/select_at_least"s + suffix, scores.size(), [&] {
+            return Measure([&] {
+                for (int i = 0; i < 100; ++i) {
+                    sink += kernels.select_at_least(scores.data(), scores.size(), 0.2, indices.data());
+                }
+            }) / 100;
+        });
+    }
+
+    // стоп-слова - самые частые слова языка, поэтому берутся верхние по рангу слова словаря
+    const size_t stop_word_count = min<size_t>(300, vocabulary.size());
+    set<string_view> ordinary_stop_words;
+    StopWordSet stop_words;
+    for (size_t i = 0; i < stop_word_count; ++i) {
+        ordinary_stop_words.insert(vocabulary[i]);
+        stop_words.Insert(vocabulary[i]);
+    }
+    vector<string_view> tokens;
+    for (const string& document : corpus) {
+        for (const string_view word : SplitIntoWordsView(document)) {
+            tokens.push_back(word);
+        }
+    }
+    runner.Run("stop_words/std_set"s, tokens.size(), [&] {
+        return Measure([&] {
+            for (const string_view token : tokens) {
+                sink += ordinary_stop_words.count(token);
+            }
+        });
+    });
+    runner.Run("stop_words/stop_word_set"s, tokens.size(), [&] {
+        return Measure([&] {
+            for (const string_view token : tokens) {
+                sink += stop_words.Contains(token);
+            }
+        });
+    });
+
+    // тот же текст кириллицей: латинская буква заменяется буквой с тем же номером от "а", так что у всех
+    // слов первый байт 0xD0 или 0xD1, а частоты слов и длины в буквах те же
+    const auto to_cyrillic = [](string_view word) {
+        string result;
+        for (const char c : word) {
+            if (c >= 'a' && c <= 'z') {
+                const char32_t code_point = U'а' + (c - 'a');
+                result += static_cast<char>(0xC0 | code_point >> 6);
+                result += static_cast<char>(0x80 | (code_point & 0x3F));
+            } else {
+                result += c;
+            }
+        }
+        return result;
+    };
+    StopWordSet cyrillic_stop_words;
+    for (size_t i = 0; i < stop_word_count; ++i) {
+        cyrillic_stop_words.Insert(to_cyrillic(vocabulary[i]));
+    }
+    vector<string> cyrillic_tokens;
+    cyrillic_tokens.reserve(min<size_t>(tokens.size(), 1'000'000));
+    for (size_t i = 0; i < cyrillic_tokens.capacity() && i < tokens.size(); ++i) {
+        cyrillic_tokens.push_back(to_cyrillic(tokens[i]));
+    }
+    runner.Run("stop_words/stop_word_set_cyrillic"s, cyrillic_tokens.size(), [&] {
+        return Measure([&] {
+            for (const string& token : cyrillic_tokens) {
+                sink += cyrillic_stop_words.Contains(token);
+            }
+        });
+    });
+
+    cerr << "checksum: "s << sink << '\n';
+}
+
+void RunConcurrentMapBenchmarks(BenchmarkRunner& runner) {
+    const size_t key_count = 100'000;
+    const size_t operation_count = 2'000'000;
+    for (size_t thread_count : {1, 2, 4, 8}) {
+        runner.Run("concurrent_map/threads_"s + to_string(thread_count), operation_count, [&] {
+            ConcurrentMap<int, double> concurrent_map(key_count);
+            return Measure([&] {
+                vector<thread> threads;
+                for (size_t t = 0; t < thread_count; ++t) {
+                    threads.emplace_back([&, t] {
+                        mt19937 generator(static_cast<uint32_t>(t));
+                        for (size_t i = 0; i < operation_count / thread_count; ++i) {
+                            concurrent_map.Add(static_cast<int>(generator() % key_count), 1.0);
+                        }
+                    });
+                }
+                for (auto& worker : threads) {
+                    worker.join();
+                }
+            });
+        });
+    }
+
+    // ключи с шагом 1024, как id документов, раздаваемые блоками: по младшим битам хеша они совпали бы
+    runner.Run("concurrent_map/strided_keys"s, key_count, [&] {
+        ConcurrentMap<int, double> concurrent_map(key_count);
+        return Measure([&] {
+            for (size_t i = 0; i < key_count; ++i) {
+                concurrent_map.Add(static_cast<int>(i * 1024), 1.0);
+            }
+        });
+    });
+}
+
+// Векторы вокруг центров кластеров, как эмбеддинги текстов на близкие темы. Построение графа - самая дорогая
+// часть, поэтому векторов не больше 10 000
+void RunVectorBenchmarks(BenchmarkRunner& runner, const CorpusOptions& options) {
+    const size_t dimension = 64;
+    const size_t vector_count = min<size_t>(options.document_count, 10'000);
+    const size_t query_count = min<size_t>(options.query_count, 1'000);
+    mt19937 generator(options.seed);
+    normal_distribution<float> normal;
+    vector<vector<float>> centers(100, vector<float>(dimension));
+    for (auto& center : centers) {
+        for (float& value : center) {
+            value = normal(generator);
+        }
+    }
+    const auto random_vector = [&] {
+        vector<float> vector = centers[generator() % centers.size()];
+        for (float& value : vector) {
+            value += 0.5f * normal(generator);
+        }
+        return vector;
+    };
+    vector<pair<int, vector<float>>> vectors;
+    for (size_t i = 0; i < vector_count; ++i) {
+        vectors.push_back({static_cast<int>(i), random_vector()});
+    }
+    vector<vector<float>> queries;
+    for (size_t i = 0; i < query_count; ++i) {
+        queries.push_back(random_vector());
+    }
+
+    runner.Run("vectors/build_seq"s, vectors.size(), [&] {
+        HnswIndex index(dimension);
+        return Measure([&] { index.AddBatch(execution::seq, vectors); });
+    });
+    runner.Run("vectors/build_par"s, vectors.size(), [&] {
+        HnswIndex index(dimension);
+        return Measure([&] { index.AddBatch(execution::par, vectors); });
+    });
+
+    HnswIndex index(dimension);
+    index.AddBatch(execution::par, vectors);
+    runner.Add({"memory/hnsw_index"s, vectors.size(), 0, index.MemoryBytes()});
+    size_t found = 0;
+    for (const auto& query : queries) {
+        const auto approximate = index.Search(query, 10);
+        for (const VectorMatch& match : index.SearchExact(query, 10)) {
+            found += any_of(approximate.begin(), approximate.end(), [&match](const VectorMatch& other) {
+                return other.id == match.id;
+            });
+        }
+    }
+    cerr << "vectors recall@10: "s << static_cast<double>(found) / max<size_t>(1, queries.size() * 10) << '\n';
+
+    double sink = 0;
+    runner.Run("vectors/search_exact"s, queries.size(), [&] {
+        return Measure([&] {
+            for (const auto& query : queries) {
+                sink += index.SearchExact(query, 10)[0].similarity;
+            }
+        });
+    });
+    runner.Run("vectors/search_hnsw"s, queries.size(), [&] {
+        return Measure([&] {
+            for (const auto& query : queries) {
+                sink += index.Search(query, 10)[0].similarity;
+            }
+        });
+    });
+    // строгий фильтр пропускает каждый сотый документ, как фильтр по редкому статусу
+    runner.Run("vectors/search_filtered"s, queries.size(), [&] {
+        return Measure([&] {
+            for (const auto& query : queries) {
+                sink += index.Search(query, 10, [](int id) { return id % 100 == 0; })[0].similarity;
+            }
+        });
+    });
+    cerr << "checksum: "s << sink << '\n';
+}
+
+void RunDocumentStoreBenchmarks(BenchmarkRunner& runner, const CorpusOptions& options) {
+    mt19937 generator(options.seed);
+    const auto vocabulary = GenerateVocabulary(generator, options.vocabulary_size, 12);
+    const auto corpus = GenerateCorpus(generator, vocabulary, options);
+    vector<pair<int, string>> documents;
+    for (size_t id = 0; id < corpus.size(); ++id) {
+        documents.push_back({static_cast<int>(id), corpus[id]});
+    }
+    DocumentStoreOptions store_options;
+    store_options.dictionary_bytes = 16 * 1024;
+
+    runner.Run("store/add_batch_seq"s, documents.size(), [&] {
+        DocumentStore store(store_options);
+        return Measure([&] { store.AddBatch(execution::seq, documents); });
+    });
+    runner.Run("store/add_batch_par"s, documents.size(), [&] {
+        DocumentStore store(store_options);
+        return Measure([&] { store.AddBatch(execution::par, documents); });
+    });
+
+    DocumentStore store(store_options);
+    store.AddBatch(execution::par, documents);
+    store.Flush();
+    runner.Add({"memory/document_store_raw"s, documents.size(), 0, store.RawBytes()});
+    runner.Add({"memory/document_store"s, documents.size(), 0, store.CompressedBytes()});
+
+    // чтение вразнобой распаковывает блок почти на каждый документ, подряд - один раз на блок
+    vector<int> random_ids(min<size_t>(documents.size(), 10'000));
+    for (int& id : random_ids) {
+        id = static_cast<int>(generator() % documents.size());
+    }
+    size_t sink = 0;
+    runner.Run("store/get_random"s, random_ids.size(), [&] {
+        return Measure([&] {
+            for (const int id : random_ids) {
+                sink += store.Get(id).size();
+            }
+        });
+    });
+    runner.Run("store/get_sequential"s, documents.size(), [&] {
+        return Measure([&] {
+            for (const auto& [id, text] : documents) {
+                sink += store.Get(id).size();
+            }
+        });
+    });
+
+    const filesystem::path path = filesystem::temp_directory_path() / ("search_server_store_bench_"s + to_string(random_device()()));
+    store.Save(path.string());
+    runner.Run("store/open_mapped"s, 1, [&] {
+        return Measure([&] { sink += DocumentStore::Open(path.string()).Size(); });
+    });
+    const DocumentStore mapped = DocumentStore::Open(path.string());
+    runner.Run("store/get_random_mapped"s, random_ids.size(), [&] {
+        return Measure([&] {
+            for (const int id : random_ids) {
+                sink += mapped.Get(id).size();
+            }
+        });
+    });
+    filesystem::remove(path);
+    cerr << "store checksum: "s << sink << '\n';
+}
+
+void WriteJson(ostream& output, const CorpusOptions& options, const vector<BenchmarkResult>& results) {
+    output << "{\n"s;
+    output << "\"config\": {\"documents\": "s << options.document_count
+           << ", \"vocabulary\": "s << options.vocabulary_size
+           << ", \"words_per_document\": "s << options.words_per_document
+           << ", \"queries\": "s << options.query_count
+           << ", \"words_per_query\": "s << options.words_per_query
+           << ", \"seed\": "s << options.seed << "},\n"s;
+    output << "\"benchmarks\": [\n"s;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        output << "{\"name\": \""s << result.name << "\", \"iterations\": "s << result.iterations
+               << ", \"ns_per_op\": "s << result.ns_per_op << ", \"bytes\": "s << result.bytes << '}'
+               << (i + 1 < results.size() ? ",\n"s : "\n"s);
+    }
+    output << "]\n}\n"s;
+}
+
+string ExtractField(const string& line, const string& key) {
+    const string pattern = "\""s + key + "\": "s;
+    const size_t start = line.find(pattern);
+    if (start == string::npos) {
+        return {};
+    }
+    size_t begin = start + pattern.size();
+    if (line[begin] == '"') {
+        ++begin;
+        return line.substr(begin, line.find('"', begin) - begin);
+    }
+    return line.substr(begin, line.find_first_of(",}"s, begin) - begin);
+}
+
+// Возвращает число регрессий относительно базового прогона: роста времени операции или, если он записан,
+// размера в байтах больше чем на tolerance. У замеров памяти вроде memory/index_resident есть только байты
+int CompareWithBaseline(const string& path, const vector<BenchmarkResult>& results, double tolerance) {
+    ifstream input(path);
+    if (!input) {
+        throw invalid_argument("Не удалось открыть "s + path);
+    }
+    map<string, BenchmarkResult> baseline;
+    for (string line; getline(input, line);) {
+        const string name = ExtractField(line, "name"s);
+        if (!name.empty()) {
+            const string bytes = ExtractField(line, "bytes"s);
+            baseline[name] = {name, 0, stod(ExtractField(line, "ns_per_op"s)), bytes.empty() ? 0 : stoull(bytes)};
+        }
+    }
+
+    int regressions = 0;
+    const auto compare = [&](const string& name, double before, double after, const string& unit) {
+        const double ratio = after / before;
+        const bool regressed = ratio > 1 + tolerance;
+        regressions += regressed;
+        cerr << (regressed ? "REGRESSION "s : "ok "s) << name << ": "s << before << " -> "s << after << ' ' << unit
+             << " ("s << (ratio - 1) * 100 << "%)"s << '\n';
+    };
+    for (const auto& result : results) {
+        const auto it = baseline.find(result.name);
+        if (it == baseline.end()) {
+            continue;
+        }
+        if (it->second.ns_per_op > 0) {
+            compare(result.name, it->second.ns_per_op, result.ns_per_op, "ns/op"s);
+        }
+        if (it->second.bytes > 0) {
+            compare(result.name, static_cast<double>(it->second.bytes), static_cast<double>(result.bytes), "bytes"s);
+        }
+    }
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const auto arguments = ParseArguments(argc, argv);
+
+    CorpusOptions options;
+    options.document_count = GetSize(arguments, "documents"s, options.document_count);
+    options.vocabulary_size = GetSize(arguments, "vocabulary"s, options.vocabulary_size);
+    options.words_per_document = GetSize(arguments, "words-per-document"s, options.words_per_document);
+    options.query_count = GetSize(arguments, "queries"s, options.query_count);
+    options.words_per_query = GetSize(arguments, "words-per-query"s, options.words_per_query);
+    options.seed = static_cast<uint32_t>(GetSize(arguments, "seed"s, options.seed));
+
+    BenchmarkRunner runner(static_cast<int>(GetSize(arguments, "repetitions"s, 3)));
+    RunSearchBenchmarks(runner, options);
+    RunConcurrentMapBenchmarks(runner);
+    RunVectorBenchmarks(runner, options);
+    RunDocumentStoreBenchmarks(runner, options);
+
+    if (const auto json = arguments.find("json"s); json != arguments.end()) {
+        ofstream output(json->second);
+        WriteJson(output, options, runner.Results());
+    } else {
+        WriteJson(cout, options, runner.Results());
+    }
+
+    if (const auto baseline = arguments.find("baseline"s); baseline != arguments.end()) {
+        const double tolerance = arguments.count("tolerance"s) ? stod(arguments.at("tolerance"s)) : 0.1;
+        return CompareWithBaseline(baseline->second, runner.Results(), tolerance) > 0 ? 1 : 0;
+    }
+    return 0;
+}
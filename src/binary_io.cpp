@@ -0,0 +1,80 @@
+#include "binary_io.h"
+
+#include <array>
+#include <cerrno>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void ThrowSystemError(const std::string& action, const std::string& path) {
+    throw std::runtime_error(action + " " + path + ": " + std::strerror(errno));
+}
+
+void SyncPath(const std::string& path, int flags) {
+    const int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        ThrowSystemError("Не удалось синхронизировать", path);
+    }
+    ::close(fd);
+}
+
+std::array<uint32_t, 256> MakeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+        }
+        table[i] = value;
+    }
+    return table;
+}
+
+} // namespace
+
+uint32_t Crc32(std::string_view data, uint32_t previous) { // CRC-32 IEEE, как в zlib
+    static const std::array<uint32_t, 256> table = MakeCrcTable();
+    uint32_t crc = previous ^ 0xFFFFFFFFu;
+    for (const char c : data) {
+        crc = table[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void WriteFileDurably(const std::string& path, std::string_view data) {
+    const std::string temporary_path = path + ".tmp";
+    const int fd = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ThrowSystemError("Не удалось создать", temporary_path);
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            ::close(fd);
+            ThrowSystemError("Не удалось записать", temporary_path);
+        }
+        written += static_cast<size_t>(result);
+    }
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        ThrowSystemError("Не удалось синхронизировать", temporary_path);
+    }
+    ::close(fd);
+
+    if (::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        ThrowSystemError("Не удалось заменить", path);
+    }
+    // переименование надежно, только когда на диск ушел и каталог
+    const std::string directory = std::filesystem::path(path).parent_path().string();
+    SyncPath(directory.empty() ? "." : directory, O_RDONLY | O_DIRECTORY);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Двоичная запись журнала и снимков. Числа пишутся в порядке байтов машины: файлы не переносятся
+// между архитектурами, а читаются тем же сервером после перезапуска
+
+// previous - CRC уже обработанных данных, чтобы считать контрольную сумму потока по частям
+uint32_t Crc32(std::string_view data, uint32_t previous = 0);
+
+// Пишет data во временный файл рядом с path, синхронизирует его и переименовывает поверх path,
+// так что на диске всегда лежит либо старый, либо новый целый файл. Бросает std::runtime_error
+void WriteFileDurably(const std::string& path, std::string_view data);
+
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::string& output)
+        : output_(output) {
+    }
+
+    template <typename T>
+    void Put(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        output_.append(bytes, sizeof(T));
+    }
+
+    void PutString(std::string_view text) {
+        Put(static_cast<uint32_t>(text.size()));
+        output_.append(text);
+    }
+
+private:
+    std::string& output_;
+};
+
+// Читает поля по порядку и бросает std::runtime_error, если данные кончились раньше
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view input)
+        : input_(input) {
+    }
+
+    template <typename T>
+    T Get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Require(sizeof(T));
+        T value;
+        std::memcpy(&value, input_.data(), sizeof(T));
+        input_.remove_prefix(sizeof(T));
+        return value;
+    }
+
+    std::string_view GetString() {
+        const uint32_t size = Get<uint32_t>();
+        Require(size);
+        const std::string_view text = input_.substr(0, size);
+        input_.remove_prefix(size);
+        return text;
+    }
+
+    size_t Remaining() const {
+        return input_.size();
+    }
+
+private:
+    std::string_view input_;
+
+    void Require(size_t size) const {
+        if (input_.size() < size) {
+            throw std::runtime_error("Двоичные данные оборваны");
+        }
+    }
+};
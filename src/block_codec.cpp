@@ -0,0 +1,327 @@
+#include "block_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifdef SEARCH_SERVER_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+#include "string_processing.h"
+
+namespace {
+
+// Ограничения формата блока LZ4: повтор не короче 4 байт, смещение в 2 байта, последние 5 байт блока -
+// всегда литералы, а последний повтор начинается не ближе 12 байт к концу
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+const size_t LZ_LAST_LITERALS = 5;
+const size_t LZ_MATCH_FIND_LIMIT = 12;
+const int LZ_HASH_BITS = 14;
+
+uint32_t Read32(const char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t HashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void PutLength(std::string& output, size_t length) {
+    for (; length >= 255; length -= 255) {
+        output.push_back(static_cast<char>(255));
+    }
+    output.push_back(static_cast<char>(length));
+}
+
+void PutSequence(std::string& output, std::string_view literals, size_t match_length, size_t offset) {
+    const size_t match_code = match_length - LZ_MIN_MATCH;
+    const size_t token = (std::min<size_t>(literals.size(), 15) << 4) | (match_length ? std::min<size_t>(match_code, 15) : 0);
+    output.push_back(static_cast<char>(token));
+    if (literals.size() >= 15) {
+        PutLength(output, literals.size() - 15);
+    }
+    output.append(literals);
+    if (match_length == 0) {
+        return;
+    }
+    output.push_back(static_cast<char>(offset & 0xFF));
+    output.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15) {
+        PutLength(output, match_code - 15);
+    }
+}
+
+std::string CompressLz(std::string_view block, std::string_view dictionary) {
+    // повторы ищутся в словаре и уже пройденной части блока как в одной строке
+    dictionary = dictionary.substr(dictionary.size() - std::min(dictionary.size(), LZ_MAX_OFFSET));
+    std::string window;
+    window.reserve(dictionary.size() + block.size());
+    window.append(dictionary).append(block);
+    const char* data = window.data();
+    const size_t end = window.size();
+
+    std::string output;
+    output.reserve(block.size() + block.size() / 255 + 16);
+    size_t anchor = dictionary.size();
+    if (block.size() > LZ_MATCH_FIND_LIMIT) {
+        std::vector<int32_t> table(size_t{1} << LZ_HASH_BITS, -1);
+        for (size_t position = 0; position + LZ_MIN_MATCH <= dictionary.size(); ++position) {
+            table[HashSequence(Read32(data + position))] = static_cast<int32_t>(position);
+        }
+        const size_t match_limit = end - LZ_LAST_LITERALS;
+        const size_t search_limit = end - LZ_MATCH_FIND_LIMIT;
+        size_t position = anchor;
+        while (position < search_limit) {
+            const uint32_t sequence = Read32(data + position);
+            int32_t& slot = table[HashSequence(sequence)];
+            const int32_t candidate = slot;
+            slot = static_cast<int32_t>(position);
+            if (candidate < 0 || position - candidate > LZ_MAX_OFFSET || Read32(data + candidate) != sequence) {
+                // чем дольше нет повторов, тем крупнее шаг: несжимаемые данные проходятся быстро
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+            size_t length = LZ_MIN_MATCH;
+            while (position + length < match_limit && data[candidate + length] == data[position + length]) {
+                ++length;
+            }
+            PutSequence(output, std::string_view(data + anchor, position - anchor), length, position - candidate);
+            position += length;
+            anchor = position;
+            if (position - 2 < search_limit) {
+                table[HashSequence(Read32(data + position - 2))] = static_cast<int32_t>(position - 2);
+            }
+        }
+    }
+    PutSequence(output, std::string_view(data + anchor, end - anchor), 0, 0);
+    return output;
+}
+
+[[noreturn]] void ThrowCorrupted() {
+    throw std::runtime_error("Поврежденный блок хранилища документов");
+}
+
+size_t GetLength(std::string_view compressed, size_t& position, size_t length) {
+    if (length != 15) {
+        return length;
+    }
+    for (;;) {
+        if (position >= compressed.size()) {
+            ThrowCorrupted();
+        }
+        const uint8_t byte = static_cast<uint8_t>(compressed[position++]);
+        length += byte;
+        if (byte != 255) {
+            return length;
+        }
+    }
+}
+
+std::string DecompressLz(std::string_view compressed, size_t raw_size, std::string_view dictionary) {
+    dictionary = dictionary.substr(dictionary.size() - std::min(dictionary.size(), LZ_MAX_OFFSET));
+    std::string output(raw_size, '\0');
+    char* out = output.data();
+    size_t produced = 0;
+    size_t position = 0;
+    for (;;) {
+        if (position >= compressed.size()) {
+            ThrowCorrupted();
+        }
+        const uint8_t token = static_cast<uint8_t>(compressed[position++]);
+        const size_t literals = GetLength(compressed, position, token >> 4);
+        if (literals > compressed.size() - position || literals > raw_size - produced) {
+            ThrowCorrupted();
+        }
+        std::memcpy(out + produced, compressed.data() + position, literals);
+        position += literals;
+        produced += literals;
+        if (position == compressed.size()) {
+            break;
+        }
+
+        if (compressed.size() - position < 2) {
+            ThrowCorrupted();
+        }
+        const size_t offset = static_cast<uint8_t>(compressed[position]) | (static_cast<size_t>(static_cast<uint8_t>(compressed[position + 1])) << 8);
+        position += 2;
+        size_t length = GetLength(compressed, position, token & 0x0F) + LZ_MIN_MATCH;
+        if (offset == 0 || offset > produced + dictionary.size() || length > raw_size - produced) {
+            ThrowCorrupted();
+        }
+        if (offset > produced) {
+            // начало повтора в словаре
+            const size_t from_dictionary = std::min(length, offset - produced);
+            std::memcpy(out + produced, dictionary.data() + dictionary.size() - (offset - produced), from_dictionary);
+            produced += from_dictionary;
+            length -= from_dictionary;
+        }
+        if (offset >= length) {
+            std::memcpy(out + produced, out + produced - offset, length);
+            produced += length;
+        } else {
+            // повтор перекрывается с собой, как в "abababab": копируется по байту
+            for (; length > 0; --length, ++produced) {
+                out[produced] = out[produced - offset];
+            }
+        }
+    }
+    if (produced != raw_size) {
+        ThrowCorrupted();
+    }
+    return output;
+}
+
+std::string TrainLzDictionary(const std::vector<std::string_view>& samples, size_t max_bytes) {
+    // каждое вхождение частого слова в словаре заменяется повтором, выгода - примерно число вхождений на длину
+    std::unordered_map<std::string_view, size_t> counts;
+    for (const std::string_view sample : samples) {
+        for (const std::string_view word : SplitIntoWordsView(sample)) {
+            ++counts[word];
+        }
+    }
+    std::vector<std::pair<size_t, std::string_view>> words;
+    for (const auto& [word, count] : counts) {
+        if (count > 1 && word.size() >= LZ_MIN_MATCH - 1) {
+            words.push_back({count * word.size(), word});
+        }
+    }
+    std::sort(words.begin(), words.end(), std::greater<>());
+    max_bytes = std::min(max_bytes, LZ_MAX_OFFSET);
+    std::vector<std::string_view> chosen;
+    size_t size = 0;
+    for (const auto& [gain, word] : words) {
+        if (size + word.size() + 1 > max_bytes) {
+            continue;
+        }
+        chosen.push_back(word);
+        size += word.size() + 1;
+    }
+    // самые выгодные слова - в конце словаря, ближе к блоку: до них дотягиваются повторы из любого его места
+    std::string dictionary;
+    dictionary.reserve(size);
+    for (auto word = chosen.rbegin(); word != chosen.rend(); ++word) {
+        dictionary.append(*word).push_back(' ');
+    }
+    return dictionary;
+}
+
+#ifdef SEARCH_SERVER_ZSTD
+void CheckZstd(size_t result) {
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(std::string("Ошибка zstd: ") + ZSTD_getErrorName(result));
+    }
+}
+
+// контексты сжатия переиспользуются потоком от блока к блоку
+struct ZstdContexts {
+    ZSTD_CCtx* compression = ZSTD_createCCtx();
+    ZSTD_DCtx* decompression = ZSTD_createDCtx();
+
+    ~ZstdContexts() {
+        ZSTD_freeCCtx(compression);
+        ZSTD_freeDCtx(decompression);
+    }
+};
+
+ZstdContexts& ThreadZstdContexts() {
+    thread_local ZstdContexts contexts;
+    return contexts;
+}
+#endif
+
+void CheckAvailable(BlockCodec codec) {
+    if (!IsCodecAvailable(codec)) {
+        throw std::invalid_argument("Сервер собран без этого кодека сжатия");
+    }
+}
+
+} // namespace
+
+bool IsCodecAvailable(BlockCodec codec) {
+    switch (codec) {
+    case BlockCodec::RAW:
+    case BlockCodec::LZ:
+        return true;
+    case BlockCodec::ZSTD:
+#ifdef SEARCH_SERVER_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+std::string CompressBlock(BlockCodec codec, std::string_view block, std::string_view dictionary, int level) {
+    CheckAvailable(codec);
+    if (codec == BlockCodec::LZ) {
+        return CompressLz(block, dictionary);
+    }
+#ifdef SEARCH_SERVER_ZSTD
+    if (codec == BlockCodec::ZSTD) {
+        std::string output(ZSTD_compressBound(block.size()), '\0');
+        const size_t size = ZSTD_compress_usingDict(ThreadZstdContexts().compression, output.data(), output.size(), block.data(), block.size(),
+                                                    dictionary.data(), dictionary.size(), level == 0 ? ZSTD_CLEVEL_DEFAULT : level);
+        CheckZstd(size);
+        output.resize(size);
+        return output;
+    }
+#else
+    (void)level;
+#endif
+    return std::string(block);
+}
+
+std::string DecompressBlock(BlockCodec codec, std::string_view compressed, size_t raw_size, std::string_view dictionary) {
+    CheckAvailable(codec);
+    if (codec == BlockCodec::LZ) {
+        return DecompressLz(compressed, raw_size, dictionary);
+    }
+#ifdef SEARCH_SERVER_ZSTD
+    if (codec == BlockCodec::ZSTD) {
+        std::string output(raw_size, '\0');
+        const size_t size = ZSTD_decompress_usingDict(ThreadZstdContexts().decompression, output.data(), output.size(), compressed.data(),
+                                                      compressed.size(), dictionary.data(), dictionary.size());
+        if (ZSTD_isError(size) || size != raw_size) {
+            ThrowCorrupted();
+        }
+        return output;
+    }
+#endif
+    if (compressed.size() != raw_size) {
+        ThrowCorrupted();
+    }
+    return std::string(compressed);
+}
+
+std::string TrainDictionary(BlockCodec codec, const std::vector<std::string_view>& samples, size_t max_bytes) {
+    CheckAvailable(codec);
+    if (codec == BlockCodec::LZ) {
+        return TrainLzDictionary(samples, max_bytes);
+    }
+#ifdef SEARCH_SERVER_ZSTD
+    if (codec == BlockCodec::ZSTD) {
+        std::string buffer;
+        std::vector<size_t> sizes;
+        for (const std::string_view sample : samples) {
+            buffer.append(sample);
+            sizes.push_back(sample.size());
+        }
+        std::string dictionary(max_bytes, '\0');
+        const size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), buffer.data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+        // на малом числе образцов обучение не удается, тогда блоки сжимаются без словаря
+        if (ZDICT_isError(size)) {
+            return {};
+        }
+        dictionary.resize(size);
+        return dictionary;
+    }
+#endif
+    return {};
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Сжатие блоков хранилища документов. LZ - встроенная реализация формата блока LZ4: быстрая, без внешних
+// зависимостей, словарь служит предысторией, на которую могут ссылаться повторы. ZSTD доступен, только если
+// сервер собран с SEARCH_SERVER_ZSTD, и сжимает сильнее, особенно с обученным словарем
+enum class BlockCodec : uint8_t {
+    RAW,
+    LZ,
+    ZSTD
+};
+
+// Собран ли сервер с поддержкой codec
+bool IsCodecAvailable(BlockCodec codec);
+
+// Сжимает block. dictionary должен быть тем же при распаковке. level учитывает только ZSTD, 0 - уровень по умолчанию.
+// Бросает std::invalid_argument, если кодек недоступен
+std::string CompressBlock(BlockCodec codec, std::string_view block, std::string_view dictionary = {}, int level = 0);
+
+// Распаковывает блок, исходный размер которого raw_size. Бросает std::runtime_error, если данные повреждены
+std::string DecompressBlock(BlockCodec codec, std::string_view compressed, size_t raw_size, std::string_view dictionary = {});
+
+// Строит словарь размером не больше max_bytes по образцам текстов. Для ZSTD - обучением zstd, для LZ - из самых
+// выгодных частых слов образцов. Пустой словарь, если образцов мало
+std::string TrainDictionary(BlockCodec codec, const std::vector<std::string_view>& samples, size_t max_bytes);
@@ -1,52 +1,114 @@
 #pragma once
 
-using namespace std::string_literals;
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
+// Хеш-таблица с открытой адресацией без блокировок: ключ занимается через CAS, значение увеличивается
+// атомарным fetch_add. Размер задается заранее по ожидаемому числу ключей и дальше не меняется.
+// Ключ std::numeric_limits<Key>::min() зарезервирован под пустую ячейку.
 template <typename Key, typename Value>
     class ConcurrentMap {
     private:
-        struct Bucket {
-            std::mutex mutex;
-            std::map<Key, Value> map;
+        struct Slot {
+            std::atomic<Key> key{EMPTY_KEY};
+            std::atomic<Value> value{};
+            std::atomic<bool> erased{false};
         };
 
     public:
-        static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
+        static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys");
+        static_assert(std::is_arithmetic_v<Value>, "ConcurrentMap supports only arithmetic values");
 
-        struct Access {
-            std::lock_guard<std::mutex> guard;
-            Value& ref_to_value;
+        static constexpr Key EMPTY_KEY = std::numeric_limits<Key>::min();
 
-            Access(const Key& key, Bucket& bucket)
-                : guard(bucket.mutex)
-                , ref_to_value(bucket.map[key]) {
-            }
-        };
+        // expected_count - сколько разных ключей ожидается, например суммарная длина постингов запроса
+        explicit ConcurrentMap(size_t expected_count)
+            : slots_(RoundUpCapacity(expected_count))
+            , mask_(slots_.size() - 1)
+            , shift_(64 - Log2(slots_.size())) {
+        }
 
-        explicit ConcurrentMap(size_t bucket_count)
-            : buckets_(bucket_count) {
+        // Прибавляет delta к значению по ключу, создавая ключ при первом обращении
+        void Add(const Key& key, Value delta) {
+            FindOrInsert(key).value.fetch_add(delta, std::memory_order_relaxed);
         }
 
+        // Помечает ключ удаленным: при обходе он пропускается, последующие Add его не возвращают
         void erase(const Key& key) {
-            auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-            std::lock_guard<std::mutex> guard{bucket.mutex};
-            bucket.map.erase(key);
+            FindOrInsert(key).erased.store(true, std::memory_order_relaxed);
         }
 
-        Access operator[](const Key& key) {
-            auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-            return {key, bucket};
+        // Обходит живые ключи без копирования. Вызывать после того, как все потоки закончили запись
+        template <typename Function>
+        void ForEach(Function function) const {
+            for (const Slot& slot : slots_) {
+                const Key key = slot.key.load(std::memory_order_acquire);
+                if (key != EMPTY_KEY && !slot.erased.load(std::memory_order_relaxed)) {
+                    function(key, slot.value.load(std::memory_order_relaxed));
+                }
+            }
         }
 
-        std::map<Key, Value> BuildOrdinaryMap() {
+        std::map<Key, Value> BuildOrdinaryMap() const {
             std::map<Key, Value> result;
-            for (auto& [mutex, map] : buckets_) {
-                std::lock_guard g(mutex);
-                result.insert(map.begin(), map.end());
-            }
+            ForEach([&result](const Key& key, Value value) {
+                result.emplace(key, value);
+            });
             return result;
         }
 
+        size_t capacity() const {
+            return slots_.size();
+        }
+
     private:
-        std::vector<Bucket> buckets_;
-    };
\ No newline at end of file
+        std::vector<Slot> slots_;
+        size_t mask_;
+        // номер ячейки - старшие биты произведения, 64 - log2(capacity)
+        unsigned shift_;
+
+        static size_t RoundUpCapacity(size_t expected_count) {
+            // не больше половины заполнения, чтобы цепочки проб оставались короткими
+            size_t capacity = 16;
+            while (capacity < expected_count * 2) {
+                capacity *= 2;
+            }
+            return capacity;
+        }
+
+        static unsigned Log2(size_t capacity) {
+            unsigned log = 0;
+            while ((size_t{1} << log) < capacity) {
+                ++log;
+            }
+            return log;
+        }
+
+        Slot& FindOrInsert(const Key& key) {
+            if (key == EMPTY_KEY) {
+                throw std::invalid_argument("Ключ зарезервирован под пустую ячейку");
+            }
+            // хеш Фибоначчи: младшие биты произведения зависят только от младших битов ключа, и ключи с общим
+            // шагом, кратным степени двойки, легли бы в одни ячейки. Старшие биты перемешаны со всем ключом
+            size_t index = static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> shift_);
+            for (size_t probe = 0; probe < slots_.size(); ++probe) {
+                Slot& slot = slots_[index];
+                Key current = slot.key.load(std::memory_order_acquire);
+                if (current == key) {
+                    return slot;
+                }
+                if (current == EMPTY_KEY) {
+                    if (slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel) || current == key) {
+                        return slot;
+                    }
+                }
+                index = (index + 1) & mask_;
+            }
+            throw std::length_error("ConcurrentMap переполнена");
+        }
+    };
@@ -0,0 +1,80 @@
+#include "corpus_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+ZipfDistribution::ZipfDistribution(size_t size, double exponent)
+    : cumulative_(size) {
+    double sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+        sum += 1.0 / std::pow(i + 1.0, exponent);
+        cumulative_[i] = sum;
+    }
+    for (double& value : cumulative_) {
+        value /= sum;
+    }
+}
+
+size_t ZipfDistribution::operator()(std::mt19937& generator) const {
+    const double point = std::uniform_real_distribution<>(0, 1)(generator);
+    const size_t rank = std::lower_bound(cumulative_.begin(), cumulative_.end(), point) - cumulative_.begin();
+    return std::min(rank, cumulative_.size() - 1);
+}
+
+std::vector<std::string> GenerateVocabulary(std::mt19937& generator, size_t word_count, int max_length) {
+    std::set<std::string> unique_words;
+    std::vector<std::string> words;
+    words.reserve(word_count);
+    while (words.size() < word_count) {
+        const int length = std::uniform_int_distribution(2, max_length)(generator);
+        std::string word;
+        word.reserve(length);
+        for (int i = 0; i < length; ++i) {
+            word.push_back(std::uniform_int_distribution('a', 'z')(generator));
+        }
+        if (unique_words.insert(word).second) {
+            words.push_back(std::move(word));
+        }
+    }
+    return words;
+}
+
+namespace {
+
+std::string GenerateText(std::mt19937& generator, const std::vector<std::string>& vocabulary, const ZipfDistribution& zipf, size_t word_count, double minus_word_probability) {
+    std::string text;
+    for (size_t i = 0; i < word_count; ++i) {
+        if (!text.empty()) {
+            text.push_back(' ');
+        }
+        if (minus_word_probability > 0 && std::uniform_real_distribution<>(0, 1)(generator) < minus_word_probability) {
+            text.push_back('-');
+        }
+        text += vocabulary[zipf(generator)];
+    }
+    return text;
+}
+
+} // namespace
+
+std::vector<std::string> GenerateCorpus(std::mt19937& generator, const std::vector<std::string>& vocabulary, const CorpusOptions& options) {
+    const ZipfDistribution zipf(vocabulary.size(), options.zipf_exponent);
+    std::vector<std::string> documents;
+    documents.reserve(options.document_count);
+    for (size_t i = 0; i < options.document_count; ++i) {
+        documents.push_back(GenerateText(generator, vocabulary, zipf, options.words_per_document, 0));
+    }
+    return documents;
+}
+
+std::vector<std::string> GenerateQueryLog(std::mt19937& generator, const std::vector<std::string>& vocabulary, const CorpusOptions& options) {
+    const ZipfDistribution zipf(vocabulary.size(), options.zipf_exponent);
+    std::vector<std::string> queries;
+    queries.reserve(options.query_count);
+    for (size_t i = 0; i < options.query_count; ++i) {
+        const size_t word_count = std::uniform_int_distribution<size_t>(1, std::max<size_t>(1, options.words_per_query))(generator);
+        queries.push_back(GenerateText(generator, vocabulary, zipf, word_count, options.minus_word_probability));
+    }
+    return queries;
+}
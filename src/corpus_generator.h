@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// Воспроизводимые синтетические корпуса для бенчмарков: частоты слов распределены по закону Ципфа,
+// как в реальных текстах, а не равномерно
+struct CorpusOptions {
+    size_t vocabulary_size = 20'000;
+    size_t document_count = 20'000;
+    size_t words_per_document = 60;
+    size_t query_count = 2'000;
+    size_t words_per_query = 6;
+    double minus_word_probability = 0.1;
+    double zipf_exponent = 1.0;
+    uint32_t seed = 42;
+};
+
+// Ранг 0 - самое частое слово. Вероятность ранга k пропорциональна 1 / (k + 1)^exponent
+class ZipfDistribution {
+public:
+    ZipfDistribution(size_t size, double exponent);
+
+    size_t operator()(std::mt19937& generator) const;
+
+private:
+    std::vector<double> cumulative_;
+};
+
+std::vector<std::string> GenerateVocabulary(std::mt19937& generator, size_t word_count, int max_length);
+
+std::vector<std::string> GenerateCorpus(std::mt19937& generator, const std::vector<std::string>& vocabulary, const CorpusOptions& options);
+
+std::vector<std::string> GenerateQueryLog(std::mt19937& generator, const std::vector<std::string>& vocabulary, const CorpusOptions& options);
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+
+// точность сравнения релевантностей
+#define SCOPE 1e-6
+
 enum class DocumentStatus { //перечислимый тип в котором описывается актуальность
     ACTUAL,
     IRRELEVANT,
@@ -7,6 +13,11 @@ enum class DocumentStatus { //перечислимый тип в котором
     REMOVED
 };
 
+enum class QueryMode { // способ объединения плюс-слов запроса
+    ANY, // документ должен содержать хотя бы одно плюс-слово
+    ALL  // документ должен содержать все плюс-слова
+};
+
 struct Document { // структура в которой хранятся результаты
 
     Document() = default;
@@ -17,4 +28,11 @@ struct Document { // структура в которой хранятся ре
     double relevance = 0;
     int rating = 0;
     DocumentStatus satus = DocumentStatus::IRRELEVANT;
-};
\ No newline at end of file
+};
+
+// Ступень релевантности в порядке выдачи: релевантности, округляющиеся до одной ступени SCOPE, равны,
+// и между такими документами выше тот, у кого больше рейтинг. Сравнение по ступеням, в отличие от
+// сравнения с допуском, транзитивно
+inline int64_t RelevanceKey(double relevance) {
+    return std::llround(relevance / SCOPE);
+}
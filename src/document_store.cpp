@@ -0,0 +1,381 @@
+#include "document_store.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binary_io.h"
+
+namespace {
+
+const uint32_t DOCUMENT_STORE_MAGIC = 0x434F4453; // "SDOC"
+const uint32_t DOCUMENT_STORE_VERSION = 1;
+
+[[noreturn]] void ThrowSystemError(const std::string& action, const std::string& path) {
+    throw std::runtime_error(action + " " + path + ": " + std::strerror(errno));
+}
+
+void CheckCodec(BlockCodec codec) {
+    if (!IsCodecAvailable(codec)) {
+        throw std::invalid_argument("Сервер собран без этого кодека сжатия");
+    }
+}
+
+// последний распакованный блок потока
+struct BlockCache {
+    uint64_t store = 0;
+    uint32_t block = 0;
+    std::string text;
+};
+
+} // namespace
+
+// Файл, отображенный в память только для чтения
+class DocumentStore::MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            ThrowSystemError("Не удалось открыть хранилище документов", path);
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+            ::close(fd);
+            ThrowSystemError("Не удалось открыть хранилище документов", path);
+        }
+        size_ = static_cast<size_t>(status.st_size);
+        if (size_ == 0) {
+            ::close(fd);
+            throw std::runtime_error("Хранилище документов пусто: " + path);
+        }
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            ThrowSystemError("Не удалось отобразить хранилище документов", path);
+        }
+        // документы читаются вразнобой, упреждающее чтение соседних страниц только тратило бы память
+        ::madvise(data, size_, MADV_RANDOM);
+        data_ = static_cast<const char*>(data);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    std::string_view Data() const {
+        return {data_, size_};
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+DocumentStore::DocumentStore(DocumentStoreOptions options)
+    : options_(options)
+    , instance_id_(NextInstanceId()) {
+    CheckCodec(options_.codec);
+    if (options_.block_bytes == 0) {
+        throw std::invalid_argument("Размер блока хранилища документов должен быть положительным");
+    }
+}
+
+// Перемещенное хранилище получает новый номер: иначе блоки, добавленные в него заново, совпали бы
+// в кеше потоков с блоками хранилища, куда ушли данные
+DocumentStore::DocumentStore(DocumentStore&& other) noexcept
+    : options_(other.options_)
+    , instance_id_(std::exchange(other.instance_id_, NextInstanceId()))
+    , dictionary_(std::move(other.dictionary_))
+    , locations_(std::move(other.locations_))
+    , blocks_(std::move(other.blocks_))
+    , owned_blocks_(std::move(other.owned_blocks_))
+    , mapped_(std::move(other.mapped_))
+    , pending_(std::move(other.pending_))
+    , raw_bytes_(std::exchange(other.raw_bytes_, 0))
+    , compressed_bytes_(std::exchange(other.compressed_bytes_, 0))
+    , owned_bytes_(std::exchange(other.owned_bytes_, 0))
+    , dead_bytes_(std::exchange(other.dead_bytes_, 0)) {
+}
+
+DocumentStore& DocumentStore::operator=(DocumentStore&& other) noexcept {
+    if (this != &other) {
+        options_ = other.options_;
+        instance_id_ = std::exchange(other.instance_id_, NextInstanceId());
+        dictionary_ = std::move(other.dictionary_);
+        locations_ = std::move(other.locations_);
+        blocks_ = std::move(other.blocks_);
+        owned_blocks_ = std::move(other.owned_blocks_);
+        mapped_ = std::move(other.mapped_);
+        pending_ = std::move(other.pending_);
+        raw_bytes_ = std::exchange(other.raw_bytes_, 0);
+        compressed_bytes_ = std::exchange(other.compressed_bytes_, 0);
+        owned_bytes_ = std::exchange(other.owned_bytes_, 0);
+        dead_bytes_ = std::exchange(other.dead_bytes_, 0);
+    }
+    return *this;
+}
+
+DocumentStore::~DocumentStore() = default;
+
+uint64_t DocumentStore::NextInstanceId() {
+    // с нуля не начинается, чтобы пустой кеш потока не совпал ни с одним хранилищем
+    static std::atomic<uint64_t> next_id{1};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Формат файла: заголовок с таблицами блоков и документов, CRC заголовка, затем сжатые блоки подряд.
+// Блоки контрольной суммой не защищены, чтобы чтение документа не проходило весь файл, но распаковка
+// проверяет границы и на поврежденных данных бросает исключение
+void DocumentStore::Save(const std::string& path) const {
+    std::string pending_block;
+    if (!pending_.empty()) {
+        pending_block = CompressBlock(options_.codec, pending_, dictionary_, options_.level);
+    }
+
+    std::string header;
+    BinaryWriter writer(header);
+    writer.Put(DOCUMENT_STORE_MAGIC);
+    writer.Put(DOCUMENT_STORE_VERSION);
+    writer.Put(static_cast<uint8_t>(options_.codec));
+    writer.Put(static_cast<uint64_t>(options_.block_bytes));
+    writer.Put(static_cast<int32_t>(options_.level));
+    writer.PutString(dictionary_);
+
+    writer.Put(static_cast<uint32_t>(blocks_.size() + (pending_.empty() ? 0 : 1)));
+    uint64_t offset = 0;
+    for (const Block& block : blocks_) {
+        writer.Put(offset);
+        writer.Put(static_cast<uint32_t>(block.data.size()));
+        writer.Put(block.raw_size);
+        offset += block.data.size();
+    }
+    if (!pending_.empty()) {
+        writer.Put(offset);
+        writer.Put(static_cast<uint32_t>(pending_block.size()));
+        writer.Put(static_cast<uint32_t>(pending_.size()));
+    }
+
+    writer.Put(static_cast<uint32_t>(locations_.size()));
+    for (const auto& [id, location] : locations_) {
+        writer.Put(static_cast<int32_t>(id));
+        writer.Put(location.block);
+        writer.Put(location.offset);
+        writer.Put(location.size);
+    }
+    writer.Put(Crc32(header));
+
+    std::string data = std::move(header);
+    for (const Block& block : blocks_) {
+        data.append(block.data);
+    }
+    data.append(pending_block);
+    WriteFileDurably(path, data);
+}
+
+DocumentStore DocumentStore::Open(const std::string& path) {
+    auto mapped = std::make_unique<MappedFile>(path);
+    const std::string_view file = mapped->Data();
+    const auto corrupted = [&path] {
+        return std::runtime_error("Хранилище документов повреждено: " + path);
+    };
+
+    BinaryReader reader(file);
+    if (reader.Get<uint32_t>() != DOCUMENT_STORE_MAGIC || reader.Get<uint32_t>() != DOCUMENT_STORE_VERSION) {
+        throw corrupted();
+    }
+    DocumentStoreOptions options;
+    options.codec = static_cast<BlockCodec>(reader.Get<uint8_t>());
+    options.block_bytes = reader.Get<uint64_t>();
+    options.level = reader.Get<int32_t>();
+    const std::string_view dictionary = reader.GetString();
+    options.dictionary_bytes = dictionary.size();
+    if (options.codec > BlockCodec::ZSTD || options.block_bytes == 0) {
+        throw corrupted();
+    }
+    // хранилище, сжатое zstd, не прочитать серверу, собранному без него
+    CheckCodec(options.codec);
+
+    struct BlockEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t raw_size;
+    };
+    // размеры таблиц сверяются с длиной файла до выделения памяти под них
+    const uint32_t block_count = reader.Get<uint32_t>();
+    if (block_count > reader.Remaining() / (sizeof(uint64_t) + 2 * sizeof(uint32_t))) {
+        throw corrupted();
+    }
+    std::vector<BlockEntry> entries(block_count);
+    for (BlockEntry& entry : entries) {
+        entry.offset = reader.Get<uint64_t>();
+        entry.size = reader.Get<uint32_t>();
+        entry.raw_size = reader.Get<uint32_t>();
+    }
+
+    DocumentStore store(options);
+    store.dictionary_ = dictionary;
+    const uint32_t document_count = reader.Get<uint32_t>();
+    if (document_count > reader.Remaining() / (4 * sizeof(uint32_t))) {
+        throw corrupted();
+    }
+    store.locations_.reserve(document_count);
+    size_t live_bytes = 0;
+    for (uint32_t i = 0; i < document_count; ++i) {
+        const int id = reader.Get<int32_t>();
+        Location location;
+        location.block = reader.Get<uint32_t>();
+        location.offset = reader.Get<uint32_t>();
+        location.size = reader.Get<uint32_t>();
+        if (location.block >= entries.size() || location.offset > entries[location.block].raw_size
+            || location.size > entries[location.block].raw_size - location.offset || !store.locations_.emplace(id, location).second) {
+            throw corrupted();
+        }
+        live_bytes += location.size;
+    }
+    const size_t header_size = file.size() - reader.Remaining();
+    if (reader.Get<uint32_t>() != Crc32(file.substr(0, header_size))) {
+        throw corrupted();
+    }
+
+    const std::string_view data = file.substr(header_size + sizeof(uint32_t));
+    store.blocks_.reserve(entries.size());
+    for (const BlockEntry& entry : entries) {
+        if (entry.offset > data.size() || entry.size > data.size() - entry.offset) {
+            throw corrupted();
+        }
+        store.blocks_.push_back({data.substr(entry.offset, entry.size), entry.raw_size});
+        store.raw_bytes_ += entry.raw_size;
+        store.compressed_bytes_ += entry.size;
+    }
+    // удаленные до сохранения документы остаются в блоках файла
+    store.dead_bytes_ = store.raw_bytes_ > live_bytes ? store.raw_bytes_ - live_bytes : 0;
+    store.mapped_ = std::move(mapped);
+    return store;
+}
+
+void DocumentStore::TrainDictionary(const std::vector<std::string_view>& samples) {
+    dictionary_ = ::TrainDictionary(options_.codec, samples, options_.dictionary_bytes);
+}
+
+bool DocumentStore::Append(int id, std::string_view text, uint32_t block) {
+    if (pending_.empty()) {
+        pending_.reserve(options_.block_bytes);
+    }
+    locations_[id] = {block, static_cast<uint32_t>(pending_.size()), static_cast<uint32_t>(text.size())};
+    pending_.append(text);
+    return pending_.size() >= options_.block_bytes;
+}
+
+void DocumentStore::PushBlock(std::string compressed, size_t raw_size) {
+    const std::string& owned = owned_blocks_.emplace_back(std::move(compressed));
+    blocks_.push_back({owned, static_cast<uint32_t>(raw_size)});
+    raw_bytes_ += raw_size;
+    compressed_bytes_ += owned.size();
+    owned_bytes_ += owned.size();
+}
+
+void DocumentStore::Add(int id, std::string_view text) {
+    if (Contains(id)) {
+        throw std::invalid_argument("Документ с таким id уже есть в хранилище");
+    }
+    if (Append(id, text, static_cast<uint32_t>(blocks_.size()))) {
+        Flush();
+    }
+}
+
+void DocumentStore::Flush() {
+    if (pending_.empty()) {
+        return;
+    }
+    if (NeedsDictionary()) {
+        // словарь учится на документах первого блока
+        std::vector<std::string_view> samples;
+        for (const auto& [id, location] : locations_) {
+            if (location.block == blocks_.size()) {
+                samples.push_back(std::string_view(pending_).substr(location.offset, location.size));
+            }
+        }
+        TrainDictionary(samples);
+    }
+    PushBlock(CompressBlock(options_.codec, pending_, dictionary_, options_.level), pending_.size());
+    pending_.clear();
+}
+
+bool DocumentStore::Remove(int id) {
+    const auto location = locations_.find(id);
+    if (location == locations_.end()) {
+        return false;
+    }
+    dead_bytes_ += location->second.size;
+    locations_.erase(location);
+    return true;
+}
+
+void DocumentStore::Compact() {
+    if (dead_bytes_ == 0) {
+        return;
+    }
+    // документы идут в порядке блоков, поэтому каждый блок распаковывается один раз
+    std::vector<std::pair<Location, int>> live;
+    live.reserve(locations_.size());
+    for (const auto& [id, location] : locations_) {
+        live.push_back({location, id});
+    }
+    std::sort(live.begin(), live.end(), [](const auto& lhs, const auto& rhs) {
+        return std::tie(lhs.first.block, lhs.first.offset) < std::tie(rhs.first.block, rhs.first.offset);
+    });
+    DocumentStore compacted(options_);
+    compacted.dictionary_ = dictionary_;
+    for (const auto& [location, id] : live) {
+        compacted.Add(id, BlockText(location.block).substr(location.offset, location.size));
+    }
+    *this = std::move(compacted);
+}
+
+std::string_view DocumentStore::BlockText(uint32_t block) const {
+    if (block == blocks_.size()) {
+        return pending_;
+    }
+    thread_local BlockCache cache;
+    if (cache.store != instance_id_ || cache.block != block) {
+        // если распаковка бросит, кеш остается пустым, а не с чужим блоком
+        cache.store = 0;
+        cache.text = DecompressBlock(options_.codec, blocks_[block].data, blocks_[block].raw_size, dictionary_);
+        cache.store = instance_id_;
+        cache.block = block;
+    }
+    return cache.text;
+}
+
+std::string DocumentStore::Get(int id) const {
+    const auto location = locations_.find(id);
+    if (location == locations_.end()) {
+        throw std::out_of_range("Документа нет в хранилище");
+    }
+    return std::string(BlockText(location->second.block).substr(location->second.offset, location->second.size));
+}
+
+bool DocumentStore::Matches(int id, std::string_view text) const {
+    const auto location = locations_.find(id);
+    if (location == locations_.end() || location->second.size != text.size()) {
+        return false;
+    }
+    return BlockText(location->second.block).substr(location->second.offset, location->second.size) == text;
+}
+
+size_t DocumentStore::MemoryBytes() const {
+    size_t bytes = owned_bytes_ + dictionary_.capacity() + pending_.capacity() + blocks_.capacity() * sizeof(Block);
+    // узел хеш-таблицы: ключ, значение и указатель на следующий, плюс корзина
+    bytes += locations_.size() * (sizeof(std::pair<const int, Location>) + sizeof(void*)) + locations_.bucket_count() * sizeof(void*);
+    return bytes;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <execution>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "block_codec.h"
+
+#define DOCUMENT_STORE_BLOCK_BYTES 32768
+// на образцах во столько раз больше словаря zstd обучается хорошо, больше брать нет смысла
+#define DOCUMENT_STORE_SAMPLE_FACTOR 100
+
+struct DocumentStoreOptions {
+    BlockCodec codec = BlockCodec::LZ;
+    // блок сжимается, когда в нем набирается столько байт текста: крупнее блок - лучше сжатие, но дороже
+    // чтение одного документа, который распаковывается вместе со всем блоком
+    size_t block_bytes = DOCUMENT_STORE_BLOCK_BYTES;
+    // размер словаря, обучаемого по первым документам; 0 - без словаря. Для LZ больше 64 КиБ не бывает
+    size_t dictionary_bytes = 0;
+    // уровень сжатия ZSTD, 0 - по умолчанию
+    int level = 0;
+};
+
+// Хранилище исходных текстов документов, сжатых блоками. Документы копятся в открытом блоке, заполненный блок
+// сжимается целиком, так повторы между соседними документами тоже сжимаются. Чтение по id распаковывает
+// один блок; последний распакованный блок запоминается в потоке, поэтому чтение подряд идущих документов
+// не распаковывает блок заново. Чтение из нескольких потоков безопасно, пока хранилище не меняется
+class DocumentStore {
+public:
+    explicit DocumentStore(DocumentStoreOptions options = DocumentStoreOptions());
+    DocumentStore(DocumentStore&& other) noexcept;
+    DocumentStore& operator=(DocumentStore&& other) noexcept;
+    ~DocumentStore();
+
+    // Отображает файл, записанный Save, в память: блоки читаются прямо из отображения и подгружаются с диска
+    // по мере чтения документов. Новые документы можно добавлять, файл при этом не меняется.
+    // Бросает std::runtime_error, если файла нет или он поврежден
+    static DocumentStore Open(const std::string& path);
+    // Пишет хранилище вместе с открытым блоком, атомарно заменяя файл path
+    void Save(const std::string& path) const;
+
+    // Бросает std::invalid_argument, если документ с таким id уже есть
+    void Add(int id, std::string_view text);
+    // Тексты раскладываются по блокам последовательно, а заполненные блоки сжимаются параллельно policy.
+    // Бросает std::invalid_argument, если id повторяется, ничего не добавляя
+    template <typename ExecutionPolicy>
+    void AddBatch(ExecutionPolicy&& policy, const std::vector<std::pair<int, std::string>>& documents);
+    // Сжимает открытый блок, даже если он не заполнен
+    void Flush();
+    // Возвращает false, если документа нет. Место в блоке не освобождается до Compact
+    bool Remove(int id);
+    // Переписывает хранилище только из текстов оставшихся документов, в прежнем порядке, и освобождает
+    // место удаленных. Распаковывает и сжимает заново все блоки; отображенный файл больше не используется
+    void Compact();
+
+    // Бросает std::out_of_range, если документа нет, и std::runtime_error, если блок поврежден
+    std::string Get(int id) const;
+    bool Contains(int id) const {
+        return locations_.count(id) != 0;
+    }
+    // Лежит ли у id ровно такой текст. Длины сравниваются без распаковки, блок распаковывается только
+    // при совпадении длины, и текст сравнивается прямо в нем, без копии
+    bool Matches(int id, std::string_view text) const;
+    size_t Size() const {
+        return locations_.size();
+    }
+
+    const DocumentStoreOptions& Options() const {
+        return options_;
+    }
+    const std::string& Dictionary() const {
+        return dictionary_;
+    }
+    size_t BlockCount() const {
+        return blocks_.size();
+    }
+    // исходный и сжатый размер сжатых блоков, без открытого
+    size_t RawBytes() const {
+        return raw_bytes_;
+    }
+    size_t CompressedBytes() const {
+        return compressed_bytes_;
+    }
+    // исходный размер текстов удаленных документов, которые еще занимают место в блоках, включая открытый
+    size_t DeadBytes() const {
+        return dead_bytes_;
+    }
+    // память в куче: сжатые блоки, открытый блок, словарь и таблица документов. Отображенный файл
+    // не считается, его страницами распоряжается ядро
+    size_t MemoryBytes() const;
+
+private:
+    struct Location {
+        uint32_t block = 0;
+        uint32_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    struct Block {
+        std::string_view data;
+        uint32_t raw_size = 0;
+    };
+
+    class MappedFile;
+
+    DocumentStoreOptions options_;
+    uint64_t instance_id_;
+    std::string dictionary_;
+    std::unordered_map<int, Location> locations_;
+    // сжатые данные - в owned_blocks_ или в отображенном файле; deque не двигает строки при росте
+    std::vector<Block> blocks_;
+    std::deque<std::string> owned_blocks_;
+    std::unique_ptr<MappedFile> mapped_;
+    // открытый блок, его номер - blocks_.size()
+    std::string pending_;
+    size_t raw_bytes_ = 0;
+    size_t compressed_bytes_ = 0;
+    // сжатые блоки в куче, без отображенных
+    size_t owned_bytes_ = 0;
+    size_t dead_bytes_ = 0;
+
+    static uint64_t NextInstanceId();
+
+    // Словарь обучается один раз, до первого сжатого блока
+    bool NeedsDictionary() const {
+        return options_.dictionary_bytes > 0 && blocks_.empty() && dictionary_.empty();
+    }
+    void TrainDictionary(const std::vector<std::string_view>& samples);
+    // Дописывает текст в открытый блок с номером block; возвращает true, если блок заполнен
+    bool Append(int id, std::string_view text, uint32_t block);
+    void PushBlock(std::string compressed, size_t raw_size);
+    // Текст блока: из открытого блока, из запомненного потоком или распакованный заново
+    std::string_view BlockText(uint32_t block) const;
+};
+
+template <typename ExecutionPolicy>
+void DocumentStore::AddBatch(ExecutionPolicy&& policy, const std::vector<std::pair<int, std::string>>& documents) {
+    // исключение внутри параллельного алгоритма завершает программу, поэтому все проверки - до сжатия
+    std::unordered_set<int> ids;
+    for (const auto& [id, text] : documents) {
+        if (Contains(id) || !ids.insert(id).second) {
+            throw std::invalid_argument("Документ с таким id уже есть в хранилище");
+        }
+    }
+    if (NeedsDictionary()) {
+        std::vector<std::string_view> samples;
+        size_t sampled = 0;
+        for (const auto& [id, text] : documents) {
+            if (sampled >= options_.dictionary_bytes * DOCUMENT_STORE_SAMPLE_FACTOR) {
+                break;
+            }
+            samples.push_back(text);
+            sampled += text.size();
+        }
+        TrainDictionary(samples);
+    }
+
+    std::vector<std::string> full_blocks;
+    for (const auto& [id, text] : documents) {
+        // заполненные блоки еще не сжаты, но номера за ними уже закреплены
+        if (Append(id, text, static_cast<uint32_t>(blocks_.size() + full_blocks.size()))) {
+            full_blocks.push_back(std::move(pending_));
+            pending_.clear();
+        }
+    }
+
+    std::vector<std::string> compressed(full_blocks.size());
+    std::transform(policy, full_blocks.begin(), full_blocks.end(), compressed.begin(), [this](const std::string& block) {
+        return CompressBlock(options_.codec, block, dictionary_, options_.level);
+    });
+    for (size_t i = 0; i < full_blocks.size(); ++i) {
+        PushBlock(std::move(compressed[i]), full_blocks[i].size());
+    }
+}
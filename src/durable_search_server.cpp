@@ -0,0 +1,141 @@
+#include "durable_search_server.h"
+
+#include <filesystem>
+
+#include "snapshot.h"
+
+std::string DurableSearchServer::SnapshotPath() const {
+    return (std::filesystem::path(directory_) / "snapshot.bin").string();
+}
+
+std::string DurableSearchServer::LogPath() const {
+    return (std::filesystem::path(directory_) / "wal.log").string();
+}
+
+void DurableSearchServer::Recover() {
+    std::filesystem::create_directories(directory_);
+    const uint64_t snapshot_lsn = LoadSnapshot(SnapshotPath(), server_).value_or(0);
+    // журнал мог пережить контрольную точку, если сбой случился между записью снимка и очисткой журнала:
+    // записи, которые уже есть в снимке, пропускаются
+    log_ = std::make_unique<WriteAheadLog>(LogPath(), [this, snapshot_lsn](const WalRecord& record) {
+        if (record.lsn <= snapshot_lsn) {
+            return;
+        }
+        ++records_since_checkpoint_;
+        try {
+            Apply(record);
+        } catch (const std::invalid_argument&) {
+            // мутация была отклонена и при выполнении, индекс она не меняла
+        } catch (const std::out_of_range&) {
+        }
+    });
+    log_->AdvanceLsn(snapshot_lsn);
+}
+
+void DurableSearchServer::Apply(const WalRecord& record) {
+    switch (record.type) {
+    case WalRecordType::ADD_DOCUMENT:
+        server_.AddDocument(record.document_id, record.text, record.status, record.ratings);
+        break;
+    case WalRecordType::REMOVE_DOCUMENT:
+        server_.RemoveDocument(record.document_id);
+        break;
+    case WalRecordType::UPDATE_DOCUMENT:
+        server_.UpdateDocument(record.document_id, record.text, record.status, record.ratings);
+        break;
+    case WalRecordType::SET_STATUS:
+        server_.SetDocumentStatus(record.document_id, record.status);
+        break;
+    case WalRecordType::SET_RATING:
+        server_.SetRating(record.document_id, record.ratings.at(0));
+        break;
+    }
+}
+
+void DurableSearchServer::AddDocument(int document_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings) {
+    std::unique_lock lock(mutation_mutex_);
+    WalRecord record;
+    record.type = WalRecordType::ADD_DOCUMENT;
+    record.document_id = document_id;
+    record.status = status;
+    record.ratings = ratings;
+    record.text = document;
+    Mutate(record, lock);
+}
+
+void DurableSearchServer::RemoveDocument(int document_id) {
+    std::unique_lock lock(mutation_mutex_);
+    // удаление отсутствующего документа ничего не делает, и при проигрывании журнала тоже
+    WalRecord record;
+    record.type = WalRecordType::REMOVE_DOCUMENT;
+    record.document_id = document_id;
+    Mutate(record, lock);
+}
+
+void DurableSearchServer::UpdateDocument(int document_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings) {
+    std::unique_lock lock(mutation_mutex_);
+    WalRecord record;
+    record.type = WalRecordType::UPDATE_DOCUMENT;
+    record.document_id = document_id;
+    record.status = status;
+    record.ratings = ratings;
+    record.text = document;
+    Mutate(record, lock);
+}
+
+void DurableSearchServer::SetDocumentStatus(int document_id, DocumentStatus status) {
+    std::unique_lock lock(mutation_mutex_);
+    WalRecord record;
+    record.type = WalRecordType::SET_STATUS;
+    record.document_id = document_id;
+    record.status = status;
+    Mutate(record, lock);
+}
+
+void DurableSearchServer::SetRating(int document_id, int rating) {
+    std::unique_lock lock(mutation_mutex_);
+    WalRecord record;
+    record.type = WalRecordType::SET_RATING;
+    record.document_id = document_id;
+    record.ratings = {rating};
+    Mutate(record, lock);
+}
+
+void DurableSearchServer::Mutate(const WalRecord& record, std::unique_lock<std::mutex>& lock) {
+    const uint64_t lsn = log_->Append(record);
+    ++records_since_checkpoint_;
+    Apply(record);
+    if (records_since_checkpoint_ >= options_.checkpoint_records) {
+        CheckpointLocked();
+        return;
+    }
+    if (options_.sync_every_write) {
+        // ожидание без mutation_mutex_: пока лидер группы пишет журнал, другие потоки добавляют в него записи
+        lock.unlock();
+        log_->WaitDurable(lsn);
+        return;
+    }
+    if (++records_since_sync_ >= options_.group_commit_records) {
+        records_since_sync_ = 0;
+        lock.unlock();
+        log_->WaitDurable(lsn);
+    }
+}
+
+void DurableSearchServer::Sync() {
+    log_->Sync();
+}
+
+void DurableSearchServer::Checkpoint() {
+    std::lock_guard lock(mutation_mutex_);
+    CheckpointLocked();
+}
+
+void DurableSearchServer::CheckpointLocked() {
+    // журнал сначала сохраняется целиком: если снимок записать не удастся, данные останутся в журнале
+    log_->Sync();
+    SaveSnapshot(server_, log_->LastLsn(), SnapshotPath());
+    log_->Truncate();
+    records_since_checkpoint_ = 0;
+    records_since_sync_ = 0;
+}
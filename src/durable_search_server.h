@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "search_server.h"
+#include "wal.h"
+
+struct DurabilityOptions {
+    // true - каждая мутация возвращается, только когда ее запись журнала на диске. Одновременные мутации
+    // разных потоков делят один fsync. false - журнал синхронизируется пачками по group_commit_records записей
+    // и в Sync(), при сбое теряется не больше одной пачки
+    bool sync_every_write = false;
+    size_t group_commit_records = 256;
+    // после стольких записей журнала делается контрольная точка: снимок индекса и очистка журнала
+    size_t checkpoint_records = 100'000;
+};
+
+// Поисковый сервер, переживающий перезапуск: каждая мутация сначала пишется в журнал упреждающей записи,
+// затем применяется к индексу в памяти, поэтому мутация, которую журнал не принял, индекс не меняет.
+// Некорректную мутацию индекс отклоняет уже после записи в журнал, ничего не изменив; при проигрывании
+// журнала она отклоняется так же и пропускается. Если журнал не удалось записать на диск, мутация уже
+// в индексе и в буфере журнала: исключение значит, что она еще не сохранена, следующий Sync допишет ее.
+// При создании сервер загружает последний снимок из directory и проигрывает поверх него журнал.
+// Мутации можно вызывать из нескольких потоков, но поиск по GetServer() одновременно с ними не допускается,
+// как и у SearchServer
+class DurableSearchServer {
+public:
+    template <typename StopWords>
+    DurableSearchServer(const std::string& directory, const StopWords& stop_words, TextAnalyzer analyzer = TextAnalyzer(), DurabilityOptions options = DurabilityOptions());
+
+    void AddDocument(int document_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings);
+    void RemoveDocument(int document_id);
+    void UpdateDocument(int document_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings);
+    void SetDocumentStatus(int document_id, DocumentStatus status);
+    void SetRating(int document_id, int rating);
+
+    // Возвращает, когда все уже выполненные мутации лежат на диске
+    void Sync();
+
+    // Пишет снимок индекса и очищает журнал, чтобы следующий запуск не проигрывал его целиком
+    void Checkpoint();
+
+    const SearchServer& GetServer() const {
+        return server_;
+    }
+
+    const WriteAheadLog& GetLog() const {
+        return *log_;
+    }
+
+private:
+    std::string directory_;
+    SearchServer server_;
+    DurabilityOptions options_;
+    std::unique_ptr<WriteAheadLog> log_;
+    std::mutex mutation_mutex_;
+    size_t records_since_checkpoint_ = 0;
+    size_t records_since_sync_ = 0;
+
+    std::string SnapshotPath() const;
+    std::string LogPath() const;
+
+    void Recover();
+    void Apply(const WalRecord& record);
+    // Под mutation_mutex_ пишет запись в журнал и применяет ее к индексу, затем дожидается сохранения
+    // по правилам options_
+    void Mutate(const WalRecord& record, std::unique_lock<std::mutex>& lock);
+    void CheckpointLocked();
+};
+
+template <typename StopWords>
+DurableSearchServer::DurableSearchServer(const std::string& directory, const StopWords& stop_words, TextAnalyzer analyzer, DurabilityOptions options)
+    : directory_(directory)
+    , server_(stop_words, analyzer)
+    , options_(options) {
+    Recover();
+}
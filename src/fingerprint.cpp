@@ -0,0 +1,33 @@
+#include "fingerprint.h"
+
+namespace {
+
+uint64_t Mix(uint64_t value) { // финализатор splitmix64
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return value;
+}
+
+uint64_t HashWord(std::string_view word, uint64_t seed) { // FNV-1a со своей затравкой для каждой половины отпечатка
+    uint64_t hash = 0xCBF29CE484222325ull ^ seed;
+    for (const char c : word) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001B3ull;
+    }
+    return Mix(hash ^ word.size());
+}
+
+} // namespace
+
+DocumentFingerprint ComputeFingerprint(const std::pmr::map<std::string_view, double>& word_frequencies) {
+    DocumentFingerprint fingerprint{0x243F6A8885A308D3ull, 0x13198A2E03707344ull};
+    for (const auto& [word, frequency] : word_frequencies) {
+        fingerprint.high = Mix(fingerprint.high ^ HashWord(word, 0x452821E638D01377ull));
+        fingerprint.low = Mix(fingerprint.low + HashWord(word, 0xBE5466CF34E90C6Cull));
+    }
+    fingerprint.high ^= word_frequencies.size();
+    return fingerprint;
+}
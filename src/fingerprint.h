@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <string_view>
+
+// 128-битный отпечаток множества слов документа. Два документа с одинаковым набором слов
+// (без учета частот) получают одинаковый отпечаток
+struct DocumentFingerprint {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    bool operator==(const DocumentFingerprint& other) const {
+        return high == other.high && low == other.low;
+    }
+    bool operator!=(const DocumentFingerprint& other) const {
+        return !(*this == other);
+    }
+};
+
+struct DocumentFingerprintHasher {
+    size_t operator()(const DocumentFingerprint& fingerprint) const {
+        return static_cast<size_t>(fingerprint.high ^ (fingerprint.low * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+// Слова в map уже упорядочены, поэтому отпечаток не зависит от порядка слов в тексте
+DocumentFingerprint ComputeFingerprint(const std::pmr::map<std::string_view, double>& word_frequencies);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define INDEX_STATS_TOP_TERMS 10
+
+// Память, занятая структурами сервера, в байтах. Для индексов - выделенное через считающие ресурсы
+// и еще не освобожденное (без накладных расходов самого malloc), для копий постингов и графа векторов -
+// их собственный учет
+struct MemoryUsage {
+    // словарь обратного индекса и постинги
+    size_t inverted_index = 0;
+    // частоты слов каждого документа
+    size_t forward_index = 0;
+    // тексты слов словаря
+    size_t vocabulary = 0;
+    // статус, рейтинг и отпечаток документов, список их id
+    size_t metadata = 0;
+    size_t impact_postings = 0;
+    size_t vector_index = 0;
+    // сжатые тексты документов в куче, без отображенного файла хранилища
+    size_t document_store = 0;
+
+    size_t Total() const {
+        return inverted_index + forward_index + vocabulary + metadata + impact_postings + vector_index + document_store;
+    }
+};
+
+struct IndexStats {
+    MemoryUsage memory;
+    size_t document_count = 0;
+    // слова, у которых есть хотя бы один документ
+    size_t vocabulary_size = 0;
+    // сумма длин постингов, то есть пар слово-документ
+    size_t posting_entries = 0;
+    // posting_length_histogram[i] - число слов, встречающихся в [2^i, 2^(i+1)) документах
+    std::vector<size_t> posting_length_histogram;
+    // слова с самыми длинными постингами и длины постингов, по убыванию длины
+    std::vector<std::pair<std::string, size_t>> heaviest_terms;
+    // Мусор после удалений и обновлений: слова, у которых не осталось документов, остаются в словаре
+    // с пустыми постингами, garbage_bytes - оценка памяти под них. Векторы удаленных документов
+    // остаются в графе транзитными узлами. Тексты удаленных и замененных документов остаются в блоках
+    // хранилища, document_store_dead_bytes - их исходный размер до сжатия
+    size_t empty_postings = 0;
+    size_t garbage_bytes = 0;
+    size_t deleted_vectors = 0;
+    size_t document_store_dead_bytes = 0;
+};
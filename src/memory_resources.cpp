@@ -0,0 +1,50 @@
+#include "memory_resources.h"
+
+#include <algorithm>
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    void* pointer = upstream_->allocate(bytes, alignment);
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    bytes_allocated_.fetch_add(bytes, std::memory_order_relaxed);
+    bytes_in_use_.fetch_add(bytes, std::memory_order_relaxed);
+    return pointer;
+}
+
+void CountingResource::do_deallocate(void* pointer, size_t bytes, size_t alignment) {
+    upstream_->deallocate(pointer, bytes, alignment);
+    deallocations_.fetch_add(1, std::memory_order_relaxed);
+    bytes_in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void* QueryArena::Upstream::do_allocate(size_t size, size_t alignment) {
+    bytes += size;
+    return target->allocate(size, alignment);
+}
+
+void QueryArena::Upstream::do_deallocate(void* pointer, size_t size, size_t alignment) {
+    target->deallocate(pointer, size, alignment);
+}
+
+QueryArena::QueryArena(size_t initial_bytes, size_t max_bytes)
+    : buffer_(initial_bytes)
+    , max_bytes_(std::max(initial_bytes, max_bytes)) {
+    arena_.emplace(buffer_.data(), buffer_.size(), &upstream_);
+}
+
+void QueryArena::Begin(std::pmr::memory_resource* upstream) {
+    upstream_.target = upstream;
+}
+
+void QueryArena::Reset() {
+    arena_->release();
+    if (upstream_.bytes == 0 || buffer_.size() == max_bytes_) {
+        upstream_.bytes = 0;
+        return;
+    }
+    // буфер растет на все, что запрос взял у upstream: тот же запрос в следующий раз уместится целиком
+    const size_t size = std::min(max_bytes_, buffer_.size() + upstream_.bytes);
+    upstream_.bytes = 0;
+    arena_.reset();
+    buffer_.assign(size, std::byte{});
+    arena_.emplace(buffer_.data(), buffer_.size(), &upstream_);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+// Откуда сервер берет память. Ресурсы принадлежат вызывающему и должны жить дольше сервера
+struct MemoryResources {
+    // словарь и постинги индекса, например пул для узлов деревьев постингов. Параллельный RemoveDocument
+    // освобождает узлы из нескольких потоков, для него ресурс должен быть потокобезопасным
+    std::pmr::memory_resource* index = std::pmr::get_default_resource();
+    // откуда арена запроса берет память, когда запрос не уместился в ее буфер
+    std::pmr::memory_resource* query = std::pmr::get_default_resource();
+};
+
+// Ресурс-обертка, считающий выделения и освобождения памяти у upstream. Счетчики атомарные,
+// потокобезопасность самих выделений та же, что у upstream
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream_(upstream) {
+    }
+
+    uint64_t AllocationCount() const {
+        return allocations_.load(std::memory_order_relaxed);
+    }
+    uint64_t DeallocationCount() const {
+        return deallocations_.load(std::memory_order_relaxed);
+    }
+    uint64_t BytesAllocated() const {
+        return bytes_allocated_.load(std::memory_order_relaxed);
+    }
+    // выделено и еще не освобождено
+    uint64_t BytesInUse() const {
+        return bytes_in_use_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::pmr::memory_resource* upstream_;
+    std::atomic<uint64_t> allocations_ = 0;
+    std::atomic<uint64_t> deallocations_ = 0;
+    std::atomic<uint64_t> bytes_allocated_ = 0;
+    std::atomic<uint64_t> bytes_in_use_ = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Арена одного запроса: monotonic_buffer_resource поверх собственного буфера, вся память запроса
+// освобождается разом в Reset. Если запрос не уместился в буфер, недостающее берется у upstream,
+// а после запроса буфер вырастает до его размера (не больше max_bytes), так что в установившемся
+// режиме поток обслуживает запросы вовсе без обращений к upstream. Не потокобезопасна
+class QueryArena {
+public:
+    QueryArena(size_t initial_bytes, size_t max_bytes);
+    QueryArena(const QueryArena&) = delete;
+    QueryArena& operator=(const QueryArena&) = delete;
+
+    // Начинает запрос, память сверх буфера будет браться у upstream
+    void Begin(std::pmr::memory_resource* upstream);
+    // Освобождает всю память запроса
+    void Reset();
+
+    std::pmr::memory_resource* Resource() {
+        return &*arena_;
+    }
+    size_t BufferSize() const {
+        return buffer_.size();
+    }
+
+private:
+    // передает выделения ресурсу текущего запроса и считает, сколько памяти не хватило в буфере
+    class Upstream : public std::pmr::memory_resource {
+    public:
+        std::pmr::memory_resource* target = std::pmr::get_default_resource();
+        size_t bytes = 0;
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    std::vector<std::byte> buffer_;
+    size_t max_bytes_;
+    Upstream upstream_;
+    std::optional<std::pmr::monotonic_buffer_resource> arena_;
+};
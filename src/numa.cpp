@@ -0,0 +1,293 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "search_server.h"
+#include "snapshot.h"
+#include "string_processing.h"
+
+namespace {
+
+int ParseCpu(std::string_view text) {
+    int cpu = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), cpu);
+    if (error != std::errc() || end != text.data() + text.size() || cpu < 0) {
+        throw std::invalid_argument("Некорректный список процессоров");
+    }
+    return cpu;
+}
+
+// процессоры, на которых процессу разрешено работать
+std::vector<int> AllowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+#endif
+    cpus.resize(std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t cpu = 0; cpu < cpus.size(); ++cpu) {
+        cpus[cpu] = static_cast<int>(cpu);
+    }
+    return cpus;
+}
+
+} // namespace
+
+std::vector<int> ParseCpuList(std::string_view text) {
+    std::vector<int> cpus;
+    while (!text.empty() && (text.back() == '\n' || text.back() == ' ')) {
+        text.remove_suffix(1);
+    }
+    size_t begin = 0;
+    while (begin < text.size()) {
+        const size_t end = std::min(text.find(',', begin), text.size());
+        const std::string_view range = text.substr(begin, end - begin);
+        const size_t dash = range.find('-');
+        const int first = ParseCpu(range.substr(0, dash));
+        const int last = dash == std::string_view::npos ? first : ParseCpu(range.substr(dash + 1));
+        if (last < first) {
+            throw std::invalid_argument("Некорректный список процессоров");
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        begin = end + 1;
+    }
+    return cpus;
+}
+
+std::vector<NumaNode> DetectNumaTopology() {
+    const std::vector<int> allowed = AllowedCpus();
+    std::vector<NumaNode> nodes;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), [](char c) {
+                return c >= '0' && c <= '9';
+            })) {
+            continue;
+        }
+        std::ifstream input(entry.path() / "cpulist");
+        std::stringstream cpulist;
+        cpulist << input.rdbuf();
+        NumaNode node;
+        node.id = std::stoi(name.substr(4));
+        try {
+            node.cpus = ParseCpuList(cpulist.str());
+        } catch (const std::invalid_argument&) {
+            continue;
+        }
+        // узлы только с памятью и узлы, чьи процессоры процессу недоступны, не нужны
+        std::erase_if(node.cpus, [&allowed](int cpu) {
+            return !std::binary_search(allowed.begin(), allowed.end(), cpu);
+        });
+        if (!node.cpus.empty()) {
+            nodes.push_back(std::move(node));
+        }
+    }
+    if (nodes.empty()) {
+        nodes.push_back({0, allowed});
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& lhs, const NumaNode& rhs) {
+        return lhs.id < rhs.id;
+    });
+    return nodes;
+}
+
+bool PinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+void NumaReplicas::CopyImpactPostings(const SearchServer& source, SearchServer& replica) {
+    // ключи копий - слова словаря source, у реплики они свои
+    ImpactPostings& impact_postings = replica.impact_postings_;
+    impact_postings.owner = replica.instance_id_;
+    impact_postings.revision = replica.postings_revision_;
+    for (const auto& [word, postings] : source.impact_postings_.by_word) {
+        const auto local_word = replica.content_.find(word);
+        if (local_word == replica.content_.end()) {
+            continue;
+        }
+        const auto& copy = impact_postings.by_word.emplace(*local_word, postings).first->second;
+        impact_postings.bytes += copy.capacity() * sizeof(copy[0]);
+    }
+}
+
+NumaReplicas::NumaReplicas(const SearchServer& source, std::vector<NumaNode> topology)
+    : source_(source)
+    , nodes_(std::move(topology)) {
+    if (nodes_.empty()) {
+        throw std::invalid_argument("Топология NUMA не содержит узлов");
+    }
+    StartWorkers();
+    if (nodes_.size() == 1) {
+        return;
+    }
+
+    try {
+        std::ostringstream snapshot;
+        WriteSnapshot(source, 0, snapshot);
+        const std::string data = snapshot.str();
+
+        replicas_.resize(nodes_.size());
+        // реплику узла строит его первый рабочий поток, уже привязанный к процессорам узла
+        RunOnWorkers(0, nodes_.size(), [this, &data](size_t node, size_t worker) {
+            if (worker != 0) {
+                return;
+            }
+            auto replica = std::make_unique<SearchServer>(std::string(), source_.analyzer_);
+            replica->stop_words_ = source_.stop_words_;
+            std::istringstream input(data);
+            ReadSnapshot(input, *replica);
+            // снимок хранит только индекс, остальное для поиска копируется напрямую, тоже в памяти узла
+            if (source_.vectors_) {
+                replica->vectors_ = std::make_unique<HnswIndex>(*source_.vectors_);
+            }
+            CopyImpactPostings(source_, *replica);
+            replica->UpdateMemoryCounters();
+            replicas_[node] = std::move(replica);
+        });
+    } catch (...) {
+        // деструктор не вызовется, потоки нужно остановить здесь
+        StopWorkers();
+        throw;
+    }
+}
+
+NumaReplicas::~NumaReplicas() {
+    StopWorkers();
+}
+
+void NumaReplicas::StartWorkers() {
+    try {
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            for (size_t index = 0; index < nodes_[node].cpus.size(); ++index) {
+                // запись в вектор резервируется до запуска потока, чтобы запущенный поток не потерялся
+                workers_.push_back({node, index, std::thread()});
+                workers_.back().thread = std::thread(&NumaReplicas::WorkerLoop, this, node, index);
+            }
+        }
+    } catch (...) {
+        // уже запущенные потоки нельзя уничтожать без join
+        StopWorkers();
+        throw;
+    }
+}
+
+void NumaReplicas::StopWorkers() {
+    {
+        std::lock_guard lock(pool_mutex_);
+        stopping_ = true;
+    }
+    batch_ready_.notify_all();
+    for (Worker& worker : workers_) {
+        if (worker.thread.joinable()) {
+            worker.thread.join();
+        }
+    }
+    workers_.clear();
+}
+
+void NumaReplicas::WorkerLoop(size_t node, size_t index) const {
+    // на одном узле привязка ничего не дает, потоки остаются на усмотрение планировщика
+    if (nodes_.size() > 1) {
+        PinCurrentThread(nodes_[node].cpus);
+    }
+    uint64_t seen = 0;
+    std::unique_lock lock(pool_mutex_);
+    while (true) {
+        batch_ready_.wait(lock, [this, &seen] {
+            return stopping_ || generation_ != seen;
+        });
+        if (stopping_) {
+            return;
+        }
+        seen = generation_;
+        if (node < task_first_node_ || node >= task_last_node_) {
+            continue;
+        }
+        const WorkerTask& task = *task_;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            task(node, index);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !task_error_) {
+            task_error_ = std::move(error);
+        }
+        if (--running_ == 0) {
+            batch_done_.notify_all();
+        }
+    }
+}
+
+void NumaReplicas::RunOnWorkers(size_t first_node, size_t last_node, const WorkerTask& task) const {
+    if (first_node > last_node || last_node > nodes_.size()) {
+        throw std::out_of_range("Нет узла NUMA с таким номером");
+    }
+    std::lock_guard batch_lock(batch_mutex_);
+    std::unique_lock lock(pool_mutex_);
+    running_ = 0;
+    for (const Worker& worker : workers_) {
+        running_ += worker.node >= first_node && worker.node < last_node;
+    }
+    if (running_ == 0) {
+        return;
+    }
+    task_ = &task;
+    task_first_node_ = first_node;
+    task_last_node_ = last_node;
+    task_error_ = nullptr;
+    ++generation_;
+    batch_ready_.notify_all();
+    batch_done_.wait(lock, [this] {
+        return running_ == 0;
+    });
+    task_ = nullptr;
+    if (task_error_) {
+        std::rethrow_exception(std::exchange(task_error_, nullptr));
+    }
+}
+
+const SearchServer& NumaReplicas::Replica(size_t index) const {
+    if (index >= nodes_.size()) {
+        throw std::out_of_range("Нет узла NUMA с таким номером");
+    }
+    return replicas_.empty() ? source_ : *replicas_[index];
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class SearchServer;
+
+// Узел NUMA: сокет со своей памятью и процессоры, которым она локальна
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+// Разбирает список процессоров в формате sysfs ("0-3,8,10-11"). Бросает std::invalid_argument на мусоре
+std::vector<int> ParseCpuList(std::string_view text);
+
+// Узлы NUMA, на процессорах которых процессу разрешено работать. Без sysfs (не Linux, урезанный контейнер)
+// возвращает один узел со всеми доступными процессорами
+std::vector<NumaNode> DetectNumaTopology();
+
+// Привязывает текущий поток к процессорам cpus. Возвращает false, если система этого не умеет или отказала
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+// Копии индекса по одной на каждый узел NUMA. Каждую строит поток, привязанный к своему узлу, поэтому
+// по правилу первого касания ее память оказывается локальной для процессоров узла. На машине с одним
+// узлом копий нет, запросы идут в исходный сервер.
+// Реплики - снимок source на момент создания: после изменения source их нужно построить заново.
+// В реплику копируются индекс, векторы документов и упорядоченные по вкладу копии постингов, то есть все,
+// что нужно поиску. Хранилище текстов остается только у source: GetDocumentText у реплики бросает
+// std::out_of_range, тексты нужно брать из source.
+// Реплики берут память из ресурса по умолчанию, ресурсы памяти source к ним не переносятся.
+// Вместе с репликами живут рабочие потоки, по одному на процессор узла и привязанные к нему: они строят
+// реплики и обрабатывают все последующие пакеты запросов, так что потоковые кеши разбора не остывают
+class NumaReplicas {
+public:
+    explicit NumaReplicas(const SearchServer& source, std::vector<NumaNode> topology = DetectNumaTopology());
+    ~NumaReplicas();
+
+    size_t NodeCount() const {
+        return nodes_.size();
+    }
+    const NumaNode& Node(size_t index) const {
+        return nodes_.at(index);
+    }
+    bool IsReplicated() const {
+        return !replicas_.empty();
+    }
+    // Сервер, который должны опрашивать потоки узла index
+    const SearchServer& Replica(size_t index) const;
+
+    // Вызывает task(node, worker) в каждом рабочем потоке узлов [first_node, last_node) и ждет, пока все
+    // вызовы завершатся. Первое исключение из task пробрасывается после этого. Пакеты от разных вызывающих
+    // потоков выполняются по очереди
+    using WorkerTask = std::function<void(size_t node, size_t worker)>;
+    void RunOnWorkers(size_t first_node, size_t last_node, const WorkerTask& task) const;
+
+private:
+    struct Worker {
+        size_t node = 0;
+        size_t index = 0;
+        std::thread thread;
+    };
+
+    const SearchServer& source_;
+    std::vector<NumaNode> nodes_;
+    std::vector<std::unique_ptr<SearchServer>> replicas_;
+
+    std::vector<Worker> workers_;
+    mutable std::mutex batch_mutex_;
+    mutable std::mutex pool_mutex_;
+    mutable std::condition_variable batch_ready_;
+    mutable std::condition_variable batch_done_;
+    mutable const WorkerTask* task_ = nullptr;
+    mutable size_t task_first_node_ = 0;
+    mutable size_t task_last_node_ = 0;
+    mutable uint64_t generation_ = 0;
+    mutable size_t running_ = 0;
+    mutable std::exception_ptr task_error_;
+    bool stopping_ = false;
+
+    void StartWorkers();
+    void StopWorkers();
+    void WorkerLoop(size_t node, size_t index) const;
+    static void CopyImpactPostings(const SearchServer& source, SearchServer& replica);
+};
+
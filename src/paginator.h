@@ -1,5 +1,9 @@
 #pragma once
 
+#include <iterator>
+#include <ostream>
+#include <vector>
+
 #include "document.h"
 
     template<typename Iterator>
@@ -61,7 +65,7 @@
         return Paginator(begin(c), end(c), page_size);
     }
     
-    std::ostream &operator<<(std::ostream &output, const Document &doc) {// перегрузка для вывода страницы
+    inline std::ostream &operator<<(std::ostream &output, const Document &doc) {// перегрузка для вывода страницы
         return output << "{ document_id = " << doc.id << ", relevance = " << doc.relevance << ", rating = " << doc.rating
                 << " }";
     }
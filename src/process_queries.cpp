@@ -1,5 +1,8 @@
 #include "process_queries.h"
 
+#include <atomic>
+#include <stdexcept>
+
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries) {
     std::vector<std::vector<Document>> output(queries.size());
     std::transform(std::execution::par, queries.begin(), queries.end(), output.begin(), [&search_server](const std::string& query){
@@ -17,4 +20,37 @@ std::deque<Document> ProcessQueriesJoined(const SearchServer& search_server, con
         }
     }
     return output;
-}
\ No newline at end of file
+}
+
+namespace {
+
+std::vector<std::vector<Document>> ProcessQueriesOnNodes(const NumaReplicas& replicas, const std::vector<std::string>& queries, size_t first_node, size_t last_node) {
+    std::vector<std::vector<Document>> output(queries.size());
+    std::atomic<size_t> next_query = 0;
+    replicas.RunOnWorkers(first_node, last_node, [&](size_t node, size_t) {
+        const SearchServer& search_server = replicas.Replica(node);
+        try {
+            for (size_t i = next_query++; i < queries.size(); i = next_query++) {
+                output[i] = search_server.FindTopDocuments(queries[i]);
+            }
+        } catch (...) {
+            // остальные потоки бросают очередь, исключение пробросит RunOnWorkers
+            next_query = queries.size();
+            throw;
+        }
+    });
+    return output;
+}
+
+} // namespace
+
+std::vector<std::vector<Document>> ProcessQueriesNuma(const NumaReplicas& replicas, const std::vector<std::string>& queries) {
+    return ProcessQueriesOnNodes(replicas, queries, 0, replicas.NodeCount());
+}
+
+std::vector<std::vector<Document>> ProcessQueriesNuma(const NumaReplicas& replicas, const std::vector<std::string>& queries, size_t node) {
+    if (node >= replicas.NodeCount()) {
+        throw std::out_of_range("Нет узла NUMA с таким номером");
+    }
+    return ProcessQueriesOnNodes(replicas, queries, node, node + 1);
+}
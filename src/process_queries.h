@@ -2,6 +2,7 @@
 
 #include "search_server.h"
 #include "document.h"
+#include "numa.h"
 
 #include <deque>
 
@@ -11,4 +12,17 @@ std::vector<std::vector<Document>> ProcessQueries(
 
 std::deque<Document> ProcessQueriesJoined(
     const SearchServer& search_server,
-    const std::vector<std::string>& queries);
\ No newline at end of file
+    const std::vector<std::string>& queries);
+
+// То же, но на каждом узле NUMA запросы обрабатывают рабочие потоки replicas, привязанные к его процессорам,
+// по одному на процессор, и каждый опрашивает реплику своего узла. Запросы раздаются потокам по одному по мере
+// освобождения. Потоки живут вместе с replicas, новые на каждый пакет не создаются
+std::vector<std::vector<Document>> ProcessQueriesNuma(
+    const NumaReplicas& replicas,
+    const std::vector<std::string>& queries);
+
+// Только потоками узла node, чтобы мерить пропускную способность сокетов по отдельности
+std::vector<std::vector<Document>> ProcessQueriesNuma(
+    const NumaReplicas& replicas,
+    const std::vector<std::string>& queries,
+    size_t node);
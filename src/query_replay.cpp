@@ -0,0 +1,237 @@
+#include "query_replay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "process_queries.h"
+#include "string_processing.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t ElapsedNs(Clock::time_point from, Clock::time_point to) {
+    return static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()));
+}
+
+[[noreturn]] void ThrowBadLine(const std::string& what, size_t line_number) {
+    throw std::invalid_argument(what + " в строке " + std::to_string(line_number + 1));
+}
+
+// Одна отправка клиента: запросы журнала [first, last) и момент поступления от начала прогона
+struct Request {
+    size_t first = 0;
+    size_t last = 0;
+    uint64_t arrival_ns = 0;
+};
+
+} // namespace
+
+size_t LoadCorpus(std::istream& input, SearchServer& search_server) {
+    std::string line;
+    size_t added = 0;
+    for (size_t line_number = 0; std::getline(input, line); ++line_number) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        int document_id = static_cast<int>(line_number);
+        int status = static_cast<int>(DocumentStatus::ACTUAL);
+        std::vector<int> ratings = {0};
+        std::string text;
+        const size_t id_end = line.find('\t');
+        if (id_end == std::string::npos) {
+            text = std::move(line);
+        } else {
+            const size_t status_end = line.find('\t', id_end + 1);
+            const size_t ratings_end = status_end == std::string::npos ? std::string::npos : line.find('\t', status_end + 1);
+            if (ratings_end == std::string::npos) {
+                ThrowBadLine("В корпусе ожидается id, статус, рейтинги и текст", line_number);
+            }
+            try {
+                document_id = std::stoi(line.substr(0, id_end));
+                status = std::stoi(line.substr(id_end + 1, status_end - id_end - 1));
+                ratings.clear();
+                for (const std::string_view rating : SplitIntoWordsView(std::string_view(line).substr(status_end + 1, ratings_end - status_end - 1))) {
+                    ratings.push_back(std::stoi(std::string(rating)));
+                }
+            } catch (const std::logic_error&) {
+                ThrowBadLine("Некорректное число", line_number);
+            }
+            if (status < static_cast<int>(DocumentStatus::ACTUAL) || status > static_cast<int>(DocumentStatus::REMOVED)) {
+                ThrowBadLine("Неизвестный статус документа", line_number);
+            }
+            text = line.substr(ratings_end + 1);
+        }
+        try {
+            search_server.AddDocument(document_id, text, static_cast<DocumentStatus>(status), ratings);
+        } catch (const std::invalid_argument& error) {
+            ThrowBadLine(error.what(), line_number);
+        }
+        ++added;
+    }
+    return added;
+}
+
+std::vector<LoggedQuery> ReadQueryLog(std::istream& input) {
+    std::vector<LoggedQuery> log;
+    std::string line;
+    for (size_t line_number = 0; std::getline(input, line); ++line_number) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        LoggedQuery query;
+        const size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            query.text = line;
+        } else {
+            try {
+                query.offset_ns = std::stoull(line.substr(0, tab)) * 1000;
+            } catch (const std::logic_error&) {
+                ThrowBadLine("Некорректное время запроса", line_number);
+            }
+            query.text = line.substr(tab + 1);
+        }
+        if (!log.empty() && query.offset_ns < log.back().offset_ns) {
+            ThrowBadLine("Время запросов в журнале убывает", line_number);
+        }
+        log.push_back(std::move(query));
+    }
+    return log;
+}
+
+void RecordWithExpectedInterval(LatencyHistogram& histogram, uint64_t value, uint64_t expected_interval) {
+    histogram.Record(value);
+    if (expected_interval == 0 || value <= expected_interval) {
+        return;
+    }
+    for (uint64_t missed = value - expected_interval; missed >= expected_interval; missed -= expected_interval) {
+        histogram.Record(missed);
+    }
+}
+
+ReplayReport ReplayQueries(const SearchServer& search_server, const std::vector<LoggedQuery>& log, const ReplayOptions& options) {
+    if (options.threads == 0) {
+        throw std::invalid_argument("Нужен хотя бы один поток");
+    }
+    if (options.mode == ReplayMode::FIXED_RATE && !(options.rate > 0)) {
+        throw std::invalid_argument("Для постоянной частоты нужна частота больше нуля");
+    }
+    if (options.mode == ReplayMode::RECORDED && !(options.speed > 0)) {
+        throw std::invalid_argument("Ускорение журнала должно быть больше нуля");
+    }
+
+    // ProcessQueries не переживает исключение в своем параллельном алгоритме, поэтому каждый запрос
+    // один раз выполняется здесь, вне замеров: некорректные считаются ошибками и в пачки не попадают
+    size_t invalid_queries = 0;
+    std::vector<size_t> replayed;
+    replayed.reserve(log.size());
+    for (size_t i = 0; i < log.size(); ++i) {
+        if (options.api == ReplayApi::PROCESS_QUERIES) {
+            try {
+                search_server.FindTopDocuments(log[i].text);
+            } catch (const std::exception&) {
+                ++invalid_queries;
+                continue;
+            }
+        }
+        replayed.push_back(i);
+    }
+
+    // пачки и их тексты готовятся заранее, чтобы копирование строк не попадало в замеры. Пачка поступает
+    // вместе со своим последним запросом, в его момент по журналу
+    const size_t batch_size = options.api == ReplayApi::PROCESS_QUERIES ? std::max<size_t>(1, options.batch_size) : 1;
+    std::vector<Request> requests;
+    std::vector<std::vector<std::string>> batches;
+    for (size_t first = 0; first < replayed.size(); first += batch_size) {
+        Request request;
+        request.first = replayed[first];
+        const size_t last = std::min(first + batch_size, replayed.size());
+        request.last = replayed[last - 1] + 1;
+        if (options.mode == ReplayMode::FIXED_RATE) {
+            request.arrival_ns = static_cast<uint64_t>((request.last - 1) * 1e9 / options.rate);
+        } else if (options.mode == ReplayMode::RECORDED) {
+            request.arrival_ns = static_cast<uint64_t>((log[request.last - 1].offset_ns - log.front().offset_ns) / options.speed);
+        }
+        requests.push_back(request);
+        if (options.api == ReplayApi::PROCESS_QUERIES) {
+            std::vector<std::string>& batch = batches.emplace_back();
+            for (size_t i = first; i < last; ++i) {
+                batch.push_back(log[replayed[i]].text);
+            }
+        }
+    }
+
+    struct WorkerResult {
+        LatencyHistogram service;
+        LatencyHistogram response;
+        std::vector<uint64_t> closed_loop_samples;
+        size_t errors = 0;
+    };
+    std::vector<WorkerResult> results(options.threads);
+    std::atomic<size_t> next_request = 0;
+    std::vector<std::thread> workers;
+    const Clock::time_point start = Clock::now();
+    for (size_t worker = 0; worker < options.threads; ++worker) {
+        workers.emplace_back([&, worker] {
+            WorkerResult& result = results[worker];
+            for (size_t r = next_request++; r < requests.size(); r = next_request++) {
+                const Request& request = requests[r];
+                const Clock::time_point intended = start + std::chrono::nanoseconds(request.arrival_ns);
+                if (options.mode != ReplayMode::CLOSED_LOOP) {
+                    std::this_thread::sleep_until(intended);
+                }
+                const Clock::time_point begin = Clock::now();
+                try {
+                    if (options.api == ReplayApi::FIND_TOP) {
+                        search_server.FindTopDocuments(log[request.first].text);
+                    } else {
+                        ProcessQueries(search_server, batches[r]);
+                    }
+                } catch (const std::exception&) {
+                    // некорректные запросы в журнале считаются, но не останавливают прогон
+                    ++result.errors;
+                }
+                const Clock::time_point end = Clock::now();
+                result.service.Record(ElapsedNs(begin, end));
+                if (options.mode == ReplayMode::CLOSED_LOOP) {
+                    result.closed_loop_samples.push_back(ElapsedNs(begin, end));
+                } else {
+                    result.response.Record(ElapsedNs(intended, end));
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    ReplayReport report;
+    report.queries = log.size();
+    report.errors = invalid_queries;
+    report.seconds = ElapsedNs(start, Clock::now()) / 1e9;
+    for (const WorkerResult& result : results) {
+        report.service.Merge(result.service);
+        report.response.Merge(result.response);
+        report.errors += result.errors;
+    }
+    if (options.mode == ReplayMode::CLOSED_LOOP) {
+        // каждый поток - клиент, который ждал бы rate / threads запросов в секунду
+        const uint64_t expected_interval = options.rate > 0 ? static_cast<uint64_t>(options.threads * batch_size * 1e9 / options.rate)
+                                                            : report.service.ValueAtPercentile(50);
+        for (const WorkerResult& result : results) {
+            for (const uint64_t sample : result.closed_loop_samples) {
+                RecordWithExpectedInterval(report.response, sample, expected_interval);
+            }
+        }
+    }
+    return report;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "search_server.h"
+#include "trace.h"
+
+// Запрос из журнала: время поступления от начала журнала и текст
+struct LoggedQuery {
+    uint64_t offset_ns = 0;
+    std::string text;
+};
+
+// Корпус: документ на строку. Строка "id<TAB>статус<TAB>рейтинги через пробел<TAB>текст" задает все поля,
+// строка без табуляций - только текст, тогда id - номер строки с нуля, статус ACTUAL и рейтинг 0.
+// Статус - число, как в DocumentStatus. Возвращает число добавленных документов
+size_t LoadCorpus(std::istream& input, SearchServer& search_server);
+
+// Журнал запросов: строка "микросекунды от начала<TAB>запрос" или просто запрос, тогда время 0.
+// Пустые строки пропускаются, время должно не убывать
+std::vector<LoggedQuery> ReadQueryLog(std::istream& input);
+
+enum class ReplayMode {
+    // каждый поток шлет следующий запрос сразу после ответа на предыдущий
+    CLOSED_LOOP,
+    // запросы поступают с постоянной частотой rate, независимо от того, успевает ли сервер
+    FIXED_RATE,
+    // запросы поступают в моменты из журнала, ускоренные в speed раз
+    RECORDED
+};
+
+enum class ReplayApi {
+    FIND_TOP,
+    // пачки по batch_size запросов через ProcessQueries. Исключение в его параллельном алгоритме завершает
+    // программу, поэтому запросы проверяются заранее, вне замеров, а некорректные в пачки не попадают
+    PROCESS_QUERIES
+};
+
+struct ReplayOptions {
+    ReplayMode mode = ReplayMode::CLOSED_LOOP;
+    ReplayApi api = ReplayApi::FIND_TOP;
+    size_t threads = 1;
+    // запросов в секунду для FIXED_RATE; в CLOSED_LOOP, если задана, - ожидаемая частота для поправки
+    // на скоординированное упущение, иначе ожидаемым интервалом считается медианное время обслуживания
+    double rate = 0;
+    double speed = 1;
+    size_t batch_size = 16;
+};
+
+// service - время обслуживания запроса от фактического начала до ответа.
+// response - время ответа с поправкой на скоординированное упущение: в открытом цикле от момента, когда запрос
+// должен был поступить, а не когда до него дошла очередь; в закрытом - с добавлением запросов, которые
+// клиент не отправил, пока ждал медленный ответ (как recordValueWithExpectedInterval в HdrHistogram).
+// Для ProcessQueries замеры относятся к пачке, поступившей вместе с последним ее запросом
+struct ReplayReport {
+    size_t queries = 0;
+    // запросы, на которых сервер бросил исключение (например, некорректные минус-слова)
+    size_t errors = 0;
+    double seconds = 0;
+    LatencyHistogram service;
+    LatencyHistogram response;
+
+    double Throughput() const {
+        return seconds > 0 ? queries / seconds : 0;
+    }
+};
+
+ReplayReport ReplayQueries(const SearchServer& search_server, const std::vector<LoggedQuery>& log, const ReplayOptions& options);
+
+// Добавляет в гистограмму value и запросы, которые отправились бы за время ожидания с интервалом expected_interval
+void RecordWithExpectedInterval(LatencyHistogram& histogram, uint64_t value, uint64_t expected_interval);
@@ -1,21 +1,17 @@
 #include <iostream>
+#include <unordered_set>
+#include <vector>
+
 #include "remove_duplicates.h"
 
 using namespace std;
 
-void RemoveDuplicates(SearchServer& search_server) { // Удаляет дубликаты документов. Удаление происходит через множество в котором хранятся множества слов документов, при каждой итерации собирается множество текущего документа и проверяется, хранится ли оно уже в множестве слов, если да, то тогда это дубликат
-    set<int> id_to_remove;
-    set<set<string>> set_to_compare;
-    for(int i : search_server) {
-        const map<string, double>& temp1 = search_server.GetWordFrequencies(i);
-        set<string> words;
-        for (auto i : temp1) {
-            words.insert(i.first);
-        }
-        if(set_to_compare.count(words)) {
-            id_to_remove.insert(i);
-        } else {
-            set_to_compare.insert(words);
+void RemoveDuplicates(SearchServer& search_server) { // Удаляет дубликаты документов. Отпечаток множества слов считается при AddDocument, здесь остается только найти повторяющиеся отпечатки; из группы дубликатов остается документ с наименьшим id
+    vector<int> id_to_remove;
+    unordered_set<DocumentFingerprint, DocumentFingerprintHasher> seen_fingerprints;
+    for (int i : search_server) {
+        if (!seen_fingerprints.insert(search_server.GetFingerprint(i)).second) {
+            id_to_remove.push_back(i);
         }
     }
 
@@ -1,37 +1,137 @@
-// #include <vector>
-
 #include "request_queue.h"
 #include "search_server.h"
 
+#include <algorithm>
+
+namespace {
+
+// номер кольца закрепляется за потоком при первом запросе, потоки раздаются по кольцам по очереди
+size_t ThreadShardIndex() {
+    static std::atomic<size_t> next_thread{0};
+    thread_local const size_t index = next_thread.fetch_add(1, std::memory_order_relaxed) % REQUEST_QUEUE_SHARDS;
+    return index;
+}
+
+} // namespace
+
+    RequestQueue::RequestQueue(const SearchServer& search_server, Clock::duration window, TimeSource now)
+        : search_server_(search_server)
+        , now_(now)
+        , start_time_(now())
+        , bucket_width_(std::max(Clock::duration(1), window / bucket_count_)) {
+    }
+
+    RequestQueue::~RequestQueue() {
+        for (auto& shard : shards_) {
+            delete[] shard.load(std::memory_order_relaxed);
+        }
+    }
+
     std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
+        const auto start = now_();
         const auto result = search_server_.FindTopDocuments(raw_query, status);
-        RequestQueue::AddRequest(result.size());
+        RequestQueue::AddRequest(result.size(), start, now_());
         return result;
     }
 
     std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
+        const auto start = now_();
         const auto result = search_server_.FindTopDocuments(raw_query);
-        RequestQueue::AddRequest(result.size());
+        RequestQueue::AddRequest(result.size(), start, now_());
         return result;
     }
 
     int RequestQueue::GetNoResultRequests() const {
-        return no_results_requests_;
+        return static_cast<int>(GetStats().no_result_requests);
     }
 
-    void RequestQueue::AddRequest(int results_num) {
-        // новый запрос - новая секунда
-        ++current_time_;
-        // удаляем все результаты поиска, которые устарели
-        while (!requests_.empty() && min_in_day_ <= current_time_ - requests_.front().timestamp) {
-            if (0 == requests_.front().results) {
-                --no_results_requests_;
+    RequestStats RequestQueue::GetStats() const {
+        const int64_t current = CurrentInterval(now_());
+        RequestStats stats;
+        std::array<uint64_t, latency_bins_> latency{};
+        for (const auto& shard : shards_) {
+            const Bucket* buckets = shard.load(std::memory_order_acquire);
+            if (buckets == nullptr) {
+                continue;
+            }
+            for (int b = 0; b < bucket_count_; ++b) {
+                const Bucket& bucket = buckets[b];
+                const int64_t interval = bucket.interval.load(std::memory_order_acquire);
+                // корзины старше окна еще не перезаписаны, но уже не считаются
+                if (interval < 0 || current - interval >= bucket_count_) {
+                    continue;
+                }
+                stats.requests += bucket.requests.load(std::memory_order_relaxed);
+                stats.no_result_requests += bucket.no_results.load(std::memory_order_relaxed);
+                for (int i = 0; i < latency_bins_; ++i) {
+                    latency[i] += bucket.latency[i].load(std::memory_order_relaxed);
+                }
             }
-            requests_.pop_front();
         }
-        // сохраняем новый результат поиска
-        requests_.push_back({static_cast<uint64_t>(current_time_), results_num});
+        if (stats.requests == 0) {
+            return stats;
+        }
+
+        const auto covered = std::min<int64_t>(current + 1, bucket_count_) * bucket_width_;
+        stats.requests_per_second = stats.requests / std::chrono::duration<double>(covered).count();
+        stats.no_result_rate = 1.0 * stats.no_result_requests / stats.requests;
+
+        // перцентиль - верхняя граница корзины, в которую он попал
+        const auto percentile = [&latency](uint64_t rank) {
+            uint64_t seen = 0;
+            for (int i = 0; i < latency_bins_; ++i) {
+                seen += latency[i];
+                if (seen >= rank) {
+                    return std::chrono::microseconds(int64_t{1} << i);
+                }
+            }
+            return std::chrono::microseconds(int64_t{1} << (latency_bins_ - 1));
+        };
+        stats.latency_p50 = percentile((stats.requests + 1) / 2);
+        stats.latency_p99 = percentile(stats.requests - stats.requests / 100);
+        stats.latency_max = percentile(stats.requests);
+        return stats;
+    }
+
+    int64_t RequestQueue::CurrentInterval(Clock::time_point time) const {
+        return (time - start_time_) / bucket_width_;
+    }
+
+    RequestQueue::Bucket* RequestQueue::ThreadShard() {
+        std::atomic<Bucket*>& shard = shards_[ThreadShardIndex()];
+        Bucket* buckets = shard.load(std::memory_order_acquire);
+        if (buckets != nullptr) {
+            return buckets;
+        }
+        // кольцо могут выделять два потока сразу, остается то, что установлено первым
+        auto fresh = std::make_unique<Bucket[]>(bucket_count_);
+        if (shard.compare_exchange_strong(buckets, fresh.get(), std::memory_order_acq_rel)) {
+            return fresh.release();
+        }
+        return buckets;
+    }
+
+    void RequestQueue::AddRequest(int results_num, Clock::time_point start, Clock::time_point finish) {
+        const int64_t current = CurrentInterval(finish);
+        Bucket& bucket = ThreadShard()[current % bucket_count_];
+        int64_t interval = bucket.interval.load(std::memory_order_acquire);
+        // корзина осталась от прошлого круга - обнуляет ее тот, кто первым сменил номер интервала
+        if (interval < current && bucket.interval.compare_exchange_strong(interval, current, std::memory_order_acq_rel)) {
+            bucket.requests.store(0, std::memory_order_relaxed);
+            bucket.no_results.store(0, std::memory_order_relaxed);
+            for (auto& counter : bucket.latency) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        bucket.requests.fetch_add(1, std::memory_order_relaxed);
         if (0 == results_num) {
-            ++no_results_requests_;
+            bucket.no_results.fetch_add(1, std::memory_order_relaxed);
+        }
+        const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+        int bin = 0;
+        while (bin < latency_bins_ - 1 && (int64_t{1} << bin) <= micros) {
+            ++bin;
         }
-}
\ No newline at end of file
+        bucket.latency[bin].fetch_add(1, std::memory_order_relaxed);
+}
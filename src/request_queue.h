@@ -1,15 +1,42 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
 #include "document.h"
 #include "search_server.h"
 
+// Столько колец корзин у очереди: поток пишет в свое кольцо, и счетчики текущей корзины не делят между потоками
+#define REQUEST_QUEUE_SHARDS 16
+
+// Статистика запросов за скользящее окно реального времени
+struct RequestStats {
+    uint64_t requests = 0;
+    uint64_t no_result_requests = 0;
+    double requests_per_second = 0;
+    double no_result_rate = 0;
+    std::chrono::microseconds latency_p50{0};
+    std::chrono::microseconds latency_p99{0};
+    std::chrono::microseconds latency_max{0};
+};
+
+// Окно разбито на кольцо корзин фиксированной ширины. Запись в корзину - атомарные инкременты без блокировок,
+// поэтому AddFindRequest можно вызывать из нескольких потоков. Потоки раскладываются по REQUEST_QUEUE_SHARDS
+// кольцам, кольцо выделяется в куче при первом запросе из своих потоков, GetStats суммирует все кольца.
+// Корзина, в которую пришел запрос из нового интервала, обнуляется потоком, выигравшим CAS по номеру интервала;
+// события, попавшие в нее одновременно с обнулением, могут потеряться - для статистики это допустимо
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server)
-        : search_server_(search_server)
-        , no_results_requests_(0)
-        , current_time_(0) {
-    }
+    using Clock = std::chrono::steady_clock;
+    using TimeSource = Clock::time_point (*)();
+
+    explicit RequestQueue(const SearchServer& search_server, Clock::duration window = std::chrono::hours(24), TimeSource now = &Clock::now);
+    RequestQueue(const RequestQueue&) = delete;
+    RequestQueue& operator=(const RequestQueue&) = delete;
+    ~RequestQueue();
 
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
@@ -20,23 +47,39 @@ public:
 
     int GetNoResultRequests() const;
 
+    RequestStats GetStats() const;
+
 private:
-    struct QueryResult {
-        std::uint64_t timestamp;
-        int results;
+    static constexpr int bucket_count_ = 1440;
+    static constexpr int latency_bins_ = 40; // корзина i - задержки в [2^(i-1), 2^i) мкс
+
+    // корзина занимает целые кеш-линии и не делит их с соседней
+    struct alignas(64) Bucket {
+        std::atomic<int64_t> interval{-1};
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> no_results{0};
+        std::array<std::atomic<uint64_t>, latency_bins_> latency{};
     };
-    std::deque<QueryResult> requests_;
+
     const SearchServer& search_server_;
-    int no_results_requests_;
-    std::int64_t current_time_;
-    const static int min_in_day_ = 1440;
+    const TimeSource now_;
+    const Clock::time_point start_time_;
+    const Clock::duration bucket_width_;
+    // кольца по bucket_count_ корзин, nullptr - в кольцо еще никто не писал
+    std::array<std::atomic<Bucket*>, REQUEST_QUEUE_SHARDS> shards_{};
+
+    int64_t CurrentInterval(Clock::time_point time) const;
+
+    // Кольцо потока, выделяется при первом обращении
+    Bucket* ThreadShard();
 
-    void AddRequest(int results_num);
+    void AddRequest(int results_num, Clock::time_point start, Clock::time_point finish);
 };
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
+    const auto start = now_();
     const auto result = search_server_.FindTopDocuments(raw_query, document_predicate);
-    AddRequest(result.size());
+    AddRequest(result.size(), start, now_());
     return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,445 @@
+#include "scoring.h"
+
+#include <functional>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCORING_HAS_X86_KERNELS 1
+#endif
+
+namespace
+{
+
+void ScaleScoresPortable(double *scores, size_t size, double factor)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        scores[i] *= factor;
+    }
+}
+
+void AddScaledPortable(double *scores, const double *values, size_t size, double factor)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        scores[i] += factor * values[i];
+    }
+}
+
+void BlockMaxPortable(const double *scores, size_t size, double *maxima)
+{
+    for (size_t begin = 0; begin < size; begin += SCORING_BLOCK_SIZE)
+    {
+        const size_t end = std::min<size_t>(size, begin + SCORING_BLOCK_SIZE);
+        *maxima++ = *std::max_element(scores + begin, scores + end);
+    }
+}
+
+size_t SelectAtLeastPortable(const double *scores, size_t size, double threshold, uint32_t *indices)
+{
+    // запись без ветвления: номер пишется всегда, а счетчик сдвигается только у подходящих
+    size_t selected = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        indices[selected] = static_cast<uint32_t>(i);
+        selected += scores[i] >= threshold;
+    }
+    return selected;
+}
+
+#ifdef SCORING_HAS_X86_KERNELS
+__attribute__((target("avx2"))) void ScaleScoresAvx2(double *scores, size_t size, double factor)
+{
+    const __m256d multiplier = _mm256_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        _mm256_storeu_pd(scores + i, _mm256_mul_pd(_mm256_loadu_pd(scores + i), multiplier));
+    }
+    for (; i < size; ++i)
+    {
+        scores[i] *= factor;
+    }
+}
+
+__attribute__((target("avx2"))) void AddScaledAvx2(double *scores, const double *values, size_t size, double factor)
+{
+    const __m256d multiplier = _mm256_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        const __m256d terms = _mm256_mul_pd(_mm256_loadu_pd(values + i), multiplier);
+        _mm256_storeu_pd(scores + i, _mm256_add_pd(_mm256_loadu_pd(scores + i), terms));
+    }
+    for (; i < size; ++i)
+    {
+        scores[i] += factor * values[i];
+    }
+}
+
+__attribute__((target("avx2"))) void BlockMaxAvx2(const double *scores, size_t size, double *maxima)
+{
+    for (size_t begin = 0; begin < size; begin += SCORING_BLOCK_SIZE)
+    {
+        const size_t end = std::min<size_t>(size, begin + SCORING_BLOCK_SIZE);
+        size_t i = begin;
+        double block_max = scores[i];
+        if (end - begin >= 8)
+        {
+            // два независимых максимума, чтобы сравнения не ждали друг друга
+            __m256d first = _mm256_loadu_pd(scores + i);
+            __m256d second = _mm256_loadu_pd(scores + i + 4);
+            for (i += 8; i + 8 <= end; i += 8)
+            {
+                first = _mm256_max_pd(first, _mm256_loadu_pd(scores + i));
+                second = _mm256_max_pd(second, _mm256_loadu_pd(scores + i + 4));
+            }
+            const __m256d both = _mm256_max_pd(first, second);
+            __m128d half = _mm_max_pd(_mm256_castpd256_pd128(both), _mm256_extractf128_pd(both, 1));
+            half = _mm_max_pd(half, _mm_unpackhi_pd(half, half));
+            block_max = _mm_cvtsd_f64(half);
+        }
+        for (; i < end; ++i)
+        {
+            block_max = std::max(block_max, scores[i]);
+        }
+        *maxima++ = block_max;
+    }
+}
+
+__attribute__((target("avx2"))) size_t SelectAtLeastAvx2(const double *scores, size_t size, double threshold, uint32_t *indices)
+{
+    const __m256d bound = _mm256_set1_pd(threshold);
+    size_t selected = 0;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(scores + i), bound, _CMP_GE_OQ)));
+        while (mask != 0)
+        {
+            indices[selected++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < size; ++i)
+    {
+        indices[selected] = static_cast<uint32_t>(i);
+        selected += scores[i] >= threshold;
+    }
+    return selected;
+}
+
+// интринсики AVX-512 в GCC 12 начинают с неопределенного регистра, и -Wmaybe-uninitialized ложно срабатывает на них
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) void ScaleScoresAvx512(double *scores, size_t size, double factor)
+{
+    const __m512d multiplier = _mm512_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        _mm512_storeu_pd(scores + i, _mm512_mul_pd(_mm512_loadu_pd(scores + i), multiplier));
+    }
+    for (; i < size; ++i)
+    {
+        scores[i] *= factor;
+    }
+}
+
+__attribute__((target("avx512f"))) void AddScaledAvx512(double *scores, const double *values, size_t size, double factor)
+{
+    const __m512d multiplier = _mm512_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        const __m512d terms = _mm512_mul_pd(_mm512_loadu_pd(values + i), multiplier);
+        _mm512_storeu_pd(scores + i, _mm512_add_pd(_mm512_loadu_pd(scores + i), terms));
+    }
+    for (; i < size; ++i)
+    {
+        scores[i] += factor * values[i];
+    }
+}
+
+__attribute__((target("avx512f"))) void BlockMaxAvx512(const double *scores, size_t size, double *maxima)
+{
+    for (size_t begin = 0; begin < size; begin += SCORING_BLOCK_SIZE)
+    {
+        const size_t end = std::min<size_t>(size, begin + SCORING_BLOCK_SIZE);
+        size_t i = begin;
+        double block_max = scores[i];
+        if (end - begin >= 16)
+        {
+            __m512d first = _mm512_loadu_pd(scores + i);
+            __m512d second = _mm512_loadu_pd(scores + i + 8);
+            for (i += 16; i + 16 <= end; i += 16)
+            {
+                first = _mm512_max_pd(first, _mm512_loadu_pd(scores + i));
+                second = _mm512_max_pd(second, _mm512_loadu_pd(scores + i + 8));
+            }
+            const __m512d both = _mm512_max_pd(first, second);
+            const __m256d quarter = _mm256_max_pd(_mm512_castpd512_pd256(both), _mm512_extractf64x4_pd(both, 1));
+            __m128d half = _mm_max_pd(_mm256_castpd256_pd128(quarter), _mm256_extractf128_pd(quarter, 1));
+            half = _mm_max_pd(half, _mm_unpackhi_pd(half, half));
+            block_max = _mm_cvtsd_f64(half);
+        }
+        for (; i < end; ++i)
+        {
+            block_max = std::max(block_max, scores[i]);
+        }
+        *maxima++ = block_max;
+    }
+}
+
+__attribute__((target("avx512f"))) size_t SelectAtLeastAvx512(const double *scores, size_t size, double threshold, uint32_t *indices)
+{
+    // сравнение 16 релевантностей дает 16-битную маску, по которой сжатая запись кладет подходящие номера подряд
+    const __m512d bound = _mm512_set1_pd(threshold);
+    const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t selected = 0;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __mmask8 low = _mm512_cmp_pd_mask(_mm512_loadu_pd(scores + i), bound, _CMP_GE_OQ);
+        const __mmask8 high = _mm512_cmp_pd_mask(_mm512_loadu_pd(scores + i + 8), bound, _CMP_GE_OQ);
+        const __mmask16 mask = static_cast<__mmask16>(low | (high << 8));
+        const __m512i numbers = _mm512_add_epi32(lanes, _mm512_set1_epi32(static_cast<int>(i)));
+        _mm512_mask_compressstoreu_epi32(indices + selected, mask, numbers);
+        selected += __builtin_popcount(mask);
+    }
+    for (; i < size; ++i)
+    {
+        indices[selected] = static_cast<uint32_t>(i);
+        selected += scores[i] >= threshold;
+    }
+    return selected;
+}
+#pragma GCC diagnostic pop
+#endif
+
+const ScoringKernels PORTABLE_KERNELS{ScaleScoresPortable, AddScaledPortable, BlockMaxPortable, SelectAtLeastPortable};
+#ifdef SCORING_HAS_X86_KERNELS
+const ScoringKernels AVX2_KERNELS{ScaleScoresAvx2, AddScaledAvx2, BlockMaxAvx2, SelectAtLeastAvx2};
+const ScoringKernels AVX512_KERNELS{ScaleScoresAvx512, AddScaledAvx512, BlockMaxAvx512, SelectAtLeastAvx512};
+#endif
+
+} // namespace
+
+bool IsScoringIsaSupported(ScoringIsa isa)
+{
+    switch (isa)
+    {
+    case ScoringIsa::PORTABLE:
+        return true;
+#ifdef SCORING_HAS_X86_KERNELS
+    case ScoringIsa::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case ScoringIsa::AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+ScoringIsa DetectScoringIsa()
+{
+    if (IsScoringIsaSupported(ScoringIsa::AVX512))
+        return ScoringIsa::AVX512;
+    if (IsScoringIsaSupported(ScoringIsa::AVX2))
+        return ScoringIsa::AVX2;
+    return ScoringIsa::PORTABLE;
+}
+
+const char *ScoringIsaName(ScoringIsa isa)
+{
+    switch (isa)
+    {
+    case ScoringIsa::AVX2:
+        return "avx2";
+    case ScoringIsa::AVX512:
+        return "avx512";
+    default:
+        return "portable";
+    }
+}
+
+const ScoringKernels &GetScoringKernels(ScoringIsa isa)
+{
+    if (!IsScoringIsaSupported(isa))
+        throw std::invalid_argument("Процессор не поддерживает этот набор команд");
+#ifdef SCORING_HAS_X86_KERNELS
+    if (isa == ScoringIsa::AVX512)
+        return AVX512_KERNELS;
+    if (isa == ScoringIsa::AVX2)
+        return AVX2_KERNELS;
+#endif
+    return PORTABLE_KERNELS;
+}
+
+const ScoringKernels &GetScoringKernels()
+{
+    static const ScoringKernels &kernels = GetScoringKernels(DetectScoringIsa());
+    return kernels;
+}
+
+bool SelectTopCandidates(const ScoreAccumulator &acc, size_t count, BlockMaxBuffers &buffers, double &threshold, double slack)
+{
+    const size_t block_count = (acc.Size() + SCORING_BLOCK_SIZE - 1) / SCORING_BLOCK_SIZE;
+    if (count == 0 || block_count < count)
+        return false;
+
+    const ScoringKernels &kernels = GetScoringKernels();
+    buffers.maxima.resize(block_count);
+    kernels.block_max(acc.scores.data(), acc.Size(), buffers.maxima.data());
+    buffers.order.assign(buffers.maxima.begin(), buffers.maxima.end());
+    std::nth_element(buffers.order.begin(), buffers.order.begin() + (count - 1), buffers.order.end(), std::greater<>());
+    threshold = buffers.order[count - 1] - slack;
+
+    buffers.candidates.clear();
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        if (buffers.maxima[block] < threshold)
+            continue;
+        const size_t begin = block * SCORING_BLOCK_SIZE;
+        const size_t size = std::min<size_t>(SCORING_BLOCK_SIZE, acc.Size() - begin);
+        const size_t written = buffers.candidates.size();
+        buffers.candidates.resize(written + size);
+        const size_t selected = kernels.select_at_least(acc.scores.data() + begin, size, threshold, buffers.candidates.data() + written);
+        buffers.candidates.resize(written + selected);
+        for (size_t i = written; i < buffers.candidates.size(); ++i)
+        {
+            buffers.candidates[i] += static_cast<uint32_t>(begin);
+        }
+    }
+    return true;
+}
+
+void AccumulatePosting(ScoreAccumulator &acc, Posting::const_iterator first, Posting::const_iterator last, double idf, MergeBuffers &buffers)
+{
+    if (first == last)
+        return;
+    if (acc.Empty())
+    {
+        // первое слово: TF копируются подряд, а умножает их на idf векторное ядро
+        for (; first != last; ++first)
+        {
+            acc.Add(first->first, first->second);
+        }
+        GetScoringKernels().scale(acc.scores.data(), acc.Size(), idf);
+        return;
+    }
+
+    // слияние только раскладывает id, прежнюю релевантность и TF по выровненным массивам. У документов без
+    // слова TF нулевой, у новых документов нулевая прежняя релевантность: s + idf * 0 и 0 + idf * tf точны,
+    // поэтому результат совпадает до бита со сложением по месту
+    ScoreAccumulator &merged = buffers.merged;
+    std::vector<double> &tfs = buffers.tfs;
+    merged.Clear();
+    merged.Reserve(acc.Size());
+    tfs.clear();
+    size_t i = 0;
+    while (i < acc.Size() && first != last)
+    {
+        if (acc.ids[i] < first->first)
+        {
+            merged.Add(acc.ids[i], acc.scores[i]);
+            tfs.push_back(0);
+            ++i;
+        }
+        else if (first->first < acc.ids[i])
+        {
+            merged.Add(first->first, 0);
+            tfs.push_back(first->second);
+            ++first;
+        }
+        else
+        {
+            merged.Add(acc.ids[i], acc.scores[i]);
+            tfs.push_back(first->second);
+            ++i;
+            ++first;
+        }
+    }
+    for (; first != last; ++first)
+    {
+        merged.Add(first->first, 0);
+        tfs.push_back(first->second);
+    }
+    // за последним документом постинга релевантность не меняется, хвост накопителя ядро не проходит
+    GetScoringKernels().add_scaled(merged.scores.data(), tfs.data(), tfs.size(), idf);
+    merged.ids.insert(merged.ids.end(), acc.ids.begin() + i, acc.ids.end());
+    merged.scores.insert(merged.scores.end(), acc.scores.begin() + i, acc.scores.end());
+    acc.Swap(merged);
+}
+
+void AccumulatePosting(ScoreAccumulator &acc, const Posting &posting, double idf, MergeBuffers &buffers)
+{
+    AccumulatePosting(acc, posting.begin(), posting.end(), idf, buffers);
+}
+
+Posting::const_iterator SkipTo(const Posting &posting, Posting::const_iterator from, int target)
+{
+    const int linear_steps = 8;
+    for (int i = 0; i < linear_steps; ++i)
+    {
+        if (from == posting.end() || from->first >= target)
+            return from;
+        ++from;
+    }
+    return posting.lower_bound(target);
+}
+
+void ExcludePosting(ScoreAccumulator &acc, const Posting &posting)
+{
+    if (acc.Empty() || posting.empty())
+        return;
+
+    // короткий накопитель против длинного постинга - точечные поиски дешевле прохода по всему постингу
+    size_t out = 0;
+    if (acc.Size() * 8 < posting.size())
+    {
+        for (size_t i = 0; i < acc.Size(); ++i)
+        {
+            if (posting.count(acc.ids[i]) > 0)
+                continue;
+            acc.ids[out] = acc.ids[i];
+            acc.scores[out++] = acc.scores[i];
+        }
+    }
+    else
+    {
+        auto first = posting.lower_bound(acc.ids.front());
+        for (size_t i = 0; i < acc.Size(); ++i)
+        {
+            while (first != posting.end() && first->first < acc.ids[i])
+            {
+                ++first;
+            }
+            if (first != posting.end() && first->first == acc.ids[i])
+                continue;
+            acc.ids[out] = acc.ids[i];
+            acc.scores[out++] = acc.scores[i];
+        }
+    }
+    acc.ids.resize(out);
+    acc.scores.resize(out);
+}
+
+void IntersectScores(ScoreAccumulator &acc, const ScoreAccumulator &other)
+{
+    auto other_it = other.ids.begin();
+    size_t out = 0;
+    for (size_t i = 0; i < acc.Size() && other_it != other.ids.end(); ++i)
+    {
+        other_it = std::lower_bound(other_it, other.ids.end(), acc.ids[i]);
+        if (other_it != other.ids.end() && *other_it == acc.ids[i])
+        {
+            acc.ids[out] = acc.ids[i];
+            acc.scores[out++] = acc.scores[i] + other.scores[other_it - other.ids.begin()];
+        }
+    }
+    acc.ids.resize(out);
+    acc.scores.resize(out);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+
+// Постинг слова: id документа -> TF слова в документе. Узлы берутся из ресурса памяти индекса
+using Posting = std::pmr::map<int, double>;
+
+// Документы накопителя делятся на блоки такого размера, у каждого блока считается максимум релевантности
+#define SCORING_BLOCK_SIZE 64
+
+// Накопитель релевантности: id документов по возрастанию и их релевантность, в двух параллельных массивах.
+// Лежит в памяти непрерывно, поэтому накопление идет слиянием, а не вставкой узлов в дерево, а релевантности
+// подряд обрабатываются векторными ядрами
+struct ScoreAccumulator
+{
+    std::vector<int> ids;
+    std::vector<double> scores;
+
+    size_t Size() const { return ids.size(); }
+    bool Empty() const { return ids.empty(); }
+    void Clear()
+    {
+        ids.clear();
+        scores.clear();
+    }
+    void Reserve(size_t size)
+    {
+        ids.reserve(size);
+        scores.reserve(size);
+    }
+    void Add(int id, double score)
+    {
+        ids.push_back(id);
+        scores.push_back(score);
+    }
+    void Swap(ScoreAccumulator &other)
+    {
+        ids.swap(other.ids);
+        scores.swap(other.scores);
+    }
+    bool operator==(const ScoreAccumulator &other) const = default;
+};
+
+// Набор команд, под который собраны векторные ядра
+enum class ScoringIsa
+{
+    PORTABLE,
+    AVX2,
+    AVX512,
+};
+
+// Векторные ядра над подряд лежащими релевантностями
+struct ScoringKernels
+{
+    // scores[i] *= factor
+    void (*scale)(double *scores, size_t size, double factor);
+    // scores[i] += factor * values[i]. Произведение и сумма округляются по отдельности, без слитного
+    // умножения-сложения, поэтому все наборы команд дают одну и ту же до бита релевантность
+    void (*add_scaled)(double *scores, const double *values, size_t size, double factor);
+    // maxima[b] - максимум scores в блоке b из SCORING_BLOCK_SIZE элементов, последний блок может быть короче
+    void (*block_max)(const double *scores, size_t size, double *maxima);
+    // Пишет в indices по возрастанию номера i, у которых scores[i] >= threshold, и возвращает их число
+    size_t (*select_at_least)(const double *scores, size_t size, double threshold, uint32_t *indices);
+};
+
+bool IsScoringIsaSupported(ScoringIsa isa);
+// Лучший набор команд, который поддерживает процессор
+ScoringIsa DetectScoringIsa();
+const char *ScoringIsaName(ScoringIsa isa);
+// Ядра под isa. Бросает std::invalid_argument, если процессор isa не поддерживает
+const ScoringKernels &GetScoringKernels(ScoringIsa isa);
+// Ядра под DetectScoringIsa(), выбираются один раз
+const ScoringKernels &GetScoringKernels();
+
+// Рабочие буферы отбора кандидатов, переиспользуются между запросами
+struct BlockMaxBuffers
+{
+    std::vector<double> maxima;
+    std::vector<double> order;
+    std::vector<uint32_t> candidates;
+};
+
+// Отбирает по максимумам блоков кандидатов в лучшие count документов накопителя. Порог - count-й по величине
+// максимум блока: в каждом из count блоков с наибольшими максимумами есть документ не ниже порога, поэтому
+// документ ниже порога в лучшие count не попадет, если фильтр пропустит хотя бы count кандидатов.
+// Блоки с максимумом ниже порога пропускаются целиком. Порог опускается на slack, если документы чуть ниже
+// порога тоже могут попасть в лучшие, например при равенстве релевантностей с допуском. Кладет номера
+// кандидатов в накопителе в buffers.candidates, а порог - в threshold; если блоков меньше count, отсекать
+// нечего и возвращает false
+bool SelectTopCandidates(const ScoreAccumulator &acc, size_t count, BlockMaxBuffers &buffers, double &threshold, double slack = 0);
+
+// Рабочие буферы слияния постинга с накопителем, переиспользуются между вызовами, чтобы не выделять память
+// на каждое слово. merged - объединение id с прежней релевантностью, tfs - выровненные с ним TF постинга (0 у
+// документов без слова), по которым вклад idf * tf добавляет векторное ядро
+struct MergeBuffers
+{
+    ScoreAccumulator merged;
+    std::vector<double> tfs;
+};
+
+// Добавляет к накопителю вклад idf * tf для постингов из [first, last).
+// Слияние id идет по ветвлениям, а арифметику над собранными подряд TF выполняют векторные ядра
+void AccumulatePosting(ScoreAccumulator &acc, Posting::const_iterator first, Posting::const_iterator last, double idf, MergeBuffers &buffers);
+
+void AccumulatePosting(ScoreAccumulator &acc, const Posting &posting, double idf, MergeBuffers &buffers);
+
+// Возвращает первый элемент постинга с id не меньше target, начиная поиск с from.
+// Сначала делает несколько шагов вперед (соседние id при пересечении встречаются часто), потом прыгает через lower_bound
+Posting::const_iterator SkipTo(const Posting &posting, Posting::const_iterator from, int target);
+
+// Удаляет из накопителя документы, которые есть в постинге минус-слова
+void ExcludePosting(ScoreAccumulator &acc, const Posting &posting);
+
+// Оставляет в накопителе только документы, которые есть и в other, складывая их релевантность
+void IntersectScores(ScoreAccumulator &acc, const ScoreAccumulator &other);
+
+// Оставляет в векторе не более k первых по порядку comp документов, отсортированных.
+// В отличие от полной сортировки упорядочивает только голову, хвост просто отбрасывается
+template <typename ExecutionPolicy, typename Documents, typename Compare>
+void SelectTopDocuments(ExecutionPolicy &&policy, Documents &documents, size_t k, Compare comp)
+{
+    if (documents.size() > k)
+    {
+        std::partial_sort(policy, documents.begin(), documents.begin() + k, documents.end(), comp);
+        documents.resize(k);
+    }
+    else
+    {
+        std::sort(policy, documents.begin(), documents.end(), comp);
+    }
+}
@@ -0,0 +1,45 @@
+#include "search_page.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <stdexcept>
+
+SearchCursor SearchCursor::After(const Document& document) {
+    SearchCursor cursor;
+    cursor.started_ = true;
+    cursor.last_ = document;
+    cursor.relevance_key_ = RelevanceKey(document.relevance);
+    return cursor;
+}
+
+std::string SearchCursor::ToString() const {
+    if (!started_) {
+        return {};
+    }
+    // передается ступень релевантности, по которой курсор и сравнивается, поэтому после разбора
+    // он указывает ровно на то же место выдачи
+    char buffer[80];
+    std::snprintf(buffer, sizeof(buffer), "%" PRId64 ".%d.%d", relevance_key_, last_.rating, last_.id);
+    return buffer;
+}
+
+SearchCursor SearchCursor::FromString(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    const std::string copy(text);
+    int64_t relevance_key = 0;
+    int rating = 0;
+    int id = 0;
+    int consumed = 0;
+    if (std::sscanf(copy.c_str(), "%" SCNd64 ".%d.%d%n", &relevance_key, &rating, &id, &consumed) != 3 || static_cast<size_t>(consumed) != copy.size()) {
+        throw std::invalid_argument("Некорректный курсор выдачи");
+    }
+    SearchCursor cursor;
+    cursor.started_ = true;
+    cursor.last_.relevance = relevance_key * SCOPE;
+    cursor.last_.rating = rating;
+    cursor.last_.id = id;
+    cursor.relevance_key_ = relevance_key;
+    return cursor;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+// Позиция в выдаче: ступень релевантности, рейтинг и id последнего показанного документа. Следующая страница
+// начинается строго после нее, поэтому глубокие страницы не требуют пересчитывать и сортировать все предыдущие.
+// Для клиента курсор непрозрачен: он передается обратно как есть или строкой из ToString
+class SearchCursor {
+public:
+    // Курсор на начало выдачи
+    SearchCursor() = default;
+
+    static SearchCursor After(const Document& document);
+
+    bool IsStart() const {
+        return !started_;
+    }
+
+    std::string ToString() const;
+    static SearchCursor FromString(std::string_view text);
+
+    bool operator==(const SearchCursor& other) const {
+        return started_ == other.started_ && (!started_ || (last_.id == other.last_.id && relevance_key_ == other.relevance_key_ && last_.rating == other.last_.rating));
+    }
+    bool operator!=(const SearchCursor& other) const {
+        return !(*this == other);
+    }
+
+private:
+    friend class SearchServer;
+
+    bool started_ = false;
+    Document last_;
+    // ступень релевантности last_, по ней курсор сравнивается с документами
+    int64_t relevance_key_ = 0;
+};
+
+struct SearchPage {
+    std::vector<Document> documents;
+    // передается в следующий вызов, чтобы получить следующую страницу
+    SearchCursor next;
+    bool has_more = false;
+};
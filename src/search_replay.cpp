@@ -0,0 +1,169 @@
+#include "corpus_generator.h"
+#include "query_replay.h"
+#include "search_server.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Воспроизведение журнала запросов против поискового сервера: пропускная способность и хвосты задержек
+ * под реалистичной нагрузкой, а не суммарное время пачки.
+ *
+ *  ./search_replay --corpus=docs.tsv --log=queries.tsv --mode=recorded --threads=8
+ *  ./search_replay --corpus=docs.tsv --log=queries.tsv --mode=fixed --rate=5000 --threads=8
+ *  ./search_replay --documents=20000 --queries=20000 --mode=closed --api=process_queries --batch=32
+ *
+ * Форматы файлов описаны у LoadCorpus и ReadQueryLog. Без --corpus и --log корпус и журнал генерируются
+ * так же, как в бенчмарках (--documents, --vocabulary, --queries, --seed).
+ * --mode: closed - каждый поток шлет следующий запрос после ответа; fixed - постоянная частота --rate;
+ * recorded - моменты из журнала, ускоренные в --speed раз.
+ * --api: find_top - по запросу через FindTopDocuments; process_queries - пачки по --batch запросов.
+ * --json=путь дополнительно пишет отчет с гистограммами.
+ */
+
+namespace {
+
+map<string, string> ParseArguments(int argc, char* argv[]) {
+    map<string, string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+        if (argument.rfind("--"s, 0) != 0) {
+            throw invalid_argument("Неизвестный аргумент "s + argument);
+        }
+        const size_t equal = argument.find('=');
+        if (equal == string::npos) {
+            arguments[argument.substr(2)] = "1"s;
+        } else {
+            arguments[argument.substr(2, equal - 2)] = argument.substr(equal + 1);
+        }
+    }
+    return arguments;
+}
+
+string GetString(const map<string, string>& arguments, const string& key, const string& default_value) {
+    const auto it = arguments.find(key);
+    return it == arguments.end() ? default_value : it->second;
+}
+
+size_t GetSize(const map<string, string>& arguments, const string& key, size_t default_value) {
+    const auto it = arguments.find(key);
+    return it == arguments.end() ? default_value : stoull(it->second);
+}
+
+double GetDouble(const map<string, string>& arguments, const string& key, double default_value) {
+    const auto it = arguments.find(key);
+    return it == arguments.end() ? default_value : stod(it->second);
+}
+
+ReplayOptions ParseReplayOptions(const map<string, string>& arguments) {
+    ReplayOptions options;
+    const string mode = GetString(arguments, "mode"s, "closed"s);
+    if (mode == "closed"s) {
+        options.mode = ReplayMode::CLOSED_LOOP;
+    } else if (mode == "fixed"s) {
+        options.mode = ReplayMode::FIXED_RATE;
+    } else if (mode == "recorded"s) {
+        options.mode = ReplayMode::RECORDED;
+    } else {
+        throw invalid_argument("--mode должен быть closed, fixed или recorded"s);
+    }
+    const string api = GetString(arguments, "api"s, "find_top"s);
+    if (api == "find_top"s) {
+        options.api = ReplayApi::FIND_TOP;
+    } else if (api == "process_queries"s) {
+        options.api = ReplayApi::PROCESS_QUERIES;
+    } else {
+        throw invalid_argument("--api должен быть find_top или process_queries"s);
+    }
+    options.threads = GetSize(arguments, "threads"s, max(1u, thread::hardware_concurrency()));
+    options.rate = GetDouble(arguments, "rate"s, 0);
+    options.speed = GetDouble(arguments, "speed"s, 1);
+    options.batch_size = GetSize(arguments, "batch"s, options.batch_size);
+    return options;
+}
+
+void PrintLatency(const string& name, const LatencyHistogram& histogram) {
+    cout << left << setw(10) << name << fixed << setprecision(1)
+         << " p50 " << histogram.ValueAtPercentile(50) / 1e3
+         << " us, p99 " << histogram.ValueAtPercentile(99) / 1e3
+         << " us, p999 " << histogram.ValueAtPercentile(99.9) / 1e3
+         << " us, max " << histogram.Max() / 1e3 << " us"s << endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        const auto arguments = ParseArguments(argc, argv);
+        const ReplayOptions options = ParseReplayOptions(arguments);
+
+        CorpusOptions corpus_options;
+        corpus_options.document_count = GetSize(arguments, "documents"s, corpus_options.document_count);
+        corpus_options.vocabulary_size = GetSize(arguments, "vocabulary"s, corpus_options.vocabulary_size);
+        corpus_options.query_count = GetSize(arguments, "queries"s, corpus_options.query_count);
+        corpus_options.seed = static_cast<uint32_t>(GetSize(arguments, "seed"s, corpus_options.seed));
+        mt19937 generator(corpus_options.seed);
+        const auto vocabulary = GenerateVocabulary(generator, corpus_options.vocabulary_size, 12);
+
+        SearchServer search_server(GetString(arguments, "stop-words"s, "a an the"s));
+        if (const auto corpus_path = arguments.find("corpus"s); corpus_path != arguments.end()) {
+            ifstream input(corpus_path->second);
+            if (!input) {
+                throw runtime_error("Не удалось открыть "s + corpus_path->second);
+            }
+            LoadCorpus(input, search_server);
+        } else {
+            const auto corpus = GenerateCorpus(generator, vocabulary, corpus_options);
+            for (size_t i = 0; i < corpus.size(); ++i) {
+                search_server.AddDocument(static_cast<int>(i), corpus[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 10)});
+            }
+        }
+
+        vector<LoggedQuery> log;
+        if (const auto log_path = arguments.find("log"s); log_path != arguments.end()) {
+            ifstream input(log_path->second);
+            if (!input) {
+                throw runtime_error("Не удалось открыть "s + log_path->second);
+            }
+            log = ReadQueryLog(input);
+        } else {
+            // сгенерированный журнал без времени; для --mode=recorded запросы идут с частотой --rate или 1000 в секунду
+            const double rate = options.rate > 0 ? options.rate : 1000;
+            const auto queries = GenerateQueryLog(generator, vocabulary, corpus_options);
+            for (size_t i = 0; i < queries.size(); ++i) {
+                log.push_back({static_cast<uint64_t>(i * 1e9 / rate), queries[i]});
+            }
+        }
+
+        cout << "documents: "s << search_server.GetDocumentCount() << ", queries: "s << log.size()
+             << ", threads: "s << options.threads << endl;
+        const ReplayReport report = ReplayQueries(search_server, log, options);
+        cout << "errors: "s << report.errors << ", seconds: "s << fixed << setprecision(3) << report.seconds
+             << ", throughput: "s << setprecision(1) << report.Throughput() << " queries/s"s << endl;
+        PrintLatency("service"s, report.service);
+        PrintLatency("response"s, report.response);
+
+        if (const auto json = arguments.find("json"s); json != arguments.end()) {
+            ofstream output(json->second);
+            output << "{\"queries\":" << report.queries << ",\"errors\":" << report.errors << ",\"seconds\":" << report.seconds
+                   << ",\"throughput\":" << report.Throughput() << ",\"service\":";
+            report.service.WriteJson(output);
+            output << ",\"response\":";
+            report.response.WriteJson(output);
+            output << "}\n";
+        }
+    } catch (const exception& error) {
+        cerr << error.what() << endl;
+        return 1;
+    }
+    return 0;
+}
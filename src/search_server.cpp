@@ -1,18 +1,35 @@
 #include "search_server.h"
 #include "string_processing.h"
 
+#include <atomic>
+#include <bit>
+
 using namespace std;
 
-SearchServer::SearchServer(const string &stop_words)
-    : documents_(), stop_words_(), data_about_documents_()
+SearchServer::SearchServer(const string &stop_words, TextAnalyzer analyzer, MemoryResources resources)
+    : resources_(resources), memory_(make_unique<MemoryAccounting>(resources.index)), documents_(&memory_->inverted_index), stop_words_(),
+      data_about_documents_(&memory_->metadata), documenis_key_id_(&memory_->forward_index), document_id_list_(&memory_->metadata),
+      content_(&memory_->vocabulary), analyzer_(analyzer), posting_revisions_(&memory_->inverted_index)
 {
 
-    for (std::string &word : SplitIntoWords(stop_words))
+    for (const std::string_view word : SplitIntoWordsView(stop_words))
     {
         if (!IsValidWord(word))
-            throw invalid_argument("В слове "s + word + " содержатся спецсимволы"s);
-        stop_words_.insert(std::string_view(*content_.insert(std::move(word)).first));
+            throw invalid_argument("В слове "s + std::string(word) + " содержатся спецсимволы"s);
+        AddStopWord(word);
+    }
+}
+
+void SearchServer::AddStopWord(std::string_view word)
+{
+    if (analyzer_.IsIdentity())
+    {
+        stop_words_.Insert(word);
+        return;
     }
+    // стоп-слова сравниваются с нормализованными словами до выделения основы, поэтому и сами только нормализуются
+    analyzer_.ForEachToken(word, [this](std::string_view token)
+                           { stop_words_.Insert(token); });
 }
 
 void SearchServer::AddDocument(int document_id, const string &document, DocumentStatus status, const vector<int> &raiting)
@@ -26,46 +43,216 @@ void SearchServer::AddDocument(int document_id, const string &document, Document
     const double tf_for_word = 1.0 / words.size();
     for (std::string &word : words)
     {
-        auto word_iter = content_.insert(std::move(word));
-        documents_[*word_iter.first][document_id] += tf_for_word;
-        documenis_key_id_[document_id][*word_iter.first] += tf_for_word;
+        const std::string_view interned = InternWord(word);
+        Posting &posting = documents_[interned];
+        if (posting.empty())
+            ++generation_;
+        double &tf = posting[document_id];
+        const double old_tf = tf;
+        tf += tf_for_word;
+        documenis_key_id_[document_id][interned] += tf_for_word;
+        UpdateImpact(interned, document_id, old_tf, tf);
     }
 
-    data_about_documents_.insert({document_id, {ComputeAverageRating(raiting), status}});
+    const auto word_frequencies = documenis_key_id_.find(document_id);
+    const DocumentFingerprint fingerprint = word_frequencies != documenis_key_id_.end() ? ComputeFingerprint(word_frequencies->second) : DocumentFingerprint{};
+    data_about_documents_.insert({document_id, {ComputeAverageRating(raiting), status, fingerprint}});
     document_id_list_.insert(document_id);
+    // в подключенном хранилище текст может уже лежать: такой же остается на месте, другой заменяется.
+    // Текст другой длины отсеивается без распаковки блока
+    if (store_ && !store_->Matches(document_id, document))
+    {
+        store_->Remove(document_id);
+        store_->Add(document_id, document);
+    }
+    ++revision_;
+    UpdateMemoryCounters();
 }
 
-int SearchServer::GetDocumentCount() const { return documenis_key_id_.size(); }
-
-tuple<vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const string &raw_query, int document_id) const
+void SearchServer::UpdateDocument(int document_id, const string &document, DocumentStatus status, const vector<int> &raiting)
 {
-    if (!document_id_list_.count(document_id) || document_id < 0)
-        throw std::out_of_range("Документ не найден"s);
-    if (!IsValidWord(raw_query))
-        throw std::invalid_argument("Некорректный запрос");
+    const auto meta_data = data_about_documents_.find(document_id);
+    if (meta_data == data_about_documents_.end())
+    {
+        AddDocument(document_id, document, status, raiting);
+        return;
+    }
 
-    Query query = ParseQueryWord(raw_query);
-    query.NormalizeVec();
-    DocumentStatus status = data_about_documents_.find(document_id)->second.status;
-    vector<std::string_view> output_words;
-    for (std::string_view word : query.minus_words_vec)
+    MetaDataOfDocument &meta = meta_data->second;
+    // в хранилище лежит прежний текст: если он тот же, индекс и хранилище не меняются и текст не разбирается
+    if (store_ && store_->Matches(document_id, document))
     {
-        const auto id_in_index = documents_.find(word);
-        if ((id_in_index != documents_.end()) && (id_in_index->second.count(document_id) > 0))
+        meta.raiting = ComputeAverageRating(raiting);
+        meta.status = status;
+        ++revision_;
+        return;
+    }
+
+    // текст разбирается до любых изменений, чтобы некорректный документ не оставил индекс наполовину обновленным
+    vector<string> words = SplitIntoWordsNoStop(document);
+    const double tf_for_word = 1.0 / words.size();
+    WordFrequencies new_frequencies(&memory_->forward_index);
+    for (std::string &word : words)
+    {
+        new_frequencies[InternWord(word)] += tf_for_word;
+    }
+
+    // старые и новые слова упорядочены, слиянием находятся исчезнувшие, новые и сменившие частоту
+    auto &old_frequencies = documenis_key_id_[document_id];
+    auto old_word = old_frequencies.begin();
+    auto new_word = new_frequencies.begin();
+    while (old_word != old_frequencies.end() || new_word != new_frequencies.end())
+    {
+        if (new_word == new_frequencies.end() || (old_word != old_frequencies.end() && old_word->first < new_word->first))
+        {
+            documents_.find(old_word->first)->second.erase(document_id);
+            UpdateImpact(old_word->first, document_id, old_word->second, 0);
+            ++old_word;
+        }
+        else if (old_word == old_frequencies.end() || new_word->first < old_word->first)
+        {
+            Posting &posting = documents_[new_word->first];
+            if (posting.empty())
+                ++generation_;
+            posting[document_id] = new_word->second;
+            UpdateImpact(new_word->first, document_id, 0, new_word->second);
+            ++new_word;
+        }
+        else
         {
-            return {output_words = {}, status};
+            if (old_word->second != new_word->second)
+            {
+                documents_.find(new_word->first)->second[document_id] = new_word->second;
+                UpdateImpact(new_word->first, document_id, old_word->second, new_word->second);
+            }
+            ++old_word;
+            ++new_word;
         }
     }
-    for (std::string_view word : query.plus_words_vec)
+
+    if (new_frequencies.empty())
+    {
+        documenis_key_id_.erase(document_id);
+        meta.fingerprint = DocumentFingerprint{};
+    }
+    else
+    {
+        old_frequencies = std::move(new_frequencies);
+        meta.fingerprint = ComputeFingerprint(old_frequencies);
+    }
+    meta.raiting = ComputeAverageRating(raiting);
+    meta.status = status;
+    if (store_)
+    {
+        store_->Remove(document_id);
+        store_->Add(document_id, document);
+    }
+    ++revision_;
+    UpdateMemoryCounters();
+}
+
+void SearchServer::SetDocumentStatus(int document_id, DocumentStatus status)
+{
+    const auto meta_data = data_about_documents_.find(document_id);
+    if (meta_data == data_about_documents_.end())
+        throw out_of_range("Документ не найден"s);
+    meta_data->second.status = status;
+    ++revision_;
+}
+
+void SearchServer::SetRating(int document_id, int rating)
+{
+    const auto meta_data = data_about_documents_.find(document_id);
+    if (meta_data == data_about_documents_.end())
+        throw out_of_range("Документ не найден"s);
+    meta_data->second.raiting = rating;
+    ++revision_;
+}
+
+void SearchServer::RestoreDocument(int document_id, DocumentStatus status, int rating, const std::vector<std::pair<std::string_view, double>> &word_frequencies)
+{
+    if (document_id < 0 || data_about_documents_.count(document_id) != 0)
+        throw invalid_argument("Документ с таким ID уже есть в системе"s);
+
+    for (const auto &[word, frequency] : word_frequencies)
+    {
+        const std::string_view interned = InternWord(word);
+        Posting &posting = documents_[interned];
+        if (posting.empty())
+            ++generation_;
+        double &tf = posting[document_id];
+        const double old_tf = tf;
+        tf = frequency;
+        documenis_key_id_[document_id][interned] = frequency;
+        UpdateImpact(interned, document_id, old_tf, tf);
+    }
+
+    const auto frequencies = documenis_key_id_.find(document_id);
+    const DocumentFingerprint fingerprint = frequencies != documenis_key_id_.end() ? ComputeFingerprint(frequencies->second) : DocumentFingerprint{};
+    data_about_documents_.insert({document_id, {rating, status, fingerprint}});
+    document_id_list_.insert(document_id);
+    ++revision_;
+    UpdateMemoryCounters();
+}
+
+int SearchServer::GetDocumentCount() const { return documenis_key_id_.size(); }
+
+namespace
+{
+    // Порядок упорядоченных по вкладу копий: по убыванию TF, при равных - по id, как в исходном постинге
+    bool ImpactBefore(const std::pair<int, double> &lhs, const std::pair<int, double> &rhs)
     {
-        const auto id_in_index = documents_.find(word);
-        if ((id_in_index != documents_.end()) && (id_in_index->second.count(document_id) > 0))
+        return lhs.second > rhs.second || (lhs.second == rhs.second && lhs.first < rhs.first);
+    }
+
+    // Вызывает callback для каждого слова документа, которое есть в упорядоченном векторе слов запроса.
+    // Длинный документ против короткого запроса выгоднее пробить поиском, иначе - слиянием двух упорядоченных
+    // последовательностей. callback возвращает false, если продолжать не нужно
+    template <typename Terms, typename Callback>
+    void ForEachCommonWord(const Terms &query_words, const SearchServer::WordFrequencies &document_words, Callback callback)
+    {
+        if (query_words.empty() || document_words.empty())
+            return;
+        if (query_words.size() * 8 < document_words.size())
         {
-            output_words.push_back(word);
+            for (const auto &term : query_words)
+            {
+                const auto it = document_words.find(term->first);
+                if (it != document_words.end() && !callback(it->first))
+                    return;
+            }
+            return;
+        }
+        auto query_it = query_words.begin();
+        auto document_it = document_words.begin();
+        while (query_it != query_words.end() && document_it != document_words.end())
+        {
+            if ((*query_it)->first < document_it->first)
+            {
+                ++query_it;
+            }
+            else if (document_it->first < (*query_it)->first)
+            {
+                ++document_it;
+            }
+            else
+            {
+                if (!callback(document_it->first))
+                    return;
+                ++query_it;
+                ++document_it;
+            }
         }
     }
+}
 
-    return {output_words, status};
+tuple<vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const string &raw_query, int document_id) const
+{
+    if (!document_id_list_.count(document_id) || document_id < 0)
+        throw std::out_of_range("Документ не найден"s);
+
+    QueryScope scope(*this, raw_query);
+    return MatchParsedQuery(scope.GetQuery(), document_id);
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy &, const std::string &raw_query, int document_id) const
@@ -75,40 +262,95 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy &policy, const std::string &raw_query, int document_id) const
 {
-    if (!document_id_list_.count(document_id) || document_id < 0)
-        throw std::out_of_range("Документ не найден"s);
-    if (!IsValidWord(raw_query))
-        throw std::invalid_argument("Некорректный запрос");
+    // запрос из нескольких слов против одного документа параллелить нечего, пересечение и так линейное
+    return this->MatchDocument(raw_query, document_id);
+}
 
-    Query query = std::move(ParseQueryWord(raw_query));
-    std::vector<std::string_view> output;
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchParsedQuery(const Query &query, int document_id) const
+{
+    static const WordFrequencies empty_document;
+    const auto word_frequencies = documenis_key_id_.find(document_id);
+    const auto &document_words = word_frequencies != documenis_key_id_.end() ? word_frequencies->second : empty_document;
+    const DocumentStatus status = data_about_documents_.at(document_id).status;
 
-    if (std::any_of(query.minus_words_vec.begin(), query.minus_words_vec.end(), [&](const auto &word)
-                    {
-        const auto id_in_index = documents_.find(word);
-        return id_in_index != documents_.end() && id_in_index->second.count(document_id) ? true : false; }))
-        return {std::vector<std::string_view>(), data_about_documents_.at(document_id).status};
+    bool has_minus_word = false;
+    ForEachCommonWord(query.minus_terms, document_words, [&has_minus_word](std::string_view)
+                      {
+        has_minus_word = true;
+        return false; });
+    if (has_minus_word)
+        return {vector<std::string_view>(), status};
 
-    output.reserve(documenis_key_id_.at(document_id).size());
+    // слова возвращаются видами на ключи индекса, а не на строку запроса, которая может умереть раньше результата
+    vector<std::string_view> output_words;
+    ForEachCommonWord(query.plus_terms, document_words, [&output_words](std::string_view word)
+                      {
+        output_words.push_back(word);
+        return true; });
+    return {output_words, status};
+}
 
-    std::copy_if(make_move_iterator(query.plus_words_vec.begin()), make_move_iterator(query.plus_words_vec.end()), std::back_inserter(output), [&](const auto word)
-                 {
-        const auto id_in_index = documents_.find(word);
-        return id_in_index != documents_.end() && id_in_index->second.count(document_id) ? true : false; });
+SearchPage SearchServer::FindPage(const std::string_view raw_query, const SearchCursor &after, size_t page_size, DocumentStatus status, QueryMode mode) const
+{
+    if (page_size == 0)
+        throw std::invalid_argument("Размер страницы должен быть больше нуля"s);
 
-    std::sort(execution::par, output.begin(), output.end());
+    // Окно выдачи, посчитанное последним в этом потоке: документы после курсора start, упорядоченные.
+    // Клиент листает страницы подряд, поэтому следующий курсор почти всегда указывает внутрь окна
+    struct PageWindow
+    {
+        uint64_t owner = 0;
+        uint64_t revision = 0;
+        std::string query;
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        QueryMode mode = QueryMode::ANY;
+        SearchCursor start;
+        std::vector<Document> documents;
+        bool exhausted = false;
+    };
+    thread_local PageWindow window;
 
-    output.erase(std::unique(output.begin(), output.end()), output.end());
+    size_t offset = 0;
+    bool hit = window.owner == instance_id_ && window.revision == revision_ && window.query == raw_query && window.status == status && window.mode == mode;
+    if (hit && after != window.start)
+    {
+        const auto position = std::find_if(window.documents.begin(), window.documents.end(), [&after](const Document &document)
+                                           { return SearchCursor::After(document) == after; });
+        hit = position != window.documents.end();
+        offset = hit ? position - window.documents.begin() + 1 : 0;
+    }
+    if (!hit || (offset + page_size > window.documents.size() && !window.exhausted))
+    {
+        const size_t window_size = page_size * PAGE_WINDOW_PAGES;
+        auto predicat = [status](int, DocumentStatus document_status, int)
+        { return document_status == status; };
+        window.documents = FindRankedDocuments(std::execution::seq, raw_query, mode, predicat, window_size + 1, after);
+        window.exhausted = window.documents.size() <= window_size;
+        if (!window.exhausted)
+            window.documents.pop_back();
+        window.owner = instance_id_;
+        window.revision = revision_;
+        window.query.assign(raw_query);
+        window.status = status;
+        window.mode = mode;
+        window.start = after;
+        offset = 0;
+    }
 
-    return {output, data_about_documents_.at(document_id).status};
+    SearchPage page;
+    const size_t end = std::min(offset + page_size, window.documents.size());
+    page.documents.assign(window.documents.begin() + offset, window.documents.begin() + end);
+    page.has_more = end < window.documents.size() || !window.exhausted;
+    page.next = page.documents.empty() ? after : SearchCursor::After(page.documents.back());
+    return page;
 }
 
-set<int>::const_iterator SearchServer::begin() const
+std::pmr::set<int>::const_iterator SearchServer::begin() const
 {
     return document_id_list_.cbegin();
 }
 
-set<int>::const_iterator SearchServer::end() const
+std::pmr::set<int>::const_iterator SearchServer::end() const
 {
     return document_id_list_.cend();
 }
@@ -119,10 +361,22 @@ void SearchServer::RemoveDocument(int document_id)
         return;
     for (auto &i : documents_)
     {
-        i.second.erase(document_id);
+        const auto posting = i.second.find(document_id);
+        if (posting == i.second.end())
+            continue;
+        const double tf = posting->second;
+        i.second.erase(posting);
+        UpdateImpact(i.first, document_id, tf, 0);
     }
     documenis_key_id_.erase(document_id);
     document_id_list_.erase(document_id);
+    data_about_documents_.erase(document_id);
+    if (vectors_)
+        vectors_->Remove(document_id);
+    if (store_)
+        store_->Remove(document_id);
+    ++revision_;
+    UpdateMemoryCounters();
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy &, int document_id)
@@ -134,7 +388,9 @@ void SearchServer::RemoveDocument(const std::execution::parallel_policy &policy,
 {
     if (!document_id_list_.count(document_id))
         return;
-    auto &docum_to_renove = documenis_key_id_.at(document_id);
+    static const WordFrequencies empty_document;
+    const auto word_frequencies = documenis_key_id_.find(document_id);
+    const auto &docum_to_renove = word_frequencies != documenis_key_id_.end() ? word_frequencies->second : empty_document;
     std::vector<const std::string_view *> words(docum_to_renove.size());
 
     std::transform(policy, docum_to_renove.begin(), docum_to_renove.end(), words.begin(), [](auto &elem)
@@ -142,23 +398,616 @@ void SearchServer::RemoveDocument(const std::execution::parallel_policy &policy,
 
     std::for_each(policy, words.begin(), words.end(), [this, document_id](const std::string_view *str)
                   { this->documents_.at(*str).erase(document_id); });
+    for (const auto &[word, tf] : docum_to_renove)
+    {
+        UpdateImpact(word, document_id, tf, 0);
+    }
     documenis_key_id_.erase(document_id);
     document_id_list_.erase(document_id);
+    data_about_documents_.erase(document_id);
+    if (vectors_)
+        vectors_->Remove(document_id);
+    if (store_)
+        store_->Remove(document_id);
+    ++revision_;
+    UpdateMemoryCounters();
+}
+
+std::string_view SearchServer::InternWord(std::string_view word)
+{
+    // сравнение прозрачное: поиск не строит строку, узел выделяется только для нового слова
+    const auto known = content_.find(word);
+    if (known != content_.end())
+        return *known;
+    return *content_.emplace(word).first;
+}
+
+void SearchServer::UpdateMemoryCounters()
+{
+    memory_->impact_postings = impact_postings_.bytes;
+    memory_->vector_index = vectors_ ? vectors_->MemoryBytes() : 0;
+    memory_->document_store = store_ ? store_->MemoryBytes() : 0;
+}
+
+void SearchServer::UpdateImpact(std::string_view word, int document_id, double old_tf, double new_tf)
+{
+    posting_revisions_[word] = ++postings_revision_;
+    if (impact_postings_.by_word.empty())
+        return;
+    const auto impact = impact_postings_.by_word.find(word);
+    if (impact == impact_postings_.by_word.end())
+        return;
+    // копия упорядочена так же, как при построении, поэтому место документа находится двоичным поиском
+    auto &postings = impact->second;
+    const size_t capacity = postings.capacity();
+    if (old_tf != 0)
+        postings.erase(std::lower_bound(postings.begin(), postings.end(), std::pair(document_id, old_tf), ImpactBefore));
+    if (new_tf != 0)
+        postings.insert(std::lower_bound(postings.begin(), postings.end(), std::pair(document_id, new_tf), ImpactBefore), {document_id, new_tf});
+    impact_postings_.bytes += (postings.capacity() - capacity) * sizeof(postings[0]);
+    if (postings.empty())
+    {
+        // у слова не осталось документов, его запрос проще обработать полным просмотром
+        impact_postings_.bytes -= postings.capacity() * sizeof(postings[0]);
+        impact_postings_.by_word.erase(impact);
+    }
+}
+
+ImpactPostings SearchServer::BuildImpactPostings(size_t memory_budget_bytes, size_t min_posting_length) const
+{
+    ImpactPostings impact_postings;
+    impact_postings.owner = instance_id_;
+    impact_postings.revision = postings_revision_;
+
+    // копия выгоднее всего для самых длинных постингов: их полный просмотр дороже всего
+    std::vector<Term> terms;
+    for (auto term = documents_.begin(); term != documents_.end(); ++term)
+    {
+        if (term->second.size() >= std::max<size_t>(min_posting_length, 1))
+            terms.push_back(term);
+    }
+    std::sort(terms.begin(), terms.end(), [](Term lhs, Term rhs)
+              { return lhs->second.size() > rhs->second.size(); });
+
+    for (const Term term : terms)
+    {
+        const size_t bytes = term->second.size() * sizeof(std::pair<int, double>);
+        if (impact_postings.bytes + bytes > memory_budget_bytes)
+            continue;
+        std::vector<std::pair<int, double>> postings(term->second.begin(), term->second.end());
+        std::sort(postings.begin(), postings.end(), ImpactBefore);
+        impact_postings.bytes += bytes;
+        impact_postings.by_word.emplace(term->first, std::move(postings));
+    }
+    return impact_postings;
+}
+
+bool SearchServer::InstallImpactPostings(ImpactPostings impact_postings)
+{
+    if (impact_postings.owner != instance_id_)
+        return false;
+    if (impact_postings.revision != postings_revision_)
+    {
+        // пока копии строились, индекс менялся: копии изменившихся слов отбрасываются, остальные годятся
+        for (auto impact = impact_postings.by_word.begin(); impact != impact_postings.by_word.end();)
+        {
+            const auto changed = posting_revisions_.find(impact->first);
+            if (changed == posting_revisions_.end() || changed->second <= impact_postings.revision)
+            {
+                ++impact;
+                continue;
+            }
+            impact_postings.bytes -= impact->second.capacity() * sizeof(impact->second[0]);
+            impact = impact_postings.by_word.erase(impact);
+        }
+    }
+    impact_postings_ = std::move(impact_postings);
+    UpdateMemoryCounters();
+    return true;
+}
+
+void SearchServer::RebuildImpactPostings(size_t memory_budget_bytes, size_t min_posting_length)
+{
+    InstallImpactPostings(BuildImpactPostings(memory_budget_bytes, min_posting_length));
+}
+
+void SearchServer::ConfigureEmbeddings(size_t dimension, HnswOptions options)
+{
+    if (vectors_ && vectors_->NodeCount() != 0)
+        throw logic_error("Векторы документов уже добавлены"s);
+    vectors_ = make_unique<HnswIndex>(dimension, options);
+    UpdateMemoryCounters();
+}
+
+void SearchServer::AddDocument(int document_id, const string &document, DocumentStatus status, const vector<int> &raiting, const vector<float> &embedding)
+{
+    AddDocument(document_id, document, status, raiting);
+    try
+    {
+        SetEmbeddings({{document_id, embedding}});
+    }
+    catch (...)
+    {
+        RemoveDocument(document_id);
+        throw;
+    }
+}
+
+void SearchServer::PrepareEmbeddings(const vector<pair<int, vector<float>>> &embeddings)
+{
+    if (embeddings.empty())
+        return;
+    set<int> batch_ids;
+    for (const auto &[document_id, embedding] : embeddings)
+    {
+        if (!document_id_list_.count(document_id))
+            throw out_of_range("Документ не найден"s);
+        if (!batch_ids.insert(document_id).second)
+            throw invalid_argument("Вектор документа задан дважды"s);
+    }
+    // первый вектор задает размерность нового графа, но граф заводится, только если подошли все векторы:
+    // отклоненная пачка не должна закрепить размерность
+    unique_ptr<HnswIndex> created;
+    if (!vectors_)
+        created = make_unique<HnswIndex>(embeddings.front().second.size());
+    const HnswIndex &checked = vectors_ ? *vectors_ : *created;
+    for (const auto &[document_id, embedding] : embeddings)
+        checked.CheckVector(embedding);
+    if (created)
+        vectors_ = std::move(created);
+    for (const auto &[document_id, embedding] : embeddings)
+        vectors_->Remove(document_id);
+}
+
+void SearchServer::SetEmbeddings(const vector<pair<int, vector<float>>> &embeddings)
+{
+    PrepareEmbeddings(embeddings);
+    if (!embeddings.empty())
+        vectors_->AddBatch(execution::seq, embeddings);
+    UpdateMemoryCounters();
+}
+
+void SearchServer::SetEmbeddings(const execution::parallel_policy &policy, const vector<pair<int, vector<float>>> &embeddings)
+{
+    PrepareEmbeddings(embeddings);
+    if (!embeddings.empty())
+        vectors_->AddBatch(policy, embeddings);
+    UpdateMemoryCounters();
+}
+
+void SearchServer::EnableDocumentStore(DocumentStoreOptions options)
+{
+    if (!document_id_list_.empty())
+        throw logic_error("Документы уже добавлены без текста"s);
+    store_ = make_unique<DocumentStore>(options);
+    UpdateMemoryCounters();
+}
+
+void SearchServer::AttachDocumentStore(DocumentStore store)
+{
+    store_ = make_unique<DocumentStore>(std::move(store));
+    UpdateMemoryCounters();
+}
+
+void SearchServer::CompactDocumentStore()
+{
+    if (!store_)
+        return;
+    store_->Compact();
+    UpdateMemoryCounters();
+}
+
+string SearchServer::GetDocumentText(int document_id) const
+{
+    if (!store_)
+        throw out_of_range("Хранилище текстов документов не включено"s);
+    return store_->Get(document_id);
+}
+
+MemoryUsage SearchServer::GetMemoryUsage() const
+{
+    MemoryUsage usage;
+    usage.inverted_index = memory_->inverted_index.BytesInUse();
+    usage.forward_index = memory_->forward_index.BytesInUse();
+    usage.vocabulary = memory_->vocabulary.BytesInUse();
+    usage.metadata = memory_->metadata.BytesInUse();
+    usage.impact_postings = memory_->impact_postings;
+    usage.vector_index = memory_->vector_index;
+    usage.document_store = memory_->document_store;
+    return usage;
+}
+
+IndexStats SearchServer::GetStats(size_t top_terms) const
+{
+    // заголовок узла красно-черного дерева libstdc++: цвет и три указателя
+    const size_t tree_node_overhead = 4 * sizeof(void *);
+    // строки до 15 символов хранятся внутри объекта строки
+    const size_t short_string_length = 15;
+
+    IndexStats stats;
+    stats.memory = GetMemoryUsage();
+    stats.document_count = document_id_list_.size();
+    stats.deleted_vectors = vectors_ ? vectors_->NodeCount() - vectors_->Size() : 0;
+    stats.document_store_dead_bytes = store_ ? store_->DeadBytes() : 0;
+
+    // куча с самым коротким из отобранных постингов наверху
+    std::vector<std::pair<size_t, std::string_view>> heaviest;
+    const std::greater<std::pair<size_t, std::string_view>> shorter_first;
+    for (const auto &[word, posting] : documents_)
+    {
+        const size_t length = posting.size();
+        if (length == 0)
+        {
+            ++stats.empty_postings;
+            stats.garbage_bytes += 2 * tree_node_overhead + sizeof(Index::value_type) + sizeof(std::pmr::string);
+            if (word.size() > short_string_length)
+                stats.garbage_bytes += word.size() + 1;
+            continue;
+        }
+        ++stats.vocabulary_size;
+        stats.posting_entries += length;
+        const size_t bucket = std::bit_width(length) - 1;
+        if (stats.posting_length_histogram.size() <= bucket)
+            stats.posting_length_histogram.resize(bucket + 1);
+        ++stats.posting_length_histogram[bucket];
+
+        if (heaviest.size() < top_terms || (top_terms != 0 && length > heaviest.front().first))
+        {
+            heaviest.push_back({length, word});
+            std::push_heap(heaviest.begin(), heaviest.end(), shorter_first);
+            if (heaviest.size() > top_terms)
+            {
+                std::pop_heap(heaviest.begin(), heaviest.end(), shorter_first);
+                heaviest.pop_back();
+            }
+        }
+    }
+    std::sort_heap(heaviest.begin(), heaviest.end(), shorter_first);
+    for (const auto &[length, word] : heaviest)
+        stats.heaviest_terms.push_back({std::string(word), length});
+    return stats;
 }
 
-const map<string_view, double> &SearchServer::GetWordFrequencies(int document_id) const
+const SearchServer::WordFrequencies &SearchServer::GetWordFrequencies(int document_id) const
 {
-    static const map<string_view, double> a;
-    if (document_id_list_.count(document_id))
+    static const WordFrequencies a;
+    // у документа из одних стоп-слов нет записи в прямом индексе
+    const auto word_frequencies = documenis_key_id_.find(document_id);
+    if (word_frequencies != documenis_key_id_.end())
     {
-        return documenis_key_id_.at(document_id);
+        return word_frequencies->second;
     }
     return a;
 }
 
-double SearchServer::CountIDF(const string_view word) const
+DocumentFingerprint SearchServer::GetFingerprint(int document_id) const
+{
+    if (!document_id_list_.count(document_id))
+        throw std::out_of_range("Документ не найден"s);
+    return data_about_documents_.at(document_id).fingerprint;
+}
+
+double SearchServer::CountIDF(const Posting &posting) const
+{
+    return log(1.0 * document_id_list_.size() / posting.size());
+}
+
+void SearchServer::FetchPostings(const Query &query_words, QueryMode mode, QueryPostings &postings) const
+{
+    TRACE_STAGE(TraceStage::POSTING_FETCH);
+    postings.plus_terms.clear();
+    postings.plus.clear();
+    postings.required.clear();
+    postings.pattern_postings.clear();
+    postings.pattern_ends.clear();
+    postings.minus.clear();
+    postings.all_plus_found = !query_words.has_unknown_plus_word;
+    if (mode == QueryMode::ANY)
+    {
+        auto &terms = postings.plus_terms;
+        for (const Term term : query_words.required_terms)
+        {
+            // после удаления документов постинг слова может опустеть, но из индекса слово не уходит
+            if (!term->second.empty())
+                terms.push_back({term, CountIDF(term->second)});
+        }
+        for (size_t i = 0; i < query_words.pattern_terms.size(); ++i)
+        {
+            const Term term = query_words.pattern_terms[i];
+            if (!term->second.empty())
+                terms.push_back({term, query_words.pattern_weights[i] * CountIDF(term->second)});
+        }
+        // слово попадает в запрос несколько раз, если оно есть и само, и в раскрытии шаблона или нечеткого
+        // слова (cat cat*, cat* ca*). Его вклад учитывается один раз, с наибольшим весом. Постинги
+        // складываются в порядке слов, а не адресов: от порядка сложения зависит округление релевантности,
+        // и у реплики или индекса, восстановленного из снимка, она должна выйти той же до последнего бита
+        std::sort(terms.begin(), terms.end(), [](const auto &lhs, const auto &rhs)
+                  { return lhs.first->first < rhs.first->first; });
+        for (const auto &[term, weight] : terms)
+        {
+            if (!postings.plus.empty() && postings.plus.back().first == &term->second)
+                postings.plus.back().second = std::max(postings.plus.back().second, weight);
+            else
+                postings.plus.push_back({&term->second, weight});
+        }
+    }
+    else
+    {
+        for (const Term term : query_words.required_terms)
+        {
+            if (term->second.empty())
+            {
+                postings.all_plus_found = false;
+                continue;
+            }
+            postings.required.push_back({&term->second, CountIDF(term->second)});
+        }
+        size_t pattern_begin = 0;
+        for (const size_t pattern_end : query_words.pattern_ends)
+        {
+            for (size_t i = pattern_begin; i < pattern_end; ++i)
+            {
+                const Posting &posting = query_words.pattern_terms[i]->second;
+                if (!posting.empty())
+                    postings.pattern_postings.push_back({&posting, query_words.pattern_weights[i] * CountIDF(posting)});
+            }
+            if (postings.pattern_postings.size() == (postings.pattern_ends.empty() ? 0 : postings.pattern_ends.back()))
+                postings.all_plus_found = false;
+            else
+                postings.pattern_ends.push_back(postings.pattern_postings.size());
+            pattern_begin = pattern_end;
+        }
+    }
+    for (const Term term : query_words.minus_terms)
+    {
+        if (!term->second.empty())
+        {
+            postings.minus.push_back(&term->second);
+        }
+    }
+}
+
+namespace
+{
+    // Длиннее запросы нечеткого поиска не раскрываются, такие слова с опечатками ищутся точно
+    const size_t MAX_FUZZY_WORD_LENGTH = 32;
+
+    bool IsPattern(std::string_view word)
+    {
+        return word.find_first_of("*?") != std::string_view::npos;
+    }
+
+    // После ~ может стоять только расстояние: cat~, cat~2
+    bool IsFuzzySuffix(std::string_view suffix)
+    {
+        return std::all_of(suffix.begin(), suffix.end(), [](char c)
+                           { return c >= '0' && c <= '9'; });
+    }
+
+    // Символы слова в UTF-8, не больше limit первых: расстояние Левенштейна считается по буквам, а не по байтам
+    void DecodeLetters(std::string_view word, size_t limit, std::vector<char32_t> &letters)
+    {
+        letters.clear();
+        for (size_t pos = 0; pos < word.size() && letters.size() < limit;)
+        {
+            const unsigned char lead = static_cast<unsigned char>(word[pos]);
+            size_t length = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+            length = std::min(length, word.size() - pos);
+            char32_t letter = length == 1 ? lead : lead & (0x7F >> length);
+            for (size_t i = 1; i < length; ++i)
+            {
+                letter = (letter << 6) | (static_cast<unsigned char>(word[pos + i]) & 0x3F);
+            }
+            letters.push_back(letter);
+            pos += length;
+        }
+    }
+
+    // Длина в байтах первых letter_count символов слова
+    size_t Utf8PrefixLength(std::string_view word, size_t letter_count)
+    {
+        size_t pos = 0;
+        for (size_t i = 0; i < letter_count && pos < word.size(); ++i)
+        {
+            ++pos;
+            while (pos < word.size() && (static_cast<unsigned char>(word[pos]) & 0xC0) == 0x80)
+            {
+                ++pos;
+            }
+        }
+        return pos;
+    }
+
+    size_t CodePointLength(std::string_view word, size_t pos)
+    {
+        size_t length = 1;
+        while (pos + length < word.size() && (static_cast<unsigned char>(word[pos + length]) & 0xC0) == 0x80)
+        {
+            ++length;
+        }
+        return length;
+    }
+
+    // '*' - любая последовательность символов, '?' - ровно один символ UTF-8. При несовпадении
+    // откатывается к последней звездочке, поэтому работает за O(|шаблон| * |слово|) без рекурсии
+    bool MatchesPattern(std::string_view pattern, std::string_view word)
+    {
+        size_t p = 0;
+        size_t w = 0;
+        size_t star = std::string_view::npos;
+        size_t star_word = 0;
+        while (w < word.size())
+        {
+            if (p < pattern.size() && pattern[p] == '?')
+            {
+                ++p;
+                w += CodePointLength(word, w);
+            }
+            else if (p < pattern.size() && pattern[p] == '*')
+            {
+                star = p++;
+                star_word = w;
+            }
+            else if (p < pattern.size() && pattern[p] == word[w])
+            {
+                ++p;
+                ++w;
+            }
+            else if (star != std::string_view::npos)
+            {
+                p = star + 1;
+                star_word += CodePointLength(word, star_word);
+                w = star_word;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*')
+        {
+            ++p;
+        }
+        return p == pattern.size();
+    }
+}
+
+void SearchServer::FinishExpansion(Query &query, size_t begin)
 {
-    return log(1.0 * document_id_list_.size() / documents_.at(word).size());
+    if (query.pattern_terms.size() == begin)
+    {
+        query.has_unknown_plus_word = true;
+        return;
+    }
+    query.pattern_ends.push_back(query.pattern_terms.size());
+    query.plus_terms.insert(query.plus_terms.end(), query.pattern_terms.begin() + begin, query.pattern_terms.end());
+}
+
+void SearchServer::ExpandFuzzy(std::string_view word, int max_distance, std::vector<std::pair<Term, int>> &candidates) const
+{
+    // Упорядоченный словарь обходится как бор: строки таблицы Левенштейна для общего с предыдущим словом начала
+    // переиспользуются, а если все значения строки больше max_distance, то ни одно слово с таким началом не подойдет
+    // и весь их диапазон пропускается одним lower_bound. Это пересечение автомата Левенштейна со словарем без
+    // явного построения автомата: просматриваются только начала слов, которые автомат еще может принять
+    std::vector<char32_t> query_letters;
+    DecodeLetters(word, MAX_FUZZY_WORD_LENGTH + 1, query_letters);
+    if (query_letters.size() > MAX_FUZZY_WORD_LENGTH)
+    {
+        if (const auto term = documents_.find(word); term != documents_.end() && !term->second.empty())
+            candidates.push_back({term, 0});
+        return;
+    }
+
+    const size_t width = query_letters.size() + 1;
+    // слово длиннее запроса больше чем на max_distance не подходит, глубже строки не нужны
+    const size_t max_depth = query_letters.size() + max_distance + 1;
+    std::vector<int> rows((max_depth + 1) * width);
+    std::iota(rows.begin(), rows.begin() + width, 0);
+    std::vector<char32_t> previous;
+    std::vector<char32_t> letters;
+    size_t valid_depth = 0;
+
+    auto it = documents_.begin();
+    while (it != documents_.end())
+    {
+        DecodeLetters(it->first, max_depth, letters);
+        size_t common = 0;
+        while (common < valid_depth && common < letters.size() && previous[common] == letters[common])
+        {
+            ++common;
+        }
+
+        bool pruned = false;
+        size_t depth = common + 1;
+        for (; depth <= letters.size(); ++depth)
+        {
+            const int *above = &rows[(depth - 1) * width];
+            int *row = &rows[depth * width];
+            row[0] = static_cast<int>(depth);
+            int row_min = row[0];
+            for (size_t j = 1; j < width; ++j)
+            {
+                row[j] = std::min({above[j] + 1, row[j - 1] + 1, above[j - 1] + (letters[depth - 1] != query_letters[j - 1] ? 1 : 0)});
+                row_min = std::min(row_min, row[j]);
+            }
+            if (row_min > max_distance)
+            {
+                pruned = true;
+                break;
+            }
+        }
+
+        previous.swap(letters);
+        if (pruned)
+        {
+            // все слова, начинающиеся с первых depth букв текущего, дальше max_distance - прыгаем за них
+            valid_depth = depth - 1;
+            std::string successor(it->first.substr(0, Utf8PrefixLength(it->first, depth)));
+            while (!successor.empty() && static_cast<unsigned char>(successor.back()) == 0xFF)
+            {
+                successor.pop_back();
+            }
+            if (successor.empty())
+                break;
+            successor.back() = static_cast<char>(static_cast<unsigned char>(successor.back()) + 1);
+            it = documents_.lower_bound(successor);
+            continue;
+        }
+
+        valid_depth = previous.size();
+        const int distance = rows[previous.size() * width + width - 1];
+        if (distance <= max_distance && !it->second.empty())
+            candidates.push_back({it, distance});
+        ++it;
+    }
+
+    if (candidates.size() > MAX_PATTERN_EXPANSION)
+    {
+        std::stable_sort(candidates.begin(), candidates.end(), [](const auto &lhs, const auto &rhs)
+                         { return lhs.second < rhs.second; });
+        candidates.resize(MAX_PATTERN_EXPANSION);
+    }
+}
+
+bool SearchServer::ExpandPattern(std::string_view pattern, std::vector<Term> &terms) const
+{
+    const std::string_view prefix = pattern.substr(0, pattern.find_first_of("*?"));
+    // без буквального начала кандидатом был бы весь словарь
+    if (prefix.empty())
+        throw invalid_argument("Шаблон должен начинаться с буквы, а не с * или ?"s);
+    const bool prefix_only = prefix.size() + 1 == pattern.size() && pattern.back() == '*';
+
+    // куча из лучших найденных слов, на вершине худшее: с меньшим числом документов, при равенстве - дальше по словарю
+    const auto more_frequent = [](const std::pair<size_t, Term> &lhs, const std::pair<size_t, Term> &rhs)
+    { return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second->first < rhs.second->first; };
+    std::vector<std::pair<size_t, Term>> best;
+    size_t matching = 0;
+    for (auto it = documents_.lower_bound(prefix); it != documents_.end() && it->first.substr(0, prefix.size()) == prefix; ++it)
+    {
+        if (it->second.empty() || (!prefix_only && !MatchesPattern(pattern, it->first)))
+            continue;
+        ++matching;
+        const std::pair<size_t, Term> candidate{it->second.size(), it};
+        if (best.size() < MAX_PATTERN_EXPANSION)
+        {
+            best.push_back(candidate);
+            std::push_heap(best.begin(), best.end(), more_frequent);
+        }
+        else if (more_frequent(candidate, best.front()))
+        {
+            std::pop_heap(best.begin(), best.end(), more_frequent);
+            best.back() = candidate;
+            std::push_heap(best.begin(), best.end(), more_frequent);
+        }
+    }
+    // раскрытие идет в порядке словаря, как и без ограничения
+    std::sort(best.begin(), best.end(), [](const auto &lhs, const auto &rhs)
+              { return lhs.second->first < rhs.second->first; });
+    for (const auto &[frequency, term] : best)
+    {
+        terms.push_back(term);
+    }
+    return matching > best.size();
 }
 
 vector<string> SearchServer::SplitIntoWordsNoStop(const string &text) const
@@ -168,10 +1017,8 @@ vector<string> SearchServer::SplitIntoWordsNoStop(const string &text) const
     {
         if (!IsValidWord(word))
             throw invalid_argument("В слове "s + word + " содержатся спецсимволы"s);
-        if (!(stop_words_.count(word) > 0))
-        {
-            words.push_back(word);
-        }
+        ForEachTerm(word, [&words](std::string_view term)
+                         { words.emplace_back(term); });
     }
     return words;
 }
@@ -185,48 +1032,208 @@ int SearchServer::ComputeAverageRating(const vector<int> &raitings)
     return static_cast<int>(accumulate(raitings.begin(), raitings.end(), 0)) / static_cast<int>(raitings.size());
 }
 
+void SearchServer::Query::Clear()
+{
+    plus_terms.clear();
+    required_terms.clear();
+    pattern_terms.clear();
+    pattern_weights.clear();
+    pattern_ends.clear();
+    minus_terms.clear();
+    has_unknown_plus_word = false;
+    truncated_expansion = false;
+}
+
 void SearchServer::Query::NormalizeVec()
 {
-    if (!plus_words_vec.empty())
+    // слов в запросе единицы, параллельная сортировка тут только тратит время на запуск задач
+    const auto by_word = [](Term lhs, Term rhs)
+    { return lhs->first < rhs->first; };
+    // раскрытия шаблонов уже идут в порядке словаря и не сортируются, чтобы не перемешать границы
+    for (std::vector<Term> *terms : {&plus_terms, &required_terms, &minus_terms})
     {
-        std::sort(execution::par, plus_words_vec.begin(), plus_words_vec.end());
-        plus_words_vec.erase(std::unique(plus_words_vec.begin(), plus_words_vec.end()), plus_words_vec.end());
-    }
-    if (!minus_words_vec.empty())
-    {
-        std::sort(execution::par, minus_words_vec.begin(), minus_words_vec.end());
-        minus_words_vec.erase(std::unique(minus_words_vec.begin(), minus_words_vec.end()), minus_words_vec.end());
+        std::sort(terms->begin(), terms->end(), by_word);
+        terms->erase(std::unique(terms->begin(), terms->end()), terms->end());
     }
 }
 
-SearchServer::Query SearchServer::ParseQueryWord(const std::string_view text) const
+void SearchServer::ParseQuery(const std::string_view text, Query &query) const
 {
     if (text.empty())
     {
         throw invalid_argument("Запрос не может быть пустым"s);
     }
-    Query query;
-    std::vector<std::string_view> words = SplitIntoWordsView(text);
-    query.plus_words_vec.reserve(words.size());
-    query.minus_words_vec.reserve((words.size() / 2));
-    for (std::string_view &word : words)
+    if (!IsValidWord(text))
+        throw std::invalid_argument("Некорректный запрос");
+
+    // строка режется на месте, а слова сразу ищутся в индексе: векторы query переиспользуются и в
+    // установившемся режиме разбор не выделяет память
+    query.Clear();
+    size_t pos = 0;
+    while (pos < text.size())
     {
-        if (word[0] != '-')
+        const size_t space = std::min(text.find(' ', pos), text.size());
+        std::string_view word = text.substr(pos, space - pos);
+        pos = space + 1;
+        if (word.empty())
+            continue;
+
+        const bool is_minus = word[0] == '-';
+        if (is_minus)
+        {
+            word.remove_prefix(1);
+            if (word.empty() || word[0] == '-')
+                throw invalid_argument("В запросе содежатся лишние тире"s);
+        }
+
+        if (IsPattern(word))
+        {
+            // шаблон не стеммится и не режется по пунктуации, только приводится к регистру словаря
+            std::string pattern;
+            analyzer_.FoldPattern(word, pattern);
+            if (is_minus)
+            {
+                query.truncated_expansion |= ExpandPattern(pattern, query.minus_terms);
+                continue;
+            }
+            const size_t pattern_begin = query.pattern_terms.size();
+            query.truncated_expansion |= ExpandPattern(pattern, query.pattern_terms);
+            query.pattern_weights.resize(query.pattern_terms.size(), 1.0);
+            FinishExpansion(query, pattern_begin);
+        }
+        else if (const size_t tilde = word.rfind('~'); tilde != std::string_view::npos && tilde > 0 && IsFuzzySuffix(word.substr(tilde + 1)))
+        {
+            const std::string_view suffix = word.substr(tilde + 1);
+            const int max_distance = suffix.empty() ? 1 : suffix[0] - '0';
+            if (suffix.size() > 1 || max_distance < 1 || max_distance > MAX_FUZZY_DISTANCE)
+                throw invalid_argument("Расстояние нечеткого поиска должно быть от 1 до "s + std::to_string(MAX_FUZZY_DISTANCE));
+            // слово с опечаткой проходит тот же анализ, что и обычное, и раскрывается в близкие слова словаря
+            ForEachTerm(word.substr(0, tilde), [this, &query, is_minus, max_distance](std::string_view text)
+                        {
+                std::vector<std::pair<Term, int>> candidates;
+                ExpandFuzzy(text, max_distance, candidates);
+                const size_t fuzzy_begin = query.pattern_terms.size();
+                for (const auto &[term, distance] : candidates) {
+                    if (is_minus) {
+                        query.minus_terms.push_back(term);
+                        continue;
+                    }
+                    query.pattern_terms.push_back(term);
+                    query.pattern_weights.push_back(1.0 / (1 + distance));
+                }
+                if (!is_minus)
+                    FinishExpansion(query, fuzzy_begin); });
+        }
+        else if (!is_minus)
         {
-            query.plus_words_vec.push_back(word);
+            ForEachTerm(word, [this, &query](std::string_view text)
+                             {
+                const auto term = documents_.find(text);
+                if (term == documents_.end()) {
+                    query.has_unknown_plus_word = true;
+                    return;
+                }
+                query.plus_terms.push_back(term);
+                query.required_terms.push_back(term); });
         }
         else
         {
-            word = word.substr(1);
-            if (word[0] == '-' || word.empty())
-                throw invalid_argument("В запросе содежатся лишние тире"s);
-            if (!stop_words_.count(word))
+            ForEachTerm(word, [this, &query](std::string_view text)
+                             {
+                const auto term = documents_.find(text);
+                if (term != documents_.end())
+                    query.minus_terms.push_back(term); });
+        }
+    }
+    TRACE_STAGE(TraceStage::NORMALIZE);
+    query.NormalizeVec();
+}
+
+uint64_t SearchServer::NextInstanceId()
+{
+    static std::atomic<uint64_t> next_id{1};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+SearchServer::QueryScope::QueryScope(const SearchServer &server, std::string_view raw_query)
+{
+    thread_local QueryWorkspace thread_workspace;
+    if (thread_workspace.busy)
+    {
+        own_workspace_ = std::make_unique<QueryWorkspace>();
+        workspace_ = own_workspace_.get();
+    }
+    else
+    {
+        workspace_ = &thread_workspace;
+    }
+
+    QueryWorkspace &workspace = *workspace_;
+    // разобранный запрос держит итераторы в индекс конкретного сервера и знает только слова, которые
+    // в нем были на момент разбора, поэтому кеш годен, пока не сменился сервер или его словарь
+    if (workspace.cache_owner != server.instance_id_ || workspace.cache_generation != server.generation_)
+    {
+        workspace.cache.clear();
+        workspace.cache_slots.clear();
+        workspace.cache_hand = 0;
+        workspace.cache_owner = server.instance_id_;
+        workspace.cache_generation = server.generation_;
+    }
+
+    if (const auto cached = workspace.cache.find(raw_query); cached != workspace.cache.end())
+    {
+        CachedQuery &slot = workspace.cache_slots[cached->second];
+        if (slot.query.truncated_expansion && slot.revision != server.revision_)
+        {
+            server.ParseQuery(raw_query, workspace.query);
+            // обмен вместо копии: старый разбор отдает свои векторы под следующий
+            std::swap(slot.query, workspace.query);
+            slot.revision = server.revision_;
+        }
+        slot.referenced = true;
+        query_ = &slot.query;
+    }
+    else
+    {
+        server.ParseQuery(raw_query, workspace.query);
+        // полный кеш не сбрасывается целиком: стрелка CLOCK вытесняет один давно не встречавшийся запрос
+        size_t index = workspace.cache_slots.size();
+        if (index < QUERY_CACHE_SIZE)
+        {
+            workspace.cache_slots.emplace_back();
+            workspace.cache.emplace(raw_query, index);
+        }
+        else
+        {
+            while (workspace.cache_slots[workspace.cache_hand].referenced)
             {
-                query.minus_words_vec.push_back(word);
+                workspace.cache_slots[workspace.cache_hand].referenced = false;
+                workspace.cache_hand = (workspace.cache_hand + 1) % QUERY_CACHE_SIZE;
             }
+            index = workspace.cache_hand;
+            workspace.cache_hand = (workspace.cache_hand + 1) % QUERY_CACHE_SIZE;
+            // узел вытесненного запроса вставляется обратно с новым ключом: ни узел, ни строка ключа
+            // заново не выделяются
+            auto node = workspace.cache.extract(workspace.cache_slots[index].text);
+            node.key().assign(raw_query);
+            workspace.cache.insert(std::move(node));
         }
+        CachedQuery &slot = workspace.cache_slots[index];
+        slot.text.assign(raw_query);
+        // разобранный запрос переезжает в слот, а векторы вытесненного остаются для следующего разбора
+        std::swap(slot.query, workspace.query);
+        slot.revision = server.revision_;
+        slot.referenced = false;
+        query_ = &slot.query;
     }
-    return query;
+    workspace.arena.Begin(server.resources_.query);
+    workspace.busy = true;
+}
+
+SearchServer::QueryScope::~QueryScope()
+{
+    workspace_->arena.Reset();
+    workspace_->busy = false;
 }
 
 bool SearchServer::IsValidWord(const std::string_view word)
@@ -7,34 +7,107 @@
 #include <map>
 #include <cmath>
 #include <numeric>
+#include <optional>
 #include <tuple>
 #include <deque>
 #include <stdexcept>
 #include <algorithm>
+#include <atomic>
 #include <execution>
+#include <iosfwd>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include "document.h"
-#include "concurrent_map.h"
+#include "document_store.h"
+#include "fingerprint.h"
+#include "index_stats.h"
 #include "log_duration.h"
+#include "memory_resources.h"
+#include "scoring.h"
+#include "search_page.h"
+#include "stop_words.h"
+#include "text_analysis.h"
+#include "trace.h"
+#include "vector_index.h"
 
 #define MAX_RESULT_DOCUMENT_COUNT 5
-#define SCOPE 1e-6
+#define QUERY_CACHE_SIZE 1024
+#define MAX_PATTERN_EXPANSION 64
+#define MAX_FUZZY_DISTANCE 2
+#define PAGE_WINDOW_PAGES 4
+#define QUERY_ARENA_BYTES (64 * 1024)
+#define QUERY_ARENA_MAX_BYTES (16 * 1024 * 1024)
+#define IMPACT_MIN_POSTING_LENGTH 1024
+#define HYBRID_CANDIDATES 100
+#define HYBRID_RANK_CONSTANT 60
+
+// Копии постингов частых слов, упорядоченные по убыванию TF: лучшие документы однословного запроса
+// находятся чтением только головы такого списка. owner и revision - сервер и состояние его постингов,
+// по которым копии построены
+struct ImpactPostings
+{
+    std::unordered_map<std::string_view, std::vector<std::pair<int, double>>> by_word;
+    size_t bytes = 0;
+    uint64_t owner = 0;
+    uint64_t revision = 0;
+};
+
+// Гибридная выдача: сколько кандидатов брать из выдачи по словам и из ближайших по вектору и с какими весами
+// сливать их места. rank_constant сглаживает разницу между первыми местами и остальными
+struct HybridOptions
+{
+    double lexical_weight = 1;
+    double vector_weight = 1;
+    double rank_constant = HYBRID_RANK_CONSTANT;
+    size_t candidates = HYBRID_CANDIDATES;
+    size_t count = MAX_RESULT_DOCUMENT_COUNT;
+    QueryMode mode = QueryMode::ANY;
+};
 
 class SearchServer
 {
 
 public:
-    explicit SearchServer(const std::string &stop_words);
+    // analyzer задает нормализацию слов документов, запросов и стоп-слов; по умолчанию слова берутся как есть.
+    // resources - откуда брать память под индекс и под временные данные запросов
+    explicit SearchServer(const std::string &stop_words, TextAnalyzer analyzer = TextAnalyzer(), MemoryResources resources = MemoryResources());
     template <typename ContainerInput>
-    explicit SearchServer(const ContainerInput &stop_words);
+    explicit SearchServer(const ContainerInput &stop_words, TextAnalyzer analyzer = TextAnalyzer(), MemoryResources resources = MemoryResources());
 
     void AddDocument(int document_id, const std::string &document, DocumentStatus status, const std::vector<int> &raiting);
 
+    // Заменяет текст, статус и рейтинг документа, а если документа нет - добавляет его. Постинги меняются
+    // только у слов, которые появились, исчезли или сменили частоту. Если в хранилище текстов лежит тот же текст,
+    // меняются только статус и рейтинг
+    void UpdateDocument(int document_id, const std::string &document, DocumentStatus status, const std::vector<int> &raiting);
+
+    // Меняют только метаданные документа, индекс не трогается. Бросают std::out_of_range, если документа нет
+    void SetDocumentStatus(int document_id, DocumentStatus status);
+    // rating - итоговый рейтинг документа, как в Document::rating
+    void SetRating(int document_id, int rating);
+
     int GetDocumentCount() const;
 
     template <typename ExecutionPolicy, typename Predicate>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, Predicate predicat) const;
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, QueryMode mode, Predicate predicat) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, QueryMode mode) const
+    {
+        return FindTopDocuments(policy, raw_query, mode, [](int document_id, DocumentStatus status, int rating)
+                                { return status == DocumentStatus::ACTUAL; });
+    }
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, QueryMode mode) const
+    {
+        return FindTopDocuments(std::execution::seq, raw_query, mode);
+    }
+    template <typename ExecutionPolicy, typename Predicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, Predicate predicat) const
+    {
+        return FindTopDocuments(policy, raw_query, QueryMode::ANY, predicat);
+    }
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, DocumentStatus status_in) const
     {
@@ -60,60 +133,368 @@ public:
         return FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
     }
 
+    // Страница из page_size документов, идущих в выдаче после курсора after. Отбираются только лучшие
+    // page_size документов за курсором, предыдущие страницы не сортируются заново
+    template <typename ExecutionPolicy, typename Predicate>
+    SearchPage FindPage(ExecutionPolicy &&policy, const std::string_view raw_query, const SearchCursor &after, size_t page_size, QueryMode mode, Predicate predicat) const;
+    // То же для фильтра по статусу. Поток запоминает окно из PAGE_WINDOW_PAGES страниц, и следующие
+    // страницы того же запроса отдаются из него без повторного поиска, пока индекс не изменился
+    SearchPage FindPage(const std::string_view raw_query, const SearchCursor &after, size_t page_size, DocumentStatus status = DocumentStatus::ACTUAL, QueryMode mode = QueryMode::ANY) const;
+
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string &raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy &, const std::string &raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy &policy, const std::string &raw_query, int document_id) const;
 
-    std::set<int>::const_iterator begin() const;
+    // Разбирает запрос один раз и сопоставляет его с каждым документом из списка, например для подсветки сниппетов
+    template <typename ExecutionPolicy>
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, const std::vector<int> &document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(const std::string_view raw_query, const std::vector<int> &document_ids) const
+    {
+        return MatchDocuments(std::execution::seq, raw_query, document_ids);
+    }
+
+    // частоты слов документа
+    using WordFrequencies = std::pmr::map<std::string_view, double>;
+
+    std::pmr::set<int>::const_iterator begin() const;
 
-    std::set<int>::const_iterator end() const;
+    std::pmr::set<int>::const_iterator end() const;
 
-    const std::map<std::string_view, double> &GetWordFrequencies(int document_id) const;
+    const WordFrequencies &GetWordFrequencies(int document_id) const;
+
+    DocumentFingerprint GetFingerprint(int document_id) const;
 
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy &, int document_id);
     void RemoveDocument(const std::execution::parallel_policy &policy, int document_id);
 
+    // Строит упорядоченные по вкладу копии постингов длиной от min_posting_length, начиная с самых длинных,
+    // пока они умещаются в memory_budget_bytes. Индекс только читается, поэтому построение может идти
+    // в фоновом потоке одновременно с поиском
+    ImpactPostings BuildImpactPostings(size_t memory_budget_bytes, size_t min_posting_length = IMPACT_MIN_POSTING_LENGTH) const;
+    // Подключает построенные копии, кроме копий слов, чьи постинги с тех пор изменились. Возвращает false,
+    // если копии построены другим сервером. Подключенные копии правятся на месте при изменении документов
+    bool InstallImpactPostings(ImpactPostings impact_postings);
+    void RebuildImpactPostings(size_t memory_budget_bytes, size_t min_posting_length = IMPACT_MIN_POSTING_LENGTH);
+    size_t GetImpactPostingsBytes() const { return memory_->impact_postings; }
+
+    // Векторы документов для семантического поиска. Размерность и настройки графа задаются до первого вектора,
+    // иначе размерность берется у первого добавленного. Бросает std::logic_error, если векторы уже есть.
+    // Векторы живут только в памяти: в снимок и журнал они не попадают
+    void ConfigureEmbeddings(size_t dimension, HnswOptions options = HnswOptions());
+    // Добавляет документ вместе с его вектором; если вектор не подошел, документ не добавляется
+    void AddDocument(int document_id, const std::string &document, DocumentStatus status, const std::vector<int> &raiting, const std::vector<float> &embedding);
+    // Задает или заменяет векторы добавленных документов. Параллельная версия строит связи графа в несколько потоков.
+    // Бросает std::out_of_range, если документа нет, и std::invalid_argument на неподходящем векторе, ничего не меняя.
+    // UpdateDocument вектор не трогает, RemoveDocument удаляет его вместе с документом
+    void SetEmbeddings(const std::vector<std::pair<int, std::vector<float>>> &embeddings);
+    void SetEmbeddings(const std::execution::parallel_policy &policy, const std::vector<std::pair<int, std::vector<float>>> &embeddings);
+    bool HasEmbedding(int document_id) const { return vectors_ && vectors_->Contains(document_id); }
+
+    // Хранилище исходных текстов документов. EnableDocumentStore заводит пустое хранилище, и дальше AddDocument
+    // и UpdateDocument кладут в него текст, а RemoveDocument удаляет. Бросает std::logic_error, если документы
+    // уже есть: их текстов уже не получить. Снимок и журнал тексты не хранят, хранилище сохраняется своим Save
+    void EnableDocumentStore(DocumentStoreOptions options = DocumentStoreOptions());
+    // Подключает готовое хранилище, например открытое DocumentStore::Open рядом со снимком или собранное
+    // параллельным AddBatch. Тексты должны соответствовать документам сервера, это не проверяется.
+    // Если текст добавляемого документа в хранилище уже есть, но другой, он заменяется
+    void AttachDocumentStore(DocumentStore store);
+    // Освобождает место текстов удаленных и замененных документов, см. IndexStats::document_store_dead_bytes
+    void CompactDocumentStore();
+    const DocumentStore *GetDocumentStore() const { return store_.get(); }
+    // Бросает std::out_of_range, если хранилища нет или в нем нет текста документа
+    std::string GetDocumentText(int document_id) const;
+
+    // Память по структурам сервера: только читает атомарные счетчики, поэтому годится для частого опроса
+    // мониторингом из другого потока, в том числе одновременно с изменением сервера
+    MemoryUsage GetMemoryUsage() const;
+    // Память и форма индекса: размер словаря, гистограмма длин постингов, top_terms самых длинных постингов
+    // и мусор после удалений. Один проход по словарю, без обхода постингов. Словарь при этом читается,
+    // поэтому, как и поиск, GetStats нельзя вызывать одновременно с изменением сервера
+    IndexStats GetStats(size_t top_terms = INDEX_STATS_TOP_TERMS) const;
+
+    // count ближайших к query_vector по косинусной близости документов, прошедших predicat; relevance - близость.
+    // Поиск приближенный, фильтр проверяется при обходе графа
+    template <typename Predicate>
+    std::vector<Document> FindNearestDocuments(const std::vector<float> &query_vector, Predicate predicat, size_t count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindNearestDocuments(const std::vector<float> &query_vector, DocumentStatus status_in = DocumentStatus::ACTUAL, size_t count = MAX_RESULT_DOCUMENT_COUNT) const
+    {
+        return FindNearestDocuments(query_vector, [status_in](int document_id, DocumentStatus status, int rating)
+                                    { return status == status_in; }, count);
+    }
+
+    // Гибридная выдача: лучшие по TF-IDF и ближайшие по вектору кандидаты, слитые по местам в обоих списках
+    // (reciprocal rank fusion). relevance - сумма weight / (rank_constant + место) по спискам, где документ есть
+    template <typename Predicate>
+    std::vector<Document> FindHybridDocuments(const std::string_view raw_query, const std::vector<float> &query_vector, Predicate predicat, const HybridOptions &options = HybridOptions()) const;
+    std::vector<Document> FindHybridDocuments(const std::string_view raw_query, const std::vector<float> &query_vector, DocumentStatus status_in = DocumentStatus::ACTUAL, const HybridOptions &options = HybridOptions()) const
+    {
+        return FindHybridDocuments(raw_query, query_vector, [status_in](int document_id, DocumentStatus status, int rating)
+                                   { return status == status_in; }, options);
+    }
+
 private:
+    friend void WriteSnapshot(const SearchServer &search_server, uint64_t lsn, std::ostream &output);
+    friend uint64_t ReadSnapshot(std::istream &input, SearchServer &search_server);
+    // реплика узла NUMA получает те же стоп-слова и анализатор, что и исходный сервер
+    friend class NumaReplicas;
+
+    using Index = std::pmr::map<std::string_view, Posting>;
+    // слово запроса, уже найденное в индексе; итераторы std::map не инвалидируются при добавлении документов
+    using Term = Index::const_iterator;
+
     struct Query
     {
-        std::vector<std::string_view> plus_words_vec;
-        std::vector<std::string_view> minus_words_vec;
+        // все плюс-термы вместе с раскрытыми шаблонами, для режима ANY и сопоставления с документом
+        std::vector<Term> plus_terms;
+        // обычные плюс-слова, в режиме ALL каждое обязано быть в документе
+        std::vector<Term> required_terms;
+        // раскрытия шаблонов (cat*, c?t) и нечетких слов (cat~1) подряд; pattern_ends - конец каждого из них,
+        // в режиме ALL документ обязан содержать хотя бы один терм каждого. pattern_weights - множитель IDF
+        // каждого раскрытия: 1 для шаблонов, для нечетких слов убывает с расстоянием до слова запроса
+        std::vector<Term> pattern_terms;
+        std::vector<double> pattern_weights;
+        std::vector<size_t> pattern_ends;
+        std::vector<Term> minus_terms;
+        bool has_unknown_plus_word = false;
+        // какой-то шаблон раскрылся не во все подходящие слова: выбор самых частых зависит от числа
+        // документов у слов, поэтому такой разбор устаревает при любом изменении индекса
+        bool truncated_expansion = false;
 
+        void Clear();
         void NormalizeVec();
     };
 
+    // постинги и IDF слов запроса, найденные в индексе. Для режима ANY заполняется plus,
+    // для ALL - required и pattern_postings с границами шаблонов в pattern_ends
+    struct QueryPostings
+    {
+        // слова ANY-запроса с весами до слияния повторов, буфер переиспользуется между запросами
+        std::vector<std::pair<Term, double>> plus_terms;
+        std::vector<std::pair<const Posting *, double>> plus;
+        std::vector<std::pair<const Posting *, double>> required;
+        std::vector<std::pair<const Posting *, double>> pattern_postings;
+        std::vector<size_t> pattern_ends;
+        std::vector<const Posting *> minus;
+        bool all_plus_found = true;
+    };
+
+    struct StringHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view text) const { return std::hash<std::string_view>{}(text); }
+    };
+
+    // Запрос в кеше разобранных. referenced - бит CLOCK: выставляется при попадании, а стрелка вытеснения
+    // сбрасывает его и пропускает слот; вытесняется первый слот, к которому не обращались с прошлого оборота
+    struct CachedQuery
+    {
+        std::string text;
+        Query query;
+        // revision_ сервера на момент разбора, нужна запросам с усеченным раскрытием шаблона
+        uint64_t revision = 0;
+        bool referenced = false;
+    };
+
+    // Буферы, которые поток переиспользует от запроса к запросу, чтобы в установившемся режиме разбор
+    // и подсчет релевантности не выделяли память. Здесь же кеш разобранных частых запросов и арена
+    // для остальных временных данных запроса, которая очищается по его окончании
+    struct QueryWorkspace
+    {
+        Query query;
+        QueryArena arena{QUERY_ARENA_BYTES, QUERY_ARENA_MAX_BYTES};
+        QueryPostings postings;
+        ScoreAccumulator document_to_relevance;
+        MergeBuffers buffer;
+        ScoreAccumulator pattern_scores;
+        BlockMaxBuffers block_max;
+        // не больше QUERY_CACHE_SIZE слотов; cache - текст запроса -> номер слота
+        std::vector<CachedQuery> cache_slots;
+        std::unordered_map<std::string, size_t, StringHash, std::equal_to<>> cache;
+        size_t cache_hand = 0;
+        uint64_t cache_owner = 0;
+        uint64_t cache_generation = 0;
+        bool busy = false;
+    };
+
+    // Захватывает буферы потока на время одного запроса и отдает разобранный запрос, из кеша или свежий.
+    // Если буферы уже заняты (поиск вызван из предиката другого поиска), работает на собственных
+    class QueryScope
+    {
+    public:
+        QueryScope(const SearchServer &server, std::string_view raw_query);
+        QueryScope(const QueryScope &) = delete;
+        QueryScope &operator=(const QueryScope &) = delete;
+        ~QueryScope();
+
+        const Query &GetQuery() const { return *query_; }
+        QueryWorkspace &Workspace() { return *workspace_; }
+        std::pmr::memory_resource *Arena() { return workspace_->arena.Resource(); }
+
+    private:
+        std::unique_ptr<QueryWorkspace> own_workspace_;
+        QueryWorkspace *workspace_;
+        const Query *query_ = nullptr;
+    };
+
     struct MetaDataOfDocument
     {
         int raiting;
         DocumentStatus status;
+        DocumentFingerprint fingerprint;
     };
-    std::map<std::string_view, std::map<int, double>> documents_;
-    std::set<std::string_view> stop_words_;
-    std::map<int, MetaDataOfDocument> data_about_documents_;
-    std::map<int, std::map<std::string_view, double>> documenis_key_id_;
-    std::set<int> document_id_list_;
-    std::set<std::string, std::less<>> content_;
 
-    double CountIDF(const std::string_view word) const;
+    // Считающие ресурсы, через которые структуры индекса берут память, для GetMemoryUsage. Обратный индекс
+    // считается поверх resources.index, остальные - поверх ресурса по умолчанию. Лежат в куче, чтобы адрес,
+    // запомненный аллокаторами контейнеров, не менялся при перемещении сервера
+    struct MemoryAccounting
+    {
+        explicit MemoryAccounting(std::pmr::memory_resource *index) : inverted_index(index) {}
+
+        CountingResource inverted_index;
+        CountingResource forward_index;
+        CountingResource vocabulary;
+        CountingResource metadata;
+        // собственный учет копий постингов, графа векторов и хранилища текстов: пишет поток, меняющий
+        // сервер, а GetMemoryUsage читает из любого
+        std::atomic<size_t> impact_postings = 0;
+        std::atomic<size_t> vector_index = 0;
+        std::atomic<size_t> document_store = 0;
+    };
+
+    MemoryResources resources_;
+    std::unique_ptr<MemoryAccounting> memory_;
+    Index documents_;
+    StopWordSet stop_words_;
+    // метаданные читаются для каждого кандидата выдачи и меняются модерацией, поэтому хеш-таблица
+    std::pmr::unordered_map<int, MetaDataOfDocument> data_about_documents_;
+    std::pmr::map<int, WordFrequencies> documenis_key_id_;
+    std::pmr::set<int> document_id_list_;
+    std::pmr::set<std::pmr::string, std::less<>> content_;
+    TextAnalyzer analyzer_;
+    const uint64_t instance_id_ = NextInstanceId();
+    // меняется, когда у слова появляется первый документ: новое слово или слово, все документы которого
+    // удалялись. Раскрытия шаблонов и нечетких слов берут только слова с документами, поэтому по нему
+    // кеш разобранных запросов понимает, что устарел
+    uint64_t generation_ = 0;
+    // меняется при любом изменении индекса, по нему устаревает окно страниц выдачи
+    uint64_t revision_ = 0;
+    // меняется при изменении постингов; для каждого слова помнится, когда изменился его постинг, и копии,
+    // построенные в фоне, при подключении теряют только слова, изменившиеся после построения
+    uint64_t postings_revision_ = 0;
+    std::pmr::unordered_map<std::string_view, uint64_t> posting_revisions_;
+    ImpactPostings impact_postings_;
+    // граф векторов документов, появляется с первым вектором
+    std::unique_ptr<HnswIndex> vectors_;
+    // исходные тексты документов, если хранилище включено
+    std::unique_ptr<DocumentStore> store_;
+
+    static uint64_t NextInstanceId();
+
+    double CountIDF(const Posting &posting) const;
+
+    void AddStopWord(std::string_view word);
+
+    // Добавляет документ из снимка: частоты слов уже посчитаны, текст заново не разбирается
+    void RestoreDocument(int document_id, DocumentStatus status, int rating, const std::vector<std::pair<std::string_view, double>> &word_frequencies);
 
     std::vector<std::string> SplitIntoWordsNoStop(const std::string &text) const;
 
+    bool IsStopWord(std::string_view word) const
+    {
+        return stop_words_.Contains(word);
+    }
+
+    // Передает в callback термы одного слова документа или запроса без стоп-слов: само слово или результат анализатора
+    template <typename Callback>
+    void ForEachTerm(std::string_view word, Callback callback) const;
+
     static int ComputeAverageRating(const std::vector<int> &raitings);
 
-    Query ParseQueryWord(const std::string_view text) const;
+    // Проверяет векторы до изменения индекса и убирает старые векторы этих документов
+    void PrepareEmbeddings(const std::vector<std::pair<int, std::vector<float>>> &embeddings);
+
+    // Слово словаря, равное word; заводится, если его еще нет
+    std::string_view InternWord(std::string_view word);
+    // Переносит размеры копий постингов, графа векторов и хранилища в счетчики memory_ для GetMemoryUsage.
+    // Вызывается в конце каждого изменения, которое может их поменять
+    void UpdateMemoryCounters();
+
+    // TF документа в постинге слова сменился с old_tf на new_tf, 0 - документа в постинге нет.
+    // Упорядоченная по вкладу копия постинга правится на месте
+    void UpdateImpact(std::string_view word, int document_id, double old_tf, double new_tf);
+
+    void ParseQuery(const std::string_view text, Query &query) const;
 
     static bool IsValidWord(const std::string_view word);
 
+    // Полный порядок выдачи: ступень релевантности RelevanceKey, затем рейтинг, затем id. Сравнение с допуском
+    // SCOPE не транзитивно, и курсор по нему мог бы пропускать или повторять документы на границе страниц
+    static bool RanksAbove(int64_t lhs_key, int lhs_rating, int lhs_id, const Document &rhs)
+    {
+        const int64_t rhs_key = RelevanceKey(rhs.relevance);
+        if (lhs_key != rhs_key)
+            return lhs_key > rhs_key;
+        if (lhs_rating != rhs.rating)
+            return lhs_rating > rhs.rating;
+        return lhs_id < rhs.id;
+    }
+    static bool IsMoreRelevant(const Document &lhs, const Document &rhs)
+    {
+        return RanksAbove(RelevanceKey(lhs.relevance), lhs.rating, lhs.id, rhs);
+    }
+
+    static bool IsAfterCursor(const SearchCursor &after, const Document &document)
+    {
+        return after.IsStart() || RanksAbove(after.relevance_key_, after.last_.rating, after.last_.id, document);
+    }
+
+    // Общая часть FindTopDocuments и FindPage: лучшие count документов после курсора after
+    template <typename ExecutionPolicy, typename Predicate>
+    std::vector<Document> FindRankedDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, QueryMode mode, Predicate &predicat, size_t count, const SearchCursor &after) const;
+
+    void FetchPostings(const Query &query_words, QueryMode mode, QueryPostings &postings) const;
+
+    // Добавляет в terms в порядке словаря слова, подходящие под шаблон: если их больше MAX_PATTERN_EXPANSION,
+    // то столько слов с наибольшим числом документов. Словарь упорядочен, поэтому кандидаты - только диапазон
+    // слов с буквальным началом шаблона. Возвращает true, если подходящие слова вошли не все.
+    // Бросает std::invalid_argument, если шаблон начинается с * или ?
+    bool ExpandPattern(std::string_view pattern, std::vector<Term> &terms) const;
+
+    // Кладет в candidates слова словаря на расстоянии Левенштейна не больше max_distance от word вместе с расстоянием,
+    // не больше MAX_PATTERN_EXPANSION ближайших
+    void ExpandFuzzy(std::string_view word, int max_distance, std::vector<std::pair<Term, int>> &candidates) const;
+
+    // Добавляет в запрос раскрытие шаблона или нечеткого слова, лежащее в конце query.pattern_terms начиная с begin
+    static void FinishExpansion(Query &query, size_t begin);
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchParsedQuery(const Query &query, int document_id) const;
+
+    // Однословный запрос без минус-слов, для слова которого есть упорядоченная по вкладу копия постинга:
+    // кладет в matched_documents кандидатов, прочитав только голову копии, и возвращает true
     template <typename Predicat>
-    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy &policy, const Query &query_words, Predicat predicat) const;
+    bool FindTopByImpact(const Query &query_words, QueryMode mode, Predicat &predicat, size_t count, const SearchCursor &after, std::pmr::vector<Document> &matched_documents) const;
+
+    // Кладет в matched_documents документы накопителя, прошедшие курсор и предикат. Если по максимумам блоков
+    // виден порог, ниже которого документы в лучшие count не попадут, сначала проверяются только кандидаты
+    // не ниже порога; полный проход нужен, только если из них фильтр пропустил меньше count
     template <typename Predicat>
-    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy &policy, const Query &query_words, Predicat predicat) const;
+    void FilterDocuments(const ScoreAccumulator &document_to_relevance, Predicat &predicat, const SearchCursor &after, size_t count, BlockMaxBuffers &buffers, std::pmr::vector<Document> &matched_documents) const;
+
+    // Кладут в matched_documents кандидатов в выдачу; временные данные берутся из арены запроса
+    template <typename Predicat>
+    void FindAllDocumentsIntersect(const Query &query_words, QueryWorkspace &workspace, Predicat &predicat, const SearchCursor &after, size_t count, std::pmr::vector<Document> &matched_documents) const;
+    template <typename Predicat>
+    void FindAllDocuments(const std::execution::parallel_policy &policy, const Query &query_words, QueryWorkspace &workspace, Predicat &predicat, const SearchCursor &after, size_t count, std::pmr::vector<Document> &matched_documents) const;
+    template <typename Predicat>
+    void FindAllDocuments(const std::execution::sequenced_policy &policy, const Query &query_words, QueryWorkspace &workspace, Predicat &predicat, const SearchCursor &after, size_t count, std::pmr::vector<Document> &matched_documents) const;
 };
 
 template <typename ContainerInput>
-SearchServer::SearchServer(const ContainerInput &stop_words)
-    : documents_(), stop_words_(), data_about_documents_()
+SearchServer::SearchServer(const ContainerInput &stop_words, TextAnalyzer analyzer, MemoryResources resources)
+    : resources_(resources), memory_(std::make_unique<MemoryAccounting>(resources.index)), documents_(&memory_->inverted_index), stop_words_(),
+      data_about_documents_(&memory_->metadata), documenis_key_id_(&memory_->forward_index), document_id_list_(&memory_->metadata),
+      content_(&memory_->vocabulary), analyzer_(analyzer), posting_revisions_(&memory_->inverted_index)
 {
 
     for (const std::string &word : stop_words)
@@ -123,104 +504,360 @@ SearchServer::SearchServer(const ContainerInput &stop_words)
             if (!IsValidWord(word))
                 throw std::invalid_argument("Стоп слова содержат недопустимые символы");
         }
-        stop_words_.insert(std::string_view(*content_.insert(word).first));
+        AddStopWord(word);
     }
 }
 
+template <typename Callback>
+void SearchServer::ForEachTerm(std::string_view word, Callback callback) const
+{
+    if (analyzer_.IsIdentity())
+    {
+        if (!IsStopWord(word))
+            callback(word);
+        return;
+    }
+    analyzer_.ForEachTerm(word, [this](std::string_view token)
+                          { return IsStopWord(token); }, callback);
+}
+
 template <typename ExecutionPolicy, typename Predicate>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, Predicate predicat) const
-{
-    if (!IsValidWord(raw_query))
-        throw std::invalid_argument("Некорректный запрос");
-    std::vector<Document> matched_documents;
-    Query query = ParseQueryWord(raw_query);
-    query.NormalizeVec();
-    matched_documents = std::move(FindAllDocuments(policy, query, predicat));
-
-    std::sort(policy, matched_documents.begin(), matched_documents.end(),
-              [](const Document &lhs, const Document &rhs)
-              {
-                  if ((std::abs(lhs.relevance - rhs.relevance)) < SCOPE)
-                  {
-                      return lhs.rating > rhs.rating;
-                  }
-                  return lhs.relevance > rhs.relevance;
-              });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT)
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, QueryMode mode, Predicate predicat) const
+{
+    return FindRankedDocuments(policy, raw_query, mode, predicat, MAX_RESULT_DOCUMENT_COUNT, SearchCursor());
+}
+
+template <typename ExecutionPolicy, typename Predicate>
+SearchPage SearchServer::FindPage(ExecutionPolicy &&policy, const std::string_view raw_query, const SearchCursor &after, size_t page_size, QueryMode mode, Predicate predicat) const
+{
+    if (page_size == 0)
+        throw std::invalid_argument("Размер страницы должен быть больше нуля");
+    // на один документ больше, чтобы знать, есть ли следующая страница
+    SearchPage page;
+    page.documents = FindRankedDocuments(policy, raw_query, mode, predicat, page_size + 1, after);
+    page.has_more = page.documents.size() > page_size;
+    if (page.has_more)
+        page.documents.pop_back();
+    page.next = page.documents.empty() ? after : SearchCursor::After(page.documents.back());
+    return page;
+}
+
+template <typename ExecutionPolicy, typename Predicate>
+std::vector<Document> SearchServer::FindRankedDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, QueryMode mode, Predicate &predicat, size_t count, const SearchCursor &after) const
+{
+    std::optional<QueryScope> scope;
+    {
+        TRACE_STAGE(TraceStage::PARSE);
+        scope.emplace(*this, raw_query);
+    }
+    // кандидаты живут в арене запроса, из кучи выделяется только сам ответ
+    std::pmr::vector<Document> matched_documents(scope->Arena());
+    if (!FindTopByImpact(scope->GetQuery(), mode, predicat, count, after, matched_documents))
     {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+        if (mode == QueryMode::ALL)
+            FindAllDocumentsIntersect(scope->GetQuery(), scope->Workspace(), predicat, after, count, matched_documents);
+        else
+            FindAllDocuments(policy, scope->GetQuery(), scope->Workspace(), predicat, after, count, matched_documents);
     }
-    return matched_documents;
+
+    TRACE_STAGE(TraceStage::SORT);
+    SelectTopDocuments(policy, matched_documents, count, IsMoreRelevant);
+    return std::vector<Document>(matched_documents.begin(), matched_documents.end());
+}
+
+template <typename Predicate>
+std::vector<Document> SearchServer::FindNearestDocuments(const std::vector<float> &query_vector, Predicate predicat, size_t count) const
+{
+    if (!vectors_)
+        return {};
+    const std::vector<VectorMatch> matches = vectors_->Search(query_vector, count, [this, &predicat](int document_id)
+                                                              {
+        const MetaDataOfDocument &meta_data = data_about_documents_.at(document_id);
+        return predicat(document_id, meta_data.status, meta_data.raiting); });
+    std::vector<Document> result;
+    result.reserve(matches.size());
+    for (const VectorMatch &match : matches)
+    {
+        const MetaDataOfDocument &meta_data = data_about_documents_.at(match.id);
+        result.emplace_back(match.id, match.similarity, meta_data.raiting, meta_data.status);
+    }
+    return result;
+}
+
+template <typename Predicate>
+std::vector<Document> SearchServer::FindHybridDocuments(const std::string_view raw_query, const std::vector<float> &query_vector, Predicate predicat, const HybridOptions &options) const
+{
+    const size_t candidates = std::max(options.candidates, options.count);
+    const std::vector<Document> lexical = FindRankedDocuments(std::execution::seq, raw_query, options.mode, predicat, candidates, SearchCursor());
+    const std::vector<Document> semantic = FindNearestDocuments(query_vector, predicat, candidates);
+
+    // сливаются места, а не оценки: TF-IDF и косинусная близость несоизмеримы, а места не нужно нормировать
+    std::vector<Document> fused(lexical);
+    for (size_t rank = 0; rank < fused.size(); ++rank)
+        fused[rank].relevance = options.lexical_weight / (options.rank_constant + rank + 1);
+    for (size_t rank = 0; rank < semantic.size(); ++rank)
+    {
+        const double score = options.vector_weight / (options.rank_constant + rank + 1);
+        const auto lexical_end = fused.begin() + lexical.size();
+        const auto same = std::find_if(fused.begin(), lexical_end, [&semantic, rank](const Document &document)
+                                       { return document.id == semantic[rank].id; });
+        if (same != lexical_end)
+        {
+            same->relevance += score;
+        }
+        else
+        {
+            fused.push_back(semantic[rank]);
+            fused.back().relevance = score;
+        }
+    }
+    SelectTopDocuments(std::execution::seq, fused, options.count, IsMoreRelevant);
+    return fused;
+}
+
+template <typename ExecutionPolicy>
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments(ExecutionPolicy &&policy, const std::string_view raw_query, const std::vector<int> &document_ids) const
+{
+    for (const int document_id : document_ids)
+    {
+        if (!document_id_list_.count(document_id))
+            throw std::out_of_range("Документ не найден");
+    }
+
+    QueryScope scope(*this, raw_query);
+    const Query &query = scope.GetQuery();
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> result(document_ids.size());
+    std::transform(policy, document_ids.begin(), document_ids.end(), result.begin(), [this, &query](int document_id)
+                   { return MatchParsedQuery(query, document_id); });
+    return result;
 }
 
 template <typename Predicat>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy &policy, const Query &query_words, Predicat predicat) const
+bool SearchServer::FindTopByImpact(const Query &query_words, QueryMode mode, Predicat &predicat, size_t count, const SearchCursor &after, std::pmr::vector<Document> &matched_documents) const
 {
-    std::vector<Document> matched_documents;
-    ConcurrentMap<int, double> document_to_relevance(150);
-    std::for_each(std::execution::par, query_words.plus_words_vec.begin(), query_words.plus_words_vec.end(), [&](const auto &plus_words)
-                  {
-        const auto element_of_map_doc = documents_.find(plus_words); 
-        if (element_of_map_doc != documents_.end()) { 
-            const double idf = CountIDF(plus_words);
-            for (const auto& [ID, TF] : element_of_map_doc->second) {
-                document_to_relevance[ID].ref_to_value += idf * TF;
-            }
-        } });
-    std::for_each(std::execution::par, query_words.minus_words_vec.begin(), query_words.minus_words_vec.end(), [&](const auto &minus_words)
-                  {
-        const auto element_of_map_doc = documents_.find(minus_words);
-        if (element_of_map_doc != documents_.end()){
-            for (const auto& [ID, TF] : element_of_map_doc->second) {
-                document_to_relevance.erase(ID);
-            }
-        } });
-    for (const auto &[id, rel] : document_to_relevance.BuildOrdinaryMap())
+    if (impact_postings_.by_word.empty() || query_words.required_terms.size() != 1 || !query_words.pattern_terms.empty() || !query_words.minus_terms.empty() || (mode == QueryMode::ALL && query_words.has_unknown_plus_word))
+        return false;
+    const Term term = query_words.required_terms[0];
+    const auto impact = impact_postings_.by_word.find(term->first);
+    if (impact == impact_postings_.by_word.end())
+        return false;
+
+    TRACE_STAGE(TraceStage::SCORE);
+    // релевантность убывает вдоль списка. Когда набрано count документов, дальше нужны только документы
+    // с той же релевантностью, что у count-го: они могут обойти его по рейтингу, остальных превосходят уже count найденных
+    const double idf = CountIDF(term->second);
+    double threshold = 0;
+    size_t accepted = 0;
+    for (const auto &[id, tf] : impact->second)
+    {
+        const double relevance = idf * tf;
+        if (accepted >= count && RelevanceKey(relevance) < RelevanceKey(threshold))
+            break;
+        const auto meta_data = data_about_documents_.find(id);
+        const Document document(id, relevance, meta_data->second.raiting, meta_data->second.status);
+        if (IsAfterCursor(after, document) && predicat(id, meta_data->second.status, meta_data->second.raiting))
+        {
+            matched_documents.push_back(document);
+            if (++accepted == count)
+                threshold = relevance;
+        }
+    }
+    return true;
+}
+
+template <typename Predicat>
+void SearchServer::FilterDocuments(const ScoreAccumulator &document_to_relevance, Predicat &predicat, const SearchCursor &after, size_t count, BlockMaxBuffers &buffers, std::pmr::vector<Document> &matched_documents) const
+{
+    TRACE_STAGE(TraceStage::FILTER);
+    const auto accept = [&](size_t i)
     {
+        const int id = document_to_relevance.ids[i];
         const auto meta_data = data_about_documents_.find(id);
-        if (predicat(id, meta_data->second.status, meta_data->second.raiting))
+        const Document document(id, document_to_relevance.scores[i], meta_data->second.raiting, meta_data->second.status);
+        if (!IsAfterCursor(after, document) || !predicat(id, meta_data->second.status, meta_data->second.raiting))
+            return false;
+        matched_documents.push_back(document);
+        return true;
+    };
+
+    double threshold = 0;
+    // документ ступени порога может обойти кандидатов по рейтингу, поэтому порог опускается на SCOPE
+    if (SelectTopCandidates(document_to_relevance, count, buffers, threshold, SCOPE))
+    {
+        const size_t begin = matched_documents.size();
+        matched_documents.reserve(begin + buffers.candidates.size());
+        size_t accepted = 0;
+        for (const uint32_t i : buffers.candidates)
         {
-            matched_documents.push_back({id, rel, meta_data->second.raiting, meta_data->second.status});
+            accepted += accept(i);
         }
+        if (accepted >= count)
+            return;
+        // курсор или предикат отсеяли слишком многих кандидатов, порог ничего не гарантирует
+        matched_documents.erase(matched_documents.begin() + begin, matched_documents.end());
+    }
+    matched_documents.reserve(matched_documents.size() + document_to_relevance.Size());
+    for (size_t i = 0; i < document_to_relevance.Size(); ++i)
+    {
+        accept(i);
     }
-    return matched_documents;
 }
 
 template <typename Predicat>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy &policy, const Query &query_words, Predicat predicat) const
+void SearchServer::FindAllDocumentsIntersect(const Query &query_words, QueryWorkspace &workspace, Predicat &predicat, const SearchCursor &after, size_t count, std::pmr::vector<Document> &matched_documents) const
 {
-    std::vector<Document> matched_documents;
-    std::map<int, double> document_to_relevance;
-    for (const auto &plus_words : query_words.plus_words_vec)
+    // пересечение постингов: ведущим идет самый короткий, по остальным прыгаем к его id через SkipTo
+    QueryPostings &postings = workspace.postings;
+    FetchPostings(query_words, QueryMode::ALL, postings);
+    if (!postings.all_plus_found || (postings.required.empty() && postings.pattern_ends.empty()))
+        return;
+
+    ScoreAccumulator &document_to_relevance = workspace.document_to_relevance;
+    document_to_relevance.Clear();
     {
-        const auto element_of_map_doc = documents_.find(plus_words);
-        if (element_of_map_doc != documents_.end())
+        TRACE_STAGE(TraceStage::SCORE);
+        const auto &plus = postings.required;
+        if (!plus.empty())
         {
-            const double idf = CountIDF(plus_words);
-            for (const auto &[ID, TF] : element_of_map_doc->second)
+            std::pmr::vector<size_t> order(plus.size(), workspace.arena.Resource());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&plus](size_t lhs, size_t rhs)
+                      { return plus[lhs].first->size() < plus[rhs].first->size(); });
+
+            std::pmr::vector<Posting::const_iterator> cursors(plus.size(), workspace.arena.Resource());
+            for (size_t i = 0; i < plus.size(); ++i)
+            {
+                cursors[i] = plus[i].first->begin();
+            }
+
+            const Posting &lead_posting = *plus[order[0]].first;
+            auto &lead = cursors[order[0]];
+            while (lead != lead_posting.end())
             {
-                document_to_relevance[ID] += idf * TF;
+                const int id = lead->first;
+                bool in_all = true;
+                for (size_t i = 1; i < order.size(); ++i)
+                {
+                    const Posting &posting = *plus[order[i]].first;
+                    auto &cursor = cursors[order[i]];
+                    cursor = SkipTo(posting, cursor, id);
+                    if (cursor == posting.end())
+                    {
+                        lead = lead_posting.end();
+                        in_all = false;
+                        break;
+                    }
+                    if (cursor->first != id)
+                    {
+                        lead = SkipTo(lead_posting, lead, cursor->first);
+                        in_all = false;
+                        break;
+                    }
+                }
+                if (!in_all)
+                    continue;
+
+                double relevance = 0;
+                for (size_t i = 0; i < plus.size(); ++i)
+                {
+                    relevance += plus[i].second * cursors[i]->second;
+                }
+                document_to_relevance.Add(id, relevance);
+                ++lead;
             }
         }
-    }
-    for (const auto &minus_words : query_words.minus_words_vec)
-    {
-        const auto element_of_map_doc = documents_.find(minus_words);
-        if (element_of_map_doc != documents_.end())
+
+        // раскрытия шаблона объединяются слиянием в один накопитель, который затем пересекается с остальными словами
+        size_t pattern_begin = 0;
+        for (const size_t pattern_end : postings.pattern_ends)
         {
-            for (const auto &[ID, TF] : element_of_map_doc->second)
+            ScoreAccumulator &pattern_scores = workspace.pattern_scores;
+            pattern_scores.Clear();
+            for (size_t i = pattern_begin; i < pattern_end; ++i)
             {
-                document_to_relevance.erase(ID);
+                const auto &[posting, idf] = postings.pattern_postings[i];
+                AccumulatePosting(pattern_scores, *posting, idf, workspace.buffer);
             }
+            if (plus.empty() && pattern_begin == 0)
+                document_to_relevance.Swap(pattern_scores);
+            else
+                IntersectScores(document_to_relevance, pattern_scores);
+            pattern_begin = pattern_end;
         }
+
+        for (const Posting *posting : postings.minus)
+        {
+            ExcludePosting(document_to_relevance, *posting);
+        }
+    }
+    FilterDocuments(document_to_relevance, predicat, after, count, workspace.block_max, matched_documents);
+}
+
+template <typename Predicat>
+void SearchServer::FindAllDocuments(const std::execution::parallel_policy &policy, const Query &query_words, QueryWorkspace &workspace, Predicat &predicat, const SearchCursor &after, size_t count, std::pmr::vector<Document> &matched_documents) const
+{
+    // пространство id делится на диапазоны, каждый поток считает свой диапазон в локальный накопитель без блокировок
+    // и отдает только свои лучшие count документов, окончательный отбор делает FindRankedDocuments.
+    // Арена запроса однопоточная, поэтому рабочие потоки выделяют память из ресурса по умолчанию
+    if (document_id_list_.empty())
+        return;
+    const QueryPostings &postings = workspace.postings;
+    FetchPostings(query_words, QueryMode::ANY, workspace.postings);
+    if (postings.plus.empty())
+        return;
+
+    const int64_t min_id = *document_id_list_.begin();
+    const int64_t max_id = *document_id_list_.rbegin();
+    const int64_t range_count = std::min<int64_t>(std::max(1u, std::thread::hardware_concurrency()), max_id - min_id + 1);
+    const int64_t range_size = (max_id - min_id + range_count) / range_count;
+
+    std::vector<std::pmr::vector<Document>> range_results(range_count);
+    std::vector<int64_t> ranges(range_count);
+    std::iota(ranges.begin(), ranges.end(), 0);
+    std::for_each(policy, ranges.begin(), ranges.end(), [&](int64_t range)
+                  {
+        const int lo = static_cast<int>(min_id + range * range_size);
+        const int64_t hi = std::min(max_id + 1, min_id + (range + 1) * range_size);
+        ScoreAccumulator document_to_relevance;
+        {
+            TRACE_STAGE(TraceStage::SCORE);
+            MergeBuffers buffer;
+            for (const auto &[posting, idf] : postings.plus) {
+                const auto last = hi > max_id ? posting->end() : posting->lower_bound(static_cast<int>(hi));
+                AccumulatePosting(document_to_relevance, posting->lower_bound(lo), last, idf, buffer);
+            }
+            for (const Posting *posting : postings.minus) {
+                ExcludePosting(document_to_relevance, *posting);
+            }
+        }
+        auto &local = range_results[range];
+        BlockMaxBuffers block_max;
+        FilterDocuments(document_to_relevance, predicat, after, count, block_max, local);
+        SelectTopDocuments(std::execution::seq, local, count, IsMoreRelevant); });
+
+    for (auto &local : range_results)
+    {
+        matched_documents.insert(matched_documents.end(), local.begin(), local.end());
     }
-    for (const auto &[id, rel] : document_to_relevance)
+}
+
+template <typename Predicat>
+void SearchServer::FindAllDocuments(const std::execution::sequenced_policy &policy, const Query &query_words, QueryWorkspace &workspace, Predicat &predicat, const SearchCursor &after, size_t count, std::pmr::vector<Document> &matched_documents) const
+{
+    QueryPostings &postings = workspace.postings;
+    FetchPostings(query_words, QueryMode::ANY, postings);
+    ScoreAccumulator &document_to_relevance = workspace.document_to_relevance;
+    document_to_relevance.Clear();
     {
-        const auto meta_data = data_about_documents_.find(id);
-        if (predicat(id, meta_data->second.status, meta_data->second.raiting))
+        TRACE_STAGE(TraceStage::SCORE);
+        for (const auto &[posting, idf] : postings.plus)
+        {
+            AccumulatePosting(document_to_relevance, *posting, idf, workspace.buffer);
+        }
+        for (const Posting *posting : postings.minus)
         {
-            matched_documents.push_back({id, rel, meta_data->second.raiting, meta_data->second.status});
+            ExcludePosting(document_to_relevance, *posting);
         }
     }
-    return matched_documents;
+    FilterDocuments(document_to_relevance, predicat, after, count, workspace.block_max, matched_documents);
 }
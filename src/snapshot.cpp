@@ -0,0 +1,97 @@
+#include "snapshot.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "binary_io.h"
+#include "search_server.h"
+
+namespace {
+
+const uint32_t SNAPSHOT_MAGIC = 0x504E5353; // "SSNP"
+const uint32_t SNAPSHOT_VERSION = 1;
+
+} // namespace
+
+void WriteSnapshot(const SearchServer& search_server, uint64_t lsn, std::ostream& output) {
+    // документы пишутся по одному, контрольная сумма считается по мере записи
+    std::string chunk;
+    uint32_t crc = 0;
+    const auto flush = [&chunk, &crc, &output] {
+        crc = Crc32(chunk, crc);
+        output.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        chunk.clear();
+    };
+
+    BinaryWriter writer(chunk);
+    writer.Put(SNAPSHOT_MAGIC);
+    writer.Put(SNAPSHOT_VERSION);
+    writer.Put(lsn);
+    writer.Put(static_cast<uint64_t>(search_server.document_id_list_.size()));
+    flush();
+    for (const int document_id : search_server.document_id_list_) {
+        const auto& meta_data = search_server.data_about_documents_.at(document_id);
+        const auto& word_frequencies = search_server.GetWordFrequencies(document_id);
+        writer.Put(static_cast<int32_t>(document_id));
+        writer.Put(static_cast<uint8_t>(meta_data.status));
+        writer.Put(static_cast<int32_t>(meta_data.raiting));
+        writer.Put(static_cast<uint32_t>(word_frequencies.size()));
+        for (const auto& [word, frequency] : word_frequencies) {
+            writer.PutString(word);
+            writer.Put(frequency);
+        }
+        flush();
+    }
+    writer.Put(crc);
+    output.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    if (!output) {
+        throw std::runtime_error("Не удалось записать снимок");
+    }
+}
+
+uint64_t ReadSnapshot(std::istream& input, SearchServer& search_server) {
+    const std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    if (content.size() < sizeof(uint32_t) || Crc32(std::string_view(content).substr(0, content.size() - sizeof(uint32_t)))
+                                                  != BinaryReader(std::string_view(content).substr(content.size() - sizeof(uint32_t))).Get<uint32_t>()) {
+        throw std::runtime_error("Снимок поврежден");
+    }
+
+    BinaryReader reader(std::string_view(content).substr(0, content.size() - sizeof(uint32_t)));
+    if (reader.Get<uint32_t>() != SNAPSHOT_MAGIC || reader.Get<uint32_t>() != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Неизвестный формат снимка");
+    }
+    const uint64_t lsn = reader.Get<uint64_t>();
+    const uint64_t document_count = reader.Get<uint64_t>();
+    std::vector<std::pair<std::string_view, double>> word_frequencies;
+    for (uint64_t i = 0; i < document_count; ++i) {
+        const int document_id = reader.Get<int32_t>();
+        const auto status = static_cast<DocumentStatus>(reader.Get<uint8_t>());
+        const int rating = reader.Get<int32_t>();
+        word_frequencies.resize(reader.Get<uint32_t>());
+        for (auto& [word, frequency] : word_frequencies) {
+            word = reader.GetString();
+            frequency = reader.Get<double>();
+        }
+        search_server.RestoreDocument(document_id, status, rating, word_frequencies);
+    }
+    return lsn;
+}
+
+void SaveSnapshot(const SearchServer& search_server, uint64_t lsn, const std::string& path) {
+    std::ostringstream output;
+    WriteSnapshot(search_server, lsn, output);
+    const std::string data = output.str();
+
+    WriteFileDurably(path, data);
+}
+
+std::optional<uint64_t> LoadSnapshot(const std::string& path, SearchServer& search_server) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return std::nullopt;
+    }
+    return ReadSnapshot(input, search_server);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+
+class SearchServer;
+
+// Снимок индекса: для каждого документа id, статус, рейтинг и частоты слов, плюс lsn последней мутации журнала,
+// которая в снимке уже учтена. Текст документов не хранится, восстановление не повторяет разбор текста.
+// Стоп-слова и анализатор - настройки сервера, а не данные, их задает тот, кто создает сервер
+
+void WriteSnapshot(const SearchServer& search_server, uint64_t lsn, std::ostream& output);
+
+// Добавляет документы снимка в сервер и возвращает lsn снимка. При повреждении бросает std::runtime_error
+uint64_t ReadSnapshot(std::istream& input, SearchServer& search_server);
+
+// Пишет снимок во временный файл, синхронизирует его и переименовывает поверх path,
+// так что на диске всегда лежит либо старый, либо новый целый снимок
+void SaveSnapshot(const SearchServer& search_server, uint64_t lsn, const std::string& path);
+
+// Пустой результат, если снимка еще нет
+std::optional<uint64_t> LoadSnapshot(const std::string& path, SearchServer& search_server);
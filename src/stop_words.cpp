@@ -0,0 +1,66 @@
+#include "stop_words.h"
+
+void StopWordSet::Insert(std::string_view word) {
+    if (word.empty() || Contains(word)) {
+        return;
+    }
+    // заполнение не больше половины, чтобы промах заканчивался на первой-второй пустой ячейке
+    if ((count_ + 1) * 2 > slots_.size()) {
+        Rehash(slots_.empty() ? 16 : slots_.size() * 2);
+    }
+
+    const uint32_t hash = Hash(word);
+    const size_t mask = slots_.size() - 1;
+    size_t index = hash & mask;
+    while (slots_[index].length != 0) {
+        index = (index + 1) & mask;
+    }
+    slots_[index] = {hash, static_cast<uint32_t>(arena_.size()), static_cast<uint32_t>(word.size())};
+    arena_.append(word);
+    ++count_;
+
+    const size_t lead = LeadKey(word);
+    length_mask_ |= uint64_t{1} << LengthBit(word.size());
+    lead_mask_[lead >> 6] |= uint64_t{1} << (lead & 63);
+}
+
+uint32_t StopWordSet::Hash(std::string_view word) { // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char c : word) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const StopWordSet::Slot* StopWordSet::FindSlot(std::string_view word, uint32_t hash) const {
+    if (slots_.empty()) {
+        return nullptr;
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+        const Slot& slot = slots_[index];
+        if (slot.length == 0) {
+            return nullptr;
+        }
+        if (slot.hash == hash && std::string_view(arena_).substr(slot.offset, slot.length) == word) {
+            return &slot;
+        }
+    }
+}
+
+void StopWordSet::Rehash(size_t capacity) {
+    std::vector<Slot> slots(capacity);
+    const size_t mask = capacity - 1;
+    for (const Slot& slot : slots_) {
+        if (slot.length == 0) {
+            continue;
+        }
+        size_t index = slot.hash & mask;
+        while (slots[index].length != 0) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = slot;
+    }
+    slots_.swap(slots);
+}
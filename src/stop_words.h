@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Множество стоп-слов, которое проверяется на каждом слове документа и запроса.
+// Слова лежат подряд в одной строке, поиск идет по хеш-таблице с открытой адресацией.
+// Перед таблицей стоит фильтр по длине и первому символу: большинство слов текста отсекаются
+// им без вычисления хеша, так как стоп-слова короткие и начинаются с небольшого набора букв
+class StopWordSet {
+public:
+    StopWordSet() = default;
+
+    // Пустое слово и повторы игнорируются
+    void Insert(std::string_view word);
+
+    bool Contains(std::string_view word) const {
+        if (word.empty() || !MayContain(word)) {
+            return false;
+        }
+        return FindSlot(word, Hash(word)) != nullptr;
+    }
+
+    size_t size() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+private:
+    struct Slot {
+        uint32_t hash = 0;
+        uint32_t offset = 0;
+        uint32_t length = 0; // 0 - ячейка пуста
+    };
+
+    std::string arena_;
+    std::vector<Slot> slots_;
+    size_t count_ = 0;
+    uint64_t length_mask_ = 0;
+    // биты ключей первого символа, см. LeadKey
+    uint64_t lead_mask_[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    bool MayContain(std::string_view word) const {
+        const size_t lead = LeadKey(word);
+        return (length_mask_ >> LengthBit(word.size()) & 1) && (lead_mask_[lead >> 6] >> (lead & 63) & 1);
+    }
+
+    // Ключ первого символа: байт ASCII как есть, у многобайтного символа - 256 плюс младший байт кода
+    // символа. Все буквы кириллицы начинаются с байта 0xD0 или 0xD1, поэтому один первый байт их не различает
+    static size_t LeadKey(std::string_view word) {
+        const unsigned char first = static_cast<unsigned char>(word[0]);
+        if (first < 0x80 || word.size() < 2) {
+            return first;
+        }
+        const unsigned char second = static_cast<unsigned char>(word[1]);
+        return 256 + ((first & 3) << 6 | (second & 0x3F));
+    }
+
+    static size_t LengthBit(size_t length) {
+        return length < 63 ? length : 63;
+    }
+
+    static uint32_t Hash(std::string_view word);
+
+    const Slot* FindSlot(std::string_view word, uint32_t hash) const;
+
+    void Rehash(size_t capacity);
+};
@@ -0,0 +1,379 @@
+#include "text_analysis.h"
+
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+
+namespace {
+
+enum CharClass : unsigned char {
+    SEPARATOR,
+    PUNCTUATION,
+    LETTER,
+    UPPER_LETTER,
+    MULTIBYTE
+};
+
+// Класс каждого байта: однобайтные символы классифицируются одним чтением таблицы,
+// разбор UTF-8 нужен только для байтов старше 0x7F
+constexpr std::array<CharClass, 256> MakeCharClasses() {
+    std::array<CharClass, 256> classes{};
+    for (int c = 0; c < 256; ++c) {
+        if (c <= ' ' || c == 0x7F) {
+            classes[c] = SEPARATOR;
+        } else if (c >= 0x80) {
+            classes[c] = MULTIBYTE;
+        } else if (c >= 'A' && c <= 'Z') {
+            classes[c] = UPPER_LETTER;
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            classes[c] = LETTER;
+        } else {
+            classes[c] = PUNCTUATION;
+        }
+    }
+    return classes;
+}
+
+constexpr std::array<CharClass, 256> CHAR_CLASSES = MakeCharClasses();
+
+// Декодирует символ UTF-8 начиная с pos. Некорректная последовательность считается одним символом из одного байта
+char32_t DecodeUtf8(std::string_view text, size_t pos, size_t& length) {
+    const unsigned char lead = static_cast<unsigned char>(text[pos]);
+    size_t expected = 0;
+    char32_t code_point = 0;
+    if (lead < 0x80) {
+        length = 1;
+        return lead;
+    } else if ((lead & 0xE0) == 0xC0) {
+        expected = 2;
+        code_point = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+        expected = 3;
+        code_point = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+        expected = 4;
+        code_point = lead & 0x07;
+    }
+    if (expected == 0 || pos + expected > text.size()) {
+        length = 1;
+        return lead;
+    }
+    for (size_t i = 1; i < expected; ++i) {
+        const unsigned char next = static_cast<unsigned char>(text[pos + i]);
+        if ((next & 0xC0) != 0x80) {
+            length = 1;
+            return lead;
+        }
+        code_point = (code_point << 6) | (next & 0x3F);
+    }
+    length = expected;
+    return code_point;
+}
+
+void AppendUtf8(std::string& out, char32_t code_point) {
+    if (code_point < 0x80) {
+        out += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        out += static_cast<char>(0xC0 | (code_point >> 6));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += static_cast<char>(0xE0 | (code_point >> 12));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code_point >> 18));
+        out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+}
+
+bool IsMultibytePunctuation(char32_t code_point) {
+    if (code_point >= 0xA0 && code_point <= 0xBF) {
+        // ª, µ и º - буквы, остальное в этом блоке знаки: « » § ° ¿ и пр.
+        return code_point != 0xAA && code_point != 0xB5 && code_point != 0xBA;
+    }
+    return code_point == 0xD7 || code_point == 0xF7
+        || (code_point >= 0x2000 && code_point <= 0x206F) // тире, кавычки, многоточие, типографские пробелы
+        || (code_point >= 0x3000 && code_point <= 0x303F);
+}
+
+char32_t FoldCase(char32_t code_point) {
+    if (code_point >= 0x410 && code_point <= 0x42F) { // А-Я
+        return code_point + 0x20;
+    }
+    if (code_point == 0x401 || code_point == 0x451) { // Ё, ё -> е
+        return 0x435;
+    }
+    if (code_point >= 0x400 && code_point <= 0x40F) {
+        return code_point + 0x50;
+    }
+    if (code_point >= 0xC0 && code_point <= 0xDE && code_point != 0xD7) {
+        return code_point + 0x20;
+    }
+    return code_point;
+}
+
+// Апостроф и дефис внутри слова (don't, что-то) слово не разрывают
+bool IsJoiner(char32_t code_point) {
+    return code_point == '-' || code_point == '\'' || code_point == 0x2019;
+}
+
+} // namespace
+
+TextAnalyzer::TextAnalyzer(Options options)
+    : options_(options) {
+}
+
+TextAnalyzer::TokenBuffer::TokenBuffer()
+    : shared_(ThreadShared())
+    , owner_(!shared_.busy) {
+    shared_.busy = true;
+}
+
+TextAnalyzer::TokenBuffer::~TokenBuffer() {
+    if (owner_) {
+        shared_.busy = false;
+    }
+}
+
+TextAnalyzer::TokenBuffer::Shared& TextAnalyzer::TokenBuffer::ThreadShared() {
+    thread_local Shared shared;
+    return shared;
+}
+
+TextAnalyzer TextAnalyzer::Full() {
+    return TextAnalyzer(Options{true, true, true});
+}
+
+bool TextAnalyzer::NextToken(std::string_view text, size_t& pos, std::string& buffer) const {
+    buffer.clear();
+    // classify возвращает класс символа в pos и его длину в байтах; многобайтные символы декодируются
+    const auto classify = [this, text](size_t at, size_t& length, char32_t& code_point) {
+        const unsigned char c = static_cast<unsigned char>(text[at]);
+        CharClass char_class = CHAR_CLASSES[c];
+        if (char_class != MULTIBYTE) {
+            length = 1;
+            code_point = c;
+        } else {
+            code_point = DecodeUtf8(text, at, length);
+            char_class = IsMultibytePunctuation(code_point) ? PUNCTUATION : LETTER;
+        }
+        if (char_class == PUNCTUATION && !options_.strip_punctuation) {
+            char_class = LETTER;
+        }
+        return char_class;
+    };
+
+    while (pos < text.size()) {
+        size_t length = 0;
+        char32_t code_point = 0;
+        const CharClass char_class = classify(pos, length, code_point);
+        if (char_class == SEPARATOR || char_class == PUNCTUATION) {
+            if (!buffer.empty() && char_class == PUNCTUATION && IsJoiner(code_point) && pos + length < text.size()) {
+                size_t next_length = 0;
+                char32_t next_code_point = 0;
+                const CharClass next_class = classify(pos + length, next_length, next_code_point);
+                if (next_class == LETTER || next_class == UPPER_LETTER) {
+                    buffer += code_point == '-' ? '-' : '\'';
+                    pos += length;
+                    continue;
+                }
+            }
+            pos += length;
+            if (!buffer.empty()) {
+                return true;
+            }
+            continue;
+        }
+
+        if (!options_.fold_case || (char_class == LETTER && length == 1)) {
+            buffer.append(text.substr(pos, length));
+        } else if (char_class == UPPER_LETTER) {
+            buffer += static_cast<char>(code_point + ('a' - 'A'));
+        } else {
+            AppendUtf8(buffer, FoldCase(code_point));
+        }
+        pos += length;
+    }
+    return !buffer.empty();
+}
+
+void TextAnalyzer::FoldPattern(std::string_view pattern, std::string& out) const {
+    if (!options_.fold_case) {
+        out.assign(pattern);
+        return;
+    }
+    out.clear();
+    for (size_t pos = 0; pos < pattern.size();) {
+        size_t length = 0;
+        const char32_t code_point = DecodeUtf8(pattern, pos, length);
+        if (length == 1 && CHAR_CLASSES[static_cast<unsigned char>(pattern[pos])] != UPPER_LETTER) {
+            out += pattern[pos];
+        } else {
+            AppendUtf8(out, code_point < 0x80 ? code_point + ('a' - 'A') : FoldCase(code_point));
+        }
+        pos += length;
+    }
+}
+
+void TextAnalyzer::Stem(std::string& word) const {
+    if (!options_.stem || word.empty()) {
+        return;
+    }
+    const unsigned char lead = static_cast<unsigned char>(word[0]);
+    if (lead == 0xD0 || lead == 0xD1) {
+        StemRussian(word);
+    } else if (std::all_of(word.begin(), word.end(), [](char c) { return c >= 'a' && c <= 'z'; })) {
+        StemEnglish(word);
+    }
+}
+
+namespace {
+
+// Слова длиннее не стеммятся: таких в корпусе нет, а буфер остается на стеке
+const size_t MAX_STEM_LENGTH = 64;
+
+struct RussianWord {
+    char32_t letters[MAX_STEM_LENGTH];
+    size_t length = 0;
+    size_t rv = 0;
+    size_t r2 = 0;
+
+    bool EndsWith(std::u32string_view suffix, size_t region) const {
+        return suffix.size() <= length && length - suffix.size() >= region
+            && std::u32string_view(letters + length - suffix.size(), suffix.size()) == suffix;
+    }
+};
+
+bool IsRussianVowel(char32_t c) {
+    return c == U'а' || c == U'е' || c == U'и' || c == U'о' || c == U'у' || c == U'ы' || c == U'э' || c == U'ю' || c == U'я';
+}
+
+// Длина самого длинного окончания из списка, целиком лежащего в RV, или 0.
+// after_a_ya - окончание группы 1, перед ним в RV должна стоять а или я, которые остаются в основе
+size_t FindEnding(const RussianWord& word, std::initializer_list<std::u32string_view> endings, bool after_a_ya = false) {
+    size_t best = 0;
+    for (const std::u32string_view ending : endings) {
+        if (ending.size() <= best || !word.EndsWith(ending, word.rv)) {
+            continue;
+        }
+        if (after_a_ya) {
+            const size_t before = word.length - ending.size();
+            if (before == word.rv || (word.letters[before - 1] != U'а' && word.letters[before - 1] != U'я')) {
+                continue;
+            }
+        }
+        best = ending.size();
+    }
+    return best;
+}
+
+void RemovePerfectiveOrInflection(RussianWord& word) {
+    const size_t gerund = std::max(FindEnding(word, {U"в", U"вши", U"вшись"}, true),
+                                   FindEnding(word, {U"ив", U"ивши", U"ившись", U"ыв", U"ывши", U"ывшись"}));
+    if (gerund) {
+        word.length -= gerund;
+        return;
+    }
+
+    word.length -= FindEnding(word, {U"ся", U"сь"});
+
+    const size_t adjective = FindEnding(word, {U"ее", U"ие", U"ые", U"ое", U"ими", U"ыми", U"ей", U"ий", U"ый", U"ой", U"ем", U"им", U"ым",
+                                               U"ом", U"его", U"ого", U"ему", U"ому", U"их", U"ых", U"ую", U"юю", U"ая", U"яя", U"ою", U"ею"});
+    if (adjective) {
+        word.length -= adjective;
+        word.length -= std::max(FindEnding(word, {U"ем", U"нн", U"вш", U"ющ", U"щ"}, true), FindEnding(word, {U"ивш", U"ывш", U"ующ"}));
+        return;
+    }
+
+    const size_t verb = std::max(
+        FindEnding(word, {U"ла", U"на", U"ете", U"йте", U"ли", U"й", U"л", U"ем", U"н", U"ло", U"но", U"ет", U"ют", U"ны", U"ть", U"ешь", U"нно"}, true),
+        FindEnding(word, {U"ила", U"ыла", U"ена", U"ейте", U"уйте", U"ите", U"или", U"ыли", U"ей", U"уй", U"ил", U"ыл", U"им", U"ым", U"ен",
+                          U"ило", U"ыло", U"ено", U"ят", U"ует", U"уют", U"ит", U"ыт", U"ены", U"ить", U"ыть", U"ишь", U"ую", U"ю"}));
+    if (verb) {
+        word.length -= verb;
+        return;
+    }
+
+    word.length -= FindEnding(word, {U"а", U"ев", U"ов", U"ие", U"ье", U"е", U"иями", U"ями", U"ами", U"еи", U"ии", U"и", U"ией", U"ей", U"ой",
+                                     U"ий", U"й", U"иям", U"ям", U"ием", U"ем", U"ам", U"ом", U"о", U"у", U"ах", U"иях", U"ях", U"ы", U"ь",
+                                     U"ию", U"ью", U"ю", U"ия", U"ья", U"я"});
+}
+
+} // namespace
+
+void StemRussian(std::string& text) {
+    RussianWord word;
+    for (size_t pos = 0; pos < text.size();) {
+        if (word.length == MAX_STEM_LENGTH) {
+            return;
+        }
+        size_t length = 0;
+        word.letters[word.length++] = DecodeUtf8(text, pos, length);
+        pos += length;
+    }
+
+    // RV - все после первой гласной, R1 - после первой согласной, идущей за гласной, R2 - то же внутри R1
+    const auto region_after = [&word](size_t from) {
+        for (size_t i = from; i + 1 < word.length; ++i) {
+            if (IsRussianVowel(word.letters[i]) && !IsRussianVowel(word.letters[i + 1])) {
+                return i + 2;
+            }
+        }
+        return word.length;
+    };
+    word.rv = word.length;
+    for (size_t i = 0; i < word.length; ++i) {
+        if (IsRussianVowel(word.letters[i])) {
+            word.rv = i + 1;
+            break;
+        }
+    }
+    word.r2 = region_after(region_after(0));
+
+    const size_t original_length = word.length;
+    RemovePerfectiveOrInflection(word);
+    if (word.EndsWith(U"и", word.rv)) {
+        --word.length;
+    }
+    if (word.EndsWith(U"ость", word.r2)) {
+        word.length -= 4;
+    } else if (word.EndsWith(U"ост", word.r2)) {
+        word.length -= 3;
+    }
+    if (word.EndsWith(U"ейше", word.rv)) {
+        word.length -= 4;
+    } else if (word.EndsWith(U"ейш", word.rv)) {
+        word.length -= 3;
+    }
+    if (word.EndsWith(U"нн", word.rv)) {
+        --word.length;
+    } else if (word.EndsWith(U"ь", word.rv)) {
+        --word.length;
+    }
+
+    if (word.length == original_length) {
+        return;
+    }
+    text.clear();
+    for (size_t i = 0; i < word.length; ++i) {
+        AppendUtf8(text, word.letters[i]);
+    }
+}
+
+void StemEnglish(std::string& word) {
+    const auto ends_with = [&word](std::string_view suffix) {
+        return word.size() >= suffix.size() && std::string_view(word).substr(word.size() - suffix.size()) == suffix;
+    };
+    if (word.size() <= 3) {
+        return;
+    }
+    if (ends_with("ies") && !ends_with("eies") && !ends_with("aies")) {
+        word.replace(word.size() - 3, 3, "y");
+    } else if (ends_with("es") && !ends_with("aes") && !ends_with("ees") && !ends_with("oes")) {
+        word.pop_back();
+    } else if (ends_with("s") && !ends_with("us") && !ends_with("ss")) {
+        word.pop_back();
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Цепочка нормализации текста, одинаково применяемая к документам и запросам:
+// разбиение с учетом UTF-8 -> приведение к нижнему регистру (латиница, Latin-1, кириллица, ё -> е)
+// -> отбрасывание пунктуации -> стоп-слова -> выделение основы (Snowball для русского, S-stemmer для английского).
+// По умолчанию все этапы выключены и слова режутся только по пробелу, как раньше
+class TextAnalyzer {
+public:
+    struct Options {
+        bool fold_case = false;
+        bool strip_punctuation = false;
+        bool stem = false;
+    };
+
+    TextAnalyzer() = default;
+    explicit TextAnalyzer(Options options);
+
+    // Все этапы включены - то, что нужно для русского корпуса
+    static TextAnalyzer Full();
+
+    const Options& GetOptions() const {
+        return options_;
+    }
+
+    // Ни один этап не включен: текст режется только по пробелу и слова не меняются
+    bool IsIdentity() const {
+        return !options_.fold_case && !options_.strip_punctuation && !options_.stem;
+    }
+
+    // Вызывает callback для каждого нормализованного слова текста, без стоп-слов и выделения основы.
+    // Слово передается видом на внутренний буфер, действительным до следующего вызова callback
+    template <typename Callback>
+    void ForEachToken(std::string_view text, Callback callback) const {
+        TokenBuffer token;
+        std::string& buffer = token.Get();
+        size_t pos = 0;
+        while (NextToken(text, pos, buffer)) {
+            callback(std::string_view(buffer));
+        }
+    }
+
+    // Полная цепочка: слова, для которых is_stop_word вернул true, пропускаются, у остальных выделяется основа
+    template <typename IsStopWord, typename Callback>
+    void ForEachTerm(std::string_view text, IsStopWord is_stop_word, Callback callback) const {
+        TokenBuffer token;
+        std::string& buffer = token.Get();
+        size_t pos = 0;
+        while (NextToken(text, pos, buffer)) {
+            if (is_stop_word(std::string_view(buffer))) {
+                continue;
+            }
+            Stem(buffer);
+            callback(std::string_view(buffer));
+        }
+    }
+
+    // Отрезает у слова окончание, если выделение основы включено. Слово должно быть уже нормализовано
+    void Stem(std::string& word) const;
+
+    // Приводит шаблон поиска (cat*, к?т) к регистру словаря, если приведение включено. Остальные символы не трогает
+    void FoldPattern(std::string_view pattern, std::string& out) const;
+
+private:
+    Options options_;
+
+    // Буфер слова, общий для вызовов в одном потоке: слова длиннее SSO (в кириллице два байта на букву)
+    // не выделяют память на каждый текст. Если callback снова разбирает текст, вложенный вызов берет свой буфер
+    class TokenBuffer {
+    public:
+        TokenBuffer();
+        TokenBuffer(const TokenBuffer&) = delete;
+        TokenBuffer& operator=(const TokenBuffer&) = delete;
+        ~TokenBuffer();
+
+        std::string& Get() {
+            return owner_ ? shared_.text : own_;
+        }
+
+    private:
+        struct Shared {
+            std::string text;
+            bool busy = false;
+        };
+
+        static Shared& ThreadShared();
+
+        Shared& shared_;
+        const bool owner_;
+        std::string own_;
+    };
+
+    // Кладет в buffer следующее слово текста начиная с pos, возвращает false, если слов больше нет
+    bool NextToken(std::string_view text, size_t& pos, std::string& buffer) const;
+};
+
+// Основа русского слова по алгоритму Snowball. Слово в нижнем регистре, UTF-8
+void StemRussian(std::string& word);
+
+// Облегченный S-stemmer: снимает у английского слова окончание множественного числа
+void StemEnglish(std::string& word);
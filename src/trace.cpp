@@ -0,0 +1,221 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const size_t STAGE_COUNT = static_cast<size_t>(TraceStage::COUNT);
+
+// Гистограмма одного потока. Пишет только поток-владелец, поэтому хватает relaxed load + store без RMW,
+// а читатель из другого потока видит согласованные (пусть и чуть устаревшие) счетчики
+struct ThreadHistogram {
+    std::array<std::atomic<uint64_t>, LatencyHistogram::BUCKET_COUNT> counts{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> min{UINT64_MAX};
+    std::atomic<uint64_t> max{0};
+
+    void Record(uint64_t nanoseconds) {
+        auto& counter = counts[LatencyHistogram::BucketIndex(nanoseconds)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+        if (nanoseconds < min.load(std::memory_order_relaxed)) {
+            min.store(nanoseconds, std::memory_order_relaxed);
+        }
+        if (nanoseconds > max.load(std::memory_order_relaxed)) {
+            max.store(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    void AddTo(LatencyHistogram& histogram) const {
+        std::array<uint64_t, LatencyHistogram::BUCKET_COUNT> snapshot;
+        for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; ++i) {
+            snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        }
+        histogram.Merge(LatencyHistogram::FromBuckets(snapshot, sum.load(std::memory_order_relaxed),
+                                                      min.load(std::memory_order_relaxed), max.load(std::memory_order_relaxed)));
+    }
+
+    void Reset() {
+        for (auto& counter : counts) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        sum.store(0, std::memory_order_relaxed);
+        min.store(UINT64_MAX, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+};
+
+struct ThreadTrace;
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<ThreadTrace*> threads;
+    std::array<LatencyHistogram, STAGE_COUNT> retired;
+};
+
+TraceRegistry& Registry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+struct ThreadTrace {
+    std::array<ThreadHistogram, STAGE_COUNT> stages;
+
+    ThreadTrace() {
+        TraceRegistry& registry = Registry();
+        std::lock_guard guard(registry.mutex);
+        registry.threads.push_back(this);
+    }
+
+    ~ThreadTrace() {
+        TraceRegistry& registry = Registry();
+        std::lock_guard guard(registry.mutex);
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            stages[i].AddTo(registry.retired[i]);
+        }
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+    }
+};
+
+ThreadTrace& CurrentThreadTrace() {
+    thread_local ThreadTrace trace;
+    return trace;
+}
+
+} // namespace
+
+std::string_view TraceStageName(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::PARSE: return "parse";
+        case TraceStage::NORMALIZE: return "normalize";
+        case TraceStage::POSTING_FETCH: return "posting_fetch";
+        case TraceStage::SCORE: return "score";
+        case TraceStage::FILTER: return "filter";
+        case TraceStage::SORT: return "sort";
+        default: return "unknown";
+    }
+}
+
+int LatencyHistogram::BucketIndex(uint64_t nanoseconds) {
+    if (nanoseconds < 16) {
+        return static_cast<int>(nanoseconds);
+    }
+    const int msb = 63 - __builtin_clzll(nanoseconds);
+    return 16 + (msb - 4) * 8 + static_cast<int>((nanoseconds >> (msb - 3)) & 7);
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+    if (index < 16) {
+        return index;
+    }
+    const int msb = (index - 16) / 8 + 4;
+    const uint64_t sub = (index - 16) % 8;
+    const uint64_t lower = (8 + sub) << (msb - 3);
+    return lower + ((uint64_t{1} << (msb - 3)) - 1);
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds, uint64_t count) {
+    counts_[BucketIndex(nanoseconds)] += count;
+    total_count_ += count;
+    sum_ += nanoseconds * count;
+    min_ = std::min(min_, nanoseconds);
+    max_ = std::max(max_, nanoseconds);
+}
+
+LatencyHistogram LatencyHistogram::FromBuckets(const std::array<uint64_t, BUCKET_COUNT>& counts, uint64_t sum, uint64_t min, uint64_t max) {
+    LatencyHistogram histogram;
+    histogram.counts_ = counts;
+    for (const uint64_t count : counts) {
+        histogram.total_count_ += count;
+    }
+    histogram.sum_ = sum;
+    histogram.min_ = min;
+    histogram.max_ = max;
+    return histogram;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    total_count_ += other.total_count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+uint64_t LatencyHistogram::ValueAtPercentile(double percentile) const {
+    if (total_count_ == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100.0 * total_count_ + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            return std::min(BucketUpperBound(i), max_);
+        }
+    }
+    return max_;
+}
+
+void LatencyHistogram::WriteJson(std::ostream& output) const {
+    output << "{\"count\":" << Count()
+           << ",\"min_ns\":" << Min()
+           << ",\"mean_ns\":" << Mean()
+           << ",\"p50_ns\":" << ValueAtPercentile(50)
+           << ",\"p90_ns\":" << ValueAtPercentile(90)
+           << ",\"p99_ns\":" << ValueAtPercentile(99)
+           << ",\"p999_ns\":" << ValueAtPercentile(99.9)
+           << ",\"max_ns\":" << Max()
+           << ",\"buckets\":[";
+    bool first = true;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        if (counts_[i] == 0) {
+            continue;
+        }
+        output << (first ? "" : ",") << '[' << BucketUpperBound(i) << ',' << counts_[i] << ']';
+        first = false;
+    }
+    output << "]}";
+}
+
+void RecordTraceStage(TraceStage stage, uint64_t nanoseconds) {
+    CurrentThreadTrace().stages[static_cast<size_t>(stage)].Record(nanoseconds);
+}
+
+std::array<LatencyHistogram, static_cast<size_t>(TraceStage::COUNT)> CollectTraceHistograms() {
+    TraceRegistry& registry = Registry();
+    std::lock_guard guard(registry.mutex);
+    std::array<LatencyHistogram, STAGE_COUNT> result = registry.retired;
+    for (const ThreadTrace* trace : registry.threads) {
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            trace->stages[i].AddTo(result[i]);
+        }
+    }
+    return result;
+}
+
+void DumpTraceJson(std::ostream& output) {
+    const auto histograms = CollectTraceHistograms();
+    output << "{\"stages\":{";
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        output << (i ? "," : "") << '"' << TraceStageName(static_cast<TraceStage>(i)) << "\":";
+        histograms[i].WriteJson(output);
+    }
+    output << "}}";
+}
+
+void ResetTrace() {
+    TraceRegistry& registry = Registry();
+    std::lock_guard guard(registry.mutex);
+    registry.retired = {};
+    for (ThreadTrace* trace : registry.threads) {
+        for (auto& stage : trace->stages) {
+            stage.Reset();
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+// Этапы обработки запроса, по которым собираются гистограммы задержек
+enum class TraceStage {
+    PARSE,
+    NORMALIZE,
+    POSTING_FETCH,
+    SCORE,
+    FILTER,
+    SORT,
+    COUNT
+};
+
+std::string_view TraceStageName(TraceStage stage);
+
+// Гистограмма задержек в наносекундах в духе HDR Histogram: значения до 16 хранятся точно,
+// дальше на каждую степень двойки приходится 8 линейных корзин, то есть погрешность не больше 12.5%
+class LatencyHistogram {
+public:
+    static const int BUCKET_COUNT = 496;
+
+    void Record(uint64_t nanoseconds, uint64_t count = 1);
+    void Merge(const LatencyHistogram& other);
+
+    // Собирает гистограмму из уже разложенных по корзинам счетчиков
+    static LatencyHistogram FromBuckets(const std::array<uint64_t, BUCKET_COUNT>& counts, uint64_t sum, uint64_t min, uint64_t max);
+
+    uint64_t Count() const { return total_count_; }
+    uint64_t Min() const { return total_count_ ? min_ : 0; }
+    uint64_t Max() const { return max_; }
+    double Mean() const { return total_count_ ? 1.0 * sum_ / total_count_ : 0; }
+    // percentile в диапазоне [0, 100], результат - верхняя граница корзины, но не больше Max()
+    uint64_t ValueAtPercentile(double percentile) const;
+
+    uint64_t BucketCount(int index) const { return counts_[index]; }
+    static int BucketIndex(uint64_t nanoseconds);
+    static uint64_t BucketUpperBound(int index);
+
+    // {"count":..., "min_ns":..., "p50_ns":..., ..., "buckets":[[верхняя граница, число], ...]}
+    void WriteJson(std::ostream& output) const;
+
+private:
+    std::array<uint64_t, BUCKET_COUNT> counts_{};
+    uint64_t total_count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+// Добавляет время этапа в гистограмму текущего потока. Потоки пишут каждый в свою гистограмму,
+// общий мьютекс берется только при первом обращении потока и при его завершении
+void RecordTraceStage(TraceStage stage, uint64_t nanoseconds);
+
+// Сводные по всем потокам гистограммы, включая уже завершившиеся потоки
+std::array<LatencyHistogram, static_cast<size_t>(TraceStage::COUNT)> CollectTraceHistograms();
+
+// {"stages":{"parse":{...},"normalize":{...},...}}
+void DumpTraceJson(std::ostream& output);
+
+void ResetTrace();
+
+class ScopedStageTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ScopedStageTimer(TraceStage stage)
+        : stage_(stage) {
+    }
+
+    ~ScopedStageTimer() {
+        RecordTraceStage(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time_).count());
+    }
+
+private:
+    const TraceStage stage_;
+    const Clock::time_point start_time_ = Clock::now();
+};
+
+#define TRACE_CONCAT_INTERNAL(X, Y) X##Y
+#define TRACE_CONCAT(X, Y) TRACE_CONCAT_INTERNAL(X, Y)
+
+/**
+ * Замеряет время до конца текущего блока и записывает его в гистограмму этапа.
+ * Без SEARCH_SERVER_TRACING макрос раскрывается в пустоту и ничего не стоит.
+ *
+ * Пример использования:
+ *
+ *  {
+ *      TRACE_STAGE(TraceStage::PARSE);
+ *      ParseQuery(raw_query, query);
+ *  }
+ */
+#ifdef SEARCH_SERVER_TRACING
+#define TRACE_STAGE(stage) ScopedStageTimer TRACE_CONCAT(traceGuard, __LINE__)(stage)
+#else
+#define TRACE_STAGE(stage)
+#endif
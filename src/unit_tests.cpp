@@ -1,10 +1,41 @@
 #include "search_server.h"
 
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "block_codec.h"
+#include "concurrent_map.h"
+#include "document_store.h"
+#include "durable_search_server.h"
+#include "memory_resources.h"
+#include "numa.h"
 #include "process_queries.h"
+#include "query_replay.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "scoring.h"
+#include "snapshot.h"
+#include "stop_words.h"
+#include "text_analysis.h"
+#include "trace.h"
+#include "vector_index.h"
 
 using namespace std;
 
@@ -99,6 +130,111 @@ void RunTestImpl(F& f, const string& str) {
 
 #define RUN_TEST(func) RunTestImpl((func), #func)
 
+// Выделения памяти из кучи в текущем потоке: по ним тесты проверяют, что горячий путь запроса не выделяет память
+thread_local uint64_t heap_allocations = 0;
+
+// Заменяется все семейство operator new и delete: иначе незамененные формы (nothrow, выровненные, для массивов)
+// берут память у стандартной библиотеки или санитайзера, а отдают ее в free, и наоборот.
+// Замены не встраиваются: иначе компилятор видит malloc и free вместо new и delete и ошибочно считает их несогласованными
+[[gnu::noinline]] void* CountedAllocate(size_t size, size_t alignment) noexcept {
+    ++heap_allocations;
+    if (size == 0) {
+        size = 1;
+    }
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return malloc(size);
+    }
+    // aligned_alloc требует размер, кратный выравниванию
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* CountedAllocateOrThrow(size_t size, size_t alignment) {
+    if (void* pointer = CountedAllocate(size, alignment)) {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(size_t size) {
+    return CountedAllocateOrThrow(size, 0);
+}
+
+[[gnu::noinline]] void* operator new[](size_t size) {
+    return CountedAllocateOrThrow(size, 0);
+}
+
+[[gnu::noinline]] void* operator new(size_t size, align_val_t alignment) {
+    return CountedAllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+[[gnu::noinline]] void* operator new[](size_t size, align_val_t alignment) {
+    return CountedAllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+[[gnu::noinline]] void* operator new(size_t size, const nothrow_t&) noexcept {
+    return CountedAllocate(size, 0);
+}
+
+[[gnu::noinline]] void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return CountedAllocate(size, 0);
+}
+
+[[gnu::noinline]] void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+
+[[gnu::noinline]] void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+
+[[gnu::noinline]] void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete[](void* pointer) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete[](void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, align_val_t) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete[](void* pointer, align_val_t) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, size_t, align_val_t) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete[](void* pointer, size_t, align_val_t) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, const nothrow_t&) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete[](void* pointer, const nothrow_t&) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer, align_val_t, const nothrow_t&) noexcept {
+    free(pointer);
+}
+
+[[gnu::noinline]] void operator delete[](void* pointer, align_val_t, const nothrow_t&) noexcept {
+    free(pointer);
+}
+
 //###########################-Конец фреймворка для тестов-####################################################
 
 // -------- Начало модульных тестов поисковой системы ----------
@@ -222,6 +358,1388 @@ void TestMatchDocuments() { // проверка вывода запрашива
     }
 }
 
+void TestMatchDocumentsBatch() { // пакетное сопоставление должно совпадать с поштучным
+    SearchServer search_server("and with"s);
+
+    int id = 0;
+    for (
+        const string& text : {
+            "funny pet and nasty rat"s,
+            "funny pet with curly hair"s,
+            "funny pet and not very nasty rat"s,
+            "pet with rat and rat and rat"s,
+            "nasty rat with curly hair"s,
+        }
+    ) {
+        search_server.AddDocument(++id, text, DocumentStatus::ACTUAL, {1, 2});
+    }
+    const vector<int> ids{1, 2, 3, 4, 5};
+    const auto seq = search_server.MatchDocuments("curly rat and funny -not"s, ids);
+    const auto par = search_server.MatchDocuments(execution::par, "curly rat and funny -not"s, ids);
+    ASSERT_EQUAL(seq.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const auto [words, status] = search_server.MatchDocument("curly rat and funny -not"s, ids[i]);
+        ASSERT(get<0>(seq[i]) == words);
+        ASSERT(get<0>(par[i]) == words);
+    }
+    ASSERT(get<0>(seq[0]) == vector<string_view>({"funny"sv, "rat"sv}));
+    ASSERT(get<0>(seq[2]).empty());
+
+    bool thrown = false;
+    try {
+        search_server.MatchDocuments("rat"s, {1, 100});
+    } catch (const out_of_range&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+}
+
+void TestQueryCache() { // повторный запрос из кеша должен давать тот же ответ, а новые слова - сбрасывать кеш
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {2});
+
+    const auto first = search_server.FindTopDocuments("curly rat hamster"s);
+    const auto cached = search_server.FindTopDocuments("curly rat hamster"s);
+    ASSERT_EQUAL(first.size(), 2u);
+    ASSERT_EQUAL(cached.size(), first.size());
+    for (size_t i = 0; i < first.size(); ++i) {
+        ASSERT_EQUAL(cached[i].id, first[i].id);
+    }
+    ASSERT(search_server.FindTopDocuments("curly rat hamster"s, QueryMode::ALL).empty());
+
+    // слово hamster появилось в индексе - запрос из кеша не должен про него забыть
+    search_server.AddDocument(3, "curly hamster with rat"s, DocumentStatus::ACTUAL, {3});
+    const auto all = search_server.FindTopDocuments("curly rat hamster"s, QueryMode::ALL);
+    ASSERT_EQUAL(all.size(), 1u);
+    ASSERT_EQUAL(all[0].id, 3);
+
+    // поток разных запросов больше кеша: вытесненные слоты переиспользуются, частый запрос отвечает верно
+    for (int i = 0; i < 3 * QUERY_CACHE_SIZE; ++i) {
+        ASSERT(search_server.FindTopDocuments("rare"s + to_string(i)).empty());
+        if (i % 100 == 0) {
+            ASSERT_EQUAL(search_server.FindTopDocuments("curly rat hamster"s, QueryMode::ALL).size(), 1u);
+        }
+    }
+    for (int i = 3 * QUERY_CACHE_SIZE - 10; i < 3 * QUERY_CACHE_SIZE; ++i) {
+        const auto found = search_server.FindTopDocuments("rare"s + to_string(i) + " hamster"s);
+        ASSERT_EQUAL(found.size(), 1u);
+        ASSERT_EQUAL(found[0].id, 3);
+    }
+
+    // у другого сервера тот же текст запроса разбирается заново
+    SearchServer other_server(""s);
+    other_server.AddDocument(7, "hamster"s, DocumentStatus::ACTUAL, {1});
+    const auto other = other_server.FindTopDocuments("curly rat hamster"s);
+    ASSERT_EQUAL(other.size(), 1u);
+    ASSERT_EQUAL(other[0].id, 7);
+
+    // поиск внутри предиката другого поиска не портит разобранный внешний запрос
+    const auto nested = search_server.FindTopDocuments("funny pet"s, [&search_server](int, DocumentStatus, int) {
+        return !search_server.FindTopDocuments("curly"s).empty();
+    });
+    ASSERT_EQUAL(nested.size(), 2u);
+
+    bool thrown = false;
+    try {
+        search_server.FindTopDocuments("rat --pet"s);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT_EQUAL(search_server.FindTopDocuments("rat"s).size(), 2u);
+}
+
+void TestTextAnalysis() { // регистр, пунктуация и окончания не должны плодить разные слова
+    const TextAnalyzer analyzer = TextAnalyzer::Full();
+    vector<string> tokens;
+    analyzer.ForEachToken("Кошки, КОТ — «Ёжик»! e-mail don't..."s, [&tokens](string_view token) {
+        tokens.emplace_back(token);
+    });
+    ASSERT(tokens == vector<string>({"кошки"s, "кот"s, "ежик"s, "e-mail"s, "don't"s}));
+
+    // буфер слова переиспользуется: разбор кириллицы длиннее SSO не выделяет память, вложенный разбор
+    // из callback получает свой буфер и не портит внешнее слово
+    const string cyrillic = "Достопримечательности красивейшего побережья"s;
+    size_t total = 0;
+    analyzer.ForEachToken(cyrillic, [&total](string_view token) { total += token.size(); });
+    const uint64_t allocations_before = heap_allocations;
+    analyzer.ForEachToken(cyrillic, [&total](string_view token) { total += token.size(); });
+    const uint64_t allocations = heap_allocations - allocations_before;
+    ASSERT_EQUAL(allocations, 0u);
+    vector<string> outer;
+    analyzer.ForEachToken("Первое Второе"s, [&](string_view token) {
+        analyzer.ForEachToken("вложенное"s, [](string_view) {});
+        outer.emplace_back(token);
+    });
+    ASSERT(outer == vector<string>({"первое"s, "второе"s}));
+
+    for (const auto& [word, stem] : vector<pair<string, string>>{
+             {"кошки"s, "кошк"s}, {"кошкой"s, "кошк"s}, {"красивейшая"s, "красив"s}, {"книгами"s, "книг"s},
+             {"окончательность"s, "окончательн"s}, {"ponies"s, "pony"s}, {"cats"s, "cat"s}, {"bus"s, "bus"s}}) {
+        string stemmed = word;
+        analyzer.Stem(stemmed);
+        ASSERT_EQUAL(stemmed, stem);
+    }
+
+    // по умолчанию анализатор выключен и слова берутся как есть
+    const TextAnalyzer identity;
+    ASSERT(identity.IsIdentity());
+    string word = "Кошки"s;
+    identity.Stem(word);
+    ASSERT_EQUAL(word, "Кошки"s);
+
+    SearchServer search_server("И в"s, TextAnalyzer::Full());
+    search_server.AddDocument(1, "Рыжая КОШКА и кот, в саду"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "Собаки гуляют"s, DocumentStatus::ACTUAL, {2});
+    ASSERT_EQUAL(search_server.GetWordFrequencies(1).size(), 4u);
+    const auto found = search_server.FindTopDocuments("кошки рыжие"s, QueryMode::ALL);
+    ASSERT_EQUAL(found.size(), 1u);
+    ASSERT_EQUAL(found[0].id, 1);
+    ASSERT(search_server.FindTopDocuments("кошек -Сад!"s).empty());
+    ASSERT_EQUAL(search_server.FindTopDocuments("СОБАКА и"s, QueryMode::ALL).size(), 1u);
+    const auto [words, status] = search_server.MatchDocument("кошкам, котам"s, 1);
+    ASSERT(words == vector<string_view>({"кот"sv, "кошк"sv}));
+}
+
+void TestStopWordSet() { // таблица стоп-слов должна отвечать так же, как обычное множество
+    StopWordSet stop_words;
+    ASSERT(!stop_words.Contains("and"s));
+    const vector<string> words{"and"s, "a"s, "with"s, "и"s, "в"s, "without"s, "and"s, ""s};
+    for (const string& word : words) {
+        stop_words.Insert(word);
+    }
+    ASSERT_EQUAL(stop_words.size(), 6u);
+    for (const string& word : words) {
+        ASSERT(stop_words.Contains(word) == !word.empty());
+    }
+    // совпадает длина и первая буква, но слова нет
+    ASSERT(!stop_words.Contains("ant"s));
+    ASSERT(!stop_words.Contains("wit"s));
+    ASSERT(!stop_words.Contains("cat"s));
+    // кириллица: первый байт у всех букв общий, фильтр различает их по символу
+    stop_words.Insert("под"s);
+    ASSERT(stop_words.Contains("под"s));
+    ASSERT(!stop_words.Contains("кот"s));
+    ASSERT(!stop_words.Contains("пол"s));
+    ASSERT(!stop_words.Contains("к"s));
+    ASSERT(!stop_words.Contains(string(1, '\xD0')));
+
+    // много слов - таблица должна расти и не терять вставленные
+    for (int i = 0; i < 500; ++i) {
+        stop_words.Insert("word"s + to_string(i));
+    }
+    ASSERT_EQUAL(stop_words.size(), 507u);
+    for (int i = 0; i < 500; ++i) {
+        ASSERT(stop_words.Contains("word"s + to_string(i)));
+    }
+    ASSERT(!stop_words.Contains("word500"s));
+    ASSERT(stop_words.Contains("with"s));
+
+    const vector<string> container{"in"s, "the"s};
+    SearchServer search_server(container);
+    search_server.AddDocument(1, "cat in the city"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(search_server.GetWordFrequencies(1).size(), 2u);
+}
+
+void TestPatternSearch() { // cat* и c?t раскрываются в слова словаря
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "cats in the city"s, DocumentStatus::ACTUAL, {2});
+    search_server.AddDocument(3, "catalog of dogs"s, DocumentStatus::ACTUAL, {3});
+    search_server.AddDocument(4, "cut the rope"s, DocumentStatus::ACTUAL, {4});
+    search_server.AddDocument(5, "кот и кит"s, DocumentStatus::ACTUAL, {5});
+
+    const auto ids = [](const vector<Document>& documents) {
+        set<int> result;
+        for (const Document& document : documents) {
+            result.insert(document.id);
+        }
+        return result;
+    };
+    ASSERT(ids(search_server.FindTopDocuments("cat*"s)) == set<int>({1, 2, 3}));
+    ASSERT(ids(search_server.FindTopDocuments("c?t"s)) == set<int>({1, 4}));
+    ASSERT(ids(search_server.FindTopDocuments("c*t*"s)) == set<int>({1, 2, 3, 4}));
+    ASSERT(ids(search_server.FindTopDocuments("к?т"s)) == set<int>({5}));
+    ASSERT(ids(search_server.FindTopDocuments("cat* -dog*"s)) == set<int>({2}));
+    ASSERT(search_server.FindTopDocuments("zebra*"s).empty());
+
+    // в режиме ALL шаблон выполнен, если в документе есть любое его раскрытие
+    ASSERT(ids(search_server.FindTopDocuments("cat* dog*"s, QueryMode::ALL)) == set<int>({1, 3}));
+    ASSERT(ids(search_server.FindTopDocuments("the cat*"s, QueryMode::ALL)) == set<int>({2}));
+    ASSERT(search_server.FindTopDocuments("cat* zebra*"s, QueryMode::ALL).empty());
+
+    const auto [words, status] = search_server.MatchDocument("cat* dog"s, 1);
+    ASSERT(words == vector<string_view>({"cat"sv, "dog"sv}));
+
+    // раскрытие ограничено MAX_PATTERN_EXPANSION словами
+    SearchServer big_server(""s);
+    for (int i = 0; i < MAX_PATTERN_EXPANSION * 2; ++i) {
+        big_server.AddDocument(i, "word"s + to_string(i), DocumentStatus::ACTUAL, {1});
+    }
+    const auto [big_words, big_status] = big_server.MatchDocument("word*"s, 0);
+    ASSERT_EQUAL(big_words.size(), 1u);
+    size_t matched = 0;
+    for (int i = 0; i < MAX_PATTERN_EXPANSION * 2; ++i) {
+        matched += get<0>(big_server.MatchDocument("word*"s, i)).size();
+    }
+    ASSERT_EQUAL(matched, static_cast<size_t>(MAX_PATTERN_EXPANSION));
+    // при ограничении остаются самые частые слова, а не первые по словарю
+    for (int i = 0; i < 3; ++i) {
+        big_server.AddDocument(1000 + i, "word99"s, DocumentStatus::ACTUAL, {1});
+    }
+    ASSERT_EQUAL(get<0>(big_server.MatchDocument("word*"s, 1000)).size(), 1u);
+
+    // шаблон без буквального начала раскрывал бы весь словарь
+    for (const string& query : {"*cat"s, "?at"s, "cat -*og"s}) {
+        bool thrown = false;
+        try {
+            search_server.FindTopDocuments(query);
+        } catch (const invalid_argument&) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+
+    SearchServer analyzed_server(""s, TextAnalyzer::Full());
+    analyzed_server.AddDocument(1, "Кошки гуляют"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(analyzed_server.FindTopDocuments("КОШ*"s).size(), 1u);
+
+    // слово, попавшее в запрос и само, и через раскрытие, учитывается один раз
+    SearchServer repeated_server(""s);
+    repeated_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    repeated_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    const double cat_relevance = repeated_server.FindTopDocuments("cat"s)[0].relevance;
+    for (const string& query : {"cat cat*"s, "cat* cat*"s, "cat cat~1"s, "cat* ca?"s}) {
+        const auto found = repeated_server.FindTopDocuments(query);
+        ASSERT_EQUAL(found.size(), 1u);
+        ASSERT(abs(found[0].relevance - cat_relevance) < SCOPE);
+        ASSERT(abs(repeated_server.FindTopDocuments(execution::par, query)[0].relevance - cat_relevance) < SCOPE);
+    }
+
+    // порядок сложения постингов не зависит от того, где в памяти оказались слова: у индекса, собранного
+    // в другом порядке, релевантности совпадают до бита
+    const vector<string> tree_words = {"amber"s, "birch"s, "cedar"s, "daisy"s, "elm"s, "fern"s, "gorse"s};
+    SearchServer forward_server(""s);
+    SearchServer backward_server(""s);
+    string reversed;
+    for (auto word = tree_words.rbegin(); word != tree_words.rend(); ++word) {
+        reversed += *word + " "s;
+    }
+    backward_server.AddDocument(1000, reversed, DocumentStatus::ACTUAL, {1});
+    backward_server.RemoveDocument(1000);
+    for (int id = 0; id < 40; ++id) {
+        string text;
+        for (size_t i = 0; i < tree_words.size(); ++i) {
+            if ((id + 1) % (i + 2) != 0) {
+                text += tree_words[i] + " "s;
+            }
+        }
+        forward_server.AddDocument(id, text + "x"s, DocumentStatus::ACTUAL, {id % 3});
+        backward_server.AddDocument(id, text + "x"s, DocumentStatus::ACTUAL, {id % 3});
+    }
+    for (const string& query : {"amber birch cedar daisy elm fern gorse"s, "gorse* amb* cedar"s, "fern~1 birch daisy"s}) {
+        const auto forward = forward_server.FindTopDocuments(query);
+        const auto backward = backward_server.FindTopDocuments(query);
+        ASSERT_EQUAL(forward.size(), backward.size());
+        for (size_t i = 0; i < forward.size(); ++i) {
+            ASSERT_EQUAL(forward[i].id, backward[i].id);
+            ASSERT(forward[i].relevance == backward[i].relevance);
+        }
+    }
+
+    // слово без документов не раскрывается; когда документ с ним появляется снова, разобранный запрос
+    // из кеша устаревает, и шаблон с нечетким словом его находят
+    SearchServer revived_server(""s);
+    revived_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    revived_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    revived_server.RemoveDocument(1);
+    ASSERT(revived_server.FindTopDocuments("ca*"s).empty());
+    ASSERT(revived_server.FindTopDocuments("cat~1"s).empty());
+    revived_server.AddDocument(3, "cat"s, DocumentStatus::ACTUAL, {1});
+    ASSERT(ids(revived_server.FindTopDocuments("ca*"s)) == set<int>({3}));
+    ASSERT(ids(revived_server.FindTopDocuments("cat~1"s)) == set<int>({3}));
+    revived_server.RemoveDocument(3);
+    revived_server.UpdateDocument(2, "dog cat"s, DocumentStatus::ACTUAL, {1});
+    ASSERT(ids(revived_server.FindTopDocuments("ca*"s)) == set<int>({2}));
+}
+
+int LevenshteinDistance(const u32string& lhs, const u32string& rhs) {
+    vector<int> row(rhs.size() + 1);
+    iota(row.begin(), row.end(), 0);
+    for (size_t i = 1; i <= lhs.size(); ++i) {
+        int diagonal = row[0];
+        row[0] = static_cast<int>(i);
+        for (size_t j = 1; j <= rhs.size(); ++j) {
+            const int above = row[j];
+            row[j] = min({row[j] + 1, row[j - 1] + 1, diagonal + (lhs[i - 1] != rhs[j - 1] ? 1 : 0)});
+            diagonal = above;
+        }
+    }
+    return row.back();
+}
+
+void TestFuzzySearch() { // cat~1 находит слова с одной опечаткой, точное совпадение ранжируется выше
+    SearchServer search_server(""s);
+    search_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "cats"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(3, "cut"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(4, "dog"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(5, "кошка"s, DocumentStatus::ACTUAL, {1});
+
+    const auto found = search_server.FindTopDocuments("cat~1"s);
+    ASSERT_EQUAL(found.size(), 3u);
+    ASSERT_EQUAL(found[0].id, 1);
+    ASSERT(search_server.FindTopDocuments("cat"s).size() == 1u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("dgo~2"s).size(), 1u);
+    ASSERT(search_server.FindTopDocuments("dgo~1"s).empty());
+    // расстояние считается по буквам, а не по байтам UTF-8
+    ASSERT_EQUAL(search_server.FindTopDocuments("кашка~"s).size(), 1u);
+
+    bool thrown = false;
+    try {
+        search_server.FindTopDocuments("cat~3"s);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat~ -cuts~"s).size(), 1u);
+    ASSERT(search_server.FindTopDocuments("cat~ dog"s, QueryMode::ALL).empty());
+
+    // на случайном словаре раскрытие должно совпадать с перебором
+    mt19937 generator(7);
+    const u32string alphabet = U"abcdя";
+    vector<u32string> words;
+    SearchServer random_server(""s);
+    for (int id = 0; id < 300; ++id) {
+        u32string word;
+        const size_t length = 1 + generator() % 6;
+        for (size_t i = 0; i < length; ++i) {
+            word += alphabet[generator() % alphabet.size()];
+        }
+        words.push_back(word);
+        string text;
+        for (const char32_t letter : word) {
+            text += letter == U'я' ? "я"s : string(1, static_cast<char>(letter));
+        }
+        random_server.AddDocument(id, text, DocumentStatus::ACTUAL, {1});
+    }
+    for (const auto& [query, query_letters] : vector<pair<string, u32string>>{{"abc"s, U"abc"}, {"dяa"s, U"dяa"}, {"b"s, U"b"}}) {
+        for (const int distance : {1, 2}) {
+            for (int id = 0; id < 300; ++id) {
+                const bool expected = LevenshteinDistance(words[id], query_letters) <= distance;
+                const auto [matched, status] = random_server.MatchDocument(query + "~"s + to_string(distance), id);
+                ASSERT_EQUAL(!matched.empty(), expected);
+            }
+        }
+    }
+}
+
+void TestSearchPages() { // страницы по курсору должны складываться в полную выдачу без пропусков и повторов
+    SearchServer search_server(""s);
+    for (int id = 0; id < 23; ++id) {
+        // у части документов одинаковые релевантность и рейтинг - порядок между ними задает id
+        const string text = "cat"s + string(id % 3, ' ') + (id % 2 ? " dog"s : " cat"s);
+        search_server.AddDocument(id, text, id == 5 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {id % 4});
+    }
+
+    const SearchPage all = search_server.FindPage("cat dog"s, SearchCursor(), 100);
+    ASSERT_EQUAL(all.documents.size(), 22u);
+    ASSERT(!all.has_more);
+    const auto top = search_server.FindTopDocuments("cat dog"s);
+    for (size_t i = 0; i < top.size(); ++i) {
+        ASSERT_EQUAL(top[i].id, all.documents[i].id);
+    }
+
+    const auto collect = [&all](const auto& find_page) {
+        vector<int> ids;
+        SearchCursor cursor;
+        int pages = 0;
+        while (true) {
+            const SearchPage page = find_page(cursor);
+            for (const Document& document : page.documents) {
+                ids.push_back(document.id);
+            }
+            ++pages;
+            // курсор должен переживать передачу строкой
+            cursor = SearchCursor::FromString(page.next.ToString());
+            if (!page.has_more) {
+                break;
+            }
+        }
+        ASSERT_EQUAL(pages, 5);
+        ASSERT_EQUAL(ids.size(), all.documents.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ASSERT_EQUAL(ids[i], all.documents[i].id);
+        }
+    };
+    collect([&search_server](const SearchCursor& cursor) {
+        return search_server.FindPage("cat dog"s, cursor, 5);
+    });
+    collect([&search_server](const SearchCursor& cursor) {
+        return search_server.FindPage(execution::par, "cat dog"s, cursor, 5, QueryMode::ANY, [](int, DocumentStatus status, int) {
+            return status == DocumentStatus::ACTUAL;
+        });
+    });
+
+    // окно страниц устаревает после изменения индекса
+    const SearchPage first = search_server.FindPage("cat"s, SearchCursor(), 3);
+    search_server.AddDocument(100, "cat cat cat"s, DocumentStatus::ACTUAL, {9});
+    const SearchPage second = search_server.FindPage("cat"s, first.next, 3);
+    ASSERT(find_if(second.documents.begin(), second.documents.end(), [](const Document& document) {
+               return document.id == 100;
+           }) == second.documents.end());
+    ASSERT_EQUAL(search_server.FindPage("cat"s, SearchCursor(), 3).documents[0].id, 100);
+
+    bool thrown = false;
+    try {
+        SearchCursor::FromString("not a cursor"s);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT(SearchCursor::FromString(""s).IsStart());
+
+    // релевантности соседних документов отличаются меньше чем на SCOPE, а рейтинг растет навстречу
+    // релевантности: в пределах ступени SCOPE выше документ с большим рейтингом, и страницы все равно
+    // должны пройти каждый документ ровно один раз
+    SearchServer chained(""s);
+    for (int id = 0; id < 12; ++id) {
+        string text = "cat"s;
+        for (int word = 1; word < 1000 + id; ++word) {
+            text += " x"s;
+        }
+        chained.AddDocument(id, text, DocumentStatus::ACTUAL, {id});
+        chained.AddDocument(100 + id, "x"s, DocumentStatus::ACTUAL, {0});
+    }
+    const auto everything = [](int, DocumentStatus, int) {
+        return true;
+    };
+    const vector<Document> ranked = chained.FindPage(execution::seq, "cat"s, SearchCursor(), 12, QueryMode::ANY, everything).documents;
+    ASSERT_EQUAL(ranked.size(), 12u);
+    vector<int> expected_ids;
+    size_t rating_ties = 0;
+    for (size_t i = 0; i < ranked.size(); ++i) {
+        expected_ids.push_back(ranked[i].id);
+        if (i == 0) {
+            continue;
+        }
+        const int64_t previous_key = RelevanceKey(ranked[i - 1].relevance);
+        const int64_t key = RelevanceKey(ranked[i].relevance);
+        ASSERT(previous_key >= key);
+        if (previous_key == key) {
+            ASSERT(ranked[i - 1].rating > ranked[i].rating);
+            // внутри ступени документ с меньшей релевантностью, но большим рейтингом идет первым
+            rating_ties += ranked[i - 1].relevance < ranked[i].relevance;
+        }
+    }
+    ASSERT(rating_ties > 0);
+    vector<int> sorted_ids = expected_ids;
+    sort(sorted_ids.begin(), sorted_ids.end());
+    ASSERT(sorted_ids == vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}));
+    for (size_t page_size = 1; page_size <= 5; ++page_size) {
+        vector<int> chained_ids;
+        SearchCursor cursor;
+        for (SearchPage page; (cursor.IsStart() || page.has_more) && chained_ids.size() <= 12; cursor = page.next) {
+            page = chained.FindPage(execution::seq, "cat"s, SearchCursor::FromString(cursor.ToString()), page_size, QueryMode::ANY, everything);
+            for (const Document& document : page.documents) {
+                chained_ids.push_back(document.id);
+            }
+        }
+        ASSERT(chained_ids == expected_ids);
+    }
+}
+
+void TestUpdateDocument() { // обновленный документ должен искаться так же, как добавленный заново
+    const vector<string> texts = {"white cat and fancy collar"s, "fluffy cat fluffy tail"s, "groomed dog expressive eyes"s, "cat dog"s};
+    SearchServer updated("and in"s);
+    SearchServer rebuilt("and in"s);
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        updated.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+    }
+    // текст меняется целиком, частично и на одни стоп-слова; документа 7 не было - он добавляется
+    updated.UpdateDocument(0, "black dog and collar collar"s, DocumentStatus::ACTUAL, {5, 7});
+    updated.UpdateDocument(1, "fluffy cat tail"s, DocumentStatus::ACTUAL, {1});
+    updated.UpdateDocument(3, "and in"s, DocumentStatus::ACTUAL, {3});
+    updated.UpdateDocument(7, "fluffy parrot"s, DocumentStatus::ACTUAL, {2});
+    rebuilt.AddDocument(0, "black dog and collar collar"s, DocumentStatus::ACTUAL, {5, 7});
+    rebuilt.AddDocument(1, "fluffy cat tail"s, DocumentStatus::ACTUAL, {1});
+    rebuilt.AddDocument(2, texts[2], DocumentStatus::ACTUAL, {2});
+    rebuilt.AddDocument(3, "and in"s, DocumentStatus::ACTUAL, {3});
+    rebuilt.AddDocument(7, "fluffy parrot"s, DocumentStatus::ACTUAL, {2});
+
+    ASSERT_EQUAL(updated.GetDocumentCount(), rebuilt.GetDocumentCount());
+    for (const int id : rebuilt) {
+        ASSERT(updated.GetWordFrequencies(id) == rebuilt.GetWordFrequencies(id));
+        ASSERT(updated.GetFingerprint(id) == rebuilt.GetFingerprint(id));
+    }
+    for (const string& query : {"cat"s, "fluffy tail"s, "dog collar -eyes"s, "white fancy"s, "parrot"s}) {
+        const auto expected = rebuilt.FindTopDocuments(query);
+        const auto actual = updated.FindTopDocuments(query);
+        ASSERT_EQUAL(actual.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQUAL(actual[i].id, expected[i].id);
+            ASSERT_EQUAL(actual[i].rating, expected[i].rating);
+            ASSERT(abs(actual[i].relevance - expected[i].relevance) < SCOPE);
+        }
+    }
+
+    // смена статуса и рейтинга не трогает индекс, но сразу видна в выдаче
+    updated.SetDocumentStatus(1, DocumentStatus::BANNED);
+    ASSERT_EQUAL(updated.FindTopDocuments("fluffy"s).size(), 1u);
+    ASSERT_EQUAL(updated.FindTopDocuments("fluffy"s, DocumentStatus::BANNED)[0].id, 1);
+    updated.SetRating(7, 42);
+    ASSERT_EQUAL(updated.FindTopDocuments("parrot"s)[0].rating, 42);
+    ASSERT(get<1>(updated.MatchDocument("fluffy"s, 1)) == DocumentStatus::BANNED);
+
+    // удаленный документ можно добавить снова, а менять его метаданные уже нельзя
+    updated.RemoveDocument(7);
+    bool thrown = false;
+    try {
+        updated.SetDocumentStatus(7, DocumentStatus::ACTUAL);
+    } catch (const out_of_range&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    updated.AddDocument(7, "grey parrot"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(updated.FindTopDocuments("grey"s).size(), 1u);
+
+    // некорректный текст не портит документ
+    thrown = false;
+    try {
+        updated.UpdateDocument(2, "bad \x01word"s, DocumentStatus::ACTUAL, {1});
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT(updated.GetWordFrequencies(2) == rebuilt.GetWordFrequencies(2));
+}
+
+void TestDurableSearchServer() { // мутации должны переживать перезапуск, оборванный хвост журнала - отбрасываться
+    const filesystem::path directory = filesystem::temp_directory_path() / ("search_server_wal_test_"s + to_string(random_device()()));
+    filesystem::remove_all(directory);
+    const auto top_ids = [](const SearchServer& search_server, const string& query) {
+        vector<int> ids;
+        for (const Document& document : search_server.FindTopDocuments(query)) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+
+    vector<int> expected;
+    {
+        DurableSearchServer server(directory.string(), "and in"s);
+        server.AddDocument(1, "white cat and fancy collar"s, DocumentStatus::ACTUAL, {8, -3});
+        server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+        server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::BANNED, {5, -12, 2, 1});
+        server.AddDocument(4, "and in"s, DocumentStatus::ACTUAL, {1});
+        server.RemoveDocument(1);
+        server.RemoveDocument(42);
+        expected = top_ids(server.GetServer(), "fluffy cat"s);
+    }
+    {
+        DurableSearchServer server(directory.string(), "and in"s);
+        ASSERT_EQUAL(server.GetServer().GetDocumentCount(), 2);
+        ASSERT_EQUAL(top_ids(server.GetServer(), "fluffy cat"s), expected);
+        ASSERT_EQUAL(server.GetServer().FindTopDocuments("dog"s, DocumentStatus::BANNED).size(), 1u);
+        ASSERT_EQUAL(server.GetLog().LastLsn(), 6u);
+
+        // после контрольной точки журнал пуст, а данные живут в снимке
+        server.Checkpoint();
+        ASSERT_EQUAL(filesystem::file_size(directory / "wal.log"), 0u);
+        server.AddDocument(5, "fluffy dog"s, DocumentStatus::ACTUAL, {3});
+    }
+    {
+        DurableSearchServer server(directory.string(), "and in"s);
+        ASSERT_EQUAL(server.GetServer().GetDocumentCount(), 3);
+        ASSERT_EQUAL(server.GetLog().LastLsn(), 7u);
+        ASSERT_EQUAL(server.GetServer().GetWordFrequencies(3).at("dog"sv), 0.25);
+        ASSERT(server.GetServer().GetWordFrequencies(4).empty());
+    }
+
+    // запись, оборванная при сбое, отбрасывается вместе со всем, что за ней
+    {
+        ofstream log(directory / "wal.log", ios::binary | ios::app);
+        log << "\x30\x00\x00\x00garbage"s;
+    }
+    {
+        DurableSearchServer server(directory.string(), "and in"s);
+        ASSERT_EQUAL(server.GetServer().GetDocumentCount(), 3);
+        server.AddDocument(6, "fluffy parrot"s, DocumentStatus::ACTUAL, {1});
+        server.UpdateDocument(5, "fluffy hamster"s, DocumentStatus::ACTUAL, {4});
+        server.SetDocumentStatus(2, DocumentStatus::IRRELEVANT);
+        server.SetRating(3, 11);
+    }
+    {
+        DurableSearchServer server(directory.string(), "and in"s, TextAnalyzer(), DurabilityOptions{true, 1, 2});
+        ASSERT_EQUAL(top_ids(server.GetServer(), "parrot"s), vector<int>{6});
+        ASSERT_EQUAL(top_ids(server.GetServer(), "hamster"s), vector<int>{5});
+        ASSERT_EQUAL(server.GetServer().FindTopDocuments("fluffy"s, DocumentStatus::IRRELEVANT).size(), 1u);
+        ASSERT_EQUAL(server.GetServer().FindTopDocuments("dog"s, DocumentStatus::BANNED)[0].rating, 11);
+        // каждая мутация синхронная, а каждая вторая - еще и контрольная точка
+        server.AddDocument(7, "grey parrot"s, DocumentStatus::ACTUAL, {1});
+        server.AddDocument(8, "green parrot"s, DocumentStatus::ACTUAL, {1});
+        ASSERT_EQUAL(server.GetLog().DurableLsn(), server.GetLog().LastLsn());
+    }
+    {
+        DurableSearchServer server(directory.string(), "and in"s);
+        ASSERT_EQUAL(server.GetServer().FindTopDocuments("parrot"s).size(), 3u);
+    }
+
+    // обрывок неудачной записи отрезается, а запись остается в буфере журнала и сохраняется следующим Sync
+    const filesystem::path failing_directory = directory / "failing"s;
+    {
+        DurableSearchServer server(failing_directory.string(), "and in"s, TextAnalyzer(), DurabilityOptions{true, 1, 100});
+        server.AddDocument(1, "fluffy cat"s, DocumentStatus::ACTUAL, {1});
+        const uintmax_t log_size = filesystem::file_size(failing_directory / "wal.log");
+        rlimit saved_limit{};
+        ASSERT(getrlimit(RLIMIT_FSIZE, &saved_limit) == 0);
+        rlimit limit = saved_limit;
+        limit.rlim_cur = log_size + 10;
+        const auto saved_handler = signal(SIGXFSZ, SIG_IGN);
+        ASSERT(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        bool write_failed = false;
+        try {
+            server.AddDocument(2, "fluffy dog with a long tail"s, DocumentStatus::ACTUAL, {2});
+        } catch (const runtime_error&) {
+            write_failed = true;
+        }
+        setrlimit(RLIMIT_FSIZE, &saved_limit);
+        signal(SIGXFSZ, saved_handler);
+        ASSERT(write_failed);
+        ASSERT_EQUAL(filesystem::file_size(failing_directory / "wal.log"), log_size);
+        ASSERT_EQUAL(server.GetServer().GetDocumentCount(), 2);
+        server.Sync();
+        ASSERT_EQUAL(server.GetLog().DurableLsn(), 2u);
+
+        // отклоненная индексом мутация остается в журнале, но ничего не меняет
+        bool rejected = false;
+        try {
+            server.AddDocument(1, "grey parrot"s, DocumentStatus::ACTUAL, {3});
+        } catch (const invalid_argument&) {
+            rejected = true;
+        }
+        ASSERT(rejected);
+        ASSERT_EQUAL(server.GetServer().GetDocumentCount(), 2);
+    }
+    {
+        DurableSearchServer server(failing_directory.string(), "and in"s);
+        ASSERT_EQUAL(server.GetLog().LastLsn(), 3u);
+        ASSERT_EQUAL(server.GetServer().GetDocumentCount(), 2);
+        ASSERT_EQUAL(top_ids(server.GetServer(), "dog"s), vector<int>{2});
+        ASSERT(server.GetServer().FindTopDocuments("parrot"s).empty());
+    }
+
+    // поврежденный снимок не загружается молча
+    {
+        fstream snapshot(directory / "snapshot.bin", ios::binary | ios::in | ios::out);
+        snapshot.seekp(20);
+        snapshot.put('\x7F');
+    }
+    bool thrown = false;
+    try {
+        DurableSearchServer server(directory.string(), "and in"s);
+    } catch (const runtime_error&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    filesystem::remove_all(directory);
+}
+
+void TestQueryMemory() { // установившийся запрос не должен выделять память, кроме самого ответа
+    CountingResource index_memory;
+    CountingResource query_memory;
+    {
+        pmr::synchronized_pool_resource pool(&index_memory);
+        SearchServer search_server("and in"s, TextAnalyzer(), {&pool, &query_memory});
+        for (int id = 0; id < 200; ++id) {
+            search_server.AddDocument(id, "cat and number"s + to_string(id % 7) + " dog"s + to_string(id % 3), DocumentStatus::ACTUAL, {id % 5});
+        }
+        ASSERT(index_memory.AllocationCount() > 0);
+
+        const auto count_allocations = [](const auto& search) {
+            const uint64_t before = heap_allocations;
+            search();
+            return heap_allocations - before;
+        };
+        for (const QueryMode mode : {QueryMode::ANY, QueryMode::ALL}) {
+            const string query = "cat dog1 -number3"s;
+            // первый запрос разбирается и попадает в кеш, рабочие буферы потока вырастают до нужного размера
+            ASSERT(!search_server.FindTopDocuments(query, mode).empty());
+            const uint64_t query_allocations = query_memory.AllocationCount();
+            ASSERT_EQUAL(count_allocations([&] {
+                             search_server.FindTopDocuments(query, mode);
+                         }),
+                         1u);
+            ASSERT_EQUAL(query_memory.AllocationCount(), query_allocations);
+        }
+
+        // запросов больше, чем слотов кеша: каждый вытесняет другой, но узел и векторы вытесненного
+        // переиспользуются, и в установившемся режиме выделяется память только под ответ
+        vector<string> queries;
+        for (int i = 0; i < QUERY_CACHE_SIZE + QUERY_CACHE_SIZE / 2; ++i) {
+            queries.push_back("cat dog"s + to_string(i % 3) + " q"s + to_string(i));
+        }
+        for (int pass = 0; pass < 2; ++pass) {
+            for (const string& query : queries) {
+                search_server.FindTopDocuments(query);
+            }
+        }
+        const uint64_t cycle_allocations = count_allocations([&] {
+            for (const string& query : queries) {
+                search_server.FindTopDocuments(query);
+            }
+        });
+        ASSERT_EQUAL(cycle_allocations, queries.size());
+
+        // кандидаты не умещаются в начальный буфер арены: недостающее берется у ресурса запросов, а буфер растет
+        for (int id = 200; id < 20000; ++id) {
+            search_server.AddDocument(id, "parrot"s, DocumentStatus::ACTUAL, {1});
+        }
+        const uint64_t query_allocations = query_memory.AllocationCount();
+        search_server.FindTopDocuments("parrot"s);
+        ASSERT(query_memory.AllocationCount() > query_allocations);
+        ASSERT_EQUAL(query_memory.BytesInUse(), 0u);
+        ASSERT_EQUAL(count_allocations([&] {
+                         search_server.FindTopDocuments("parrot"s);
+                     }),
+                     1u);
+
+        for (int id = 0; id < 20000; ++id) {
+            search_server.RemoveDocument(id);
+        }
+        ASSERT(search_server.FindTopDocuments("parrot"s).empty());
+    }
+    ASSERT(index_memory.DeallocationCount() > 0);
+    ASSERT_EQUAL(index_memory.BytesInUse(), 0u);
+}
+
+void TestNumaReplicas() { // реплики по узлам должны отвечать так же, как исходный сервер
+    ASSERT_EQUAL(ParseCpuList("0-3,8,10-11\n"s), (vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    ASSERT(ParseCpuList(""s).empty());
+    for (const string& bad : {"1-"s, "3-1"s, "a"s}) {
+        bool thrown = false;
+        try {
+            ParseCpuList(bad);
+        } catch (const invalid_argument&) {
+            thrown = true;
+        }
+        ASSERT_HINT(thrown, bad);
+    }
+
+    const vector<NumaNode> topology = DetectNumaTopology();
+    ASSERT(!topology.empty());
+    for (const NumaNode& node : topology) {
+        ASSERT(!node.cpus.empty());
+    }
+
+    SearchServer search_server("and in"s);
+    search_server.AddDocument(1, "white cat and fancy collar"s, DocumentStatus::ACTUAL, {8, -3});
+    search_server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+    search_server.AddDocument(4, "in and"s, DocumentStatus::BANNED, {9});
+    search_server.SetEmbeddings({{1, {1, 0, 0}}, {2, {0.9f, 0.1f, 0}}, {3, {0, 0, 1}}});
+    search_server.RebuildImpactPostings(1 << 20, 1);
+    const vector<string> queries = {"fluffy cat"s, "cat and collar"s, "dog -eyes"s, "parrot"s, "groomed in dog"s};
+
+    const NumaReplicas local(search_server, {topology[0]});
+    ASSERT(!local.IsReplicated());
+    ASSERT_EQUAL(&local.Replica(0), &search_server);
+
+    // два узла на одних и тех же процессорах: реплики строятся и на машине с одним узлом
+    const NumaReplicas replicas(search_server, {topology[0], {1, topology[0].cpus}});
+    ASSERT(replicas.IsReplicated());
+    for (size_t node = 0; node < replicas.NodeCount(); ++node) {
+        const SearchServer& replica = replicas.Replica(node);
+        ASSERT(&replica != &search_server);
+        ASSERT_EQUAL(replica.GetDocumentCount(), search_server.GetDocumentCount());
+        // стоп-слова переносятся в реплику, иначе "and" в режиме ALL стало бы неизвестным словом
+        ASSERT_EQUAL(replica.FindTopDocuments("cat and collar"s, QueryMode::ALL).size(), 1u);
+        // векторы и упорядоченные по вкладу копии тоже: реплика ищет так же, как исходный сервер
+        ASSERT(replica.HasEmbedding(3));
+        const auto nearest = replica.FindNearestDocuments({1, 0, 0});
+        ASSERT_EQUAL(nearest.size(), 3u);
+        ASSERT_EQUAL(nearest[0].id, 1);
+        ASSERT_EQUAL(replica.FindHybridDocuments("dog"s, {1, 0, 0}).size(), 3u);
+        ASSERT_EQUAL(replica.GetImpactPostingsBytes(), search_server.GetImpactPostingsBytes());
+    }
+    const auto expected = ProcessQueries(search_server, queries);
+    for (const NumaReplicas* numa : {&local, &replicas}) {
+        const auto result = ProcessQueriesNuma(*numa, queries);
+        ASSERT_EQUAL(result.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQUAL(result[i].size(), expected[i].size());
+            for (size_t j = 0; j < expected[i].size(); ++j) {
+                ASSERT_EQUAL(result[i][j].id, expected[i][j].id);
+                ASSERT(abs(result[i][j].relevance - expected[i][j].relevance) < SCOPE);
+            }
+        }
+    }
+    // пакеты обрабатывают одни и те же рабочие потоки, ошибка в запросе не ломает их для следующих пакетов
+    for (const NumaReplicas* numa : {&local, &replicas}) {
+        set<thread::id> workers;
+        mutex workers_mutex;
+        for (int batch = 0; batch < 3; ++batch) {
+            numa->RunOnWorkers(0, numa->NodeCount(), [&](size_t, size_t) {
+                lock_guard lock(workers_mutex);
+                workers.insert(this_thread::get_id());
+            });
+        }
+        size_t worker_count = 0;
+        for (size_t node = 0; node < numa->NodeCount(); ++node) {
+            worker_count += numa->Node(node).cpus.size();
+        }
+        ASSERT_EQUAL(workers.size(), worker_count);
+        ASSERT(!workers.count(this_thread::get_id()));
+
+        bool thrown = false;
+        try {
+            ProcessQueriesNuma(*numa, {"cat"s, "cat --dog"s, "dog"s});
+        } catch (const invalid_argument&) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+        for (size_t node = 0; node < numa->NodeCount(); ++node) {
+            const auto result = ProcessQueriesNuma(*numa, queries, node);
+            ASSERT_EQUAL(result.size(), expected.size());
+            ASSERT_EQUAL(result[0].size(), expected[0].size());
+        }
+    }
+}
+
+void TestQueryReplay() { // разбор корпуса и журнала, число замеров и поправка на скоординированное упущение
+    istringstream corpus("white cat and fancy collar\n\n7\t2\t4 -2\tgroomed dog\n"s);
+    SearchServer search_server("and"s);
+    ASSERT_EQUAL(LoadCorpus(corpus, search_server), 2u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s)[0].id, 0);
+    const auto banned = search_server.FindTopDocuments("dog"s, DocumentStatus::BANNED);
+    ASSERT_EQUAL(banned.size(), 1u);
+    ASSERT_EQUAL(banned[0].id, 7);
+    ASSERT_EQUAL(banned[0].rating, 1);
+    for (const string& bad : {"1\t9\t1\tcat\n"s, "x\t0\t1\tcat\n"s, "1\t0\tcat\n"s}) {
+        istringstream input(bad);
+        bool thrown = false;
+        try {
+            LoadCorpus(input, search_server);
+        } catch (const invalid_argument&) {
+            thrown = true;
+        }
+        ASSERT_HINT(thrown, bad);
+    }
+
+    istringstream log_input("0\tcat\n250\tdog collar\r\n\n250\tcat --collar\n2000\tfancy\n"s);
+    const vector<LoggedQuery> log = ReadQueryLog(log_input);
+    ASSERT_EQUAL(log.size(), 4u);
+    ASSERT_EQUAL(log[1].offset_ns, 250'000u);
+    ASSERT_EQUAL(log[1].text, "dog collar"s);
+    istringstream unordered_log("5\tcat\n1\tdog\n"s);
+    bool thrown = false;
+    try {
+        ReadQueryLog(unordered_log);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+
+    ReplayOptions options;
+    options.threads = 2;
+    for (const ReplayMode mode : {ReplayMode::CLOSED_LOOP, ReplayMode::FIXED_RATE, ReplayMode::RECORDED}) {
+        options.mode = mode;
+        options.rate = 10'000;
+        const ReplayReport report = ReplayQueries(search_server, log, options);
+        ASSERT_EQUAL(report.queries, 4u);
+        // "--collar" - некорректный запрос, он считается ошибкой, но прогон продолжается
+        ASSERT_EQUAL(report.errors, 1u);
+        ASSERT_EQUAL(report.service.Count(), 4u);
+        ASSERT(report.response.Count() >= 4u);
+        ASSERT(report.response.Max() >= report.service.Max());
+    }
+    // журнал растягивается на 2 мс, быстрее он не проигрывается
+    options.mode = ReplayMode::RECORDED;
+    ASSERT(ReplayQueries(search_server, log, options).seconds >= 0.002);
+    // некорректный запрос не доходит до ProcessQueries: три корректных делятся на две пачки
+    options.api = ReplayApi::PROCESS_QUERIES;
+    options.batch_size = 2;
+    const ReplayReport batched = ReplayQueries(search_server, log, options);
+    ASSERT_EQUAL(batched.errors, 1u);
+    ASSERT_EQUAL(batched.service.Count(), 2u);
+
+    // ответ через 10 интервалов означает, что клиент не отправил еще 9 запросов, ждавших 9, 8, ..., 1 интервал
+    LatencyHistogram histogram;
+    RecordWithExpectedInterval(histogram, 10'000, 1'000);
+    ASSERT_EQUAL(histogram.Count(), 10u);
+    ASSERT_EQUAL(histogram.Min(), 1'000u);
+    RecordWithExpectedInterval(histogram, 500, 1'000);
+    ASSERT_EQUAL(histogram.Count(), 11u);
+}
+
+void TestImpactPostings() { // выдача по упорядоченным по вкладу копиям должна совпадать с полным просмотром
+    mt19937 generator(7);
+    const vector<string> words = {"cat"s, "dog"s, "parrot"s, "hamster"s, "fish"s};
+    SearchServer scanned(""s);
+    SearchServer impact(""s);
+    for (int id = 0; id < 600; ++id) {
+        string text;
+        const int length = 1 + static_cast<int>(generator() % 8);
+        for (int i = 0; i < length; ++i) {
+            // частоты слов разные: cat почти в каждом документе, fish редко
+            text += words[min<size_t>(generator() % 7, words.size() - 1) * (generator() % 2)] + " "s;
+        }
+        scanned.AddDocument(id, text, id % 5 ? DocumentStatus::ACTUAL : DocumentStatus::BANNED, {static_cast<int>(generator() % 5)});
+        impact.AddDocument(id, text, id % 5 ? DocumentStatus::ACTUAL : DocumentStatus::BANNED, {static_cast<int>(generator() % 5)});
+    }
+    // рейтинги разные, поэтому одинаковый порядок выдачи проверяет и разбор ничьих по релевантности
+    for (int id = 0; id < 600; ++id) {
+        impact.SetRating(id, id % 4);
+        scanned.SetRating(id, id % 4);
+    }
+
+    impact.RebuildImpactPostings(1 << 20, 50);
+    ASSERT(impact.GetImpactPostingsBytes() > 0);
+    const auto same = [](const vector<Document>& lhs, const vector<Document>& rhs) {
+        ASSERT_EQUAL(lhs.size(), rhs.size());
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            ASSERT_EQUAL(lhs[i].id, rhs[i].id);
+            ASSERT(abs(lhs[i].relevance - rhs[i].relevance) < SCOPE);
+        }
+    };
+    const auto check = [&] {
+        for (const string& word : words) {
+            same(impact.FindTopDocuments(word), scanned.FindTopDocuments(word));
+            same(impact.FindTopDocuments(execution::par, word), scanned.FindTopDocuments(execution::par, word));
+            same(impact.FindTopDocuments(word, QueryMode::ALL), scanned.FindTopDocuments(word, QueryMode::ALL));
+            same(impact.FindTopDocuments(word, DocumentStatus::BANNED), scanned.FindTopDocuments(word, DocumentStatus::BANNED));
+            const auto odd = [](int id, DocumentStatus, int) {
+                return id % 2 == 1;
+            };
+            same(impact.FindTopDocuments(word, odd), scanned.FindTopDocuments(word, odd));
+            SearchCursor cursor;
+            for (int page = 0; page < 4; ++page) {
+                const SearchPage impact_page = impact.FindPage(execution::seq, word, cursor, 7, QueryMode::ANY, odd);
+                same(impact_page.documents, scanned.FindPage(execution::seq, word, cursor, 7, QueryMode::ANY, odd).documents);
+                cursor = impact_page.next;
+            }
+        }
+    };
+    check();
+
+    // изменение документа правит копии его слов на месте
+    const size_t bytes = impact.GetImpactPostingsBytes();
+    impact.AddDocument(1000, "cat cat"s, DocumentStatus::ACTUAL, {9});
+    scanned.AddDocument(1000, "cat cat"s, DocumentStatus::ACTUAL, {9});
+    impact.UpdateDocument(3, "dog"s, DocumentStatus::ACTUAL, {1});
+    scanned.UpdateDocument(3, "dog"s, DocumentStatus::ACTUAL, {1});
+    ASSERT(impact.GetImpactPostingsBytes() >= bytes);
+    check();
+    impact.RemoveDocument(execution::par, 1000);
+    scanned.RemoveDocument(execution::par, 1000);
+    impact.RemoveDocument(7);
+    scanned.RemoveDocument(7);
+    impact.UpdateDocument(8, "fish cat fish"s, DocumentStatus::ACTUAL, {2});
+    scanned.UpdateDocument(8, "fish cat fish"s, DocumentStatus::ACTUAL, {2});
+    check();
+    impact.RebuildImpactPostings(1 << 20, 50);
+    check();
+
+    // у построенных в фоне копий отбрасываются только слова, чьи постинги успели измениться,
+    // а смена статуса им не мешает
+    const size_t full_bytes = impact.GetImpactPostingsBytes();
+    ImpactPostings stale = impact.BuildImpactPostings(1 << 20, 50);
+    impact.AddDocument(2000, "parrot"s, DocumentStatus::ACTUAL, {1});
+    scanned.AddDocument(2000, "parrot"s, DocumentStatus::ACTUAL, {1});
+    impact.SetDocumentStatus(5, DocumentStatus::ACTUAL);
+    scanned.SetDocumentStatus(5, DocumentStatus::ACTUAL);
+    ASSERT(impact.InstallImpactPostings(move(stale)));
+    const size_t stale_bytes = impact.GetImpactPostingsBytes();
+    ASSERT(stale_bytes > 0 && stale_bytes < full_bytes);
+    check();
+    SearchServer other(""s);
+    ASSERT(!other.InstallImpactPostings(impact.BuildImpactPostings(1 << 20, 50)));
+
+    // бюджет памяти ограничивает число копий
+    impact.RebuildImpactPostings(600 * sizeof(pair<int, double>), 1);
+    ASSERT(impact.GetImpactPostingsBytes() <= 600 * sizeof(pair<int, double>));
+    check();
+}
+
+void TestVectorSearch() { // HNSW должен находить почти всех точных соседей, фильтровать по статусу и сливаться с TF-IDF
+    mt19937 generator(11);
+    normal_distribution<float> normal;
+    for (size_t size = 1; size < 40; ++size) {
+        vector<float> lhs(size);
+        vector<float> rhs(size);
+        double expected = 0;
+        for (size_t i = 0; i < size; ++i) {
+            lhs[i] = normal(generator);
+            rhs[i] = normal(generator);
+            expected += static_cast<double>(lhs[i]) * rhs[i];
+        }
+        ASSERT(abs(DotProduct(lhs.data(), rhs.data(), size) - expected) < 1e-4);
+    }
+
+    // векторы вокруг центров кластеров, как у эмбеддингов похожих текстов
+    const size_t dimension = 24;
+    vector<vector<float>> centers(20, vector<float>(dimension));
+    for (auto& center : centers) {
+        for (float& value : center) {
+            value = normal(generator);
+        }
+    }
+    const auto random_vector = [&] {
+        vector<float> vector = centers[generator() % centers.size()];
+        for (float& value : vector) {
+            value += 0.5f * normal(generator);
+        }
+        return vector;
+    };
+    vector<pair<int, vector<float>>> vectors;
+    for (int id = 0; id < 3000; ++id) {
+        vectors.push_back({id, random_vector()});
+    }
+    HnswIndex sequential(dimension);
+    sequential.AddBatch(execution::seq, vectors);
+    HnswIndex parallel(dimension);
+    parallel.AddBatch(execution::par, vectors);
+    ASSERT_EQUAL(parallel.Size(), vectors.size());
+
+    vector<vector<float>> queries;
+    for (int i = 0; i < 50; ++i) {
+        queries.push_back(random_vector());
+    }
+    const auto recall = [&](const HnswIndex& index) {
+        size_t found = 0;
+        for (const auto& query : queries) {
+            const auto exact = index.SearchExact(query, 10);
+            const auto approximate = index.Search(query, 10);
+            ASSERT_EQUAL(approximate.size(), 10u);
+            for (size_t i = 1; i < approximate.size(); ++i) {
+                ASSERT(approximate[i - 1].similarity >= approximate[i].similarity);
+            }
+            for (const VectorMatch& match : exact) {
+                found += any_of(approximate.begin(), approximate.end(), [&match](const VectorMatch& other) {
+                    return other.id == match.id;
+                });
+            }
+        }
+        return static_cast<double>(found) / (queries.size() * 10);
+    };
+    ASSERT(recall(sequential) >= 0.95);
+    ASSERT(recall(parallel) >= 0.95);
+
+    // удаленные и не прошедшие фильтр векторы не попадают в выдачу, но граф остается связным
+    for (int id = 0; id < 3000; id += 3) {
+        parallel.Remove(id);
+    }
+    ASSERT(!parallel.Remove(0));
+    ASSERT_EQUAL(parallel.NodeCount(), vectors.size());
+    for (const auto& query : queries) {
+        const auto matches = parallel.Search(query, 10, [](int id) {
+            return id % 2 == 0;
+        });
+        ASSERT_EQUAL(matches.size(), 10u);
+        for (const VectorMatch& match : matches) {
+            ASSERT(match.id % 2 == 0 && match.id % 3 != 0);
+        }
+    }
+    parallel.Add(0, vectors[0].second);
+    ASSERT_EQUAL(parallel.Search(vectors[0].second, 1)[0].id, 0);
+
+    const auto throws_invalid = [](auto action) {
+        try {
+            action();
+        } catch (const invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(throws_invalid([&] { sequential.Add(5000, vector<float>(dimension - 1, 1)); }));
+    ASSERT(throws_invalid([&] { sequential.Add(5000, vector<float>(dimension, 0)); }));
+    ASSERT(throws_invalid([&] { sequential.Add(1, vectors[1].second); }));
+    ASSERT(throws_invalid([&] { sequential.Search(vector<float>(dimension + 1, 1), 3); }));
+    ASSERT_EQUAL(sequential.Size(), vectors.size());
+
+    // отклоненная первая пачка не закрепляет размерность: граф векторов так и не появляется
+    SearchServer rejected_server(""s);
+    rejected_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    rejected_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    ASSERT(throws_invalid([&] { rejected_server.SetEmbeddings({{1, {1, 0}}, {2, {1, 0, 0}}}); }));
+    ASSERT(throws_invalid([&] { rejected_server.SetEmbeddings({{1, {1, 0}}, {2, {NAN, 0}}}); }));
+    ASSERT(!rejected_server.HasEmbedding(1));
+    ASSERT_EQUAL(rejected_server.GetMemoryUsage().vector_index, 0u);
+    rejected_server.SetEmbeddings({{1, {1, 0, 0}}, {2, {0, 1, 0}}});
+    ASSERT_EQUAL(rejected_server.FindNearestDocuments({0, 1, 0})[0].id, 2);
+
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "white cat"s, DocumentStatus::ACTUAL, {1}, {1, 0, 0});
+    search_server.AddDocument(2, "black dog"s, DocumentStatus::ACTUAL, {2}, {0, 1, 0});
+    search_server.AddDocument(3, "grey cat and dog"s, DocumentStatus::BANNED, {3}, {0.9f, 0.1f, 0});
+    search_server.AddDocument(4, "parrot"s, DocumentStatus::ACTUAL, {4});
+    search_server.AddDocument(5, "kitten"s, DocumentStatus::ACTUAL, {5}, {0.8f, 0, 0.2f});
+    ASSERT(!search_server.HasEmbedding(4));
+
+    const vector<float> cat_vector = {1, 0.05f, 0};
+    vector<Document> nearest = search_server.FindNearestDocuments(cat_vector);
+    ASSERT_EQUAL(nearest.size(), 3u);
+    ASSERT_EQUAL(nearest[0].id, 1);
+    ASSERT_EQUAL(nearest[1].id, 5);
+    ASSERT_EQUAL(nearest[0].rating, 1);
+    ASSERT(nearest[0].relevance > 0.99);
+    nearest = search_server.FindNearestDocuments(cat_vector, DocumentStatus::BANNED);
+    ASSERT_EQUAL(nearest.size(), 1u);
+    ASSERT_EQUAL(nearest[0].id, 3);
+
+    // kitten не содержит слова cat, но близок по вектору; white cat первый в обоих списках
+    const vector<Document> hybrid = search_server.FindHybridDocuments("cat"s, cat_vector);
+    ASSERT_EQUAL(hybrid.size(), 3u);
+    ASSERT_EQUAL(hybrid[0].id, 1);
+    ASSERT_EQUAL(hybrid[1].id, 5);
+    ASSERT(abs(hybrid[0].relevance - 2.0 / (HYBRID_RANK_CONSTANT + 1)) < SCOPE);
+    HybridOptions lexical_only;
+    lexical_only.vector_weight = 0;
+    lexical_only.mode = QueryMode::ALL;
+    ASSERT_EQUAL(search_server.FindHybridDocuments("cat white"s, cat_vector, DocumentStatus::ACTUAL, lexical_only)[0].id, 1);
+
+    // неподходящий вектор не добавляет документ, замена вектора и удаление документа видны в выдаче
+    ASSERT(throws_invalid([&] { search_server.AddDocument(6, "cat"s, DocumentStatus::ACTUAL, {6}, {1, 0}); }));
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 5);
+    search_server.SetEmbeddings(execution::par, {{4, {1, 0.05f, 0}}, {5, {0, 0, 1}}});
+    nearest = search_server.FindNearestDocuments(cat_vector);
+    ASSERT_EQUAL(nearest[0].id, 4);
+    ASSERT_EQUAL(nearest.back().id, 5);
+    search_server.RemoveDocument(4);
+    ASSERT(!search_server.HasEmbedding(4));
+    ASSERT_EQUAL(search_server.FindNearestDocuments(cat_vector)[0].id, 1);
+    bool thrown = false;
+    try {
+        search_server.SetEmbeddings({{4, {1, 0, 0}}});
+    } catch (const out_of_range&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+}
+
+void TestIndexStats() { // учет памяти по структурам и форма индекса должны следовать за изменениями документов
+    SearchServer search_server("and"s);
+    const MemoryUsage empty = search_server.GetMemoryUsage();
+    ASSERT_EQUAL(empty.forward_index, 0u);
+    ASSERT_EQUAL(empty.inverted_index, 0u);
+
+    search_server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "cat and a very long word like hippopotomonstrosesquippedaliophobia"s, DocumentStatus::ACTUAL, {2});
+    search_server.AddDocument(3, "cat dog"s, DocumentStatus::ACTUAL, {3}, {1, 0});
+    search_server.AddDocument(4, "and"s, DocumentStatus::ACTUAL, {4}, {0, 1});
+    const MemoryUsage usage = search_server.GetMemoryUsage();
+    ASSERT(usage.inverted_index > 0 && usage.forward_index > 0 && usage.vocabulary > 0 && usage.metadata > 0 && usage.vector_index > 0);
+    ASSERT_EQUAL(usage.Total(), usage.inverted_index + usage.forward_index + usage.vocabulary + usage.metadata + usage.vector_index + usage.document_store);
+
+    IndexStats stats = search_server.GetStats(2);
+    ASSERT_EQUAL(stats.document_count, 4u);
+    // cat - 3 документа, dog - 2, остальные слова - по одному
+    ASSERT_EQUAL(stats.vocabulary_size, 8u);
+    ASSERT_EQUAL(stats.posting_entries, 11u);
+    ASSERT(stats.posting_length_histogram == vector<size_t>({6, 2}));
+    ASSERT_EQUAL(stats.heaviest_terms.size(), 2u);
+    ASSERT_EQUAL(stats.heaviest_terms[0].first, "cat"s);
+    ASSERT_EQUAL(stats.heaviest_terms[0].second, 3u);
+    ASSERT_EQUAL(stats.heaviest_terms[1].first, "dog"s);
+    ASSERT_EQUAL(stats.empty_postings, 0u);
+    ASSERT_EQUAL(stats.garbage_bytes, 0u);
+
+    // слова удаленного документа остаются в словаре мусором
+    search_server.RemoveDocument(2);
+    search_server.RemoveDocument(3);
+    stats = search_server.GetStats();
+    ASSERT_EQUAL(stats.vocabulary_size, 2u);
+    ASSERT_EQUAL(stats.empty_postings, 6u);
+    ASSERT(stats.garbage_bytes > 6 * sizeof("hippopotomonstrosesquippedaliophobia"));
+    ASSERT_EQUAL(stats.deleted_vectors, 1u);
+    ASSERT(stats.memory.forward_index < usage.forward_index);
+    ASSERT_EQUAL(search_server.GetStats(0).heaviest_terms.size(), 0u);
+
+    search_server.RemoveDocument(1);
+    search_server.RemoveDocument(4);
+    ASSERT_EQUAL(search_server.GetMemoryUsage().forward_index, 0u);
+
+    // мониторинг опрашивает память из своего потока, пока сервер меняется
+    atomic<bool> done = false;
+    atomic<size_t> polls = 0;
+    thread monitor([&] {
+        while (!done) {
+            ASSERT(search_server.GetMemoryUsage().Total() > 0);
+            ++polls;
+        }
+    });
+    while (polls == 0) {
+        this_thread::yield();
+    }
+    for (int id = 10; id < 200; ++id) {
+        search_server.AddDocument(id, "cat number"s + to_string(id), DocumentStatus::ACTUAL, {1}, {1, static_cast<float>(id)});
+    }
+    done = true;
+    monitor.join();
+    ASSERT(search_server.GetMemoryUsage().vector_index > usage.vector_index);
+}
+
+void TestDocumentStore() { // тексты должны читаться по id из сжатых блоков, после сохранения и из файла
+    // кодек: повторы, словарь, несжимаемые данные и поврежденный блок
+    string text;
+    for (int i = 0; i < 200; ++i) {
+        text += "the quick brown fox jumps over the lazy dog "s + to_string(i % 7) + " "s;
+    }
+    const string compressed = CompressBlock(BlockCodec::LZ, text);
+    ASSERT(compressed.size() * 5 < text.size());
+    ASSERT_EQUAL(DecompressBlock(BlockCodec::LZ, compressed, text.size()), text);
+    const string dictionary = TrainDictionary(BlockCodec::LZ, {text}, 64);
+    ASSERT(!dictionary.empty() && dictionary.size() <= 64u);
+    const string phrase = "quick brown fox over the lazy dog"s;
+    const string with_dictionary = CompressBlock(BlockCodec::LZ, phrase, dictionary);
+    ASSERT(with_dictionary.size() < CompressBlock(BlockCodec::LZ, phrase).size());
+    ASSERT_EQUAL(DecompressBlock(BlockCodec::LZ, with_dictionary, phrase.size(), dictionary), phrase);
+    mt19937 generator(7);
+    string noise(5000, ' ');
+    for (char& c : noise) {
+        c = static_cast<char>(generator());
+    }
+    ASSERT_EQUAL(DecompressBlock(BlockCodec::LZ, CompressBlock(BlockCodec::LZ, noise), noise.size()), noise);
+    ASSERT_EQUAL(DecompressBlock(BlockCodec::LZ, CompressBlock(BlockCodec::LZ, ""s), 0), ""s);
+    bool thrown = false;
+    try {
+        DecompressBlock(BlockCodec::LZ, compressed.substr(0, compressed.size() / 2), text.size());
+    } catch (const runtime_error&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+
+    // последовательная и параллельная загрузка дают одно и то же
+    vector<pair<int, string>> documents;
+    for (int id = 0; id < 300; ++id) {
+        documents.push_back({id, "document "s + to_string(id) + " about cats and dogs number "s + to_string(id * 31)});
+    }
+    DocumentStoreOptions options;
+    options.block_bytes = 1024;
+    options.dictionary_bytes = 256;
+    DocumentStore sequential(options);
+    for (const auto& [id, document] : documents) {
+        sequential.Add(id, document);
+    }
+    DocumentStore parallel(options);
+    parallel.AddBatch(execution::par, documents);
+    ASSERT(parallel.BlockCount() > 5u);
+    ASSERT(parallel.CompressedBytes() < parallel.RawBytes());
+    for (const auto& [id, document] : documents) {
+        ASSERT_EQUAL(sequential.Get(id), document);
+        ASSERT_EQUAL(parallel.Get(id), document);
+    }
+    thrown = false;
+    try {
+        parallel.AddBatch(execution::seq, vector<pair<int, string>>{{1000, "new"s}, {5, "duplicate"s}});
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT(!parallel.Contains(1000));
+
+    // файл читается через отображение, в том числе незаполненный последний блок
+    const filesystem::path path = filesystem::temp_directory_path() / ("search_server_store_test_"s + to_string(random_device()()));
+    parallel.Add(1000, "tail document"s);
+    ASSERT(parallel.Remove(7));
+    parallel.Save(path.string());
+    {
+        DocumentStore opened = DocumentStore::Open(path.string());
+        ASSERT_EQUAL(opened.Size(), parallel.Size());
+        ASSERT_EQUAL(opened.Dictionary(), parallel.Dictionary());
+        ASSERT_EQUAL(opened.Get(299), documents[299].second);
+        ASSERT_EQUAL(opened.Get(1000), "tail document"s);
+        ASSERT(!opened.Contains(7));
+        ASSERT(opened.Matches(299, documents[299].second));
+        ASSERT(!opened.Matches(299, documents[299].second + "!"s));
+        ASSERT(!opened.Matches(7, documents[7].second));
+        ASSERT_EQUAL(opened.DeadBytes(), documents[7].second.size());
+        opened.Add(1001, "added after open"s);
+        ASSERT_EQUAL(opened.Get(1001), "added after open"s);
+
+        // сжатие выбрасывает тексты удаленных документов, остальные читаются как прежде
+        for (int id = 0; id < 200; ++id) {
+            opened.Remove(id);
+        }
+        const size_t compressed_bytes = opened.CompressedBytes();
+        opened.Compact();
+        ASSERT_EQUAL(opened.DeadBytes(), 0u);
+        ASSERT(opened.CompressedBytes() < compressed_bytes / 2);
+        ASSERT_EQUAL(opened.Size(), 102u);
+        ASSERT_EQUAL(opened.Get(299), documents[299].second);
+        ASSERT_EQUAL(opened.Get(1001), "added after open"s);
+    }
+    {
+        string file;
+        {
+            ifstream input(path, ios::binary);
+            file.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+        }
+        file[12] ^= 1;
+        ofstream(path, ios::binary | ios::trunc) << file;
+        thrown = false;
+        try {
+            DocumentStore::Open(path.string());
+        } catch (const runtime_error&) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+    filesystem::remove(path);
+
+    // сервер кладет тексты в хранилище и убирает их оттуда вместе с документами
+    SearchServer search_server("and"s);
+    search_server.EnableDocumentStore();
+    search_server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "white cat"s, DocumentStatus::ACTUAL, {2});
+    search_server.UpdateDocument(2, "black cat"s, DocumentStatus::ACTUAL, {2});
+    search_server.UpdateDocument(3, "parrot"s, DocumentStatus::ACTUAL, {3});
+    ASSERT_EQUAL(search_server.GetDocumentText(1), "cat and dog"s);
+    ASSERT_EQUAL(search_server.GetDocumentText(2), "black cat"s);
+    ASSERT_EQUAL(search_server.GetDocumentText(3), "parrot"s);
+    ASSERT(search_server.GetMemoryUsage().document_store > 0);
+    // тот же текст не переписывается в хранилище, меняется только рейтинг
+    search_server.UpdateDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {5});
+    ASSERT_EQUAL(search_server.FindTopDocuments("dog"s)[0].rating, 5);
+    // замененный текст остается в блоках мертвым грузом, пока хранилище не сжато заново
+    ASSERT_EQUAL(search_server.GetStats().document_store_dead_bytes, "white cat"s.size());
+    search_server.CompactDocumentStore();
+    ASSERT_EQUAL(search_server.GetStats().document_store_dead_bytes, 0u);
+    ASSERT_EQUAL(search_server.GetDocumentText(2), "black cat"s);
+    ASSERT_EQUAL(search_server.GetDocumentText(3), "parrot"s);
+    search_server.RemoveDocument(execution::par, 1);
+    thrown = false;
+    try {
+        search_server.GetDocumentText(1);
+    } catch (const out_of_range&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    thrown = false;
+    try {
+        search_server.EnableDocumentStore();
+    } catch (const logic_error&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+
+    // в подключенном хранилище текст добавляемого документа заменяется, если он другой
+    DocumentStore attached;
+    attached.Add(1, "cat and dog"s);
+    attached.Add(2, "stale text"s);
+    attached.Add(3, "short"s);
+    SearchServer attached_server("and"s);
+    attached_server.AttachDocumentStore(move(attached));
+    attached_server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {1});
+    attached_server.AddDocument(2, "fresh text"s, DocumentStatus::ACTUAL, {1});
+    attached_server.AddDocument(3, "a longer text"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_EQUAL(attached_server.GetDocumentText(1), "cat and dog"s);
+    ASSERT_EQUAL(attached_server.GetDocumentText(2), "fresh text"s);
+    ASSERT_EQUAL(attached_server.GetDocumentText(3), "a longer text"s);
+    ASSERT_EQUAL(attached_server.GetStats().document_store_dead_bytes, "stale text"s.size() + "short"s.size());
+}
+
 void TestSortAndRaiting() { // проверка того как отсортирован ввывод и того как считает рейтинг
     const int doc_id = 42;
     const string content = "cat in the city"s;
@@ -390,15 +1908,389 @@ void TestParalFind() {
     }
 }
 
+void TestScoringKernels() {
+    const Posting cat{{1, 0.5}, {3, 0.25}, {7, 1.0}};
+    const Posting dog{{3, 0.5}, {5, 0.5}};
+    const Posting rat{{5, 1.0}, {9, 1.0}};
+
+    { // слияние постингов должно давать то же, что накопление в map
+        ScoreAccumulator acc;
+        MergeBuffers buffer;
+        AccumulatePosting(acc, cat, 2.0, buffer);
+        AccumulatePosting(acc, dog, 4.0, buffer);
+        const ScoreAccumulator expected{{1, 3, 5, 7}, {1.0, 2.5, 2.0, 2.0}};
+        ASSERT(acc == expected);
+
+        // на недвоичных TF векторная арифметика слияния дает до бита то же, что сложение по месту в map
+        mt19937 generator(17);
+        map<int, double> reference;
+        ScoreAccumulator merged;
+        for (int word = 0; word < 5; ++word) {
+            Posting posting;
+            for (int id = 0; id < 300; ++id) {
+                if (generator() % (word + 2) == 0) {
+                    posting[id] = 1.0 / (generator() % 9 + 3);
+                }
+            }
+            const double idf = log(7.0 / (word + 1));
+            for (const auto& [id, tf] : posting) {
+                reference[id] += idf * tf;
+            }
+            AccumulatePosting(merged, posting, idf, buffer);
+        }
+        ASSERT_EQUAL(merged.Size(), reference.size());
+        size_t position = 0;
+        for (const auto& [id, relevance] : reference) {
+            ASSERT_EQUAL(merged.ids[position], id);
+            ASSERT(merged.scores[position] == relevance);
+            ++position;
+        }
+
+        ExcludePosting(acc, rat);
+        const ScoreAccumulator expected_without_rat{{1, 3, 7}, {1.0, 2.5, 2.0}};
+        ASSERT(acc == expected_without_rat);
+    }
+
+    { // векторные ядра под каждый доступный набор команд совпадают с переносимыми, в том числе на хвостах
+        const ScoringKernels& portable = GetScoringKernels(ScoringIsa::PORTABLE);
+        for (const ScoringIsa isa : {ScoringIsa::PORTABLE, ScoringIsa::AVX2, ScoringIsa::AVX512}) {
+            if (!IsScoringIsaSupported(isa)) {
+                continue;
+            }
+            const ScoringKernels& kernels = GetScoringKernels(isa);
+            for (const size_t size : {1u, 3u, 7u, 8u, 15u, 16u, 17u, 63u, 64u, 65u, 200u}) {
+                vector<double> scores(size);
+                for (size_t i = 0; i < size; ++i) {
+                    scores[i] = static_cast<double>((i * 37) % 23) / 4;
+                }
+                vector<double> scaled = scores;
+                vector<double> expected_scaled = scores;
+                kernels.scale(scaled.data(), size, 1.5);
+                portable.scale(expected_scaled.data(), size, 1.5);
+                ASSERT(scaled == expected_scaled);
+
+                // слагаемые недвоичные: слитное умножение-сложение округлило бы иначе
+                vector<double> values(size);
+                for (size_t i = 0; i < size; ++i) {
+                    values[i] = 1.0 / static_cast<double>(i % 7 + 3);
+                }
+                vector<double> summed = scaled;
+                vector<double> expected_summed = scaled;
+                kernels.add_scaled(summed.data(), values.data(), size, 0.1);
+                portable.add_scaled(expected_summed.data(), values.data(), size, 0.1);
+                ASSERT(summed == expected_summed);
+
+                const size_t block_count = (size + SCORING_BLOCK_SIZE - 1) / SCORING_BLOCK_SIZE;
+                vector<double> maxima(block_count);
+                vector<double> expected_maxima(block_count);
+                kernels.block_max(scores.data(), size, maxima.data());
+                portable.block_max(scores.data(), size, expected_maxima.data());
+                ASSERT(maxima == expected_maxima);
+
+                vector<uint32_t> indices(size);
+                vector<uint32_t> expected_indices(size);
+                indices.resize(kernels.select_at_least(scores.data(), size, 2.5, indices.data()));
+                expected_indices.resize(portable.select_at_least(scores.data(), size, 2.5, expected_indices.data()));
+                ASSERT(indices == expected_indices);
+            }
+        }
+        ASSERT(IsScoringIsaSupported(DetectScoringIsa()));
+    }
+
+    { // кандидаты по максимумам блоков содержат всех лучших k
+        ScoreAccumulator acc;
+        for (int id = 0; id < 1000; ++id) {
+            acc.Add(id, static_cast<double>((id * 7919) % 1009));
+        }
+        BlockMaxBuffers buffers;
+        double threshold = 0;
+        ASSERT(SelectTopCandidates(acc, 5, buffers, threshold));
+        vector<double> sorted = acc.scores;
+        sort(sorted.begin(), sorted.end(), greater<>());
+        ASSERT(threshold <= sorted[4]);
+        ASSERT(buffers.candidates.size() < acc.Size());
+        size_t above = 0;
+        for (const uint32_t i : buffers.candidates) {
+            ASSERT(acc.scores[i] >= threshold);
+            above += acc.scores[i] >= sorted[4];
+        }
+        ASSERT_EQUAL(above, 5u);
+        // блоков меньше, чем нужно документов - отсекать нечего
+        ASSERT(!SelectTopCandidates(acc, 100, buffers, threshold));
+    }
+
+    { // отсечение по блокам не меняет выдачу, в том числе когда предикат отбрасывает лучших кандидатов
+        SearchServer server(""s);
+        for (int id = 0; id < 2000; ++id) {
+            server.AddDocument(id, "cat "s + string(static_cast<size_t>(id % 37), 'x') + (id % 3 == 0 ? " dog"s : ""s), DocumentStatus::ACTUAL, {id % 11});
+        }
+        for (const auto& predicat : {
+                 function<bool(int, DocumentStatus, int)>([](int, DocumentStatus, int) { return true; }),
+                 function<bool(int, DocumentStatus, int)>([](int id, DocumentStatus, int) { return id % 3 != 0; }),
+                 function<bool(int, DocumentStatus, int)>([](int id, DocumentStatus, int) { return id > 1990; }),
+             }) {
+            for (const QueryMode mode : {QueryMode::ANY, QueryMode::ALL}) {
+                const vector<Document> top = server.FindTopDocuments(execution::seq, "cat dog"s, mode, predicat);
+                // страница больше числа блоков: отсечения нет, это эталон
+                const SearchPage page = server.FindPage(execution::seq, "cat dog"s, SearchCursor(), 1000, mode, predicat);
+                ASSERT_EQUAL(top.size(), min<size_t>(MAX_RESULT_DOCUMENT_COUNT, page.documents.size()));
+                for (size_t i = 0; i < top.size(); ++i) {
+                    ASSERT_EQUAL(top[i].id, page.documents[i].id);
+                }
+                const vector<Document> top_par = server.FindTopDocuments(execution::par, "cat dog"s, mode, predicat);
+                ASSERT_EQUAL(top_par.size(), top.size());
+                for (size_t i = 0; i < top.size(); ++i) {
+                    ASSERT_EQUAL(top_par[i].id, top[i].id);
+                }
+            }
+        }
+    }
+
+    { // отбор лучших k документов
+        vector<Document> docs{{1, 0.1, 0}, {2, 0.4, 0}, {3, 0.3, 0}, {4, 0.2, 0}};
+        SelectTopDocuments(execution::seq, docs, 2u, [](const Document& lhs, const Document& rhs) { return lhs.relevance > rhs.relevance; });
+        ASSERT_EQUAL(docs.size(), 2u);
+        ASSERT_EQUAL(docs[0].id, 2);
+        ASSERT_EQUAL(docs[1].id, 3);
+    }
+}
+
+void TestQueryModeAll() {
+    SearchServer search_server("and with"s);
+
+    int id = 0;
+    for (
+        const string& text : {
+            "funny pet and nasty rat"s,
+            "funny pet with curly hair"s,
+            "funny pet and not very nasty rat"s,
+            "pet with rat and rat and rat"s,
+            "nasty rat with curly hair"s,
+        }
+    ) {
+        search_server.AddDocument(++id, text, DocumentStatus::ACTUAL, {1, 2});
+    }
+
+    { // в режиме ALL документ должен содержать все плюс-слова
+        const auto output = search_server.FindTopDocuments("nasty rat"s, QueryMode::ALL);
+        ASSERT_EQUAL(output.size(), 3u);
+        for (const Document& doc : output) {
+            ASSERT(doc.id == 1 || doc.id == 3 || doc.id == 5);
+        }
+    }
+    { // релевантность совпадает с режимом ANY для тех же документов
+        const auto all = search_server.FindTopDocuments("curly hair"s, QueryMode::ALL);
+        const auto any = search_server.FindTopDocuments("curly hair"s);
+        ASSERT_EQUAL(all.size(), any.size());
+        for (size_t i = 0; i < all.size(); ++i) {
+            ASSERT_EQUAL(all[i].id, any[i].id);
+            ASSERT(abs(all[i].relevance - any[i].relevance) < 1e-6);
+        }
+    }
+    { // минус-слова и параллельная версия
+        const auto output = search_server.FindTopDocuments(execution::par, "funny pet -not"s, QueryMode::ALL);
+        ASSERT_EQUAL(output.size(), 2u);
+    }
+    { // слово, которого нет в индексе, дает пустой результат
+        ASSERT(search_server.FindTopDocuments("funny owl"s, QueryMode::ALL).empty());
+    }
+}
+
+void TestParalFindMatchesSeq() { // параллельный поиск по диапазонам id должен совпадать с последовательным
+    SearchServer search_server("and with"s);
+    const vector<string> words{"cat"s, "dog"s, "rat"s, "owl"s, "pet"s, "fox"s, "hen"s};
+    for (int id = 0; id < 500; ++id) {
+        string text;
+        for (int i = 0; i < 4; ++i) {
+            text += words[(id * 7 + i * i * 3 + id / 5) % words.size()] + " "s;
+        }
+        search_server.AddDocument(id * 37 + id % 11, text, DocumentStatus::ACTUAL, {id % 9});
+    }
+    for (const string& query : {"cat"s, "dog owl"s, "rat pet -fox"s, "hen cat dog -owl"s}) {
+        const auto seq = search_server.FindTopDocuments(execution::seq, query);
+        const auto par = search_server.FindTopDocuments(execution::par, query);
+        ASSERT_EQUAL(seq.size(), par.size());
+        for (size_t i = 0; i < seq.size(); ++i) {
+            ASSERT(abs(seq[i].relevance - par[i].relevance) < 1e-6);
+            ASSERT_EQUAL(seq[i].rating, par[i].rating);
+        }
+    }
+}
+
+void TestConcurrentMap() {
+    ConcurrentMap<int, double> concurrent_map(1000);
+    vector<int> keys(1000);
+    for (int i = 0; i < 1000; ++i) {
+        keys[i] = i * 13 - 500;
+    }
+    for (int round = 0; round < 4; ++round) {
+        for_each(execution::par, keys.begin(), keys.end(), [&concurrent_map](int key) {
+            concurrent_map.Add(key, 0.5);
+        });
+    }
+    concurrent_map.erase(-500);
+
+    const auto result = concurrent_map.BuildOrdinaryMap();
+    ASSERT_EQUAL(result.size(), 999u);
+    ASSERT_EQUAL(result.count(-500), 0u);
+    for (const auto& [key, value] : result) {
+        ASSERT_EQUAL(value, 2.0);
+    }
+
+    // ключи с шагом, кратным емкости, раскладываются по всей таблице
+    ConcurrentMap<int64_t, int> strided(64);
+    for (int64_t i = 1; i <= 64; ++i) {
+        strided.Add(i * 4096, 1);
+        strided.Add(-i * 4096, 1);
+    }
+    strided.Add(4096, 1);
+    const auto strided_result = strided.BuildOrdinaryMap();
+    ASSERT_EQUAL(strided_result.size(), 128u);
+    ASSERT_EQUAL(strided_result.at(4096), 2);
+    ASSERT_EQUAL(strided_result.at(-64 * 4096), 1);
+}
+
+void TestRemoveDuplicates() {
+    SearchServer search_server("and with"s);
+
+    search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    // дубликат документа 2, будет удален
+    search_server.AddDocument(3, "funny pet with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    // отличие только в стоп-словах, считаем дубликатом
+    search_server.AddDocument(4, "funny pet and curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+    // множество слов такое же, считаем дубликатом документа 1
+    search_server.AddDocument(5, "funny funny pet and nasty nasty rat"s, DocumentStatus::ACTUAL, {1, 2});
+    // добавились новые слова, дубликатом не является
+    search_server.AddDocument(6, "funny pet and not very nasty rat"s, DocumentStatus::ACTUAL, {1, 2});
+    // множество слов такое же, как в id 6, несмотря на другой порядок, считаем дубликатом
+    search_server.AddDocument(7, "very nasty rat and not very funny pet"s, DocumentStatus::ACTUAL, {1, 2});
+    // есть не все слова, не является дубликатом
+    search_server.AddDocument(8, "pet with rat and rat and rat"s, DocumentStatus::ACTUAL, {1, 2});
+    // слова из разных документов, не является дубликатом
+    search_server.AddDocument(9, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, {1, 2});
+
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 9);
+    ASSERT(search_server.GetFingerprint(2) == search_server.GetFingerprint(3));
+    ASSERT(search_server.GetFingerprint(1) != search_server.GetFingerprint(6));
+    RemoveDuplicates(search_server);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 5);
+    const set<int> expected{1, 2, 6, 8, 9};
+    ASSERT(set<int>(search_server.begin(), search_server.end()) == expected);
+}
+
+RequestQueue::Clock::time_point fake_now;
+
+void TestRequestQueueWindow() {
+    SearchServer search_server("and in at"s);
+    search_server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, {1, 2, 3});
+
+    RequestQueue request_queue(search_server, chrono::minutes(1440), [] { return fake_now; });
+    for (int i = 0; i < 1439; ++i) { // запросы с пустым результатом, раз в минуту
+        request_queue.AddFindRequest("empty request"s);
+        fake_now += chrono::minutes(1);
+    }
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1439);
+
+    request_queue.AddFindRequest("curly dog"s);
+    fake_now += chrono::minutes(1);
+    request_queue.AddFindRequest("big collar"s);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1438);
+    fake_now += chrono::minutes(1);
+    request_queue.AddFindRequest("sparrow"s); // из окна ушел еще один пустой запрос, но и новый пустой
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1438);
+
+    const RequestStats stats = request_queue.GetStats();
+    ASSERT_EQUAL(stats.requests, 1440u);
+    ASSERT(abs(stats.no_result_rate - 1438.0 / 1440) < 1e-9);
+    ASSERT(abs(stats.requests_per_second - 1.0 / 60) < 1e-9);
+    ASSERT(stats.latency_p50 <= stats.latency_p99);
+
+    fake_now += chrono::hours(48); // все окно устарело
+    ASSERT_EQUAL(request_queue.GetStats().requests, 0u);
+
+    // корзины в куче, сама очередь маленькая; запросы из разных потоков попадают в разные кольца и все считаются
+    ASSERT(sizeof(RequestQueue) < 1024u);
+    RequestQueue shared_queue(search_server, chrono::minutes(1440), [] { return fake_now; });
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared_queue] {
+            for (int i = 0; i < 100; ++i) {
+                shared_queue.AddFindRequest(i % 2 == 0 ? "curly"s : "sparrow"s);
+            }
+        });
+    }
+    for (auto& worker : threads) {
+        worker.join();
+    }
+    ASSERT_EQUAL(shared_queue.GetStats().requests, 400u);
+    ASSERT_EQUAL(shared_queue.GetNoResultRequests(), 200);
+}
+
+void TestLatencyHistogram() {
+    for (uint64_t value : vector<uint64_t>{0, 7, 15, 16, 17, 1000, 123456789, UINT64_MAX / 3}) { // корзина значения накрывает его с точностью 12.5%
+        const uint64_t upper = LatencyHistogram::BucketUpperBound(LatencyHistogram::BucketIndex(value));
+        ASSERT(upper >= value);
+        ASSERT(upper - value <= value / 8);
+    }
+
+    LatencyHistogram histogram;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        histogram.Record(i * 1000);
+    }
+    ASSERT_EQUAL(histogram.Count(), 1000u);
+    ASSERT_EQUAL(histogram.Min(), 1000u);
+    ASSERT_EQUAL(histogram.Max(), 1000000u);
+    const uint64_t p50 = histogram.ValueAtPercentile(50);
+    ASSERT(p50 >= 500000u && p50 <= 500000u + 500000u / 8);
+    ASSERT_EQUAL(histogram.ValueAtPercentile(100), 1000000u);
+
+    ResetTrace();
+    RecordTraceStage(TraceStage::SCORE, 1500);
+    RecordTraceStage(TraceStage::SCORE, 2500);
+    const auto histograms = CollectTraceHistograms();
+    ASSERT_EQUAL(histograms[static_cast<size_t>(TraceStage::SCORE)].Count(), 2u);
+    ASSERT_EQUAL(histograms[static_cast<size_t>(TraceStage::PARSE)].Count(), 0u);
+
+    ostringstream dump;
+    DumpTraceJson(dump);
+    ASSERT(dump.str().find("\"score\":{\"count\":2"s) != string::npos);
+    ResetTrace();
+}
+
 void TestSearchServer() {
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
     RUN_TEST(TestMinusWordInput);
     RUN_TEST(TestMatchDocuments);
+    RUN_TEST(TestMatchDocumentsBatch);
+    RUN_TEST(TestQueryCache);
+    RUN_TEST(TestTextAnalysis);
+    RUN_TEST(TestStopWordSet);
+    RUN_TEST(TestPatternSearch);
+    RUN_TEST(TestFuzzySearch);
+    RUN_TEST(TestSearchPages);
+    RUN_TEST(TestUpdateDocument);
+    RUN_TEST(TestDurableSearchServer);
+    RUN_TEST(TestQueryMemory);
+    RUN_TEST(TestImpactPostings);
+    RUN_TEST(TestVectorSearch);
+    RUN_TEST(TestIndexStats);
+    RUN_TEST(TestDocumentStore);
+    RUN_TEST(TestNumaReplicas);
     RUN_TEST(TestSortAndRaiting);
     RUN_TEST(TestPredicate);
     RUN_TEST(TestRelevance);
     RUN_TEST(TestParalMatch);
     RUN_TEST(TestParalFind);
+    RUN_TEST(TestScoringKernels);
+    RUN_TEST(TestQueryModeAll);
+    RUN_TEST(TestParalFindMatchesSeq);
+    RUN_TEST(TestConcurrentMap);
+    RUN_TEST(TestRemoveDuplicates);
+    RUN_TEST(TestRequestQueueWindow);
+    RUN_TEST(TestLatencyHistogram);
+    RUN_TEST(TestQueryReplay);
 }
 
 // --------- Окончание модульных тестов поисковой системы -----------
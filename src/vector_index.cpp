@@ -0,0 +1,426 @@
+#include "vector_index.h"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define VECTOR_INDEX_HAS_AVX2 1
+#endif
+
+namespace {
+
+// Восемь независимых сумм: без -ffast-math компилятор не переставляет сложения float сам,
+// а с одной суммой каждое сложение ждет предыдущее
+float DotProductPortable(const float* lhs, const float* rhs, size_t size) {
+    float sums[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        for (size_t j = 0; j < 8; ++j) {
+            sums[j] += lhs[i + j] * rhs[i + j];
+        }
+    }
+    float total = ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+    for (; i < size; ++i) {
+        total += lhs[i] * rhs[i];
+    }
+    return total;
+}
+
+#ifdef VECTOR_INDEX_HAS_AVX2
+__attribute__((target("avx2,fma"))) float DotProductAvx2(const float* lhs, const float* rhs, size_t size) {
+    __m256 first = _mm256_setzero_ps();
+    __m256 second = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        first = _mm256_fmadd_ps(_mm256_loadu_ps(lhs + i), _mm256_loadu_ps(rhs + i), first);
+        second = _mm256_fmadd_ps(_mm256_loadu_ps(lhs + i + 8), _mm256_loadu_ps(rhs + i + 8), second);
+    }
+    if (i + 8 <= size) {
+        first = _mm256_fmadd_ps(_mm256_loadu_ps(lhs + i), _mm256_loadu_ps(rhs + i), first);
+        i += 8;
+    }
+    const __m256 sum = _mm256_add_ps(first, second);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_hadd_ps(half, half);
+    half = _mm_hadd_ps(half, half);
+    float total = _mm_cvtss_f32(half);
+    for (; i < size; ++i) {
+        total += lhs[i] * rhs[i];
+    }
+    return total;
+}
+#endif
+
+using DotProductFunction = float (*)(const float*, const float*, size_t);
+
+DotProductFunction ChooseDotProduct() {
+#ifdef VECTOR_INDEX_HAS_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return DotProductAvx2;
+    }
+#endif
+    return DotProductPortable;
+}
+
+// Буферы обхода графа, свои у каждого потока: отметки посещенных узлов сбрасываются сменой эпохи, а не очисткой
+struct SearchWorkspace {
+    std::vector<uint32_t> marks;
+    uint32_t epoch = 0;
+    std::vector<std::pair<float, uint32_t>> candidates;
+    std::vector<uint32_t> links;
+
+    void Reset(size_t node_count) {
+        if (marks.size() < node_count) {
+            marks.resize(node_count, 0);
+        }
+        if (++epoch == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            epoch = 1;
+        }
+        candidates.clear();
+    }
+
+    bool Visit(uint32_t node) {
+        if (marks[node] == epoch) {
+            return false;
+        }
+        marks[node] = epoch;
+        return true;
+    }
+};
+
+SearchWorkspace& ThreadWorkspace() {
+    thread_local SearchWorkspace workspace;
+    return workspace;
+}
+
+} // namespace
+
+float DotProduct(const float* lhs, const float* rhs, size_t size) {
+    static const DotProductFunction function = ChooseDotProduct();
+    return function(lhs, rhs, size);
+}
+
+HnswIndex::HnswIndex(size_t dimension, HnswOptions options)
+    : dimension_(dimension)
+    , options_(options)
+    , level_multiplier_(0)
+    , generator_(options.seed) {
+    if (dimension_ == 0) {
+        throw std::invalid_argument("Размерность векторов должна быть больше нуля");
+    }
+    if (options_.m < 2) {
+        throw std::invalid_argument("У узла графа должно быть хотя бы два соседа");
+    }
+    options_.ef_construction = std::max(options_.ef_construction, options_.m);
+    level_multiplier_ = 1 / std::log(static_cast<double>(options_.m));
+}
+
+HnswIndex::HnswIndex(const HnswIndex& other)
+    : dimension_(other.dimension_)
+    , options_(other.options_)
+    , level_multiplier_(other.level_multiplier_)
+    , generator_(other.generator_)
+    , nodes_(other.nodes_)
+    , ids_(other.ids_)
+    , node_bytes_(other.node_bytes_)
+    , entry_(other.entry_)
+    , max_level_(other.max_level_) {
+}
+
+std::vector<float> HnswIndex::Normalized(const std::vector<float>& vector) const {
+    if (vector.size() != dimension_) {
+        throw std::invalid_argument("Размерность вектора не совпадает с размерностью индекса");
+    }
+    const float norm = std::sqrt(DotProduct(vector.data(), vector.data(), dimension_));
+    if (!(norm > 0) || !std::isfinite(norm)) {
+        throw std::invalid_argument("Вектор нулевой или содержит не числа");
+    }
+    std::vector<float> result(vector);
+    for (float& value : result) {
+        value /= norm;
+    }
+    return result;
+}
+
+void HnswIndex::Add(int id, const std::vector<float>& vector) {
+    AddBatch(std::execution::seq, {{id, vector}});
+}
+
+bool HnswIndex::Remove(int id) {
+    const auto it = ids_.find(id);
+    if (it == ids_.end()) {
+        return false;
+    }
+    nodes_[it->second].deleted = true;
+    ids_.erase(it);
+    return true;
+}
+
+std::vector<uint32_t> HnswIndex::Allocate(const std::vector<std::pair<int, std::vector<float>>>& vectors) {
+    std::vector<std::vector<float>> normalized;
+    normalized.reserve(vectors.size());
+    std::unordered_set<int> batch_ids;
+    for (const auto& [id, vector] : vectors) {
+        if (ids_.count(id) != 0 || !batch_ids.insert(id).second) {
+            throw std::invalid_argument("Вектор документа с таким ID уже есть в индексе");
+        }
+        normalized.push_back(Normalized(vector));
+    }
+    if (nodes_.size() + vectors.size() >= NO_NODE) {
+        throw std::length_error("Слишком много векторов в индексе");
+    }
+
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<uint32_t> nodes;
+    nodes.reserve(vectors.size());
+    for (size_t i = 0; i < vectors.size(); ++i) {
+        const uint32_t index = static_cast<uint32_t>(nodes_.size());
+        Node& node = nodes_.emplace_back();
+        node.id = vectors[i].first;
+        // слой узла - геометрическое распределение: на каждом следующем слое примерно в m раз меньше узлов
+        node.level = static_cast<int>(-std::log(1 - uniform(generator_)) * level_multiplier_);
+        node.vector = std::move(normalized[i]);
+        node.links.resize(node.level + 1);
+        node_bytes_ += sizeof(Node) + dimension_ * sizeof(float) + node.links.size() * sizeof(node.links[0]);
+        // связей у узла не бывает больше MaxLinks + 1, поэтому память под них выделяется один раз
+        for (int level = 0; level <= node.level; ++level) {
+            node.links[level].reserve(MaxLinks(level) + 1);
+            node_bytes_ += node.links[level].capacity() * sizeof(uint32_t);
+        }
+        ids_[node.id] = index;
+        nodes.push_back(index);
+    }
+    return nodes;
+}
+
+void HnswIndex::Link(uint32_t node_index) {
+    Node& node = nodes_[node_index];
+    const float* vector = node.vector.data();
+
+    std::unique_lock entry_lock(entry_mutex_);
+    const uint32_t entry = entry_;
+    const int top_level = max_level_;
+    if (entry == NO_NODE) {
+        entry_ = node_index;
+        max_level_ = node.level;
+        return;
+    }
+    // узел выше всех станет новой точкой входа: до тех пор другие вставки ждут, иначе они начнут спуск
+    // со старой точки и пропустят верхние слои
+    if (node.level <= top_level) {
+        entry_lock.unlock();
+    }
+
+    Candidate closest{Distance(vector, entry), entry};
+    for (int level = top_level; level > node.level; --level) {
+        closest = Greedy(vector, closest, level, true);
+    }
+    std::vector<Candidate> candidates;
+    for (int level = std::min(node.level, top_level); level >= 0; --level) {
+        SearchLayer(vector, closest, options_.ef_construction, level, true, nullptr, candidates);
+        std::erase_if(candidates, [node_index](const Candidate& candidate) {
+            return candidate.second == node_index;
+        });
+        if (candidates.empty()) {
+            continue;
+        }
+        closest = candidates.front();
+        SelectNeighbors(candidates, options_.m);
+        {
+            std::lock_guard guard(node.mutex);
+            for (const Candidate& candidate : candidates) {
+                node.links[level].push_back(candidate.second);
+            }
+        }
+        for (const Candidate& candidate : candidates) {
+            Node& neighbor = nodes_[candidate.second];
+            std::lock_guard guard(neighbor.mutex);
+            std::vector<uint32_t>& links = neighbor.links[level];
+            links.push_back(node_index);
+            if (links.size() <= MaxLinks(level)) {
+                continue;
+            }
+            // у соседа слишком много связей: оставляются выбранные той же эвристикой
+            std::vector<Candidate> neighbor_candidates;
+            neighbor_candidates.reserve(links.size());
+            for (const uint32_t link : links) {
+                neighbor_candidates.push_back({Distance(neighbor.vector.data(), link), link});
+            }
+            std::sort(neighbor_candidates.begin(), neighbor_candidates.end());
+            SelectNeighbors(neighbor_candidates, MaxLinks(level));
+            links.clear();
+            for (const Candidate& neighbor_candidate : neighbor_candidates) {
+                links.push_back(neighbor_candidate.second);
+            }
+        }
+    }
+
+    if (node.level > top_level) {
+        entry_ = node_index;
+        max_level_ = node.level;
+    }
+}
+
+HnswIndex::Candidate HnswIndex::Greedy(const float* query, Candidate from, int level, bool lock) const {
+    SearchWorkspace& workspace = ThreadWorkspace();
+    for (bool changed = true; changed;) {
+        changed = false;
+        const Node& node = nodes_[from.second];
+        const std::vector<uint32_t>* links = &node.links[level];
+        if (lock) {
+            std::lock_guard guard(node.mutex);
+            workspace.links.assign(links->begin(), links->end());
+            links = &workspace.links;
+        }
+        for (const uint32_t link : *links) {
+            const float distance = Distance(query, link);
+            if (distance < from.first) {
+                from = {distance, link};
+                changed = true;
+            }
+        }
+    }
+    return from;
+}
+
+void HnswIndex::SearchLayer(const float* query, Candidate entry, size_t ef, int level, bool lock, const FilterRef* filter, std::vector<Candidate>& result) const {
+    SearchWorkspace& workspace = ThreadWorkspace();
+    workspace.Reset(nodes_.size());
+    std::vector<Candidate>& candidates = workspace.candidates;
+    const auto accept = [this, filter](uint32_t node) {
+        return filter == nullptr || filter->Accepts(nodes_[node]);
+    };
+    // candidates - куча с ближайшим наверху, result - с самым дальним
+    const std::greater<Candidate> closer_first;
+    result.clear();
+    workspace.Visit(entry.second);
+    candidates.push_back(entry);
+    if (accept(entry.second)) {
+        result.push_back(entry);
+    }
+    float bound = result.empty() ? std::numeric_limits<float>::infinity() : entry.first;
+
+    while (!candidates.empty()) {
+        std::pop_heap(candidates.begin(), candidates.end(), closer_first);
+        const Candidate current = candidates.back();
+        candidates.pop_back();
+        if (current.first > bound && result.size() >= ef) {
+            break;
+        }
+        const Node& node = nodes_[current.second];
+        const std::vector<uint32_t>* links = &node.links[level];
+        if (lock) {
+            std::lock_guard guard(node.mutex);
+            workspace.links.assign(links->begin(), links->end());
+            links = &workspace.links;
+        }
+        for (const uint32_t link : *links) {
+            if (!workspace.Visit(link)) {
+                continue;
+            }
+            const float distance = Distance(query, link);
+            if (result.size() >= ef && distance >= bound) {
+                continue;
+            }
+            candidates.push_back({distance, link});
+            std::push_heap(candidates.begin(), candidates.end(), closer_first);
+            // не прошедшие фильтр узлы остаются мостами к соседям, но в результат не идут
+            if (accept(link)) {
+                result.push_back({distance, link});
+                std::push_heap(result.begin(), result.end());
+                if (result.size() > ef) {
+                    std::pop_heap(result.begin(), result.end());
+                    result.pop_back();
+                }
+                bound = result.front().first;
+            }
+        }
+    }
+    std::sort_heap(result.begin(), result.end());
+}
+
+void HnswIndex::SelectNeighbors(std::vector<Candidate>& candidates, size_t max_count) const {
+    if (candidates.size() <= max_count) {
+        return;
+    }
+    std::vector<Candidate> selected;
+    selected.reserve(max_count);
+    for (const Candidate& candidate : candidates) {
+        if (selected.size() == max_count) {
+            break;
+        }
+        const float* vector = nodes_[candidate.second].vector.data();
+        const bool diverse = std::all_of(selected.begin(), selected.end(), [&](const Candidate& other) {
+            return Distance(vector, other.second) >= candidate.first;
+        });
+        if (diverse) {
+            selected.push_back(candidate);
+        }
+    }
+    candidates = std::move(selected);
+}
+
+size_t HnswIndex::EstimateAccepted(const FilterRef& filter) const {
+    if (filter.call == nullptr) {
+        return ids_.size();
+    }
+    const size_t sample = std::min<size_t>(nodes_.size(), HNSW_FILTER_SAMPLE);
+    size_t accepted = 0;
+    for (size_t i = 0; i < sample; ++i) {
+        accepted += filter.Accepts(nodes_[i * nodes_.size() / sample]);
+    }
+    return accepted * nodes_.size() / sample;
+}
+
+std::vector<VectorMatch> HnswIndex::Scan(const std::vector<float>& normalized, size_t count, const FilterRef& filter) const {
+    std::vector<Candidate> accepted;
+    for (uint32_t node = 0; node < nodes_.size(); ++node) {
+        if (filter.Accepts(nodes_[node])) {
+            accepted.push_back({Distance(normalized.data(), node), node});
+        }
+    }
+    count = std::min(count, accepted.size());
+    std::partial_sort(accepted.begin(), accepted.begin() + count, accepted.end());
+    std::vector<VectorMatch> matches;
+    matches.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        matches.push_back({nodes_[accepted[i].second].id, 1 - accepted[i].first});
+    }
+    return matches;
+}
+
+std::vector<VectorMatch> HnswIndex::SearchFiltered(const std::vector<float>& query, size_t count, size_t ef, FilterRef filter) const {
+    const std::vector<float> normalized = Normalized(query);
+    if (count == 0 || ids_.empty()) {
+        return {};
+    }
+    ef = std::max(ef == 0 ? options_.ef_search : ef, count);
+    if (EstimateAccepted(filter) < ef * HNSW_FILTER_SCAN_FACTOR) {
+        return Scan(normalized, count, filter);
+    }
+    Candidate closest{Distance(normalized.data(), entry_), entry_};
+    for (int level = max_level_; level > 0; --level) {
+        closest = Greedy(normalized.data(), closest, level, false);
+    }
+    std::vector<Candidate> result;
+    SearchLayer(normalized.data(), closest, ef, 0, false, &filter, result);
+
+    std::vector<VectorMatch> matches;
+    matches.reserve(std::min(count, result.size()));
+    for (size_t i = 0; i < result.size() && i < count; ++i) {
+        matches.push_back({nodes_[result[i].second].id, 1 - result[i].first});
+    }
+    return matches;
+}
+
+std::vector<VectorMatch> HnswIndex::SearchExact(const std::vector<float>& query, size_t count) const {
+    return Scan(Normalized(query), count, FilterRef());
+}
+
+size_t HnswIndex::MemoryBytes() const {
+    return node_bytes_ + ids_.size() * (sizeof(std::pair<int, uint32_t>) + 2 * sizeof(void*)) + ids_.bucket_count() * sizeof(void*);
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <execution>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define HNSW_M 16
+#define HNSW_EF_CONSTRUCTION 200
+#define HNSW_EF_SEARCH 64
+#define HNSW_FILTER_SAMPLE 256
+#define HNSW_FILTER_SCAN_FACTOR 16
+
+// Скалярное произведение векторов длины size. На x86-64 с AVX2 и FMA считается ими, выбор делается при первом вызове
+float DotProduct(const float* lhs, const float* rhs, size_t size);
+
+struct HnswOptions {
+    // число соседей узла на верхних слоях графа, на нижнем - вдвое больше
+    size_t m = HNSW_M;
+    // ширина поиска соседей при вставке: больше - точнее граф и дольше построение
+    size_t ef_construction = HNSW_EF_CONSTRUCTION;
+    // ширина поиска при запросе, если она не задана явно; не бывает меньше числа запрошенных документов
+    size_t ef_search = HNSW_EF_SEARCH;
+    uint32_t seed = 42;
+};
+
+// Документ, найденный по вектору, и его косинусная близость к запросу
+struct VectorMatch {
+    int id = 0;
+    float similarity = 0;
+};
+
+// Приближенный поиск ближайших соседей по косинусной близости: иерархический граф HNSW (Malkov, Yashunin).
+// Векторы нормализуются при добавлении, поэтому близость - скалярное произведение.
+// Поиск из нескольких потоков безопасен, пока индекс не меняется; вставка в граф параллельна только внутри AddBatch.
+// Удаленный документ остается в графе транзитным узлом, чтобы не рвать связи, но в выдачу не попадает
+class HnswIndex {
+public:
+    explicit HnswIndex(size_t dimension, HnswOptions options = HnswOptions());
+    // Копия графа, например для реплики на другом узле NUMA. Копируемый индекс не должен меняться
+    HnswIndex(const HnswIndex& other);
+    HnswIndex& operator=(const HnswIndex&) = delete;
+
+    size_t Dimension() const {
+        return dimension_;
+    }
+    // число неудаленных векторов
+    size_t Size() const {
+        return ids_.size();
+    }
+    bool Contains(int id) const {
+        return ids_.count(id) != 0;
+    }
+    // узлы графа вместе с удаленными
+    size_t NodeCount() const {
+        return nodes_.size();
+    }
+
+    // Бросает std::invalid_argument, если размерность не совпадает, вектор нулевой или id уже есть
+    void Add(int id, const std::vector<float>& vector);
+    // Добавляет пачку векторов: узлы заводятся и проверяются последовательно, связи графа строятся
+    // параллельно policy, каждый узел под своим мьютексом
+    template <typename ExecutionPolicy>
+    void AddBatch(ExecutionPolicy&& policy, const std::vector<std::pair<int, std::vector<float>>>& vectors);
+    // Возвращает false, если вектора с таким id нет
+    bool Remove(int id);
+    // Бросает std::invalid_argument, если вектор не подходит индексу, как Add
+    void CheckVector(const std::vector<float>& vector) const {
+        Normalized(vector);
+    }
+
+    // Лучшие count документов, для id которых filter(id) вернул true, по убыванию близости.
+    // Фильтр проверяется при обходе, поэтому отсеянные узлы не занимают места в выдаче. Строгий фильтр
+    // заставил бы обойти почти весь граф в поисках ef подходящих узлов, поэтому, если по выборке из
+    // HNSW_FILTER_SAMPLE узлов подходящих меньше ef * HNSW_FILTER_SCAN_FACTOR, они просто перебираются.
+    // ef = 0 - ширина поиска из настроек
+    template <typename Filter>
+    std::vector<VectorMatch> Search(const std::vector<float>& query, size_t count, Filter filter, size_t ef = 0) const;
+    std::vector<VectorMatch> Search(const std::vector<float>& query, size_t count, size_t ef = 0) const {
+        return SearchFiltered(query, count, ef, FilterRef());
+    }
+
+    // Точный поиск перебором всех векторов, для проверки полноты приближенного
+    std::vector<VectorMatch> SearchExact(const std::vector<float>& query, size_t count) const;
+
+    // память узлов графа, включая удаленные, и таблицы id; считается при добавлении, поэтому вызов дешевый
+    size_t MemoryBytes() const;
+
+private:
+    // расстояние 1 - близость и номер узла
+    using Candidate = std::pair<float, uint32_t>;
+
+    struct Node {
+        int id = 0;
+        int level = 0;
+        bool deleted = false;
+        std::vector<float> vector;
+        // соседи на каждом слое от 0 до level
+        std::vector<std::vector<uint32_t>> links;
+        mutable std::mutex mutex;
+
+        Node() = default;
+        // мьютекс не копируется, у копии он свой
+        Node(const Node& other)
+            : id(other.id)
+            , level(other.level)
+            , deleted(other.deleted)
+            , vector(other.vector)
+            , links(other.links) {
+        }
+    };
+
+    // Фильтр выдачи без шаблона, чтобы обход графа жил в vector_index.cpp. Без call подходят все неудаленные узлы
+    struct FilterRef {
+        void* context = nullptr;
+        bool (*call)(void*, int) = nullptr;
+
+        bool Accepts(const Node& node) const {
+            return !node.deleted && (call == nullptr || call(context, node.id));
+        }
+    };
+
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+    size_t dimension_;
+    HnswOptions options_;
+    double level_multiplier_;
+    std::mt19937 generator_;
+    std::deque<Node> nodes_;
+    std::unordered_map<int, uint32_t> ids_;
+    size_t node_bytes_ = 0;
+    // точка входа и верхний слой; при вставке узла выше верхнего слоя мьютекс держится до конца вставки
+    std::mutex entry_mutex_;
+    uint32_t entry_ = NO_NODE;
+    int max_level_ = -1;
+
+    std::vector<float> Normalized(const std::vector<float>& vector) const;
+    float Distance(const float* query, uint32_t node) const {
+        return 1 - DotProduct(query, nodes_[node].vector.data(), dimension_);
+    }
+    size_t MaxLinks(int level) const {
+        return level == 0 ? 2 * options_.m : options_.m;
+    }
+
+    // Заводит узлы под векторы без связей, возвращает их номера
+    std::vector<uint32_t> Allocate(const std::vector<std::pair<int, std::vector<float>>>& vectors);
+    // Встраивает узел в граф
+    void Link(uint32_t node);
+    // Жадный спуск к ближайшему узлу на слое level
+    Candidate Greedy(const float* query, Candidate from, int level, bool lock) const;
+    // Лучшие ef узлов слоя level, начиная с entry. С filter в результат попадают только неудаленные узлы,
+    // прошедшие фильтр; без него - все, как нужно при построении. result - по возрастанию расстояния
+    void SearchLayer(const float* query, Candidate entry, size_t ef, int level, bool lock, const FilterRef* filter, std::vector<Candidate>& result) const;
+    // Эвристика выбора соседей: кандидат берется, только если он ближе к узлу, чем ко всем уже взятым,
+    // так связи расходятся в разные стороны. candidates - по возрастанию расстояния
+    void SelectNeighbors(std::vector<Candidate>& candidates, size_t max_count) const;
+
+    // Оценка числа узлов, проходящих фильтр, по равномерной выборке
+    size_t EstimateAccepted(const FilterRef& filter) const;
+    // Точный поиск перебором узлов, прошедших фильтр
+    std::vector<VectorMatch> Scan(const std::vector<float>& normalized, size_t count, const FilterRef& filter) const;
+    std::vector<VectorMatch> SearchFiltered(const std::vector<float>& query, size_t count, size_t ef, FilterRef filter) const;
+};
+
+template <typename ExecutionPolicy>
+void HnswIndex::AddBatch(ExecutionPolicy&& policy, const std::vector<std::pair<int, std::vector<float>>>& vectors) {
+    // исключение внутри параллельного алгоритма завершает программу, поэтому все проверки - в Allocate
+    const std::vector<uint32_t> nodes = Allocate(vectors);
+    std::for_each(policy, nodes.begin(), nodes.end(), [this](uint32_t node) {
+        Link(node);
+    });
+}
+
+template <typename Filter>
+std::vector<VectorMatch> HnswIndex::Search(const std::vector<float>& query, size_t count, Filter filter, size_t ef) const {
+    FilterRef filter_ref;
+    filter_ref.context = &filter;
+    filter_ref.call = [](void* context, int id) {
+        return static_cast<bool>((*static_cast<Filter*>(context))(id));
+    };
+    return SearchFiltered(query, count, ef, filter_ref);
+}
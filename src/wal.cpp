@@ -0,0 +1,228 @@
+#include "wal.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "binary_io.h"
+
+namespace {
+
+// размер и CRC32 полезной нагрузки перед каждой записью
+const size_t FRAME_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+[[noreturn]] void ThrowSystemError(const std::string& action, const std::string& path) {
+    throw std::runtime_error(action + " " + path + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& path, const std::function<void(const WalRecord&)>& replay)
+    : path_(path) {
+    const uint64_t valid_size = ForEachRecord(path_, [this, &replay](const WalRecord& record) {
+        last_lsn_ = record.lsn;
+        if (replay) {
+            replay(record);
+        }
+    });
+    buffered_lsn_ = durable_lsn_ = last_lsn_;
+    durable_size_ = valid_size;
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        ThrowSystemError("Не удалось открыть журнал", path_);
+    }
+    // хвост после последней целой записи - след оборванной при сбое записи
+    if (::ftruncate(fd_, static_cast<off_t>(valid_size)) != 0 || ::fdatasync(fd_) != 0) {
+        ::close(fd_);
+        ThrowSystemError("Не удалось обрезать журнал", path_);
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    try {
+        Sync();
+    } catch (...) {
+        // из деструктора исключение не выпустить; записи, не дошедшие до диска, будут потеряны как при сбое
+    }
+    ::close(fd_);
+}
+
+void WriteAheadLog::EncodeRecord(const WalRecord& record, uint64_t lsn, std::string& output) {
+    std::string payload;
+    BinaryWriter writer(payload);
+    writer.Put(lsn);
+    writer.Put(static_cast<uint8_t>(record.type));
+    writer.Put(static_cast<int32_t>(record.document_id));
+    if (record.type != WalRecordType::REMOVE_DOCUMENT) {
+        writer.Put(static_cast<uint8_t>(record.status));
+        writer.Put(static_cast<uint32_t>(record.ratings.size()));
+        for (const int rating : record.ratings) {
+            writer.Put(static_cast<int32_t>(rating));
+        }
+        writer.PutString(record.text);
+    }
+
+    BinaryWriter frame(output);
+    frame.Put(static_cast<uint32_t>(payload.size()));
+    frame.Put(Crc32(payload));
+    output += payload;
+}
+
+uint64_t WriteAheadLog::ForEachRecord(const std::string& path, const std::function<void(const WalRecord&)>& callback) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return 0;
+    }
+    const std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    uint64_t offset = 0;
+    while (content.size() - offset >= FRAME_HEADER_SIZE) {
+        BinaryReader header(std::string_view(content).substr(offset, FRAME_HEADER_SIZE));
+        const uint32_t size = header.Get<uint32_t>();
+        const uint32_t crc = header.Get<uint32_t>();
+        if (content.size() - offset - FRAME_HEADER_SIZE < size) {
+            break;
+        }
+        const std::string_view payload = std::string_view(content).substr(offset + FRAME_HEADER_SIZE, size);
+        if (Crc32(payload) != crc) {
+            break;
+        }
+
+        WalRecord record;
+        try {
+            BinaryReader reader(payload);
+            record.lsn = reader.Get<uint64_t>();
+            record.type = static_cast<WalRecordType>(reader.Get<uint8_t>());
+            record.document_id = reader.Get<int32_t>();
+            if (record.type < WalRecordType::ADD_DOCUMENT || record.type > WalRecordType::SET_RATING) {
+                break;
+            }
+            if (record.type != WalRecordType::REMOVE_DOCUMENT) {
+                record.status = static_cast<DocumentStatus>(reader.Get<uint8_t>());
+                record.ratings.resize(reader.Get<uint32_t>());
+                for (int& rating : record.ratings) {
+                    rating = reader.Get<int32_t>();
+                }
+                record.text = std::string(reader.GetString());
+            }
+        } catch (const std::runtime_error&) {
+            break;
+        }
+        callback(record);
+        offset += FRAME_HEADER_SIZE + size;
+    }
+    return offset;
+}
+
+void WriteAheadLog::ThrowIfFailed() const {
+    if (failed_) {
+        throw std::runtime_error("Журнал " + path_ + " испорчен неудачной записью");
+    }
+}
+
+uint64_t WriteAheadLog::Append(const WalRecord& record) {
+    std::lock_guard lock(mutex_);
+    ThrowIfFailed();
+    EncodeRecord(record, last_lsn_ + 1, buffer_);
+    buffered_lsn_ = ++last_lsn_;
+    return last_lsn_;
+}
+
+void WriteAheadLog::WaitDurable(uint64_t lsn) {
+    std::unique_lock lock(mutex_);
+    while (durable_lsn_ < lsn) {
+        ThrowIfFailed();
+        if (syncing_) {
+            synced_.wait(lock);
+            continue;
+        }
+        // этот поток пишет на диск все, что накопилось в буфере, в том числе записи других потоков
+        syncing_ = true;
+        std::string batch;
+        batch.swap(buffer_);
+        const uint64_t batch_lsn = buffered_lsn_;
+        const uint64_t batch_offset = durable_size_;
+        lock.unlock();
+        try {
+            WriteAndSync(batch);
+        } catch (...) {
+            // от пачки в файле мог остаться обрывок: без него следующие записи не прочитались бы при открытии
+            const bool restored = ::ftruncate(fd_, static_cast<off_t>(batch_offset)) == 0;
+            lock.lock();
+            if (restored) {
+                // записи, добавленные во время попытки, идут после пачки
+                batch += buffer_;
+                buffer_.swap(batch);
+            } else {
+                failed_ = true;
+            }
+            syncing_ = false;
+            synced_.notify_all();
+            throw;
+        }
+        lock.lock();
+        syncing_ = false;
+        durable_lsn_ = batch_lsn;
+        durable_size_ = batch_offset + batch.size();
+        ++sync_count_;
+        synced_.notify_all();
+    }
+}
+
+void WriteAheadLog::Sync() {
+    WaitDurable(LastLsn());
+}
+
+void WriteAheadLog::Truncate() {
+    Sync();
+    std::lock_guard lock(mutex_);
+    if (::ftruncate(fd_, 0) != 0 || ::fdatasync(fd_) != 0) {
+        ThrowSystemError("Не удалось очистить журнал", path_);
+    }
+    durable_size_ = 0;
+}
+
+void WriteAheadLog::AdvanceLsn(uint64_t lsn) {
+    std::lock_guard lock(mutex_);
+    if (lsn > last_lsn_) {
+        last_lsn_ = buffered_lsn_ = durable_lsn_ = lsn;
+    }
+}
+
+uint64_t WriteAheadLog::LastLsn() const {
+    std::lock_guard lock(mutex_);
+    return last_lsn_;
+}
+
+uint64_t WriteAheadLog::DurableLsn() const {
+    std::lock_guard lock(mutex_);
+    return durable_lsn_;
+}
+
+uint64_t WriteAheadLog::SyncCount() const {
+    std::lock_guard lock(mutex_);
+    return sync_count_;
+}
+
+void WriteAheadLog::WriteAndSync(const std::string& data) const {
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t result = ::write(fd_, data.data() + written, data.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowSystemError("Не удалось записать журнал", path_);
+        }
+        written += static_cast<size_t>(result);
+    }
+    if (::fdatasync(fd_) != 0) {
+        ThrowSystemError("Не удалось синхронизировать журнал", path_);
+    }
+}
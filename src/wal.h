@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "document.h"
+
+enum class WalRecordType : uint8_t {
+    ADD_DOCUMENT = 1,
+    REMOVE_DOCUMENT = 2,
+    UPDATE_DOCUMENT = 3,
+    // метаданные: статус в status, рейтинг - единственный элемент ratings
+    SET_STATUS = 4,
+    SET_RATING = 5
+};
+
+// Одна мутация индекса. lsn - сквозной номер записи, растет и между контрольными точками
+struct WalRecord {
+    uint64_t lsn = 0;
+    WalRecordType type = WalRecordType::ADD_DOCUMENT;
+    int document_id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string text;
+};
+
+// Журнал упреждающей записи: файл, в который только дописываются записи вида
+// [размер][CRC32][lsn, тип, поля мутации]. Append лишь кладет запись в буфер, на диск буфер уходит
+// вместе с fdatasync в WaitDurable/Sync. Если несколько потоков ждут сохранения одновременно, пишет и
+// синхронизирует один из них за всех (групповой коммит), поэтому один fsync покрывает целую пачку мутаций.
+// Недописанная при сбое последняя запись не проходит проверку CRC и отбрасывается при открытии.
+// Если записать пачку не удалось, файл обрезается до последней сохраненной записи, а пачка возвращается
+// в буфер и уйдет на диск при следующей попытке. Если не удалось и обрезать файл, журнал считается
+// испорченным: Append, WaitDurable и Sync дальше бросают std::runtime_error
+class WriteAheadLog {
+public:
+    // Открывает журнал на дописывание, создавая файл при необходимости. Каждая целая запись по порядку
+    // передается в replay для восстановления состояния, поврежденный хвост обрезается
+    explicit WriteAheadLog(const std::string& path, const std::function<void(const WalRecord&)>& replay = {});
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    // Дописывает буфер и синхронизирует файл
+    ~WriteAheadLog();
+
+    // Назначает записи следующий lsn и кладет ее в буфер, record.lsn не читается. Возвращает назначенный lsn
+    uint64_t Append(const WalRecord& record);
+
+    // Возвращает, когда запись с номером lsn и все предыдущие лежат на диске.
+    // Бросает std::runtime_error, если записать не удалось; несохраненные записи остаются в буфере
+    void WaitDurable(uint64_t lsn);
+
+    // Сохраняет все добавленные записи
+    void Sync();
+
+    // Очищает файл после контрольной точки. Нумерация lsn продолжается
+    void Truncate();
+
+    // Следующие записи получат номера больше lsn, например после загрузки снимка
+    void AdvanceLsn(uint64_t lsn);
+
+    uint64_t LastLsn() const;
+    uint64_t DurableLsn() const;
+    uint64_t SyncCount() const;
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::condition_variable synced_;
+    std::string buffer_;
+    uint64_t last_lsn_ = 0;
+    uint64_t buffered_lsn_ = 0;
+    uint64_t durable_lsn_ = 0;
+    // длина файла, в которой лежат только сохраненные записи
+    uint64_t durable_size_ = 0;
+    uint64_t sync_count_ = 0;
+    bool syncing_ = false;
+    bool failed_ = false;
+
+    static void EncodeRecord(const WalRecord& record, uint64_t lsn, std::string& output);
+
+    void ThrowIfFailed() const;
+
+    // Вызывает callback для каждой целой записи журнала по порядку. Возвращает длину целой части файла в байтах
+    static uint64_t ForEachRecord(const std::string& path, const std::function<void(const WalRecord&)>& callback);
+
+    // Дописывает данные целиком и синхронизирует файл; вызывается без захваченного mutex_
+    void WriteAndSync(const std::string& data) const;
+};